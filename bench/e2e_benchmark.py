@@ -0,0 +1,196 @@
+#!/usr/bin/env python3
+"""
+End-to-end throughput benchmark: runs a whole tournament through the real
+mge_tournament binary against mock_challonge_server.py and
+mock_mge_server.py, then reports wall time, per-match dispatch latency and
+the Challonge requests it took.
+
+    python3 bench/e2e_benchmark.py --binary build/mge_tournament --players 256
+
+Dispatch latency is measured by the MGE mock: the time from both players of
+a match becoming free (tournament start or the end of their previous
+match) until the second of them is put into an arena.
+
+The manager listens on 8080 and dials the MGE plugin on localhost:9001, so
+both ports must be free. With --servers N the mock plays N plugins on
+9001 onwards and the manager is configured with all of them.
+"""
+
+import argparse
+import asyncio
+import contextlib
+import json
+import os
+import random
+import statistics
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+import websockets
+
+REPO_DIR = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+sys.path.insert(0, REPO_DIR)
+
+import mock_challonge_server  # noqa: E402
+import mock_mge_server  # noqa: E402
+
+TOURNAMENT_URL = "bench"
+MANAGER_URI = "ws://localhost:8080"
+
+
+def percentile(values, pct):
+    if not values:
+        return 0.0
+    ordered = sorted(values)
+    index = min(len(ordered) - 1, int(round(pct / 100.0 * (len(ordered) - 1))))
+    return ordered[index]
+
+
+def tournament_stats(server):
+    state = server.RequestHandlerClass.state
+    with state.lock:
+        t = state.by_url.get(TOURNAMENT_URL)
+        requests = dict(state.requests)
+        if t is None:
+            return None, requests
+        return {
+            "state": t.state,
+            "matches": len(t.matches),
+            "complete": sum(1 for m in t.matches.values() if m["state"] == "complete"),
+        }, requests
+
+
+async def wait_for(predicate, timeout, interval=0.05):
+    deadline = time.monotonic() + timeout
+    while time.monotonic() < deadline:
+        if predicate():
+            return True
+        await asyncio.sleep(interval)
+    return False
+
+
+async def run(args, challonge):
+    if args.seed is not None:
+        random.seed(args.seed)
+    mock_mge_server.configure(players=args.players, arenas=args.arenas, duration=args.duration,
+                              disconnect_rate=args.disconnect_rate, burst_interval=args.burst_interval,
+                              servers=args.servers, drop_interval=args.drop_interval, quiet=True)
+    mock_mge_server.reset_state()
+
+    async with contextlib.AsyncExitStack() as stack:
+        config = {"challonge_base_url": f"http://localhost:{args.challonge_port}/v1"}
+        if args.servers > 1:
+            config["mge_servers"] = []
+        for server in mock_mge_server.servers:
+            await stack.enter_async_context(websockets.serve(
+                mock_mge_server.server_handler(server["index"]), "0.0.0.0", server["port"]))
+            if args.servers > 1:
+                config["mge_servers"].append({"name": f"mge{server['index']}", "port": server["port"],
+                                              "connect": f"localhost:{server['port']}"})
+
+        workdir = tempfile.mkdtemp(prefix="mge_bench_")
+        with open(os.path.join(workdir, "api_key.txt"), "w") as f:
+            f.write("bench")
+        with open(os.path.join(workdir, "config.json"), "w") as f:
+            json.dump(config, f)
+        os.symlink(os.path.join(REPO_DIR, "static"), os.path.join(workdir, "static"))
+
+        log = open(os.path.join(workdir, "manager.log"), "w")
+        manager = subprocess.Popen([os.path.abspath(args.binary), TOURNAMENT_URL],
+                                   cwd=workdir, stdout=log, stderr=subprocess.STDOUT)
+        try:
+            if not await wait_for(lambda: len(mock_mge_server.connected_clients) == args.servers, 15):
+                raise RuntimeError("manager never connected to the MGE mock")
+            if not await wait_for(lambda: tournament_stats(challonge)[0] is not None, 15):
+                raise RuntimeError("manager never loaded the tournament")
+
+            async with websockets.connect(MANAGER_URI, subprotocols=["tf2serverep"]) as admin:
+                await admin.send(json.dumps({"type": "ServerHello", "payload": {"apiKey": "admin"}}))
+                started = time.monotonic()
+                await admin.send(json.dumps({"type": "TournamentStart", "payload": {}}))
+
+                def finished():
+                    t, _ = tournament_stats(challonge)
+                    return t is not None and t["state"] == "awaiting_review"
+
+                done = await wait_for(finished, args.timeout)
+                wall = time.monotonic() - started
+        finally:
+            manager.terminate()
+            try:
+                manager.wait(timeout=10)
+            except subprocess.TimeoutExpired:
+                manager.kill()
+            log.close()
+
+    t, requests = tournament_stats(challonge)
+    latencies = mock_mge_server.stats["dispatch_latencies"]
+    return {
+        "players": args.players,
+        "arenas": args.arenas,
+        "servers": args.servers,
+        "duration": args.duration,
+        "disconnect_rate": args.disconnect_rate,
+        "burst_interval": args.burst_interval,
+        "completed": done,
+        "wall_seconds": round(wall, 3),
+        "matches_total": t["matches"] if t else 0,
+        "matches_reported": t["complete"] if t else 0,
+        "matches_played": mock_mge_server.stats["matches_played"],
+        "disconnects": mock_mge_server.stats["disconnects"],
+        "redirects": mock_mge_server.stats["redirects"],
+        "drops": mock_mge_server.stats["drops"],
+        "lost_events": mock_mge_server.stats["lost_events"],
+        "largest_burst": mock_mge_server.stats["largest_burst"],
+        "dispatch_latency_ms": {
+            "mean": round(statistics.mean(latencies) * 1000, 2) if latencies else 0.0,
+            "p50": round(percentile(latencies, 50) * 1000, 2),
+            "p95": round(percentile(latencies, 95) * 1000, 2),
+            "p99": round(percentile(latencies, 99) * 1000, 2),
+            "max": round(max(latencies) * 1000, 2) if latencies else 0.0,
+        },
+        "challonge_requests": requests,
+        "challonge_requests_total": sum(requests.values()),
+        "manager_log": os.path.join(workdir, "manager.log"),
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser(description="End-to-end tournament benchmark")
+    parser.add_argument("--binary", required=True, help="path to the mge_tournament executable")
+    parser.add_argument("--players", type=int, default=256)
+    parser.add_argument("--arenas", type=int, default=16, help="arenas on each MGE server")
+    parser.add_argument("--servers", type=int, default=1, help="number of MGE servers")
+    parser.add_argument("--duration", default="fixed:0.05",
+                        help="match length distribution, see mock_mge_server.py")
+    parser.add_argument("--disconnect-rate", type=float, default=0.0)
+    parser.add_argument("--burst-interval", type=float, default=0.0)
+    parser.add_argument("--drop-interval", type=float, default=0.0,
+                        help="have the MGE mock drop the manager's connection this long after each connect")
+    parser.add_argument("--seed", type=int)
+    parser.add_argument("--challonge-port", type=int, default=9100)
+    parser.add_argument("--timeout", type=float, default=600, help="give up after this many seconds")
+    parser.add_argument("--output", help="also write the JSON report to this file")
+    args = parser.parse_args()
+
+    challonge = mock_challonge_server.make_server(args.challonge_port, quiet=True)
+    threading.Thread(target=challonge.serve_forever, daemon=True).start()
+
+    # The MGE mock narrates every message; keep that out of the report.
+    with open(os.devnull, "w") as devnull, contextlib.redirect_stdout(devnull):
+        report = asyncio.run(run(args, challonge))
+    challonge.shutdown()
+
+    text = json.dumps(report, indent=2)
+    print(text)
+    if args.output:
+        with open(args.output, "w") as f:
+            f.write(text + "\n")
+    return 0 if report["completed"] else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
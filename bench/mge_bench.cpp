@@ -0,0 +1,535 @@
+// Microbenchmarks for the manager's hot paths: admin and MGE message
+// dispatch, form encoding of Challonge writes, parsing of large Challonge
+// responses, arena assignment and the outbound frame queue. Nothing here
+// touches the network; Challonge responses are synthesized in Challonge's
+// format, or read from recordings with --participants-json/--matches-json.
+//
+//   ./mge_bench --players 1000 --arenas 64 --output mge_bench.json
+//
+// The JSON report follows Google Benchmark's layout ("context" plus a
+// "benchmarks" array with real_time in ns), so its compare.py can diff two
+// runs.
+
+#include "tournament_manager.hpp"
+#include "logger.hpp"
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using json = nlohmann::json;
+using Clock = std::chrono::steady_clock;
+
+namespace mge
+{
+
+  // Reaches the private pieces each benchmark times; the friend of
+  // ChallongeAPI and TournamentManager.
+  struct BenchAccess
+  {
+    static std::string flattenToForm(const ChallongeAPI &api, const json &j, CURL *curl)
+    {
+      return api.flattenToForm(j, curl);
+    }
+
+    static void setTournamentId(ChallongeAPI &api, const std::string &id) { api.tournamentId = id; }
+    static void cacheParticipants(ChallongeAPI &api, const std::string &body) { api.cacheParticipants(body); }
+    static void cacheMatches(ChallongeAPI &api, const std::string &body) { api.cacheMatches(body); }
+
+    static void mergeOpenMatches(TournamentManager &manager, const std::vector<PendingMatch> &matches)
+    {
+      manager.mergeOpenMatches(matches);
+    }
+
+    static void assignPendingMatches(TournamentManager &manager) { manager.assignPendingMatches(); }
+
+    // Empties every arena and marks all players free again, as if every
+    // match had just been cancelled, and discards queued plugin commands.
+    static void resetArenas(TournamentManager &manager)
+    {
+      for (size_t i = 0; i < manager.arenas.size(); ++i)
+      {
+        manager.releaseArena(static_cast<int>(i));
+      }
+      MGEServer &server = manager.mgeServer(0);
+      while (manager.hasMGEQueuedMessages(server))
+      {
+        manager.popMGEMessage(server);
+      }
+    }
+  };
+
+}
+
+namespace
+{
+
+  struct Options
+  {
+    int players = 1000;
+    int arenas = 64;
+    double minTime = 0.5;
+    std::string filter;
+    std::string output;
+    std::string participantsJson;
+    std::string matchesJson;
+  };
+
+  constexpr const char *UNREACHABLE_CHALLONGE = "http://127.0.0.1:9/v1";
+
+  // Accumulates only the timed part of each iteration, so per-iteration
+  // setup can be excluded.
+  class Stopwatch
+  {
+  public:
+    void start() { started = Clock::now(); }
+    void stop() { total += Clock::now() - started; }
+    double seconds() const { return std::chrono::duration<double>(total).count(); }
+
+  private:
+    Clock::time_point started;
+    Clock::duration total{};
+  };
+
+  struct Benchmark
+  {
+    std::string name;
+    // Runs the given number of iterations and returns the timed seconds.
+    std::function<double(size_t)> run;
+    // Items processed per iteration, for items_per_second; 0 to omit.
+    size_t itemsPerIteration = 0;
+  };
+
+  // Runs every iteration under the stopwatch.
+  template <typename Body>
+  std::function<double(size_t)> timed(Body body)
+  {
+    return [body](size_t iterations) mutable
+    {
+      Stopwatch watch;
+      watch.start();
+      for (size_t i = 0; i < iterations; ++i)
+      {
+        body();
+      }
+      watch.stop();
+      return watch.seconds();
+    };
+  }
+
+  // Runs setup() untimed before each timed body().
+  template <typename Setup, typename Body>
+  std::function<double(size_t)> timedWithSetup(Setup setup, Body body)
+  {
+    return [setup, body](size_t iterations) mutable
+    {
+      Stopwatch watch;
+      for (size_t i = 0; i < iterations; ++i)
+      {
+        setup();
+        watch.start();
+        body();
+        watch.stop();
+      }
+      return watch.seconds();
+    };
+  }
+
+  std::string readFile(const std::string &path)
+  {
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+    {
+      throw std::runtime_error("cannot read " + path);
+    }
+    std::stringstream ss;
+    ss << in.rdbuf();
+    return ss.str();
+  }
+
+  std::string steamId(int player) { return "STEAM_ID_" + std::to_string(player); }
+
+  // participants.json for players 1..n, with the fields Challonge sends.
+  std::string makeParticipantsJson(int n)
+  {
+    json list = json::array();
+    for (int player = 1; player <= n; ++player)
+    {
+      list.push_back({{"participant",
+                       {{"id", 100000 + player},
+                        {"tournament_id", 1},
+                        {"name", "Player" + std::to_string(player)},
+                        {"seed", player},
+                        {"active", true},
+                        {"created_at", "2024-01-01T12:00:00.000-05:00"},
+                        {"updated_at", "2024-01-01T12:00:00.000-05:00"},
+                        {"invite_email", nullptr},
+                        {"final_rank", nullptr},
+                        {"misc", steamId(player)},
+                        {"icon", nullptr},
+                        {"on_waiting_list", false},
+                        {"challonge_username", nullptr},
+                        {"checked_in", false},
+                        {"group_player_ids", json::array()}}}});
+    }
+    return list.dump();
+  }
+
+  // matches.json for a single-elimination bracket of n players (n a power of
+  // two): the first round is open, later rounds wait on their prereqs.
+  std::string makeMatchesJson(int n)
+  {
+    json list = json::array();
+    int id = 200000;
+    std::vector<int> previous;
+    for (int round = 1, size = n / 2; size >= 1; ++round, size /= 2)
+    {
+      std::vector<int> current;
+      for (int i = 0; i < size; ++i)
+      {
+        json match = {{"id", ++id},
+                      {"tournament_id", 1},
+                      {"state", round == 1 ? "open" : "pending"},
+                      {"round", round},
+                      {"player1_id", nullptr},
+                      {"player2_id", nullptr},
+                      {"player1_prereq_match_id", nullptr},
+                      {"player2_prereq_match_id", nullptr},
+                      {"player1_is_prereq_match_loser", false},
+                      {"player2_is_prereq_match_loser", false},
+                      {"winner_id", nullptr},
+                      {"loser_id", nullptr},
+                      {"identifier", "A" + std::to_string(id)},
+                      {"scores_csv", ""},
+                      {"created_at", "2024-01-01T12:00:00.000-05:00"},
+                      {"updated_at", "2024-01-01T12:00:00.000-05:00"},
+                      {"underway_at", nullptr},
+                      {"optional", false},
+                      {"suggested_play_order", id - 200000}};
+        if (round == 1)
+        {
+          match["player1_id"] = 100000 + 2 * i + 1;
+          match["player2_id"] = 100000 + 2 * i + 2;
+        }
+        else
+        {
+          match["player1_prereq_match_id"] = previous[2 * i];
+          match["player2_prereq_match_id"] = previous[2 * i + 1];
+        }
+        current.push_back(id);
+        list.push_back({{"match", match}});
+      }
+      previous = std::move(current);
+    }
+    return list.dump();
+  }
+
+  std::string makeGetPlayersResponse(int n)
+  {
+    json players = json::array();
+    for (int player = 1; player <= n; ++player)
+    {
+      players.push_back({{"id", player},
+                         {"name", "Player" + std::to_string(player)},
+                         {"elo", 1000 + (player * 7919) % 1000},
+                         {"arena", 0},
+                         {"inArena", false}});
+    }
+    return json{{"type", "response"}, {"command", "get_players"}, {"players", players}}.dump();
+  }
+
+  std::string makeGetArenasResponse(int n)
+  {
+    json arenas = json::array();
+    for (int arena = 1; arena <= n; ++arena)
+    {
+      arenas.push_back({{"id", arena}, {"name", "Arena " + std::to_string(arena)}});
+    }
+    return json{{"type", "response"}, {"command", "get_arenas"}, {"arenas", arenas}}.dump();
+  }
+
+  // First-round pairings for the manager: players 2i+1 and 2i+2.
+  std::vector<mge::PendingMatch> makePendingMatches(int players)
+  {
+    std::vector<mge::PendingMatch> matches;
+    for (int i = 0; 2 * i + 2 <= players; ++i)
+    {
+      mge::PendingMatch match;
+      match.matchId = 200001 + i;
+      match.player1Id = steamId(2 * i + 1);
+      match.player1Name = "Player" + std::to_string(2 * i + 1);
+      match.player2Id = steamId(2 * i + 2);
+      match.player2Name = "Player" + std::to_string(2 * i + 2);
+      matches.push_back(std::move(match));
+    }
+    return matches;
+  }
+
+  int powerOfTwoAtMost(int n)
+  {
+    int p = 1;
+    while (p * 2 <= n)
+    {
+      p *= 2;
+    }
+    return p;
+  }
+
+  // Doubles the iteration count until a run takes at least minTime, then
+  // reports that run.
+  json runBenchmark(const Benchmark &benchmark, double minTime)
+  {
+    size_t iterations = 1;
+    double seconds = 0;
+    std::clock_t cpuStart = 0;
+    std::clock_t cpuEnd = 0;
+    while (true)
+    {
+      cpuStart = std::clock();
+      seconds = benchmark.run(iterations);
+      cpuEnd = std::clock();
+      if (seconds >= minTime || iterations >= (size_t(1) << 30))
+      {
+        break;
+      }
+      // Aim straight for minTime once the timing is meaningful.
+      double scale = seconds > minTime / 100 ? minTime / seconds * 1.2 : 10.0;
+      iterations = std::max(iterations + 1, static_cast<size_t>(iterations * scale));
+    }
+
+    double cpuSeconds = static_cast<double>(cpuEnd - cpuStart) / CLOCKS_PER_SEC;
+    json result = {{"name", benchmark.name},
+                   {"run_type", "iteration"},
+                   {"iterations", iterations},
+                   {"real_time", seconds / iterations * 1e9},
+                   {"cpu_time", cpuSeconds / iterations * 1e9},
+                   {"time_unit", "ns"}};
+    if (benchmark.itemsPerIteration > 0)
+    {
+      result["items_per_second"] = benchmark.itemsPerIteration * iterations / seconds;
+    }
+    return result;
+  }
+
+  void usage(const char *argv0)
+  {
+    std::cerr << "Usage: " << argv0 << " [--players N] [--arenas N] [--min-time S] [--filter SUBSTRING]\n"
+              << "         [--participants-json FILE --matches-json FILE] [--output FILE]" << std::endl;
+  }
+
+}
+
+int main(int argc, char **argv)
+{
+  Options options;
+  for (int i = 1; i < argc; ++i)
+  {
+    std::string arg = argv[i];
+    auto next = [&]() -> std::string
+    {
+      if (i + 1 >= argc)
+      {
+        usage(argv[0]);
+        std::exit(1);
+      }
+      return argv[++i];
+    };
+
+    if (arg == "--players")
+      options.players = std::stoi(next());
+    else if (arg == "--arenas")
+      options.arenas = std::stoi(next());
+    else if (arg == "--min-time")
+      options.minTime = std::stod(next());
+    else if (arg == "--filter")
+      options.filter = next();
+    else if (arg == "--output")
+      options.output = next();
+    else if (arg == "--participants-json")
+      options.participantsJson = next();
+    else if (arg == "--matches-json")
+      options.matchesJson = next();
+    else
+    {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (options.players < 2 || options.arenas < 1 ||
+      options.participantsJson.empty() != options.matchesJson.empty())
+  {
+    usage(argv[0]);
+    return 1;
+  }
+
+  std::string participantsBody;
+  std::string matchesBody;
+  try
+  {
+    if (options.participantsJson.empty())
+    {
+      int bracketSize = powerOfTwoAtMost(options.players);
+      participantsBody = makeParticipantsJson(bracketSize);
+      matchesBody = makeMatchesJson(bracketSize);
+    }
+    else
+    {
+      participantsBody = readFile(options.participantsJson);
+      matchesBody = readFile(options.matchesJson);
+    }
+  }
+  catch (const std::exception &e)
+  {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+
+  curl_global_init(CURL_GLOBAL_DEFAULT);
+
+  // The manager logs as usual, so the cost of queueing records counts, but
+  // the writer thread sends them nowhere.
+  FILE *devNull = std::fopen("/dev/null", "w");
+  mge::log::setOutput(devNull, devNull);
+
+  json results = json::array();
+  {
+    // Challonge is unreachable on purpose: the load at construction fails
+    // at once, and nothing benchmarked below goes through it.
+    mge::TournamentManager manager(nullptr, "bench", "bench", "bench", UNREACHABLE_CHALLONGE);
+    mge::ChallongeAPI api("bench", "bench", "", "bench", UNREACHABLE_CHALLONGE);
+    mge::BenchAccess::setTournamentId(api, "1");
+    mge::BenchAccess::cacheParticipants(api, participantsBody);
+
+    mge::MGEServer &mgeServer = manager.mgeServer(0);
+    manager.onMGEConnected(mgeServer, nullptr);
+    manager.handleMGEPluginMessage(mgeServer, makeGetArenasResponse(options.arenas));
+    manager.handleMGEPluginMessage(mgeServer, makeGetPlayersResponse(options.players));
+    std::vector<mge::PendingMatch> pending = makePendingMatches(options.players);
+    mge::BenchAccess::mergeOpenMatches(manager, pending);
+    mge::BenchAccess::resetArenas(manager);
+
+    std::string getPlayers = makeGetPlayersResponse(options.players);
+    std::string matchBegan = json{{"type", "MatchBegan"},
+                                  {"payload", {{"p1Id", steamId(1)}, {"p2Id", steamId(2)}}}}
+                                 .dump();
+    std::string matchDetails = json{{"type", "MatchDetails"},
+                                    {"payload", {{"arenaId", 1}, {"p1Id", steamId(1)}, {"p2Id", steamId(2)}}}}
+                                   .dump();
+    std::string unknownType = json{{"type", "NoSuchMessage"}, {"payload", json::object()}}.dump();
+    std::string mgeSuccess = json{{"type", "success"}, {"message", "Player added to arena"}}.dump();
+    std::string mgeRemoved = json{{"type", "event"},
+                                  {"event", "player_arena_removed"},
+                                  {"player_id", options.players + 1},
+                                  {"arena_id", 1}}
+                                 .dump();
+
+    CURL *curl = curl_easy_init();
+    json bulkAdd = {{"participants", json::array()}};
+    for (int player = 1; player <= 64; ++player)
+    {
+      bulkAdd["participants"].push_back({{"name", "Player " + std::to_string(player) + " & co"},
+                                         {"misc", steamId(player)},
+                                         {"seed", player}});
+    }
+    json matchUpdate = {{"match", {{"scores_csv", "1-0"}, {"winner_id", 100001}}}};
+
+    mge::OutboundQueue queue(1024, 768, 256);
+    std::string frame = json{{"command", "add_player_to_arena"}, {"player_id", 1}, {"arena_id", 1}}.dump();
+    mge::OutboundQueue congested(1024, 768, 256);
+    for (int i = 0; i < 800; ++i)
+    {
+      congested.push(mge::OutboundFrame::fromString(frame, "arena:" + std::to_string(i % 64)));
+    }
+    size_t nextKey = 0;
+
+    std::vector<Benchmark> benchmarks = {
+        {"handleMessage/MatchBegan", timed([&]
+                                           { manager.handleMessage(nullptr, matchBegan); })},
+        {"handleMessage/MatchDetails", timed([&]
+                                             { manager.handleMessage(nullptr, matchDetails); })},
+        {"handleMessage/unknown", timed([&]
+                                        { manager.handleMessage(nullptr, unknownType); })},
+        {"handleMGEPluginMessage/success", timed([&]
+                                                 { manager.handleMGEPluginMessage(mgeServer, mgeSuccess); })},
+        {"handleMGEPluginMessage/player_arena_removed", timed([&]
+                                                              { manager.handleMGEPluginMessage(mgeServer, mgeRemoved); })},
+        {"handleMGEPluginMessage/get_players/" + std::to_string(options.players),
+         timedWithSetup([&]
+                        { mge::BenchAccess::resetArenas(manager); },
+                        [&]
+                        { manager.handleMGEPluginMessage(mgeServer, getPlayers); }),
+         static_cast<size_t>(options.players)},
+        {"flattenToForm/bulk_add_64", timed([&]
+                                            { mge::BenchAccess::flattenToForm(api, bulkAdd, curl); }),
+         64},
+        {"flattenToForm/match_update", timed([&]
+                                             { mge::BenchAccess::flattenToForm(api, matchUpdate, curl); })},
+        {"cacheParticipants",
+         timed([&]
+               { mge::BenchAccess::cacheParticipants(api, participantsBody); })},
+        {"getPendingMatches",
+         timed([&]
+               {
+                 mge::BenchAccess::cacheMatches(api, matchesBody);
+                 api.getPendingMatches(); })},
+        {"assignPendingMatches/" + std::to_string(options.players) + "p/" + std::to_string(options.arenas) + "a",
+         timedWithSetup([&]
+                        { mge::BenchAccess::resetArenas(manager); },
+                        [&]
+                        { mge::BenchAccess::assignPendingMatches(manager); }),
+         static_cast<size_t>(std::min(options.arenas, options.players / 2))},
+        {"OutboundQueue/push_pop", timed([&]
+                                         {
+                                           queue.push(mge::OutboundFrame::fromString(frame));
+                                           queue.pop(); })},
+        {"OutboundQueue/coalesce_congested", timed([&]
+                                                   {
+                                                     congested.push(mge::OutboundFrame::fromString(
+                                                         frame, "arena:" + std::to_string(nextKey++ % 64))); })},
+    };
+
+    for (const auto &benchmark : benchmarks)
+    {
+      if (!options.filter.empty() && benchmark.name.find(options.filter) == std::string::npos)
+      {
+        continue;
+      }
+      json result = runBenchmark(benchmark, options.minTime);
+      std::cerr << result["name"].get<std::string>() << ": " << result["real_time"].get<double>()
+                << " ns" << std::endl;
+      results.push_back(std::move(result));
+    }
+
+    curl_easy_cleanup(curl);
+  }
+
+  mge::log::flush();
+
+  json report = {{"context",
+                  {{"executable", argv[0]},
+                   {"date", std::to_string(std::time(nullptr))},
+                   {"num_cpus", std::thread::hardware_concurrency()},
+                   {"players", options.players},
+                   {"arenas", options.arenas},
+                   {"participants_bytes", participantsBody.size()},
+                   {"matches_bytes", matchesBody.size()}}},
+                 {"benchmarks", results}};
+
+  std::string text = report.dump(2);
+  std::cout << text << std::endl;
+  if (!options.output.empty())
+  {
+    std::ofstream out(options.output);
+    out << text << std::endl;
+  }
+
+  curl_global_cleanup();
+  return 0;
+}
@@ -0,0 +1,847 @@
+// In-process load harness for TournamentManager. It plays the MGE plugin
+// itself, without sockets: it answers the commands the manager queues for
+// the plugin, simulates matches (with the same duration, disconnect and
+// burst knobs as mock_mge_server.py) and feeds the events back through
+// handleMGEPluginMessage, timing every call. Challonge traffic goes to
+// mock_challonge_server.py.
+//
+//   python3 mock_challonge_server.py --quiet &
+//   ./mge_load_bench --players 1000 --arenas 64 --duration uniform:0.01:0.1
+//
+// Prints a JSON report: handleMGEPluginMessage throughput per message kind
+// and the scheduling latency from a pair of players becoming free until
+// both are placed in an arena.
+//
+// With --state-dir the manager journals its state there, and with
+// --restart-after N it is destroyed and rebuilt from the journal after N
+// matches, as if the process had been restarted mid-tournament; the report
+// then includes how long that took.
+//
+// With --servers N it plays N plugins, each with --arenas arenas, and deals
+// the players out among them. Players then carry steam ids, so the manager
+// can move them between servers; a redirected player shows up on the
+// other server after --redirect-seconds.
+//
+// With --blip-every N the link to one of the plugins drops after every N
+// matches, taking turns, and comes back after --blip-seconds. The plugin
+// keeps playing meanwhile; what it sends while the link is down is lost,
+// so the manager has to resynchronize when it reconnects.
+
+#include "tournament_manager.hpp"
+#include "logger.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using json = nlohmann::json;
+using Clock = std::chrono::steady_clock;
+
+namespace
+{
+
+  struct Options
+  {
+    int players = 256;
+    int arenas = 16;
+    std::string duration = "uniform:0.01:0.05";
+    double disconnectRate = 0.0;
+    double reconnectSeconds = 0.2;
+    double burstInterval = 0.0;
+    unsigned seed = 1;
+    std::string challongeUrl = "http://localhost:9100/v1";
+    // Client-side Challonge requests per second; 0 for no limit.
+    double challongeRate = 0;
+    double timeout = 600.0;
+    double idleTimeout = 10.0;
+    bool verbose = false;
+    std::string stateDir;
+    size_t restartAfter = 0;
+    bool drain = false;
+    int servers = 1;
+    double redirectSeconds = 0.05;
+    size_t blipEvery = 0;
+    double blipSeconds = 0.2;
+  };
+
+  constexpr int MAX_PLAYERS = 1000;
+
+  double secondsSince(Clock::time_point start, Clock::time_point end = Clock::now())
+  {
+    return std::chrono::duration<double>(end - start).count();
+  }
+
+  // Same grammar as mock_mge_server.py: fixed:S, uniform:MIN:MAX,
+  // normal:MEAN:SD or exp:MEAN.
+  std::function<double(std::mt19937 &)> parseDuration(const std::string &spec)
+  {
+    std::vector<std::string> parts;
+    std::stringstream ss(spec);
+    std::string part;
+    while (std::getline(ss, part, ':'))
+    {
+      parts.push_back(part);
+    }
+
+    std::vector<double> values;
+    for (size_t i = 1; i < parts.size(); ++i)
+    {
+      values.push_back(std::stod(parts[i]));
+    }
+
+    if (parts[0] == "fixed" && values.size() == 1)
+    {
+      double v = values[0];
+      return [v](std::mt19937 &) { return v; };
+    }
+    if (parts[0] == "uniform" && values.size() == 2)
+    {
+      std::uniform_real_distribution<double> dist(values[0], values[1]);
+      return [dist](std::mt19937 &rng) mutable { return dist(rng); };
+    }
+    if (parts[0] == "normal" && values.size() == 2)
+    {
+      std::normal_distribution<double> dist(values[0], values[1]);
+      return [dist](std::mt19937 &rng) mutable { return std::max(0.0, dist(rng)); };
+    }
+    if (parts[0] == "exp" && values.size() == 1 && values[0] > 0)
+    {
+      std::exponential_distribution<double> dist(1.0 / values[0]);
+      return [dist](std::mt19937 &rng) mutable { return dist(rng); };
+    }
+    throw std::invalid_argument("bad duration spec '" + spec + "'");
+  }
+
+  struct KindStats
+  {
+    size_t count = 0;
+    double totalSeconds = 0;
+    double maxSeconds = 0;
+  };
+
+  double percentile(std::vector<double> values, double pct)
+  {
+    if (values.empty())
+    {
+      return 0.0;
+    }
+    std::sort(values.begin(), values.end());
+    size_t index = static_cast<size_t>(pct / 100.0 * (values.size() - 1) + 0.5);
+    return values[std::min(index, values.size() - 1)];
+  }
+
+  class SimulatedPlugin
+  {
+  public:
+    SimulatedPlugin(const Options &options, std::function<std::unique_ptr<mge::TournamentManager>()> makeManager)
+        : options(options), makeManager(std::move(makeManager)), manager(this->makeManager()),
+          rng(options.seed), matchLength(parseDuration(options.duration)),
+          location(options.players + 1), linkDownUntil(options.servers)
+    {
+      for (int id = 1; id <= options.players; ++id)
+      {
+        location[id] = (id - 1) % options.servers;
+      }
+    }
+
+    bool run();
+    json report() const;
+
+  private:
+    // (server, arena id).
+    using ArenaKey = std::pair<int, int>;
+
+    struct Match
+    {
+      ArenaKey arena;
+      int player1;
+      int player2;
+      Clock::time_point ends;
+      bool aborted;
+    };
+
+    // A redirected player on their way to another server.
+    struct Transit
+    {
+      int server;
+      Clock::time_point arrives;
+    };
+
+    const Options &options;
+    std::function<std::unique_ptr<mge::TournamentManager>()> makeManager;
+    std::unique_ptr<mge::TournamentManager> manager;
+    std::mt19937 rng;
+    std::function<double(std::mt19937 &)> matchLength;
+
+    std::map<ArenaKey, std::set<int>> arenaPlayers;
+    std::vector<Match> running;
+    std::map<int, Clock::time_point> offlineUntil;
+    std::map<int, ArenaKey> deferredPlacements;
+    // Server each player is on, by player id; players start out dealt
+    // round-robin.
+    std::vector<int> location;
+    std::map<int, Transit> inTransit;
+    // Arenas that servers were told to put an arriving player in.
+    std::map<int, ArenaKey> arrivals;
+    std::map<int, Clock::time_point> freeSince;
+    std::vector<std::pair<int, json>> heldEvents;
+    Clock::time_point nextBurst;
+    // When each plugin's link to the manager comes back; zero while up.
+    std::vector<Clock::time_point> linkDownUntil;
+
+    std::map<std::string, KindStats> kinds;
+    std::vector<double> latencies;
+    size_t matchesPlayed = 0;
+    size_t disconnects = 0;
+    size_t redirects = 0;
+    size_t blips = 0;
+    size_t lostEvents = 0;
+    // Results lost to a blip; those matches are played again.
+    size_t lostResults = 0;
+    size_t largestBurst = 0;
+    double wallSeconds = 0;
+    double restartSeconds = -1;
+    double drainSeconds = -1;
+    bool completed = false;
+
+    bool multiServer() const { return options.servers > 1; }
+    bool linkDown(int server) const { return linkDownUntil[server] != Clock::time_point{}; }
+    static std::string steamId(int playerId) { return "STEAM_0:0:" + std::to_string(playerId); }
+    static int playerIdOf(const std::string &steamId);
+
+    void deliver(int server, const json &message);
+    void sendEvent(int server, json event);
+    void handleCommand(int server, const json &command);
+    void placePlayer(int server, int playerId, int arenaId);
+    json playerList(int server) const;
+    void tick(Clock::time_point now);
+    bool drainOutgoing();
+    void restart();
+    void dropLink(int server, Clock::time_point now);
+    void restoreLinks(Clock::time_point now);
+  };
+
+  int SimulatedPlugin::playerIdOf(const std::string &steamId)
+  {
+    size_t colon = steamId.rfind(':');
+    return colon == std::string::npos ? 0 : std::atoi(steamId.c_str() + colon + 1);
+  }
+
+  void SimulatedPlugin::deliver(int server, const json &message)
+  {
+    if (linkDown(server))
+    {
+      ++lostEvents;
+      if (message.value("event", "") == "match_end_1v1")
+      {
+        ++lostResults;
+      }
+      return;
+    }
+
+    std::string kind = message.value("type", "");
+    if (message.contains("event"))
+    {
+      kind += ":" + message["event"].get<std::string>();
+    }
+    else if (message.contains("command"))
+    {
+      kind += ":" + message["command"].get<std::string>();
+    }
+
+    std::string text = message.dump();
+    auto start = Clock::now();
+    manager->handleMGEPluginMessage(manager->mgeServer(server), text);
+    double elapsed = secondsSince(start);
+
+    KindStats &stats = kinds[kind];
+    ++stats.count;
+    stats.totalSeconds += elapsed;
+    stats.maxSeconds = std::max(stats.maxSeconds, elapsed);
+  }
+
+  void SimulatedPlugin::sendEvent(int server, json event)
+  {
+    if (options.burstInterval > 0)
+    {
+      heldEvents.emplace_back(server, std::move(event));
+      return;
+    }
+    deliver(server, event);
+  }
+
+  json SimulatedPlugin::playerList(int server) const
+  {
+    std::map<int, int> arenaOf;
+    for (const auto &[key, occupants] : arenaPlayers)
+    {
+      if (key.first == server)
+      {
+        for (int id : occupants)
+        {
+          arenaOf[id] = key.second;
+        }
+      }
+    }
+
+    json players = json::array();
+    for (int id = 1; id <= options.players; ++id)
+    {
+      if (offlineUntil.count(id) || inTransit.count(id) || location[id] != server)
+      {
+        continue;
+      }
+      auto arena = arenaOf.find(id);
+      json player = {{"id", id},
+                     {"name", "Player" + std::to_string(id)},
+                     {"elo", 1000 + (id * 7919) % 1000},
+                     {"arena", arena == arenaOf.end() ? 0 : arena->second},
+                     {"inArena", arena != arenaOf.end()}};
+      if (multiServer())
+      {
+        player["steam_id"] = steamId(id);
+      }
+      players.push_back(std::move(player));
+    }
+    return players;
+  }
+
+  void SimulatedPlugin::handleCommand(int server, const json &command)
+  {
+    std::string name = command.value("command", "");
+    if (name == "get_players")
+    {
+      auto now = Clock::now();
+      for (int id = 1; id <= options.players; ++id)
+      {
+        freeSince.emplace(id, now);
+      }
+      deliver(server, {{"type", "response"}, {"command", "get_players"}, {"players", playerList(server)}});
+    }
+    else if (name == "get_arenas")
+    {
+      json arenas = json::array();
+      for (int id = 1; id <= options.arenas; ++id)
+      {
+        arenas.push_back({{"id", id}, {"name", "Arena " + std::to_string(id)}});
+      }
+      deliver(server, {{"type", "response"}, {"command", "get_arenas"}, {"arenas", arenas}});
+    }
+    else if (name == "add_player_to_arena")
+    {
+      deliver(server, {{"type", "success"}, {"message", "Player added to arena"}});
+      if (command.contains("player_id"))
+      {
+        placePlayer(server, command.value("player_id", 0), command.value("arena_id", 0));
+        return;
+      }
+
+      // A player expected from another server; placed once they arrive.
+      int player = playerIdOf(command.value("steam_id", ""));
+      ArenaKey arena{server, command.value("arena_id", 0)};
+      if (location[player] == server && !inTransit.count(player))
+      {
+        placePlayer(server, player, arena.second);
+      }
+      else
+      {
+        arrivals[player] = arena;
+      }
+    }
+    else if (name == "redirect_player")
+    {
+      int player = command.value("player_id", 0);
+      std::string address = command.value("address", "");
+      int target = std::atoi(address.c_str() + address.rfind(':') + 1);
+      ++redirects;
+
+      // Leaving takes them out of any arena here.
+      for (auto &[key, occupants] : arenaPlayers)
+      {
+        occupants.erase(player);
+      }
+      inTransit[player] = {target, Clock::now() + std::chrono::duration_cast<Clock::duration>(
+                                                      std::chrono::duration<double>(options.redirectSeconds))};
+    }
+  }
+
+  void SimulatedPlugin::placePlayer(int server, int playerId, int arenaId)
+  {
+    if (offlineUntil.count(playerId))
+    {
+      deferredPlacements[playerId] = {server, arenaId};
+      return;
+    }
+
+    // Like MGE, adding a player moves them out of any other arena.
+    ArenaKey key{server, arenaId};
+    for (auto &[id, occupants] : arenaPlayers)
+    {
+      if (id != key)
+      {
+        occupants.erase(playerId);
+      }
+    }
+
+    auto &occupants = arenaPlayers[key];
+    if (!occupants.insert(playerId).second || occupants.size() != 2)
+    {
+      return;
+    }
+
+    std::vector<int> players(occupants.begin(), occupants.end());
+    auto now = Clock::now();
+    Clock::time_point ready = std::max(freeSince[players[0]], freeSince[players[1]]);
+    latencies.push_back(secondsSince(ready, now));
+
+    std::uniform_real_distribution<double> chance(0.0, 1.0);
+    double length = matchLength(rng);
+    bool aborted = chance(rng) < options.disconnectRate;
+    if (aborted)
+    {
+      length *= chance(rng);
+    }
+
+    auto ends = now + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(length));
+    running.push_back({key, players[0], players[1], ends, aborted});
+  }
+
+  void SimulatedPlugin::tick(Clock::time_point now)
+  {
+    std::vector<Match> finished;
+    auto split = std::partition(running.begin(), running.end(),
+                                [now](const Match &m) { return m.ends > now; });
+    finished.assign(split, running.end());
+    running.erase(split, running.end());
+
+    for (const Match &match : finished)
+    {
+      int server = match.arena.first;
+      arenaPlayers[match.arena].clear();
+      freeSince[match.player1] = now;
+      freeSince[match.player2] = now;
+
+      if (match.aborted)
+      {
+        ++disconnects;
+        int leaver = std::uniform_int_distribution<int>(0, 1)(rng) ? match.player1 : match.player2;
+        offlineUntil[leaver] = now + std::chrono::duration_cast<Clock::duration>(
+                                         std::chrono::duration<double>(options.reconnectSeconds));
+        // The arena is abandoned; MGE reports the player who left.
+        json removed = {{"type", "event"},
+                        {"event", "player_arena_removed"},
+                        {"player_id", leaver},
+                        {"arena_id", match.arena.second}};
+        if (multiServer())
+        {
+          removed["steam_id"] = steamId(leaver);
+        }
+        sendEvent(server, std::move(removed));
+        continue;
+      }
+
+      bool firstWins = std::uniform_int_distribution<int>(0, 1)(rng) == 1;
+      int winner = firstWins ? match.player1 : match.player2;
+      int loser = firstWins ? match.player2 : match.player1;
+      ++matchesPlayed;
+      json ended = {{"type", "event"},
+                    {"event", "match_end_1v1"},
+                    {"arena_id", match.arena.second},
+                    {"winner_id", winner},
+                    {"loser_id", loser},
+                    {"winner_name", "Player" + std::to_string(winner)},
+                    {"loser_name", "Player" + std::to_string(loser)},
+                    {"winner_score", 20},
+                    {"loser_score", 0}};
+      if (multiServer())
+      {
+        ended["winner_steam_id"] = steamId(winner);
+        ended["loser_steam_id"] = steamId(loser);
+      }
+      sendEvent(server, std::move(ended));
+    }
+
+    for (auto it = inTransit.begin(); it != inTransit.end();)
+    {
+      if (it->second.arrives > now)
+      {
+        ++it;
+        continue;
+      }
+      int player = it->first;
+      location[player] = it->second.server;
+      it = inTransit.erase(it);
+
+      auto arena = arrivals.find(player);
+      if (arena != arrivals.end())
+      {
+        if (arena->second.first == location[player])
+        {
+          placePlayer(arena->second.first, player, arena->second.second);
+        }
+        arrivals.erase(arena);
+      }
+    }
+
+    for (auto it = offlineUntil.begin(); it != offlineUntil.end();)
+    {
+      if (it->second > now)
+      {
+        ++it;
+        continue;
+      }
+      int player = it->first;
+      it = offlineUntil.erase(it);
+
+      auto deferred = deferredPlacements.find(player);
+      if (deferred != deferredPlacements.end())
+      {
+        ArenaKey arena = deferred->second;
+        deferredPlacements.erase(deferred);
+        placePlayer(arena.first, player, arena.second);
+      }
+    }
+
+    if (options.burstInterval > 0 && now >= nextBurst)
+    {
+      nextBurst = now + std::chrono::duration_cast<Clock::duration>(
+                            std::chrono::duration<double>(options.burstInterval));
+      std::vector<std::pair<int, json>> burst;
+      burst.swap(heldEvents);
+      largestBurst = std::max(largestBurst, burst.size());
+      for (const auto &[server, event] : burst)
+      {
+        deliver(server, event);
+      }
+    }
+  }
+
+  bool SimulatedPlugin::drainOutgoing()
+  {
+    bool any = false;
+    for (int server = 0; server < options.servers; ++server)
+    {
+      mge::MGEServer &connection = manager->mgeServer(server);
+      if (linkDown(server))
+      {
+        continue;
+      }
+      while (manager->hasMGEQueuedMessages(connection))
+      {
+        mge::OutboundFrame *frame = manager->frontMGEMessage(connection);
+        std::string text(reinterpret_cast<const char *>(frame->payload()), frame->size());
+        manager->popMGEMessage(connection);
+        handleCommand(server, json::parse(text));
+        any = true;
+      }
+    }
+    return any;
+  }
+
+  // Replaces the manager with a fresh one that restores itself from the
+  // journal, then reconnects to it the way the plugins would.
+  void SimulatedPlugin::restart()
+  {
+    auto start = Clock::now();
+    manager.reset();
+    manager = makeManager();
+    restartSeconds = secondsSince(start);
+
+    for (int server = 0; server < options.servers; ++server)
+    {
+      manager->onMGEConnected(manager->mgeServer(server), nullptr);
+      deliver(server, {{"type", "welcome"}, {"message", "mge_load_bench"}});
+    }
+  }
+
+  void SimulatedPlugin::dropLink(int server, Clock::time_point now)
+  {
+    ++blips;
+    linkDownUntil[server] = now + std::chrono::duration_cast<Clock::duration>(
+                                      std::chrono::duration<double>(options.blipSeconds));
+    manager->onMGEDisconnected(manager->mgeServer(server));
+  }
+
+  void SimulatedPlugin::restoreLinks(Clock::time_point now)
+  {
+    for (int server = 0; server < options.servers; ++server)
+    {
+      if (linkDown(server) && linkDownUntil[server] <= now)
+      {
+        linkDownUntil[server] = {};
+        manager->onMGEConnected(manager->mgeServer(server), nullptr);
+        deliver(server, {{"type", "welcome"}, {"message", "mge_load_bench"}});
+      }
+    }
+  }
+
+  bool SimulatedPlugin::run()
+  {
+    for (int server = 0; server < options.servers; ++server)
+    {
+      manager->onMGEConnected(manager->mgeServer(server), nullptr);
+      deliver(server, {{"type", "welcome"}, {"message", "mge_load_bench"}});
+    }
+    drainOutgoing();
+
+    auto started = Clock::now();
+    manager->handleMessage(nullptr, json({{"type", "TournamentStart"}, {"payload", json::object()}}).dump());
+
+    // Single elimination: everyone but the champion loses exactly once.
+    size_t expected = static_cast<size_t>(options.players - 1);
+    auto lastActivity = Clock::now();
+    nextBurst = started;
+
+    while (matchesPlayed - lostResults < expected || !heldEvents.empty())
+    {
+      auto now = Clock::now();
+      if (secondsSince(started, now) > options.timeout || secondsSince(lastActivity, now) > options.idleTimeout)
+      {
+        break;
+      }
+
+      if (options.restartAfter && restartSeconds < 0 && matchesPlayed >= options.restartAfter)
+      {
+        restart();
+      }
+      if (options.blipEvery && matchesPlayed >= (blips + 1) * options.blipEvery)
+      {
+        int server = static_cast<int>(blips % options.servers);
+        if (!linkDown(server))
+        {
+          dropLink(server, now);
+        }
+      }
+      restoreLinks(now);
+
+      manager->processChallongeResults();
+      size_t before = matchesPlayed + running.size() + latencies.size();
+      bool busy = drainOutgoing();
+      tick(now);
+      busy |= drainOutgoing();
+      if (busy || matchesPlayed + running.size() + latencies.size() != before)
+      {
+        lastActivity = now;
+      }
+      else
+      {
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+      }
+    }
+
+    wallSeconds = secondsSince(started);
+    completed = matchesPlayed - lostResults >= expected;
+
+    if (completed && options.drain)
+    {
+      auto drainStarted = Clock::now();
+      while (manager->outboxDepth() > 0 && secondsSince(started) < options.timeout)
+      {
+        manager->processChallongeResults();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+      if (manager->outboxDepth() == 0)
+      {
+        drainSeconds = secondsSince(drainStarted);
+      }
+    }
+    return completed;
+  }
+
+  json SimulatedPlugin::report() const
+  {
+    json perKind = json::object();
+    size_t messages = 0;
+    double handlerSeconds = 0;
+    for (const auto &[kind, stats] : kinds)
+    {
+      messages += stats.count;
+      handlerSeconds += stats.totalSeconds;
+      perKind[kind] = {{"count", stats.count},
+                       {"mean_us", stats.count ? stats.totalSeconds / stats.count * 1e6 : 0.0},
+                       {"max_us", stats.maxSeconds * 1e6}};
+    }
+
+    double meanLatency = 0;
+    for (double l : latencies)
+    {
+      meanLatency += l;
+    }
+    meanLatency = latencies.empty() ? 0 : meanLatency / latencies.size();
+
+    return {{"players", options.players},
+            {"servers", options.servers},
+            {"arenas", options.arenas},
+            {"duration", options.duration},
+            {"disconnect_rate", options.disconnectRate},
+            {"burst_interval", options.burstInterval},
+            {"completed", completed},
+            {"wall_seconds", wallSeconds},
+            {"matches_played", matchesPlayed},
+            {"disconnects", disconnects},
+            {"redirects", redirects},
+            {"blips", blips},
+            {"lost_events", lostEvents},
+            {"lost_results", lostResults},
+            {"largest_burst", largestBurst},
+            {"restart_ms", restartSeconds < 0 ? json(nullptr) : json(restartSeconds * 1e3)},
+            {"drain_ms", drainSeconds < 0 ? json(nullptr) : json(drainSeconds * 1e3)},
+            {"handle_mge_message",
+             {{"messages", messages},
+              {"handler_seconds", handlerSeconds},
+              {"messages_per_second", handlerSeconds > 0 ? messages / handlerSeconds : 0.0},
+              {"by_kind", perKind}}},
+            {"scheduling_latency_ms",
+             {{"mean", meanLatency * 1e3},
+              {"p50", percentile(latencies, 50) * 1e3},
+              {"p95", percentile(latencies, 95) * 1e3},
+              {"p99", percentile(latencies, 99) * 1e3},
+              {"max", percentile(latencies, 100) * 1e3}}}};
+  }
+
+  void usage(const char *argv0)
+  {
+    std::cerr << "Usage: " << argv0 << " [--players N] [--arenas N] [--duration SPEC]\n"
+              << "         [--disconnect-rate P] [--reconnect-seconds S] [--burst-interval S]\n"
+              << "         [--seed N] [--challonge-url URL] [--challonge-rate N] [--timeout S] [--verbose]\n"
+              << "         [--state-dir DIR [--restart-after MATCHES]] [--drain]\n"
+              << "         [--servers N [--redirect-seconds S]] [--blip-every MATCHES [--blip-seconds S]]" << std::endl;
+  }
+
+}
+
+int main(int argc, char **argv)
+{
+  Options options;
+  for (int i = 1; i < argc; ++i)
+  {
+    std::string arg = argv[i];
+    auto next = [&]() -> std::string
+    {
+      if (i + 1 >= argc)
+      {
+        usage(argv[0]);
+        std::exit(1);
+      }
+      return argv[++i];
+    };
+
+    if (arg == "--players")
+      options.players = std::stoi(next());
+    else if (arg == "--arenas")
+      options.arenas = std::stoi(next());
+    else if (arg == "--duration")
+      options.duration = next();
+    else if (arg == "--disconnect-rate")
+      options.disconnectRate = std::stod(next());
+    else if (arg == "--reconnect-seconds")
+      options.reconnectSeconds = std::stod(next());
+    else if (arg == "--burst-interval")
+      options.burstInterval = std::stod(next());
+    else if (arg == "--seed")
+      options.seed = static_cast<unsigned>(std::stoul(next()));
+    else if (arg == "--challonge-url")
+      options.challongeUrl = next();
+    else if (arg == "--challonge-rate")
+      options.challongeRate = std::stod(next());
+    else if (arg == "--timeout")
+      options.timeout = std::stod(next());
+    else if (arg == "--verbose")
+      options.verbose = true;
+    else if (arg == "--state-dir")
+      options.stateDir = next();
+    else if (arg == "--restart-after")
+      options.restartAfter = std::stoul(next());
+    else if (arg == "--drain")
+      options.drain = true;
+    else if (arg == "--servers")
+      options.servers = std::stoi(next());
+    else if (arg == "--redirect-seconds")
+      options.redirectSeconds = std::stod(next());
+    else if (arg == "--blip-every")
+      options.blipEvery = std::stoul(next());
+    else if (arg == "--blip-seconds")
+      options.blipSeconds = std::stod(next());
+    else
+    {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (options.players < 2 || options.players > MAX_PLAYERS || options.arenas < 1 || options.servers < 1)
+  {
+    std::cerr << "players must be 2.." << MAX_PLAYERS << ", arenas and servers at least 1" << std::endl;
+    return 1;
+  }
+  if (options.restartAfter && options.stateDir.empty())
+  {
+    std::cerr << "--restart-after needs --state-dir" << std::endl;
+    return 1;
+  }
+  if (!options.stateDir.empty())
+  {
+    // Each run starts a new tournament; state left by an earlier run
+    // would only be reconciled away.
+    std::remove((options.stateDir + "/journal.jsonl").c_str());
+    std::remove((options.stateDir + "/snapshot.json").c_str());
+  }
+
+  curl_global_init(CURL_GLOBAL_DEFAULT);
+
+  // Keep the manager's logging on, as in production, but off the terminal.
+  if (!options.verbose)
+  {
+    FILE *devNull = std::fopen("/dev/null", "w");
+    mge::log::setOutput(devNull, devNull);
+  }
+
+  json report;
+  bool completed;
+  {
+    SimulatedPlugin plugin(options, [&options]()
+                           {
+                             auto manager = std::make_unique<mge::TournamentManager>(nullptr, "bench", "bench", "loadbench",
+                                                                                     options.challongeUrl);
+                             if (options.servers > 1)
+                             {
+                               std::vector<mge::MGEEndpoint> endpoints(options.servers);
+                               for (int i = 0; i < options.servers; ++i)
+                               {
+                                 endpoints[i].name = "bench" + std::to_string(i);
+                                 endpoints[i].connect = "bench:" + std::to_string(i);
+                               }
+                               manager->setMGEEndpoints(endpoints);
+                             }
+                             if (options.challongeRate > 0)
+                             {
+                               manager->setChallongeRateLimit({options.challongeRate, options.challongeRate});
+                             }
+                             if (!options.stateDir.empty())
+                             {
+                               mge::StateJournal::Options journal;
+                               journal.dir = options.stateDir;
+                               manager->openJournal(journal);
+                             }
+                             return manager; });
+    completed = plugin.run();
+    report = plugin.report();
+  }
+
+  mge::log::flush();
+  std::cout << report.dump(2) << std::endl;
+
+  curl_global_cleanup();
+  return completed ? 0 : 1;
+}
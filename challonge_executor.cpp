@@ -0,0 +1,110 @@
+#include "challonge_executor.hpp"
+#include "logger.hpp"
+
+namespace mge
+{
+
+  ChallongeExecutor::ChallongeExecutor(std::function<void()> wakeFn)
+      : wake(std::move(wakeFn))
+  {
+    worker = std::thread(&ChallongeExecutor::run, this);
+  }
+
+  ChallongeExecutor::~ChallongeExecutor()
+  {
+    {
+      std::lock_guard<std::mutex> lock(requestMutex);
+      stopping = true;
+    }
+    requestCv.notify_all();
+
+    if (worker.joinable())
+    {
+      worker.join();
+    }
+  }
+
+  void ChallongeExecutor::enqueue(Task task)
+  {
+    {
+      std::lock_guard<std::mutex> lock(requestMutex);
+      requests.push_back(std::move(task));
+      ++pending;
+    }
+    requestCv.notify_one();
+  }
+
+  void ChallongeExecutor::post(Task completion)
+  {
+    if (!completion)
+    {
+      return;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(completionMutex);
+      completions.push_back(std::move(completion));
+    }
+
+    if (wake)
+    {
+      wake();
+    }
+  }
+
+  size_t ChallongeExecutor::drainCompletions()
+  {
+    std::vector<Task> ready;
+    {
+      std::lock_guard<std::mutex> lock(completionMutex);
+      ready.swap(completions);
+    }
+
+    for (auto &completion : ready)
+    {
+      try
+      {
+        completion();
+      }
+      catch (const std::exception &e)
+      {
+        MGE_LOG_ERROR("Error in Challonge completion", {{"error", e.what()}});
+      }
+    }
+    return ready.size();
+  }
+
+  void ChallongeExecutor::run()
+  {
+    for (;;)
+    {
+      Task task;
+      {
+        std::unique_lock<std::mutex> lock(requestMutex);
+        requestCv.wait(lock, [this]
+                       { return stopping || !requests.empty(); });
+
+        // Outstanding requests are abandoned on shutdown; nobody is left
+        // on the event loop to consume their results.
+        if (stopping)
+        {
+          return;
+        }
+
+        task = std::move(requests.front());
+        requests.pop_front();
+      }
+
+      try
+      {
+        task();
+      }
+      catch (const std::exception &e)
+      {
+        MGE_LOG_ERROR("Error in Challonge request", {{"error", e.what()}});
+      }
+      --pending;
+    }
+  }
+
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <string>
+#include <vector>
+#include "logger.hpp"
+
+namespace mge
+{
+
+  // Runs Challonge HTTP work on a dedicated worker thread so the lws_service
+  // loop never blocks on network I/O. Requests execute strictly in submission
+  // order; their completion callbacks are queued and only run on the event
+  // loop thread when it calls drainCompletions().
+  class ChallongeExecutor
+  {
+  public:
+    using Task = std::function<void()>;
+
+    // wake is invoked from the worker thread whenever a completion is posted,
+    // so the event loop can return from its poll and drain it promptly.
+    explicit ChallongeExecutor(std::function<void()> wake);
+    ~ChallongeExecutor();
+
+    ChallongeExecutor(const ChallongeExecutor &) = delete;
+    ChallongeExecutor &operator=(const ChallongeExecutor &) = delete;
+
+    // Queues work() for the worker thread. When it finishes, onDone(result)
+    // (or onDone() for void work) is run on the event loop thread. If work()
+    // throws, onError(message) is run there instead, so that a caller can
+    // undo whatever it marked as in flight; a completion is always posted.
+    template <typename Work, typename Done, typename Failed>
+    void submit(Work work, Done onDone, Failed onError)
+    {
+      using Result = std::invoke_result_t<Work &>;
+
+      enqueue([this, work = std::move(work), onDone = std::move(onDone), onError = std::move(onError)]() mutable
+              {
+                try
+                {
+                  if constexpr (std::is_void_v<Result>)
+                  {
+                    work();
+                    post(std::move(onDone));
+                  }
+                  else
+                  {
+                    auto result = std::make_shared<Result>(work());
+                    post([onDone = std::move(onDone), result]() mutable
+                         { onDone(std::move(*result)); });
+                  }
+                }
+                catch (const std::exception &e)
+                {
+                  MGE_LOG_ERROR("Error in Challonge request", {{"error", e.what()}});
+                  post([onError = std::move(onError), error = std::string(e.what())]() mutable
+                       { onError(error); });
+                } });
+    }
+
+    // As above, for callers with nothing to undo on failure.
+    template <typename Work, typename Done>
+    void submit(Work work, Done onDone)
+    {
+      submit(std::move(work), std::move(onDone), [](const std::string &) {});
+    }
+
+    template <typename Work>
+    void submit(Work work)
+    {
+      enqueue(std::move(work));
+    }
+
+    // Hands a callback to the event loop thread. Safe to call from any thread.
+    void post(Task completion);
+
+    // Runs all posted completions on the calling thread; returns how many ran.
+    size_t drainCompletions();
+
+    // Number of requests queued or currently executing on the worker.
+    size_t pendingRequests() const { return pending.load(); }
+
+  private:
+    void enqueue(Task task);
+    void run();
+
+    std::function<void()> wake;
+
+    std::mutex requestMutex;
+    std::condition_variable requestCv;
+    std::deque<Task> requests;
+    bool stopping = false;
+    std::atomic<size_t> pending{0};
+
+    std::mutex completionMutex;
+    std::vector<Task> completions;
+
+    std::thread worker;
+  };
+
+}
@@ -0,0 +1,207 @@
+#include "challonge_outbox.hpp"
+#include <algorithm>
+
+namespace mge
+{
+
+  const char *writeResultName(WriteResult result)
+  {
+    switch (result)
+    {
+    case WriteResult::Applied:
+      return "applied";
+    case WriteResult::AlreadyApplied:
+      return "already_applied";
+    case WriteResult::Retry:
+      return "retry";
+    default:
+      return "failed";
+    }
+  }
+
+  const char *outboxKindName(OutboxEntry::Kind kind)
+  {
+    return kind == OutboxEntry::Kind::Register ? "register" : "report_match";
+  }
+
+  json OutboxEntry::toJson() const
+  {
+    json j = {{"id", id}, {"kind", outboxKindName(kind)}};
+    if (kind == Kind::Register)
+    {
+      j["players"] = roster;
+    }
+    else
+    {
+      j["match"] = matchId;
+      j["winner"] = winnerSteamId;
+      j["loser"] = loserSteamId;
+    }
+    return j;
+  }
+
+  OutboxEntry OutboxEntry::fromJson(const json &j)
+  {
+    OutboxEntry entry;
+    entry.id = j.at("id").get<uint64_t>();
+    std::string kind = j.at("kind").get<std::string>();
+    if (kind == "register")
+    {
+      entry.kind = Kind::Register;
+      entry.roster = j.at("players");
+    }
+    else if (kind == "report_match")
+    {
+      entry.kind = Kind::ReportMatch;
+      entry.matchId = j.at("match").get<int>();
+      entry.winnerSteamId = j.at("winner").get<std::string>();
+      entry.loserSteamId = j.at("loser").get<std::string>();
+    }
+    else
+    {
+      throw std::invalid_argument("unknown outbox entry kind " + kind);
+    }
+    return entry;
+  }
+
+  ChallongeOutbox::ChallongeOutbox()
+      : rng(std::random_device{}())
+  {
+  }
+
+  OutboxEntry &ChallongeOutbox::add(OutboxEntry entry)
+  {
+    if (entry.id == 0)
+    {
+      entry.id = nextId;
+    }
+    nextId = std::max(nextId, entry.id + 1);
+    remove(entry.id);
+
+    uint64_t id = entry.id;
+    OutboxEntry &added = entries[id] = std::move(entry);
+    added.inFlight = false;
+    ++kindCounts[static_cast<size_t>(added.kind)];
+    schedule(added, std::chrono::steady_clock::time_point{});
+    return added;
+  }
+
+  OutboxEntry *ChallongeOutbox::find(uint64_t id)
+  {
+    auto it = entries.find(id);
+    return it == entries.end() ? nullptr : &it->second;
+  }
+
+  bool ChallongeOutbox::remove(uint64_t id)
+  {
+    auto it = entries.find(id);
+    if (it == entries.end())
+    {
+      return false;
+    }
+    if (!it->second.inFlight)
+    {
+      waiting.erase({it->second.nextAttempt, id});
+    }
+    --kindCounts[static_cast<size_t>(it->second.kind)];
+    entries.erase(it);
+    return true;
+  }
+
+  std::vector<OutboxEntry> ChallongeOutbox::removeKind(OutboxEntry::Kind kind)
+  {
+    std::vector<OutboxEntry> removed;
+    for (auto it = entries.begin(); it != entries.end() && kindCounts[static_cast<size_t>(kind)] > 0;)
+    {
+      auto next = std::next(it);
+      if (it->second.kind == kind)
+      {
+        removed.push_back(it->second);
+        remove(it->first);
+      }
+      it = next;
+    }
+    return removed;
+  }
+
+  void ChallongeOutbox::clear()
+  {
+    // Ids keep counting up, so a completion for a cleared entry can never
+    // be mistaken for a new one.
+    entries.clear();
+    waiting.clear();
+    kindCounts[0] = kindCounts[1] = 0;
+  }
+
+  std::vector<uint64_t> ChallongeOutbox::takeDue(std::chrono::steady_clock::time_point now)
+  {
+    std::vector<uint64_t> due;
+    while (!waiting.empty() && waiting.begin()->first <= now)
+    {
+      uint64_t id = waiting.begin()->second;
+      waiting.erase(waiting.begin());
+
+      OutboxEntry &entry = entries.at(id);
+      entry.inFlight = true;
+      ++entry.attempts;
+      due.push_back(id);
+    }
+    return due;
+  }
+
+  std::chrono::milliseconds ChallongeOutbox::retryLater(uint64_t id, std::chrono::steady_clock::time_point now, std::string error)
+  {
+    OutboxEntry *entry = find(id);
+    if (!entry || !entry->inFlight)
+    {
+      return std::chrono::milliseconds(0);
+    }
+    std::chrono::milliseconds delay = delayFor(entry->attempts);
+    entry->inFlight = false;
+    entry->lastError = std::move(error);
+    schedule(*entry, now + delay);
+    return delay;
+  }
+
+  void ChallongeOutbox::retryAllNow(std::chrono::steady_clock::time_point now)
+  {
+    if (waiting.empty() || waiting.rbegin()->first <= now)
+    {
+      return;
+    }
+    std::set<Slot> later;
+    later.swap(waiting);
+    for (const Slot &slot : later)
+    {
+      schedule(entries.at(slot.second), std::min(slot.first, now));
+    }
+  }
+
+  void ChallongeOutbox::schedule(OutboxEntry &entry, std::chrono::steady_clock::time_point at)
+  {
+    entry.nextAttempt = at;
+    waiting.insert({at, entry.id});
+  }
+
+  void ChallongeOutbox::setBackoff(Backoff value)
+  {
+    // delayFor() draws from [delay / 2, delay], which a negative delay
+    // would turn into an empty range.
+    backoff.initialDelay = std::max(value.initialDelay, std::chrono::milliseconds(1));
+    backoff.maxDelay = std::max(value.maxDelay, backoff.initialDelay);
+  }
+
+  std::chrono::milliseconds ChallongeOutbox::delayFor(unsigned attempts)
+  {
+    auto delay = backoff.initialDelay;
+    for (unsigned i = 1; i < attempts && delay < backoff.maxDelay; ++i)
+    {
+      delay *= 2;
+    }
+    delay = std::min(delay, backoff.maxDelay);
+
+    std::uniform_int_distribution<long long> jitter(delay.count() / 2, delay.count());
+    return std::chrono::milliseconds(jitter(rng));
+  }
+
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+using json = nlohmann::json;
+
+namespace mge
+{
+
+  // How a Challonge write went. Retry covers failures that may pass on a
+  // later attempt (no response, 429, 5xx, a match not open yet); Failed
+  // covers ones that will not, such as a match Challonge completed with a
+  // different winner.
+  enum class WriteResult
+  {
+    Applied,
+    AlreadyApplied,
+    Retry,
+    Failed
+  };
+
+  const char *writeResultName(WriteResult result);
+
+  // One Challonge mutation waiting to be confirmed.
+  struct OutboxEntry
+  {
+    enum class Kind
+    {
+      Register, // add the roster and start the tournament
+      ReportMatch
+    };
+
+    uint64_t id = 0;
+    Kind kind = Kind::ReportMatch;
+    // Register: Player::toJson() of each player, in seed order.
+    json roster;
+    // ReportMatch. matchId is 0 if the match was not known locally when
+    // the result came in; the API then finds it by its players.
+    int matchId = 0;
+    std::string winnerSteamId;
+    std::string loserSteamId;
+
+    // Attempts made so far, including one in flight. Every attempt after
+    // the first has to check whether an earlier one got through even
+    // though its response was lost.
+    unsigned attempts = 0;
+    bool inFlight = false;
+    std::chrono::steady_clock::time_point nextAttempt;
+    std::string lastError;
+    // ReportMatch: the body of the response to an attempt Challonge
+    // rejected for good (a 4xx other than 404 or 429), if the last attempt
+    // was one.
+    std::string rejection;
+
+    json toJson() const;
+    // Throws if j is not an entry written by toJson().
+    static OutboxEntry fromJson(const json &j);
+  };
+
+  const char *outboxKindName(OutboxEntry::Kind kind);
+
+  // Challonge writes that have not been confirmed yet, in the order they
+  // were made. Failed attempts are retried after an exponential backoff
+  // with jitter: attempt n waits between half and all of
+  // min(maxDelay, initialDelay * 2^(n-1)), so clients that failed together
+  // do not retry together. Persisting entries is up to the owner.
+  class ChallongeOutbox
+  {
+  public:
+    struct Backoff
+    {
+      std::chrono::milliseconds initialDelay{500};
+      std::chrono::milliseconds maxDelay{60000};
+    };
+
+    ChallongeOutbox();
+
+    void setBackoff(Backoff value);
+
+    // Queues an entry, due at once. Assigns an id unless the entry already
+    // has one (e.g. when restored).
+    OutboxEntry &add(OutboxEntry entry);
+    OutboxEntry *find(uint64_t id);
+    bool remove(uint64_t id);
+    // Removes every entry of the given kind and returns them.
+    std::vector<OutboxEntry> removeKind(OutboxEntry::Kind kind);
+    void clear();
+
+    // Marks the entries that are due and not in flight as in flight and
+    // returns their ids, earliest due first.
+    std::vector<uint64_t> takeDue(std::chrono::steady_clock::time_point now);
+    // Puts an in-flight entry back with its next attempt backed off;
+    // returns the delay.
+    std::chrono::milliseconds retryLater(uint64_t id, std::chrono::steady_clock::time_point now, std::string error);
+    // Makes every waiting entry due now, without forgetting its attempts.
+    // For when a write went through again after failures.
+    void retryAllNow(std::chrono::steady_clock::time_point now);
+
+    size_t size() const { return entries.size(); }
+    bool empty() const { return entries.empty(); }
+    size_t count(OutboxEntry::Kind kind) const { return kindCounts[static_cast<size_t>(kind)]; }
+    const std::map<uint64_t, OutboxEntry> &all() const { return entries; }
+
+    // The backed-off, jittered delay before the next try after the given
+    // number of attempts.
+    std::chrono::milliseconds delayFor(unsigned attempts);
+
+  private:
+    using Slot = std::pair<std::chrono::steady_clock::time_point, uint64_t>;
+
+    void schedule(OutboxEntry &entry, std::chrono::steady_clock::time_point at);
+
+    Backoff backoff;
+    std::map<uint64_t, OutboxEntry> entries;
+    // Entries not in flight, by when they are due next.
+    std::set<Slot> waiting;
+    size_t kindCounts[2] = {0, 0};
+    uint64_t nextId = 1;
+    std::mt19937 rng;
+  };
+
+}
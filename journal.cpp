@@ -0,0 +1,344 @@
+#include "journal.hpp"
+#include "logger.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace mge
+{
+
+  static std::string errnoText()
+  {
+    return std::strerror(errno);
+  }
+
+  // fsyncs a directory so a rename inside it survives a crash.
+  static void syncDirectory(const std::string &dir)
+  {
+    int dirFd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (dirFd < 0)
+    {
+      return;
+    }
+    ::fsync(dirFd);
+    ::close(dirFd);
+  }
+
+  // A zero sync interval would have the writer spin, and zero records per
+  // snapshot would snapshot on every event.
+  static StateJournal::Options withMinimums(StateJournal::Options options)
+  {
+    options.syncInterval = std::max(options.syncInterval, std::chrono::milliseconds(1));
+    options.snapshotEvery = std::max<size_t>(options.snapshotEvery, 1);
+    return options;
+  }
+
+  StateJournal::StateJournal(Options options)
+      : options(withMinimums(std::move(options)))
+  {
+    journalPath = this->options.dir + "/journal.jsonl";
+    snapshotPath = this->options.dir + "/snapshot.json";
+    // No seq, so open() never takes it for a record.
+    header = json{{"owner", this->options.owner}}.dump() + "\n";
+  }
+
+  StateJournal::~StateJournal()
+  {
+    if (writer.joinable())
+    {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+      }
+      cv.notify_one();
+      writer.join();
+    }
+    if (fd >= 0)
+    {
+      ::close(fd);
+    }
+  }
+
+  bool StateJournal::open(json &snapshot, std::vector<json> &records)
+  {
+    snapshot = nullptr;
+    records.clear();
+
+    if (::mkdir(options.dir.c_str(), 0755) != 0 && errno != EEXIST)
+    {
+      MGE_LOG_ERROR("Failed to create state directory", {{"dir", options.dir}, {"error", errnoText()}});
+      return false;
+    }
+
+    std::ifstream snapshotFile(snapshotPath);
+    if (snapshotFile)
+    {
+      try
+      {
+        snapshotFile >> snapshot;
+        seq = snapshot.value("seq", uint64_t{0});
+      }
+      catch (const std::exception &e)
+      {
+        // Snapshots are renamed into place whole, so this is not a torn
+        // write; starting from the journal alone beats refusing to start.
+        MGE_LOG_ERROR("Ignoring unreadable state snapshot", {{"path", snapshotPath}, {"error", e.what()}});
+        snapshot = nullptr;
+      }
+    }
+    const uint64_t snapshotSeq = seq;
+
+    // Offset just past the last intact record; anything after it is a
+    // write the previous run did not finish.
+    off_t good = 0;
+    json journalOwner;
+    std::ifstream journalFile(journalPath, std::ios::binary);
+    std::string line;
+    while (journalFile && std::getline(journalFile, line))
+    {
+      if (journalFile.eof())
+      {
+        // No trailing newline: the last write was cut short.
+        break;
+      }
+      json record;
+      try
+      {
+        record = json::parse(line);
+      }
+      catch (const json::parse_error &)
+      {
+        break;
+      }
+      if (good == 0)
+      {
+        journalOwner = record.value("owner", json());
+      }
+      good += static_cast<off_t>(line.size() + 1);
+
+      uint64_t recordSeq = record.value("seq", uint64_t{0});
+      if (recordSeq <= snapshotSeq)
+      {
+        continue;
+      }
+      seq = recordSeq;
+      records.push_back(std::move(record));
+    }
+    journalFile.close();
+
+    // State from before owners were recorded has none, and is moved aside
+    // as well: nothing says which tournament it belongs to.
+    bool foreignSnapshot = !snapshot.is_null() && snapshot.value("owner", json()) != options.owner;
+    bool foreignJournal = good > 0 && journalOwner != options.owner;
+    if (foreignSnapshot || foreignJournal)
+    {
+      moveAside(foreignSnapshot ? snapshot.value("owner", json()) : journalOwner);
+      snapshot = nullptr;
+      records.clear();
+      seq = 0;
+      good = 0;
+    }
+    sinceSnapshot = records.size();
+
+    fd = ::open(journalPath.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+      MGE_LOG_ERROR("Failed to open state journal", {{"path", journalPath}, {"error", errnoText()}});
+      return false;
+    }
+    struct stat st;
+    if (::fstat(fd, &st) == 0 && st.st_size > good)
+    {
+      MGE_LOG_WARN("Dropping incomplete state journal tail", {{"path", journalPath}, {"bytes", static_cast<long long>(st.st_size - good)}});
+      if (::ftruncate(fd, good) != 0)
+      {
+        MGE_LOG_ERROR("Failed to truncate state journal", {{"path", journalPath}, {"error", errnoText()}});
+      }
+    }
+    if (good == 0 && !writeAll(header))
+    {
+      return false;
+    }
+
+    writer = std::thread(&StateJournal::run, this);
+    return true;
+  }
+
+  void StateJournal::append(json record)
+  {
+    record["seq"] = ++seq;
+    std::string line = record.dump();
+    line += '\n';
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      pending += line;
+      ++queued;
+    }
+    ++sinceSnapshot;
+    // The writer wakes on its own every syncInterval; waking it per record
+    // would defeat batching.
+  }
+
+  void StateJournal::snapshot(json state)
+  {
+    state["seq"] = seq;
+    state["owner"] = options.owner;
+    std::string data = state.dump();
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      // A snapshot still waiting to be written is covered by this one.
+      beforeSnapshot += pending;
+      pending.clear();
+      pendingSnapshot = std::move(data);
+      ++queued;
+    }
+    sinceSnapshot = 0;
+    cv.notify_one();
+  }
+
+  void StateJournal::sync()
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (!writer.joinable())
+    {
+      return;
+    }
+    uint64_t target = queued;
+    syncRequested = true;
+    cv.notify_one();
+    syncedCv.wait(lock, [&]
+                  { return synced >= target; });
+  }
+
+  bool StateJournal::writeAll(const std::string &data)
+  {
+    size_t offset = 0;
+    while (offset < data.size())
+    {
+      ssize_t n = ::write(fd, data.data() + offset, data.size() - offset);
+      if (n < 0)
+      {
+        if (errno == EINTR)
+        {
+          continue;
+        }
+        MGE_LOG_ERROR("Failed to write state journal", {{"path", journalPath}, {"error", errnoText()}});
+        return false;
+      }
+      offset += static_cast<size_t>(n);
+    }
+    return true;
+  }
+
+  void StateJournal::writeSnapshot(const std::string &data)
+  {
+    std::string tmpPath = snapshotPath + ".tmp";
+    int tmpFd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (tmpFd < 0)
+    {
+      MGE_LOG_ERROR("Failed to write state snapshot", {{"path", tmpPath}, {"error", errnoText()}});
+      return;
+    }
+
+    bool ok = true;
+    size_t offset = 0;
+    while (ok && offset < data.size())
+    {
+      ssize_t n = ::write(tmpFd, data.data() + offset, data.size() - offset);
+      if (n < 0 && errno != EINTR)
+      {
+        ok = false;
+      }
+      else if (n > 0)
+      {
+        offset += static_cast<size_t>(n);
+      }
+    }
+    ok = ok && ::fsync(tmpFd) == 0;
+    ::close(tmpFd);
+    if (!ok || std::rename(tmpPath.c_str(), snapshotPath.c_str()) != 0)
+    {
+      // The journal is left alone, so nothing is lost.
+      MGE_LOG_ERROR("Failed to write state snapshot", {{"path", snapshotPath}, {"error", errnoText()}});
+      return;
+    }
+    syncDirectory(options.dir);
+
+    // Everything in the journal is now covered by the snapshot.
+    if (::ftruncate(fd, 0) != 0)
+    {
+      MGE_LOG_WARN("Failed to truncate state journal", {{"path", journalPath}, {"error", errnoText()}});
+      return;
+    }
+    writeAll(header);
+  }
+
+  void StateJournal::moveAside(const json &found)
+  {
+    std::string suffix = ".stale-" + std::to_string(std::chrono::duration_cast<std::chrono::seconds>(
+                                                         std::chrono::system_clock::now().time_since_epoch())
+                                                         .count());
+    MGE_LOG_WARN("Moving aside state of another tournament", {{"dir", options.dir}, {"found", found}, {"expected", options.owner}, {"suffix", suffix}});
+    for (const std::string &path : {snapshotPath, journalPath})
+    {
+      if (std::rename(path.c_str(), (path + suffix).c_str()) != 0 && errno != ENOENT)
+      {
+        MGE_LOG_ERROR("Failed to move aside state file", {{"path", path}, {"error", errnoText()}});
+      }
+    }
+    syncDirectory(options.dir);
+  }
+
+  void StateJournal::run()
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+      cv.wait_for(lock, options.syncInterval, [&]
+                  { return stopping || syncRequested || pendingSnapshot.has_value(); });
+
+      std::string before = std::move(beforeSnapshot);
+      std::optional<std::string> snapshotData = std::move(pendingSnapshot);
+      std::string after = std::move(pending);
+      beforeSnapshot.clear();
+      pendingSnapshot.reset();
+      pending.clear();
+      uint64_t target = queued;
+      bool stop = stopping;
+      syncRequested = false;
+      lock.unlock();
+
+      if (!before.empty() || !after.empty() || snapshotData)
+      {
+        // Records written before the snapshot are synced first so that a
+        // failed snapshot still leaves them durable in the journal.
+        if (!before.empty() && writeAll(before))
+        {
+          ::fdatasync(fd);
+        }
+        if (snapshotData)
+        {
+          writeSnapshot(*snapshotData);
+        }
+        if (!after.empty() && writeAll(after))
+        {
+          ::fdatasync(fd);
+        }
+      }
+
+      lock.lock();
+      synced = target;
+      syncedCv.notify_all();
+      if (stop)
+      {
+        return;
+      }
+    }
+  }
+
+}
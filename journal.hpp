@@ -0,0 +1,101 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+using json = nlohmann::json;
+
+namespace mge
+{
+
+  // Crash-safe store for tournament state that neither Challonge nor the
+  // MGE plugin can give back after a restart. Changes are appended to a
+  // journal as JSON lines. A background thread writes them out and
+  // fdatasyncs once per syncInterval, so a burst of events costs one sync
+  // rather than one each. Once snapshotEvery records have piled up the
+  // owner writes a full snapshot, and the journal starts over.
+  //
+  // dir holds snapshot.json and journal.jsonl. Every record and snapshot
+  // carries a sequence number and open() skips records the snapshot
+  // already covers, so a crash between writing a snapshot and truncating
+  // the journal is harmless. A torn final line is dropped.
+  //
+  // The snapshot and the first line of the journal name the owner the
+  // state was written for. open() moves state of any other owner aside,
+  // with a ".stale-<time>" suffix, instead of replaying it.
+  class StateJournal
+  {
+  public:
+    struct Options
+    {
+      std::string dir;
+      // E.g. the tournament; compared as a whole.
+      json owner;
+      std::chrono::milliseconds syncInterval{20};
+      size_t snapshotEvery = 1000;
+    };
+
+    explicit StateJournal(Options options);
+    // Writes out and syncs whatever is still queued.
+    ~StateJournal();
+
+    StateJournal(const StateJournal &) = delete;
+    StateJournal &operator=(const StateJournal &) = delete;
+
+    // Reads what a previous run left in dir, creating dir if needed, and
+    // starts the writer. snapshot is null if there was none; records are
+    // the ones logged after it, oldest first. False if the journal cannot
+    // be opened for writing.
+    bool open(json &snapshot, std::vector<json> &records);
+
+    // Queues a record; never waits for I/O.
+    void append(json record);
+    // Whether snapshotEvery records were appended since the last snapshot.
+    bool snapshotDue() const { return sinceSnapshot >= options.snapshotEvery; }
+    // Queues state as the new snapshot, covering every record so far.
+    void snapshot(json state);
+    // Blocks until everything queued so far is on disk.
+    void sync();
+
+  private:
+    void run();
+    bool writeAll(const std::string &data);
+    void writeSnapshot(const std::string &data);
+    void moveAside(const json &found);
+
+    const Options options;
+    std::string journalPath;
+    std::string snapshotPath;
+    // First line of every journal file.
+    std::string header;
+    int fd = -1;
+
+    // Owner thread only.
+    uint64_t seq = 0;
+    size_t sinceSnapshot = 0;
+
+    // Guards everything below.
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::condition_variable syncedCv;
+    // Records queued before the pending snapshot, then the snapshot, then
+    // records queued after it.
+    std::string beforeSnapshot;
+    std::optional<std::string> pendingSnapshot;
+    std::string pending;
+    uint64_t queued = 0;
+    uint64_t synced = 0;
+    bool syncRequested = false;
+    bool stopping = false;
+
+    std::thread writer;
+  };
+
+}
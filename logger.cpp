@@ -0,0 +1,483 @@
+#include "logger.hpp"
+#include "mpsc_queue.hpp"
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace mge
+{
+  namespace log
+  {
+
+    namespace
+    {
+
+      constexpr size_t QUEUE_CAPACITY = 8192;
+      constexpr uint32_t DEFAULT_RATE_LIMIT = 100;
+      // How long the writer sleeps when idle before checking again; a
+      // producer that finds it asleep wakes it early.
+      constexpr auto IDLE_WAIT = std::chrono::milliseconds(100);
+
+      struct Record
+      {
+        Level level = Level::Info;
+        std::chrono::system_clock::time_point time;
+        const char *file = "";
+        int line = 0;
+        uint32_t suppressed = 0;
+        std::string message;
+        std::vector<Field> fields;
+      };
+
+      std::atomic<Level> threshold{Level::Debug};
+      std::atomic<Format> format{Format::Text};
+      std::atomic<uint32_t> rateLimit{DEFAULT_RATE_LIMIT};
+      std::atomic<FILE *> outStream{nullptr};
+      std::atomic<FILE *> errStream{nullptr};
+
+      const char *levelName(Level level)
+      {
+        switch (level)
+        {
+        case Level::Debug:
+          return "debug";
+        case Level::Info:
+          return "info";
+        case Level::Warn:
+          return "warn";
+        case Level::Error:
+          return "error";
+        default:
+          return "off";
+        }
+      }
+
+      const char *baseName(const char *path)
+      {
+        const char *slash = std::strrchr(path, '/');
+        return slash ? slash + 1 : path;
+      }
+
+      // Writes s as a JSON string body (without the quotes).
+      void appendEscaped(std::string &line, const std::string &s)
+      {
+        for (char c : s)
+        {
+          switch (c)
+          {
+          case '"':
+            line += "\\\"";
+            break;
+          case '\\':
+            line += "\\\\";
+            break;
+          case '\n':
+            line += "\\n";
+            break;
+          case '\r':
+            line += "\\r";
+            break;
+          case '\t':
+            line += "\\t";
+            break;
+          default:
+            if (static_cast<unsigned char>(c) < 0x20)
+            {
+              char buf[8];
+              std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+              line += buf;
+            }
+            else
+            {
+              line += c;
+            }
+          }
+        }
+      }
+
+      bool needsQuotes(const std::string &value)
+      {
+        if (value.empty())
+        {
+          return true;
+        }
+        for (char c : value)
+        {
+          if (c == ' ' || c == '"' || c == '=' || static_cast<unsigned char>(c) < 0x20)
+          {
+            return true;
+          }
+        }
+        return false;
+      }
+
+      void appendTimestamp(std::string &line, std::chrono::system_clock::time_point time)
+      {
+        std::time_t seconds = std::chrono::system_clock::to_time_t(time);
+        auto millis = std::chrono::duration_cast<std::chrono::milliseconds>(
+                          time.time_since_epoch())
+                          .count() %
+                      1000;
+        std::tm utc;
+        gmtime_r(&seconds, &utc);
+        char buf[32];
+        size_t n = std::strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S", &utc);
+        std::snprintf(buf + n, sizeof(buf) - n, ".%03dZ", static_cast<int>(millis));
+        line += buf;
+      }
+
+      void formatText(std::string &line, const Record &record)
+      {
+        appendTimestamp(line, record.time);
+        char level[8];
+        std::snprintf(level, sizeof(level), " %-5s ", levelName(record.level));
+        for (char *c = level; *c; ++c)
+        {
+          *c = static_cast<char>(std::toupper(static_cast<unsigned char>(*c)));
+        }
+        line += level;
+        line += record.message;
+
+        for (const Field &field : record.fields)
+        {
+          line += ' ';
+          line += field.key;
+          line += '=';
+          if (field.quoted && needsQuotes(field.value))
+          {
+            line += '"';
+            appendEscaped(line, field.value);
+            line += '"';
+          }
+          else
+          {
+            line += field.value;
+          }
+        }
+        if (record.suppressed)
+        {
+          line += " suppressed=" + std::to_string(record.suppressed);
+        }
+        if (record.level >= Level::Warn)
+        {
+          line += " at=";
+          line += baseName(record.file);
+          line += ':' + std::to_string(record.line);
+        }
+        line += '\n';
+      }
+
+      void formatJson(std::string &line, const Record &record)
+      {
+        line += "{\"time\":\"";
+        appendTimestamp(line, record.time);
+        line += "\",\"level\":\"";
+        line += levelName(record.level);
+        line += "\",\"msg\":\"";
+        appendEscaped(line, record.message);
+        line += "\",\"file\":\"";
+        line += baseName(record.file);
+        line += "\",\"line\":" + std::to_string(record.line);
+        for (const Field &field : record.fields)
+        {
+          line += ",\"";
+          line += field.key;
+          line += "\":";
+          if (field.quoted)
+          {
+            line += '"';
+            appendEscaped(line, field.value);
+            line += '"';
+          }
+          else
+          {
+            line += field.value;
+          }
+        }
+        if (record.suppressed)
+        {
+          line += ",\"suppressed\":" + std::to_string(record.suppressed);
+        }
+        line += "}\n";
+      }
+
+      // Owns the queue and the writer thread. Created on first use and never
+      // destroyed, so logging stays safe during static destruction; an
+      // atexit hook drains the queue and stops the thread.
+      class Writer
+      {
+      public:
+        static Writer &instance()
+        {
+          static Writer *writer = new Writer();
+          return *writer;
+        }
+
+        void submit(Record record)
+        {
+          if (stopped.load(std::memory_order_acquire))
+          {
+            // After shutdown, write synchronously so late records still
+            // show up.
+            std::lock_guard<std::mutex> lock(writeMutex);
+            emit(record);
+            flushStreams();
+            return;
+          }
+
+          if (!queue.push(std::move(record)))
+          {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+          }
+          submitted.fetch_add(1, std::memory_order_release);
+          if (sleeping.load(std::memory_order_acquire))
+          {
+            cv.notify_one();
+          }
+        }
+
+        void flush()
+        {
+          if (stopped.load(std::memory_order_acquire))
+          {
+            return;
+          }
+          uint64_t target = submitted.load(std::memory_order_acquire);
+          std::unique_lock<std::mutex> lock(mutex);
+          cv.notify_one();
+          drainedCv.wait(lock, [&]
+                         { return written >= target || stopped.load(); });
+        }
+
+        void stop()
+        {
+          {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+          }
+          cv.notify_one();
+          if (thread.joinable())
+          {
+            thread.join();
+          }
+          stopped.store(true, std::memory_order_release);
+          // Anything pushed while the writer was exiting.
+          drain();
+          drainedCv.notify_all();
+        }
+
+      private:
+        Writer() : queue(QUEUE_CAPACITY)
+        {
+          thread = std::thread(&Writer::run, this);
+          std::atexit([]
+                      { Writer::instance().stop(); });
+        }
+
+        void run()
+        {
+          while (true)
+          {
+            size_t count = drain();
+
+            std::unique_lock<std::mutex> lock(mutex);
+            if (count == 0)
+            {
+              drainedCv.notify_all();
+              if (stopping)
+              {
+                break;
+              }
+              sleeping.store(true, std::memory_order_release);
+              cv.wait_for(lock, IDLE_WAIT);
+              sleeping.store(false, std::memory_order_release);
+            }
+          }
+        }
+
+        // Writes out everything queued, then flushes once. Returns how many
+        // records were written.
+        size_t drain()
+        {
+          size_t count = 0;
+          Record record;
+          {
+            std::lock_guard<std::mutex> lock(writeMutex);
+            while (queue.pop(record))
+            {
+              emit(record);
+              ++count;
+            }
+
+            uint64_t lost = dropped.exchange(0, std::memory_order_relaxed);
+            if (lost)
+            {
+              Record notice;
+              notice.level = Level::Warn;
+              notice.time = std::chrono::system_clock::now();
+              notice.file = __FILE__;
+              notice.line = __LINE__;
+              notice.message = "Log queue full, dropped records";
+              notice.fields.emplace_back("count", lost);
+              emit(notice);
+            }
+            if (count || lost)
+            {
+              flushStreams();
+            }
+          }
+
+          if (count)
+          {
+            std::lock_guard<std::mutex> lock(mutex);
+            written += count;
+          }
+          return count;
+        }
+
+        void emit(const Record &record)
+        {
+          line.clear();
+          if (format.load(std::memory_order_relaxed) == Format::Json)
+          {
+            formatJson(line, record);
+          }
+          else
+          {
+            formatText(line, record);
+          }
+
+          FILE *stream = record.level >= Level::Warn ? errStream.load() : outStream.load();
+          if (!stream)
+          {
+            stream = record.level >= Level::Warn ? stderr : stdout;
+          }
+          std::fwrite(line.data(), 1, line.size(), stream);
+        }
+
+        void flushStreams()
+        {
+          FILE *out = outStream.load();
+          FILE *err = errStream.load();
+          std::fflush(out ? out : stdout);
+          std::fflush(err ? err : stderr);
+        }
+
+        MPSCQueue<Record> queue;
+        std::atomic<uint64_t> submitted{0};
+        std::atomic<uint64_t> dropped{0};
+        std::atomic<bool> sleeping{false};
+        std::atomic<bool> stopped{false};
+
+        // Guards stopping, written and the condition variables.
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::condition_variable drainedCv;
+        bool stopping = false;
+        uint64_t written = 0;
+
+        // Serializes emit() between the writer and post-shutdown callers.
+        std::mutex writeMutex;
+        std::string line;
+
+        std::thread thread;
+      };
+
+    }
+
+    bool Site::admit(uint32_t &suppressed)
+    {
+      suppressed = 0;
+      uint32_t limit = rateLimit.load(std::memory_order_relaxed);
+      if (limit == 0)
+      {
+        return true;
+      }
+
+      // Fixed one-second windows. Racing threads may let a few extra
+      // records through at a window boundary, which is fine.
+      int64_t now = std::chrono::duration_cast<std::chrono::seconds>(
+                        std::chrono::steady_clock::now().time_since_epoch())
+                        .count();
+      int64_t current = window.load(std::memory_order_relaxed);
+      if (current != now && window.compare_exchange_strong(current, now, std::memory_order_relaxed))
+      {
+        count.store(0, std::memory_order_relaxed);
+      }
+
+      if (count.fetch_add(1, std::memory_order_relaxed) < limit)
+      {
+        suppressed = dropped.exchange(0, std::memory_order_relaxed);
+        return true;
+      }
+      dropped.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+
+    void setLevel(Level level) { threshold.store(level, std::memory_order_relaxed); }
+
+    Level level() { return threshold.load(std::memory_order_relaxed); }
+
+    void setFormat(Format f) { format.store(f, std::memory_order_relaxed); }
+
+    void setRateLimit(uint32_t perSecond) { rateLimit.store(perSecond, std::memory_order_relaxed); }
+
+    void setOutput(FILE *out, FILE *err)
+    {
+      outStream.store(out);
+      errStream.store(err);
+    }
+
+    bool parseLevel(const std::string &name, Level &level)
+    {
+      for (Level candidate : {Level::Debug, Level::Info, Level::Warn, Level::Error, Level::Off})
+      {
+        if (name == levelName(candidate))
+        {
+          level = candidate;
+          return true;
+        }
+      }
+      return false;
+    }
+
+    bool parseFormat(const std::string &name, Format &f)
+    {
+      if (name == "text")
+      {
+        f = Format::Text;
+        return true;
+      }
+      if (name == "json")
+      {
+        f = Format::Json;
+        return true;
+      }
+      return false;
+    }
+
+    void write(Level level, const Site &site, uint32_t suppressed,
+               std::string message, std::initializer_list<Field> fields)
+    {
+      Record record;
+      record.level = level;
+      record.time = std::chrono::system_clock::now();
+      record.file = site.file;
+      record.line = site.line;
+      record.suppressed = suppressed;
+      record.message = std::move(message);
+      record.fields.assign(fields.begin(), fields.end());
+      Writer::instance().submit(std::move(record));
+    }
+
+    void flush() { Writer::instance().flush(); }
+
+  }
+}
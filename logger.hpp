@@ -0,0 +1,136 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <initializer_list>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <nlohmann/json.hpp>
+
+// Lowest level compiled in: 0 debug, 1 info, 2 warn, 3 error. Calls below
+// it are discarded by the compiler, arguments and all. CMake sets this from
+// MGE_LOG_LEVEL; otherwise release (NDEBUG) builds drop debug logging.
+#ifndef MGE_LOG_MIN_LEVEL
+#ifdef NDEBUG
+#define MGE_LOG_MIN_LEVEL 1
+#else
+#define MGE_LOG_MIN_LEVEL 0
+#endif
+#endif
+
+namespace mge
+{
+  namespace log
+  {
+
+    enum class Level
+    {
+      Debug,
+      Info,
+      Warn,
+      Error,
+      Off
+    };
+
+    enum class Format
+    {
+      Text, // 2024-01-01T12:00:00.000Z INFO  Assigned match arena=3 player1=Alice
+      Json  // one JSON object per line
+    };
+
+    // One structured key=value pair. Keys are string literals; values are
+    // rendered when the record is made, so they may refer to temporaries.
+    struct Field
+    {
+      const char *key = "";
+      std::string value;
+      // Strings are quoted in JSON output; numbers, bools and JSON are not.
+      bool quoted = true;
+
+      Field() = default;
+      Field(const char *key, std::string value) : key(key), value(std::move(value)) {}
+      Field(const char *key, const char *value) : key(key), value(value ? value : "") {}
+      Field(const char *key, std::string_view value) : key(key), value(value) {}
+      Field(const char *key, bool value) : key(key), value(value ? "true" : "false"), quoted(false) {}
+      Field(const char *key, const nlohmann::json &value) : key(key), value(value.dump()), quoted(false) {}
+
+      template <typename T, typename = std::enable_if_t<std::is_arithmetic_v<T>>>
+      Field(const char *key, T value) : key(key), value(std::to_string(value)), quoted(false)
+      {
+      }
+    };
+
+    // Per call site state for rate limiting. Each MGE_LOG_* expansion owns
+    // one as a function-local static.
+    class Site
+    {
+    public:
+      Site(const char *file, int line) : file(file), line(line) {}
+
+      // Whether this call may log now. suppressed gets how many calls were
+      // dropped since the last one that got through.
+      bool admit(uint32_t &suppressed);
+
+      const char *const file;
+      const int line;
+
+    private:
+      std::atomic<int64_t> window{-1};
+      std::atomic<uint32_t> count{0};
+      std::atomic<uint32_t> dropped{0};
+    };
+
+    // Runtime threshold; anything below it returns before building a record.
+    void setLevel(Level level);
+    Level level();
+    inline bool enabled(Level at) { return at >= level(); }
+
+    void setFormat(Format format);
+    // Records per second allowed from any one call site; the rest are
+    // counted and reported on the next record that gets through. 0 means
+    // unlimited.
+    void setRateLimit(uint32_t perSecond);
+    // Where the writer puts debug/info and warn/error lines. Defaults to
+    // stdout and stderr.
+    void setOutput(FILE *out, FILE *err);
+
+    // "debug", "info", "warn", "error" or "off"; false if name is none of them.
+    bool parseLevel(const std::string &name, Level &level);
+    bool parseFormat(const std::string &name, Format &format);
+
+    // Queues a record for the writer thread. Never blocks: if the queue is
+    // full the record is dropped and counted. Use the MGE_LOG_* macros
+    // rather than calling this directly.
+    void write(Level level, const Site &site, uint32_t suppressed,
+               std::string message, std::initializer_list<Field> fields = {});
+
+    // Blocks until everything queued so far has been written out.
+    void flush();
+
+  }
+}
+
+#define MGE_LOG_AT(lvl, ...)                                               \
+  do                                                                       \
+  {                                                                        \
+    if constexpr (static_cast<int>(lvl) >= MGE_LOG_MIN_LEVEL)              \
+    {                                                                      \
+      if (::mge::log::enabled(lvl))                                        \
+      {                                                                    \
+        static ::mge::log::Site mgeLogSite(__FILE__, __LINE__);            \
+        uint32_t mgeLogSuppressed = 0;                                     \
+        if (mgeLogSite.admit(mgeLogSuppressed))                            \
+        {                                                                  \
+          ::mge::log::write(lvl, mgeLogSite, mgeLogSuppressed, __VA_ARGS__); \
+        }                                                                  \
+      }                                                                    \
+    }                                                                      \
+  } while (0)
+
+// MGE_LOG_INFO("Assigned match", {{"arena", 3}, {"player1", name}});
+#define MGE_LOG_DEBUG(...) MGE_LOG_AT(::mge::log::Level::Debug, __VA_ARGS__)
+#define MGE_LOG_INFO(...) MGE_LOG_AT(::mge::log::Level::Info, __VA_ARGS__)
+#define MGE_LOG_WARN(...) MGE_LOG_AT(::mge::log::Level::Warn, __VA_ARGS__)
+#define MGE_LOG_ERROR(...) MGE_LOG_AT(::mge::log::Level::Error, __VA_ARGS__)
@@ -1,4 +1,6 @@
 #include "tournament_manager.hpp"
+#include "logger.hpp"
+#include "metrics.hpp"
 #include <libwebsockets.h>
 #include <iostream>
 #include <fstream>
@@ -6,11 +8,104 @@
 #include <cstring>
 #include <thread>
 #include <chrono>
+#include <algorithm>
 
 static mge::TournamentManager* g_tournament = nullptr;
 
+// Largest payload slice handed to lws_write() per writeable callback.
+// Bigger messages are split into continuation fragments.
+static const size_t MAX_FRAGMENT_SIZE = 4096;
+
+// Writes the next fragment of frame straight from its buffer. Returns -1 on
+// error, 1 once the final fragment has been written and 0 if more remain.
+static int writeFragment(struct lws *wsi, mge::OutboundFrame &frame) {
+    size_t remaining = frame.size() - frame.sent;
+    size_t chunk = std::min(remaining, MAX_FRAGMENT_SIZE);
+    bool last = chunk == remaining;
+    
+    int flags = frame.started() ? LWS_WRITE_CONTINUATION : LWS_WRITE_TEXT;
+    if (!last) {
+        flags |= LWS_WRITE_NO_FIN;
+    }
+    
+    // lws builds the frame header in the LWS_PRE bytes ahead of the slice.
+    // For continuation fragments those bytes are payload that other
+    // connections sharing this buffer may not have sent yet, so keep a copy
+    // and put them back once lws_write() is done with the buffer.
+    unsigned char *start = frame.payload() + frame.sent;
+    unsigned char saved[LWS_PRE];
+    bool restore = frame.started();
+    if (restore) {
+        memcpy(saved, start - LWS_PRE, LWS_PRE);
+    }
+    
+    int written = lws_write(wsi, start, chunk, (enum lws_write_protocol)flags);
+    
+    if (restore) {
+        memcpy(start - LWS_PRE, saved, LWS_PRE);
+    }
+    if (written < 0) {
+        return -1;
+    }
+    
+    frame.sent += chunk;
+    return last ? 1 : 0;
+}
+
+// Per-request state of the http protocol. lws zeroes it, so it must stay
+// plain data.
+struct http_session {
+    // /metrics response body still being written, or nullptr.
+    std::string *body;
+    size_t sent;
+};
+
+static const size_t HTTP_CHUNK_SIZE = 4096;
+
+// Renders the metrics and sends the headers; the body goes out from
+// LWS_CALLBACK_HTTP_WRITEABLE.
+static int serveMetrics(struct lws *wsi, http_session *session) {
+    session->body = new std::string(g_tournament ? g_tournament->renderMetrics() : "");
+    session->sent = 0;
+    
+    unsigned char headers[LWS_PRE + 512];
+    unsigned char *start = headers + LWS_PRE;
+    unsigned char *p = start;
+    unsigned char *end = headers + sizeof(headers) - 1;
+    
+    if (lws_add_http_common_headers(wsi, HTTP_STATUS_OK, "text/plain; version=0.0.4",
+                                    session->body->size(), &p, end) ||
+        lws_finalize_write_http_header(wsi, start, &p, end)) {
+        return 1;
+    }
+    
+    lws_callback_on_writable(wsi);
+    return 0;
+}
+
+// Returns 1 once the whole body has been written, 0 if more remains and
+// -1 on error.
+static int writeMetricsChunk(struct lws *wsi, http_session *session) {
+    const std::string &body = *session->body;
+    size_t chunk = std::min(body.size() - session->sent, HTTP_CHUNK_SIZE);
+    bool last = session->sent + chunk == body.size();
+    
+    unsigned char buffer[LWS_PRE + HTTP_CHUNK_SIZE];
+    memcpy(buffer + LWS_PRE, body.data() + session->sent, chunk);
+    
+    if (lws_write(wsi, buffer + LWS_PRE, chunk,
+                  last ? LWS_WRITE_HTTP_FINAL : LWS_WRITE_HTTP) < (int)chunk) {
+        return -1;
+    }
+    
+    session->sent += chunk;
+    return last ? 1 : 0;
+}
+
 static int callback_http(struct lws *wsi, enum lws_callback_reasons reason,
                         void *user, void *in, size_t len) {
+    http_session *session = (http_session *)user;
+    
     switch (reason) {
         case LWS_CALLBACK_HTTP: {
             char *requested_uri = (char *)in;
@@ -18,6 +113,10 @@ static int callback_http(struct lws *wsi, enum lws_callback_reasons reason,
             std::string uri(requested_uri);
             std::string filepath;
             
+            if (uri == "/metrics") {
+                return serveMetrics(wsi, session);
+            }
+            
             if (uri == "/" || uri == "/admin") {
                 filepath = "static/admin.html";
             } else if (uri == "/index") {
@@ -36,6 +135,35 @@ static int callback_http(struct lws *wsi, enum lws_callback_reasons reason,
         case LWS_CALLBACK_HTTP_FILE_COMPLETION:
             return -1;
             
+        case LWS_CALLBACK_HTTP_WRITEABLE: {
+            if (!session || !session->body) {
+                break;
+            }
+            
+            int status = writeMetricsChunk(wsi, session);
+            if (status < 0) {
+                return -1;
+            }
+            if (status == 0) {
+                lws_callback_on_writable(wsi);
+                break;
+            }
+            
+            delete session->body;
+            session->body = nullptr;
+            if (lws_http_transaction_completed(wsi)) {
+                return -1;
+            }
+            break;
+        }
+        
+        case LWS_CALLBACK_CLOSED_HTTP:
+            if (session) {
+                delete session->body;
+                session->body = nullptr;
+            }
+            break;
+            
         default:
             break;
     }
@@ -48,51 +176,51 @@ static int callback_websocket(struct lws *wsi, enum lws_callback_reasons reason,
     
     switch (reason) {
         case LWS_CALLBACK_ESTABLISHED:
-            std::cout << "WebSocket connection established" << std::endl;
+            MGE_LOG_DEBUG("WebSocket connection established");
             if (g_tournament) {
                 g_tournament->addConnection(wsi);
             }
             break;
             
         case LWS_CALLBACK_CLOSED:
-            std::cout << "WebSocket connection closed" << std::endl;
+            MGE_LOG_DEBUG("WebSocket connection closed");
             if (g_tournament) {
                 g_tournament->removeConnection(wsi);
             }
             break;
             
         case LWS_CALLBACK_RECEIVE:
-            if (g_tournament && in && len > 0) {
-                std::string message((char*)in, len);
-                g_tournament->handleMessage(wsi, message);
+            if (g_tournament) {
+                g_tournament->receiveFragment(wsi, (const char*)in, in ? len : 0,
+                                              lws_is_final_fragment(wsi),
+                                              lws_remaining_packet_payload(wsi));
             }
             break;
             
         case LWS_CALLBACK_SERVER_WRITEABLE:
-            if (g_tournament && g_tournament->hasQueuedMessages(wsi)) {
-                std::string msg = g_tournament->popMessage(wsi);
+            if (g_tournament) {
+                if (g_tournament->shouldClose(wsi)) {
+                    lws_close_reason(wsi, LWS_CLOSE_STATUS_POLICY_VIOLATION, NULL, 0);
+                    return -1;
+                }
+                
+                mge::OutboundFrame *frame = g_tournament->frontMessage(wsi);
+                if (!frame) {
+                    break;
+                }
+                
+                int result = writeFragment(wsi, *frame);
+                if (result < 0) {
+                    MGE_LOG_ERROR("Error writing to websocket");
+                    return -1;
+                }
+                
+                if (result > 0) {
+                    g_tournament->popMessage(wsi);
+                }
                 
-                if (!msg.empty()) {
-                    unsigned char buf[LWS_PRE + 4096];
-                    size_t msgLen = msg.size();
-                    
-                    if (msgLen > 4096) {
-                        std::cerr << "Message too large: " << msgLen << std::endl;
-                        break;
-                    }
-                    
-                    memcpy(&buf[LWS_PRE], msg.c_str(), msgLen);
-                    
-                    int written = lws_write(wsi, &buf[LWS_PRE], msgLen, LWS_WRITE_TEXT);
-                    
-                    if (written < 0) {
-                        std::cerr << "Error writing to websocket" << std::endl;
-                        return -1;
-                    }
-                    
-                    if (g_tournament->hasQueuedMessages(wsi)) {
-                        lws_callback_on_writable(wsi);
-                    }
+                if (g_tournament->hasQueuedMessages(wsi)) {
+                    lws_callback_on_writable(wsi);
                 }
             }
             break;
@@ -104,66 +232,61 @@ static int callback_websocket(struct lws *wsi, enum lws_callback_reasons reason,
     return 0;
 }
 
+// user is the MGEServer the connection was opened for; see
+// connectToMGEPlugin.
 static int callback_mge_client(struct lws *wsi, enum lws_callback_reasons reason,
                                void *user, void *in, size_t len) {
+    mge::MGEServer *server = (mge::MGEServer *)user;
+    if (!server || !g_tournament) {
+        return 0;
+    }
     
     switch (reason) {
         case LWS_CALLBACK_CLIENT_ESTABLISHED:
-            std::cout << "MGE Plugin client connection established" << std::endl;
-            if (g_tournament) {
-                g_tournament->setMGEClientWsi(wsi);
-                g_tournament->onMGEConnected();
-            }
+            MGE_LOG_INFO("MGE plugin client connection established", {{"server", server->endpoint.name}});
+            g_tournament->onMGEConnected(*server, wsi);
             break;
             
         case LWS_CALLBACK_CLIENT_CLOSED:
-            std::cout << "MGE Plugin client connection closed" << std::endl;
-            if (g_tournament) {
-                g_tournament->onMGEDisconnected();
-            }
+            MGE_LOG_INFO("MGE plugin client connection closed", {{"server", server->endpoint.name}});
+            g_tournament->onMGEDisconnected(*server);
             break;
             
         case LWS_CALLBACK_CLIENT_RECEIVE:
-            if (g_tournament && in && len > 0) {
-                std::string message((char*)in, len);
-                g_tournament->handleMGEPluginMessage(message);
-            }
+            g_tournament->receiveMGEFragment(*server, (const char*)in, in ? len : 0,
+                                             lws_is_final_fragment(wsi),
+                                             lws_remaining_packet_payload(wsi));
             break;
             
-        case LWS_CALLBACK_CLIENT_WRITEABLE:
-            if (g_tournament && g_tournament->hasMGEQueuedMessages()) {
-                std::string msg = g_tournament->popMGEMessage();
-                
-                if (!msg.empty()) {
-                    unsigned char buf[LWS_PRE + 4096];
-                    size_t msgLen = msg.size();
-                    
-                    if (msgLen > 4096) {
-                        std::cerr << "MGE message too large: " << msgLen << std::endl;
-                        break;
-                    }
-                    
-                    memcpy(&buf[LWS_PRE], msg.c_str(), msgLen);
-                    
-                    int written = lws_write(wsi, &buf[LWS_PRE], msgLen, LWS_WRITE_TEXT);
-                    
-                    if (written < 0) {
-                        std::cerr << "Error writing to MGE plugin websocket" << std::endl;
-                        return -1;
-                    }
-                    
-                    if (g_tournament->hasMGEQueuedMessages()) {
-                        lws_callback_on_writable(wsi);
-                    }
-                }
+        case LWS_CALLBACK_CLIENT_WRITEABLE: {
+            if (g_tournament->shouldCloseMGE(*server)) {
+                return -1;
+            }
+            
+            mge::OutboundFrame *frame = g_tournament->frontMGEMessage(*server);
+            if (!frame) {
+                break;
+            }
+            
+            int result = writeFragment(wsi, *frame);
+            if (result < 0) {
+                MGE_LOG_ERROR("Error writing to MGE plugin websocket", {{"server", server->endpoint.name}});
+                return -1;
+            }
+            
+            if (result > 0) {
+                g_tournament->popMGEMessage(*server);
+            }
+            
+            if (g_tournament->hasMGEQueuedMessages(*server)) {
+                lws_callback_on_writable(wsi);
             }
             break;
+        }
             
         case LWS_CALLBACK_CLIENT_CONNECTION_ERROR:
-            std::cerr << "MGE Plugin connection error" << std::endl;
-            if (g_tournament) {
-                g_tournament->onMGEDisconnected();
-            }
+            MGE_LOG_ERROR("MGE plugin connection error", {{"server", server->endpoint.name}});
+            g_tournament->onMGEDisconnected(*server);
             break;
             
         default:
@@ -177,7 +300,7 @@ static struct lws_protocols protocols[] = {
     {
         "http",
         callback_http,
-        0,
+        sizeof(http_session),
         0,
     },
     {
@@ -198,7 +321,7 @@ static struct lws_protocols protocols[] = {
 std::string readFile(const std::string& filename) {
     std::ifstream file(filename);
     if (!file.is_open()) {
-        std::cerr << "Could not open file: " << filename << std::endl;
+        MGE_LOG_ERROR("Could not open file", {{"file", filename}});
         return "";
     }
     
@@ -211,23 +334,131 @@ std::string readFile(const std::string& filename) {
     return content;
 }
 
-void connectToMGEPlugin(lws_context *context) {
+// Optional settings; a missing or unreadable config.json means defaults.
+json readConfig(const std::string& filename) {
+    std::ifstream file(filename);
+    if (!file.is_open()) {
+        return json::object();
+    }
+    
+    try {
+        return json::parse(file);
+    } catch (const std::exception& e) {
+        MGE_LOG_WARN("Ignoring invalid config", {{"file", filename}, {"error", e.what()}});
+        return json::object();
+    }
+}
+
+// "log_level" (debug, info, warn, error, off), "log_format" (text or json)
+// and "log_rate_limit" (lines per second per call site, 0 for no limit).
+// Levels compiled out with MGE_LOG_LEVEL stay out whatever log_level says.
+void configureLogging(const json& config) {
+    if (config.contains("log_level")) {
+        mge::log::Level level;
+        if (config["log_level"].is_string() && mge::log::parseLevel(config["log_level"].get<std::string>(), level)) {
+            mge::log::setLevel(level);
+        } else {
+            MGE_LOG_WARN("Ignoring unknown log_level", {{"log_level", config["log_level"]}});
+        }
+    }
+    
+    if (config.contains("log_format")) {
+        mge::log::Format format;
+        if (config["log_format"].is_string() && mge::log::parseFormat(config["log_format"].get<std::string>(), format)) {
+            mge::log::setFormat(format);
+        } else {
+            MGE_LOG_WARN("Ignoring unknown log_format", {{"log_format", config["log_format"]}});
+        }
+    }
+    
+    if (config.contains("log_rate_limit")) {
+        if (config["log_rate_limit"].is_number_unsigned()) {
+            mge::log::setRateLimit(config["log_rate_limit"].get<uint32_t>());
+        } else {
+            MGE_LOG_WARN("Ignoring invalid log_rate_limit", {{"log_rate_limit", config["log_rate_limit"]}});
+        }
+    }
+}
+
+// An integer setting of at least minimum. A missing key gives the default;
+// a wrong type or a value below the minimum is ignored with a warning.
+long long readInteger(const json& config, const char* key, long long fallback, long long minimum) {
+    if (!config.contains(key)) {
+        return fallback;
+    }
+    const json& value = config[key];
+    if (value.is_number_integer() && value.get<long long>() >= minimum) {
+        return value.get<long long>();
+    }
+    MGE_LOG_WARN("Ignoring invalid setting", {{"setting", key}, {"value", value}, {"minimum", minimum}, {"default", fallback}});
+    return fallback;
+}
+
+// A string setting; a missing key gives the default, another type is
+// ignored with a warning.
+std::string readString(const json& config, const char* key, const std::string& fallback) {
+    if (!config.contains(key)) {
+        return fallback;
+    }
+    const json& value = config[key];
+    if (value.is_string()) {
+        return value.get<std::string>();
+    }
+    MGE_LOG_WARN("Ignoring invalid setting", {{"setting", key}, {"value", value}, {"default", fallback}});
+    return fallback;
+}
+
+// "mge_servers": [{"name", "host", "port", "path", "connect"}, ...]; a
+// missing list means one plugin at localhost:9001.
+std::vector<mge::MGEEndpoint> readMGEEndpoints(const json& config) {
+    std::vector<mge::MGEEndpoint> endpoints;
+    if (!config.contains("mge_servers")) {
+        return endpoints;
+    }
+    
+    try {
+        for (const auto& entry : config["mge_servers"]) {
+            mge::MGEEndpoint endpoint;
+            endpoint.name = entry.value("name", endpoint.name);
+            endpoint.host = entry.value("host", endpoint.host);
+            endpoint.port = entry.value("port", endpoint.port);
+            endpoint.path = entry.value("path", endpoint.path);
+            endpoint.connect = entry.value("connect", endpoint.connect);
+            endpoints.push_back(endpoint);
+        }
+    } catch (const std::exception& e) {
+        MGE_LOG_ERROR("Invalid mge_servers, using the default MGE plugin", {{"error", e.what()}});
+        endpoints.clear();
+    }
+    return endpoints;
+}
+
+// The mge-client protocol has no per-session data of its own, so lws hands
+// userdata to every callback of the connection as user. False if the
+// attempt failed before it got going; later failures arrive as
+// LWS_CALLBACK_CLIENT_CONNECTION_ERROR.
+bool connectToMGEPlugin(lws_context *context, mge::MGEServer &server) {
     struct lws_client_connect_info ccinfo;
     memset(&ccinfo, 0, sizeof(ccinfo));
     
     ccinfo.context = context;
-    ccinfo.address = "localhost";
-    ccinfo.port = 9001;
-    ccinfo.path = "/";
+    ccinfo.address = server.endpoint.host.c_str();
+    ccinfo.port = server.endpoint.port;
+    ccinfo.path = server.endpoint.path.c_str();
     ccinfo.host = ccinfo.address;
     ccinfo.origin = ccinfo.address;
     ccinfo.protocol = "mge-client";
     ccinfo.ietf_version_or_minus_one = -1;
+    ccinfo.userdata = &server;
     
+    MGE_LOG_INFO("Connecting to MGE plugin", {{"server", server.endpoint.name},
+                                              {"address", server.endpoint.host + ":" + std::to_string(server.endpoint.port)}});
     struct lws *wsi = lws_client_connect_via_info(&ccinfo);
     if (!wsi) {
-        std::cerr << "Failed to connect to MGE plugin" << std::endl;
+        MGE_LOG_ERROR("Failed to connect to MGE plugin", {{"server", server.endpoint.name}});
+        return false;
     }
+    return true;
 }
 
 int main(int argc, char** argv) {
@@ -237,16 +468,23 @@ int main(int argc, char** argv) {
     }
     
     std::string tournamentUrl = argv[1];
-    std::cout << "Tournament URL: " << tournamentUrl << std::endl;
+    
+    json config = readConfig("config.json");
+    configureLogging(config);
+    MGE_LOG_INFO("Starting", {{"tournament", tournamentUrl}});
     
     std::string apiKey = readFile("api_key.txt");
     if (apiKey.empty()) {
-        std::cerr << "Error: Could not read api_key.txt" << std::endl;
+        MGE_LOG_ERROR("Could not read api_key.txt");
+        mge::log::flush();
         return 1;
     }
     
     std::string challongeUser = "ZeroSTF";
     
+    // Must run before the Challonge worker thread makes its first request.
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+    
     struct lws_context_creation_info info;
     memset(&info, 0, sizeof(info));
     
@@ -256,25 +494,93 @@ int main(int argc, char** argv) {
     
     struct lws_context *context = lws_create_context(&info);
     if (!context) {
-        std::cerr << "Failed to create libwebsockets context" << std::endl;
+        MGE_LOG_ERROR("Failed to create libwebsockets context");
+        mge::log::flush();
         return 1;
     }
     
-    g_tournament = new mge::TournamentManager(context, challongeUser, apiKey, tournamentUrl);
+    std::string challongeBaseUrl = readString(config, "challonge_base_url", mge::ChallongeAPI::DEFAULT_BASE_URL);
     
-    std::cout << "Server started on port 8080" << std::endl;
-    std::cout << "WebSocket endpoint: ws://localhost:8080" << std::endl;
+    g_tournament = new mge::TournamentManager(context, challongeUser, apiKey, tournamentUrl, challongeBaseUrl);
+    g_tournament->setMGEEndpoints(readMGEEndpoints(config));
+    g_tournament->setMaxMessageSize(static_cast<size_t>(
+        readInteger(config, "max_message_size", mge::TournamentManager::DEFAULT_MAX_MESSAGE_SIZE, 1)));
+    if (config.contains("arenas")) {
+        g_tournament->setArenaConfig(config["arenas"]);
+    }
+    if (config.contains("challonge_retry_initial_ms") || config.contains("challonge_retry_max_ms")) {
+        mge::ChallongeOutbox::Backoff backoff;
+        backoff.initialDelay = std::chrono::milliseconds(readInteger(config, "challonge_retry_initial_ms", backoff.initialDelay.count(), 1));
+        backoff.maxDelay = std::chrono::milliseconds(readInteger(config, "challonge_retry_max_ms", backoff.maxDelay.count(), 1));
+        g_tournament->setRetryBackoff(backoff);
+    }
+    if (config.contains("mge_reconnect_initial_ms") || config.contains("mge_reconnect_max_ms")) {
+        mge::MGEReconnectBackoff backoff;
+        backoff.initialDelay = std::chrono::milliseconds(readInteger(config, "mge_reconnect_initial_ms", backoff.initialDelay.count(), 1));
+        backoff.maxDelay = std::chrono::milliseconds(readInteger(config, "mge_reconnect_max_ms", backoff.maxDelay.count(), 1));
+        g_tournament->setMGEReconnectBackoff(backoff);
+    }
+    if (config.contains("mge_offline_ttl_ms")) {
+        const json& ttls = config["mge_offline_ttl_ms"];
+        if (ttls.is_object()) {
+            for (const auto& [command, ttl] : ttls.items()) {
+                // -1 never passes the minimum, so an invalid entry leaves
+                // the command's default alone.
+                long long ms = readInteger(ttls, command.c_str(), -1, 0);
+                if (ms >= 0) {
+                    g_tournament->setMGECommandTtl(command, std::chrono::milliseconds(ms));
+                }
+            }
+        } else {
+            MGE_LOG_WARN("Ignoring invalid mge_offline_ttl_ms", {{"mge_offline_ttl_ms", ttls}});
+        }
+    }
+    if (config.contains("challonge_rate_limit")) {
+        const json &limit = config["challonge_rate_limit"];
+        if (limit.is_object()) {
+            mge::RateLimiter::Options rateLimit;
+            rateLimit.perSecond = static_cast<double>(readInteger(limit, "per_second", static_cast<long long>(rateLimit.perSecond), 1));
+            rateLimit.burst = static_cast<double>(readInteger(limit, "burst", static_cast<long long>(rateLimit.perSecond), 1));
+            g_tournament->setChallongeRateLimit(rateLimit);
+        } else {
+            MGE_LOG_WARN("Ignoring invalid challonge_rate_limit", {{"challonge_rate_limit", limit}});
+        }
+    }
+    
+    // Journaled state is replayed against the arena table, so this comes
+    // after setArenaConfig.
+    std::string stateDir = readString(config, "state_dir", "");
+    if (!stateDir.empty()) {
+        mge::StateJournal::Options journalOptions;
+        journalOptions.dir = stateDir;
+        journalOptions.syncInterval = std::chrono::milliseconds(readInteger(config, "state_sync_ms", journalOptions.syncInterval.count(), 1));
+        journalOptions.snapshotEvery = static_cast<size_t>(readInteger(config, "state_snapshot_every", journalOptions.snapshotEvery, 1));
+        if (!g_tournament->openJournal(journalOptions)) {
+            MGE_LOG_WARN("Running without a state journal; a restart will lose tournament state", {{"dir", stateDir}});
+        }
+    }
+    
+    MGE_LOG_INFO("Server started", {{"endpoint", "ws://localhost:8080"}});
+    g_tournament->setMGEConnector([context](mge::MGEServer &server) {
+        return connectToMGEPlugin(context, server);
+    });
+    for (size_t i = 0; i < g_tournament->mgeServerCount(); ++i) {
+        g_tournament->connectMGE(g_tournament->mgeServer(i));
+    }
     
-    std::cout << "Attempting to connect to MGE plugin on localhost:9001..." << std::endl;
-    connectToMGEPlugin(context);
+    mge::metrics::Histogram &loopSeconds = mge::metrics::registry().eventLoopIterationSeconds.with({});
     
     int n = 0;
     while (n >= 0) {
+        mge::metrics::ScopedTimer timer(loopSeconds);
         n = lws_service(context, 50);
+        g_tournament->processChallongeResults();
     }
     
     delete g_tournament;
     lws_context_destroy(context);
+    curl_global_cleanup();
+    mge::log::flush();
     
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory_resource>
+#include <optional>
+#include <vector>
+
+namespace mge
+{
+
+  // Bump allocator for data that only lives while one message is handled;
+  // reset() frees all of it at once. Allocations come from a block that is
+  // reused across messages. When a message needs more than the block holds,
+  // the rest comes from the heap and the block grows at the next reset(),
+  // up to MAX_BLOCK_BYTES, so steady traffic stops touching the heap.
+  class MessageArena
+  {
+  public:
+    static constexpr size_t MAX_BLOCK_BYTES = 4 * 1024 * 1024;
+
+    explicit MessageArena(size_t initialBytes) : block(initialBytes)
+    {
+      bump.emplace(block.data(), block.size(), &overflow);
+    }
+
+    MessageArena(const MessageArena &) = delete;
+    MessageArena &operator=(const MessageArena &) = delete;
+
+    std::pmr::memory_resource *resource() { return &*bump; }
+
+    // Invalidates everything allocated since the last reset().
+    void reset()
+    {
+      bump.reset();
+      if (overflow.bytes > 0 && block.size() < MAX_BLOCK_BYTES)
+      {
+        size_t wanted = block.size() + overflow.bytes;
+        size_t size = block.size();
+        while (size < wanted && size < MAX_BLOCK_BYTES)
+        {
+          size *= 2;
+        }
+        block.assign(std::min(size, MAX_BLOCK_BYTES), std::byte{0});
+      }
+      overflow.bytes = 0;
+      bump.emplace(block.data(), block.size(), &overflow);
+    }
+
+    size_t blockSize() const { return block.size(); }
+
+  private:
+    // Heap fallback that remembers how much it handed out since the last
+    // reset, to size the next block.
+    class Overflow : public std::pmr::memory_resource
+    {
+    public:
+      size_t bytes = 0;
+
+    private:
+      void *do_allocate(size_t size, size_t alignment) override
+      {
+        bytes += size;
+        return std::pmr::new_delete_resource()->allocate(size, alignment);
+      }
+
+      void do_deallocate(void *p, size_t size, size_t alignment) override
+      {
+        std::pmr::new_delete_resource()->deallocate(p, size, alignment);
+      }
+
+      bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+      {
+        return this == &other;
+      }
+    };
+
+    std::vector<std::byte> block;
+    Overflow overflow;
+    // Rebuilt on reset() so it starts over at the front of block.
+    std::optional<std::pmr::monotonic_buffer_resource> bump;
+  };
+
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace mge
+{
+
+  // 64-bit FNV-1a of a message type name. constexpr, so the id of a type
+  // named by a literal is computed at compile time.
+  constexpr uint64_t messageTypeId(std::string_view name)
+  {
+    uint64_t hash = 14695981039346656037ull;
+    for (char c : name)
+    {
+      hash ^= static_cast<unsigned char>(c);
+      hash *= 1099511628211ull;
+    }
+    return hash;
+  }
+
+  // Maps message type names to handlers. A lookup hashes the name once and
+  // probes an open-addressed table that is kept at most half full, so it
+  // costs the same however many types are registered; names are compared
+  // only when the ids match, to rule out hash collisions. Handlers are
+  // registered up front and the table is read-only afterwards.
+  template <typename... Args>
+  class MessageDispatcher
+  {
+  public:
+    using Handler = std::function<void(Args...)>;
+
+    // False, and the table is unchanged, if type already has a handler.
+    bool on(std::string_view type, Handler handler)
+    {
+      if (find(type))
+      {
+        return false;
+      }
+      if ((count + 1) * 2 > slots.size())
+      {
+        rehash(slots.empty() ? 16 : slots.size() * 2);
+      }
+      insert(Slot{messageTypeId(type), std::string(type), std::move(handler)});
+      ++count;
+      return true;
+    }
+
+    const Handler *find(std::string_view type) const
+    {
+      if (slots.empty())
+      {
+        return nullptr;
+      }
+
+      uint64_t id = messageTypeId(type);
+      for (size_t i = id & mask;; i = (i + 1) & mask)
+      {
+        const Slot &slot = slots[i];
+        if (!slot.handler)
+        {
+          return nullptr;
+        }
+        if (slot.id == id && slot.name == type)
+        {
+          return &slot.handler;
+        }
+      }
+    }
+
+    // Runs the handler for type; false if there is none.
+    bool dispatch(std::string_view type, Args... args) const
+    {
+      const Handler *handler = find(type);
+      if (!handler)
+      {
+        return false;
+      }
+      (*handler)(std::forward<Args>(args)...);
+      return true;
+    }
+
+    size_t size() const { return count; }
+
+  private:
+    struct Slot
+    {
+      uint64_t id = 0;
+      std::string name;
+      Handler handler; // empty marks a free slot
+    };
+
+    void insert(Slot slot)
+    {
+      size_t i = slot.id & mask;
+      while (slots[i].handler)
+      {
+        i = (i + 1) & mask;
+      }
+      slots[i] = std::move(slot);
+    }
+
+    void rehash(size_t capacity)
+    {
+      std::vector<Slot> old = std::move(slots);
+      slots.clear();
+      slots.resize(capacity);
+      mask = capacity - 1;
+      for (Slot &slot : old)
+      {
+        if (slot.handler)
+        {
+          insert(std::move(slot));
+        }
+      }
+    }
+
+    std::vector<Slot> slots; // power-of-two size
+    size_t mask = 0;
+    size_t count = 0;
+  };
+
+}
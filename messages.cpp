@@ -0,0 +1,566 @@
+#include "messages.hpp"
+#include <algorithm>
+
+namespace mge
+{
+
+  // Field readers. Each leaves out untouched if key is absent or null and
+  // fails if it holds a value of another type.
+
+  static bool isObject(const json &j, std::string &error)
+  {
+    if (!j.is_object())
+    {
+      error = "expected an object, got " + std::string(j.type_name());
+      return false;
+    }
+    return true;
+  }
+
+  static const json *field(const json &j, const char *key)
+  {
+    auto it = j.find(key);
+    return it == j.end() || it->is_null() ? nullptr : &*it;
+  }
+
+  static bool wrongType(const char *key, const char *expected, const json &value, std::string &error)
+  {
+    error = std::string("\"") + key + "\" must be " + expected + ", got " + value.type_name();
+    return false;
+  }
+
+  static bool readString(const json &j, const char *key, std::string &out, std::string &error)
+  {
+    const json *value = field(j, key);
+    if (!value)
+      return true;
+    if (!value->is_string())
+      return wrongType(key, "a string", *value, error);
+    out = value->get<std::string>();
+    return true;
+  }
+
+  static bool readInt(const json &j, const char *key, int &out, std::string &error)
+  {
+    const json *value = field(j, key);
+    if (!value)
+      return true;
+    if (!value->is_number())
+      return wrongType(key, "a number", *value, error);
+    out = value->get<int>();
+    return true;
+  }
+
+  // Checks that key, if present, is an array whose entries are objects.
+  static const json *readObjectArray(const json &j, const char *key, std::string &error)
+  {
+    const json *value = field(j, key);
+    if (!value)
+      return nullptr;
+    if (!value->is_array())
+    {
+      wrongType(key, "an array", *value, error);
+      return nullptr;
+    }
+    for (const auto &entry : *value)
+    {
+      if (!entry.is_object())
+      {
+        error = std::string("\"") + key + "\" entries must be objects, got " + entry.type_name();
+        return nullptr;
+      }
+    }
+    return value;
+  }
+
+  bool ServerHelloPayload::parse(const json &payload, std::string &error)
+  {
+    return isObject(payload, error) && readString(payload, "apiKey", apiKey, error);
+  }
+
+  bool TournamentStartPayload::parse(const json &payload, std::string &error)
+  {
+    return isObject(payload, error);
+  }
+
+  bool TournamentStopPayload::parse(const json &payload, std::string &error)
+  {
+    return isObject(payload, error);
+  }
+
+  bool UsersInServerPayload::parse(const json &payload, std::string &error)
+  {
+    if (!isObject(payload, error))
+      return false;
+
+    const json *list = readObjectArray(payload, "players", error);
+    if (!list)
+      return error.empty();
+
+    players.emplace();
+    players->reserve(list->size());
+    for (const auto &p : *list)
+    {
+      User user;
+      if (!readString(p, "steamId", user.steamId, error) ||
+          !readString(p, "name", user.name, error) ||
+          !readInt(p, "elo", user.elo, error))
+        return false;
+      players->push_back(std::move(user));
+    }
+    return true;
+  }
+
+  bool MatchResultsPayload::parse(const json &payload, std::string &error)
+  {
+    return isObject(payload, error) &&
+           readString(payload, "winner", winner, error) &&
+           readString(payload, "loser", loser, error) &&
+           readInt(payload, "arena", arena, error) &&
+           readString(payload, "server", server, error);
+  }
+
+  bool MatchBeganPayload::parse(const json &payload, std::string &error)
+  {
+    if (!isObject(payload, error))
+      return false;
+
+    const char *key1 = payload.contains("p1Id") ? "p1Id" : "p1";
+    const char *key2 = payload.contains("p2Id") ? "p2Id" : "p2";
+    return readString(payload, key1, player1, error) &&
+           readString(payload, key2, player2, error);
+  }
+
+  bool MatchDetailsPayload::parse(const json &payload, std::string &error)
+  {
+    if (!isObject(payload, error) ||
+        !readInt(payload, "arenaId", arenaId, error) ||
+        !readString(payload, "server", server, error) ||
+        !readString(payload, "p1Id", p1Id, error) ||
+        !readString(payload, "p2Id", p2Id, error))
+      return false;
+
+    body = payload;
+    return true;
+  }
+
+  bool SetMatchScorePayload::parse(const json &payload, std::string &error)
+  {
+    if (!isObject(payload, error))
+      return false;
+
+    auto it = payload.find("arenaId");
+    if (it != payload.end())
+    {
+      arenaId = *it;
+    }
+    body = payload;
+    return true;
+  }
+
+  bool MatchCancelPayload::parse(const json &payload, std::string &error)
+  {
+    return isObject(payload, error) &&
+           readInt(payload, "arena", arena, error) &&
+           readString(payload, "server", server, error);
+  }
+
+  bool GetOutboxPayload::parse(const json &payload, std::string &error)
+  {
+    return isObject(payload, error);
+  }
+
+  // SAX callbacks for MGEMessageDecoder. Tracks where in the message the
+  // parser is and writes each known field into the views that declare it
+  // as its value is read. The type may come after the fields, so they are
+  // routed by name rather than by type; only "message" and "arena_id"
+  // belong to two views. Containers under keys no view knows are skipped
+  // whole.
+  class MGEMessageDecoder::Handler
+  {
+  public:
+    Handler(MGEMessageDecoder &decoder, std::string &error)
+        : decoder(decoder), arena(decoder.arena.resource()), error(error)
+    {
+    }
+
+    bool null()
+    {
+      // A null field reads as absent; a null players / arenas entry is
+      // still an error.
+      if (!skipping && (depth == 1 || depth == 3))
+      {
+        target = Target{};
+        return true;
+      }
+      return consumeScalar("null", [](Target &)
+                           { return true; });
+    }
+
+    bool boolean(bool value)
+    {
+      return consumeScalar("boolean", [&](Target &target)
+                           {
+                             if (target.expect != Expect::Bool)
+                               return wrongType(target, "boolean");
+                             *static_cast<bool *>(target.out) = value;
+                             return true; });
+    }
+
+    bool number_integer(json::number_integer_t value) { return number(static_cast<double>(value), true); }
+    bool number_unsigned(json::number_unsigned_t value) { return number(static_cast<double>(value), true); }
+    bool number_float(json::number_float_t value, const json::string_t &) { return number(value, false); }
+
+    bool string(json::string_t &value)
+    {
+      return consumeScalar("string", [&](Target &target)
+                           {
+                             if (target.expect == Expect::OptionalInt)
+                               return true;
+                             if (target.expect != Expect::String)
+                               return wrongType(target, "string");
+                             std::string_view stored = store(value);
+                             *static_cast<std::string_view *>(target.out) = stored;
+                             if (target.also)
+                               *static_cast<std::string_view *>(target.also) = stored;
+                             return true; });
+    }
+
+    bool binary(json::binary_t &)
+    {
+      // Only produced by binary formats, never by JSON text.
+      return true;
+    }
+
+    bool start_object(size_t)
+    {
+      return startContainer(false);
+    }
+
+    bool end_object()
+    {
+      return endContainer();
+    }
+
+    bool start_array(size_t)
+    {
+      return startContainer(true);
+    }
+
+    bool end_array()
+    {
+      return endContainer();
+    }
+
+    bool key(json::string_t &name)
+    {
+      if (skipping)
+        return true;
+
+      if (depth == 1)
+        target = messageField(name);
+      else if (depth == 3 && list == List::Players)
+        target = playerField(name, view<MGEPlayersResponse>().players.back());
+      else if (depth == 3 && list == List::Arenas)
+        target = arenaField(name, view<MGEArenasResponse>().arenas.back());
+      else
+        target = Target{};
+      return true;
+    }
+
+    bool parse_error(size_t, const std::string &, const nlohmann::detail::exception &ex)
+    {
+      error = ex.what();
+      return false;
+    }
+
+  private:
+    enum class Expect
+    {
+      Ignore,
+      String,
+      Int,
+      Bool,
+      // Read if it is an integer, otherwise left unset without an error.
+      OptionalInt,
+      Players,
+      Arenas
+    };
+
+    enum class List
+    {
+      None,
+      Players,
+      Arenas
+    };
+
+    // Where the value after the current key goes: out, and also if a
+    // second view has the same field.
+    struct Target
+    {
+      Expect expect = Expect::Ignore;
+      const char *key = "";
+      void *out = nullptr;
+      void *also = nullptr;
+    };
+
+    template <typename View>
+    View &view()
+    {
+      return std::get<View>(*decoder.views);
+    }
+
+    Target messageField(const std::string &name)
+    {
+      Envelope &envelope = decoder.envelope;
+      if (name == "type")
+        return {Expect::String, "type", &envelope.type};
+      if (name == "command")
+        return {Expect::String, "command", &envelope.command};
+      if (name == "event")
+        return {Expect::String, "event", &envelope.event};
+      if (name == "message")
+        return {Expect::String, "message", &view<MGEWelcome>().message, &view<MGEStatus>().message};
+      if (name == "players")
+        return {Expect::Players, "players", nullptr};
+      if (name == "arenas")
+        return {Expect::Arenas, "arenas", nullptr};
+
+      MGEMatchEndEvent &matchEnd = view<MGEMatchEndEvent>();
+      MGEPlayerArenaRemovedEvent &removed = view<MGEPlayerArenaRemovedEvent>();
+      if (name == "winner_id")
+        return {Expect::Int, "winner_id", &matchEnd.winnerId};
+      if (name == "loser_id")
+        return {Expect::Int, "loser_id", &matchEnd.loserId};
+      if (name == "winner_name")
+        return {Expect::String, "winner_name", &matchEnd.winnerName};
+      if (name == "loser_name")
+        return {Expect::String, "loser_name", &matchEnd.loserName};
+      if (name == "winner_steam_id")
+        return {Expect::String, "winner_steam_id", &matchEnd.winnerSteamId};
+      if (name == "loser_steam_id")
+        return {Expect::String, "loser_steam_id", &matchEnd.loserSteamId};
+      if (name == "arena_id")
+        return {Expect::Int, "arena_id", &matchEnd.arenaId, &removed.arenaId};
+      if (name == "player_id")
+        return {Expect::Int, "player_id", &removed.playerId};
+      if (name == "steam_id")
+        return {Expect::String, "steam_id", &removed.steamId};
+      return {};
+    }
+
+    static Target playerField(const std::string &name, MGEPlayersResponse::Player &player)
+    {
+      if (name == "id")
+        return {Expect::Int, "id", &player.id};
+      if (name == "name")
+        return {Expect::String, "name", &player.name};
+      if (name == "arena")
+        return {Expect::Int, "arena", &player.arena};
+      if (name == "inArena")
+        return {Expect::Bool, "inArena", &player.inArena};
+      if (name == "elo")
+        return {Expect::Int, "elo", &player.elo};
+      if (name == "steam_id")
+        return {Expect::String, "steam_id", &player.steamId};
+      return {};
+    }
+
+    static Target arenaField(const std::string &name, MGEArenasResponse::Arena &arena)
+    {
+      if (name == "id")
+        return {Expect::Int, "id", &arena.id};
+      if (name == "name")
+        return {Expect::String, "name", &arena.name};
+      if (name == "priority")
+        return {Expect::OptionalInt, "priority", &arena.priority};
+      return {};
+    }
+
+    bool number(double value, bool integral)
+    {
+      return consumeScalar("number", [&](Target &target)
+                           {
+                             if (target.expect == Expect::OptionalInt)
+                             {
+                               if (integral)
+                                 *static_cast<std::optional<int> *>(target.out) = static_cast<int>(value);
+                               return true;
+                             }
+                             if (target.expect != Expect::Int)
+                               return wrongType(target, "number");
+                             *static_cast<int *>(target.out) = static_cast<int>(value);
+                             if (target.also)
+                               *static_cast<int *>(target.also) = static_cast<int>(value);
+                             return true; });
+    }
+
+    // A scalar is either a field value (depth 1 or 3) or an entry of the
+    // players / arenas array (depth 2), which must be an object.
+    template <typename Assign>
+    bool consumeScalar(const char *got, Assign assign)
+    {
+      if (skipping)
+        return true;
+
+      if (depth == 0)
+        return fail("expected an object");
+
+      if (depth == 2 && list != List::None)
+        return fail(std::string("\"") + listName() + "\" entries must be objects");
+
+      if (target.expect == Expect::Ignore)
+        return true;
+
+      if (target.expect == Expect::Players)
+        return wrongType(target, got);
+      if (target.expect == Expect::Arenas)
+        // A non-array "arenas" has always been ignored rather than rejected.
+        return true;
+
+      bool ok = assign(target);
+      target = Target{};
+      return ok;
+    }
+
+    bool startContainer(bool isArray)
+    {
+      if (skipping)
+      {
+        ++skipping;
+        return true;
+      }
+
+      if (depth == 0)
+      {
+        if (isArray)
+          return fail("expected an object");
+        depth = 1;
+        return true;
+      }
+
+      if (depth == 1 && isArray && target.expect == Expect::Players)
+      {
+        view<MGEPlayersResponse>().hasPlayers = true;
+        view<MGEPlayersResponse>().players.clear();
+        list = List::Players;
+        depth = 2;
+        return true;
+      }
+
+      if (depth == 1 && isArray && target.expect == Expect::Arenas)
+      {
+        view<MGEArenasResponse>().hasArenas = true;
+        view<MGEArenasResponse>().arenas.clear();
+        list = List::Arenas;
+        depth = 2;
+        return true;
+      }
+
+      if (depth == 2 && list != List::None)
+      {
+        if (isArray)
+          return fail(std::string("\"") + listName() + "\" entries must be objects");
+        if (list == List::Players)
+          view<MGEPlayersResponse>().players.emplace_back();
+        else
+          view<MGEArenasResponse>().arenas.emplace_back();
+        depth = 3;
+        return true;
+      }
+
+      // Any other nested value: an error for fields that expect a scalar
+      // (or "players", which must be an array), skipped otherwise.
+      if (target.expect != Expect::Ignore && target.expect != Expect::Arenas)
+        return wrongType(target, isArray ? "array" : "object");
+      target = Target{};
+      skipping = 1;
+      return true;
+    }
+
+    bool endContainer()
+    {
+      if (skipping)
+      {
+        --skipping;
+        return true;
+      }
+
+      if (depth == 2)
+        list = List::None;
+      --depth;
+      target = Target{};
+      return true;
+    }
+
+    std::string_view store(const std::string &value)
+    {
+      char *bytes = static_cast<char *>(arena->allocate(value.size(), 1));
+      std::copy(value.begin(), value.end(), bytes);
+      return {bytes, value.size()};
+    }
+
+    const char *listName() const
+    {
+      return list == List::Players ? "players" : "arenas";
+    }
+
+    bool wrongType(const Target &target, const char *got)
+    {
+      static const char *const names[] = {"", "a string", "a number", "a boolean", "a number", "an array", "an array"};
+      return fail(std::string("\"") + target.key + "\" must be " + names[static_cast<int>(target.expect)] + ", got " + got);
+    }
+
+    bool fail(std::string reason)
+    {
+      error = std::move(reason);
+      return false;
+    }
+
+    MGEMessageDecoder &decoder;
+    std::pmr::memory_resource *arena;
+    std::string &error;
+
+    // 1 inside the message object, 2 inside players / arenas, 3 inside
+    // one of their entries.
+    int depth = 0;
+    List list = List::None;
+    Target target;
+    // Nesting level within a container being skipped, 0 if none.
+    int skipping = 0;
+  };
+
+  bool MGEMessageDecoder::decode(std::string_view text, std::string &error)
+  {
+    // The views' vectors hand memory back to the arena, so they go first.
+    views.reset();
+    arena.reset();
+    envelope = Envelope{};
+    std::pmr::memory_resource *resource = arena.resource();
+    views.emplace(MGEWelcome{}, MGEPlayersResponse(resource), MGEArenasResponse(resource), MGEMatchEndEvent{},
+                  MGEPlayerArenaRemovedEvent{}, MGEStatus{});
+
+    Handler handler(*this, error);
+    if (!json::sax_parse(text.begin(), text.end(), &handler))
+    {
+      return false;
+    }
+
+    std::string_view type = envelope.type;
+    if (type == "response" || type == "event")
+    {
+      std::string_view sub = type == "response" ? envelope.command : envelope.event;
+      size_t size = type.size() + 1 + sub.size();
+      char *key = static_cast<char *>(resource->allocate(size, 1));
+      std::copy(type.begin(), type.end(), key);
+      key[type.size()] = ':';
+      std::copy(sub.begin(), sub.end(), key + type.size() + 1);
+      envelope.key = std::string_view(key, size);
+    }
+    else
+    {
+      envelope.key = type;
+    }
+    return true;
+  }
+}
@@ -0,0 +1,247 @@
+#pragma once
+
+#include <memory_resource>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <vector>
+#include <nlohmann/json.hpp>
+#include "message_arena.hpp"
+
+using json = nlohmann::json;
+
+namespace mge
+{
+
+  // Typed payloads of the messages TournamentManager handles. TYPE is the
+  // key a payload is dispatched under. parse() checks the shape of the
+  // message before any handler runs: a field that is present but has the
+  // wrong type fails with a description in error, while a missing field
+  // keeps its default, as the protocol has always allowed.
+
+  // Admin / game server protocol. parse() gets the message's "payload".
+
+  struct ServerHelloPayload
+  {
+    static constexpr std::string_view TYPE = "ServerHello";
+    std::string apiKey;
+    bool parse(const json &payload, std::string &error);
+  };
+
+  struct TournamentStartPayload
+  {
+    static constexpr std::string_view TYPE = "TournamentStart";
+    bool parse(const json &payload, std::string &error);
+  };
+
+  struct TournamentStopPayload
+  {
+    static constexpr std::string_view TYPE = "TournamentStop";
+    bool parse(const json &payload, std::string &error);
+  };
+
+  struct UsersInServerPayload
+  {
+    static constexpr std::string_view TYPE = "UsersInServer";
+
+    struct User
+    {
+      std::string steamId;
+      std::string name;
+      int elo = 1000;
+    };
+
+    // Unset if the message had no "players" array.
+    std::optional<std::vector<User>> players;
+    bool parse(const json &payload, std::string &error);
+  };
+
+  struct MatchResultsPayload
+  {
+    static constexpr std::string_view TYPE = "MatchResults";
+    std::string winner;
+    std::string loser;
+    int arena = 0;
+    // MGE server of the arena; empty means the first one.
+    std::string server;
+    bool parse(const json &payload, std::string &error);
+  };
+
+  struct MatchBeganPayload
+  {
+    static constexpr std::string_view TYPE = "MatchBegan";
+    // p1Id / p2Id, or the older p1 / p2.
+    std::string player1;
+    std::string player2;
+    bool parse(const json &payload, std::string &error);
+  };
+
+  struct MatchDetailsPayload
+  {
+    static constexpr std::string_view TYPE = "MatchDetails";
+    int arenaId = 0;
+    // MGE server of the arena; empty means the first one.
+    std::string server;
+    std::string p1Id;
+    std::string p2Id;
+    // Relayed to the game servers unchanged.
+    json body;
+    bool parse(const json &payload, std::string &error);
+  };
+
+  struct SetMatchScorePayload
+  {
+    static constexpr std::string_view TYPE = "SetMatchScore";
+    // Null if absent; any JSON value otherwise, since it is only used to
+    // coalesce updates for the same arena.
+    json arenaId;
+    // Relayed to the game servers unchanged.
+    json body;
+    bool parse(const json &payload, std::string &error);
+  };
+
+  struct MatchCancelPayload
+  {
+    static constexpr std::string_view TYPE = "MatchCancel";
+    int arena = 0;
+    // MGE server of the arena; empty means the first one.
+    std::string server;
+    bool parse(const json &payload, std::string &error);
+  };
+
+  struct GetOutboxPayload
+  {
+    static constexpr std::string_view TYPE = "GetOutbox";
+    bool parse(const json &payload, std::string &error);
+  };
+
+  // MGE plugin protocol. Plugin messages are decoded without building a
+  // DOM: MGEMessageDecoder runs nlohmann's SAX parser and fills the view
+  // for the message's type straight from the text. TYPE is the key a view
+  // is dispatched under. A known field that has the wrong type fails the
+  // decode, while missing fields keep their defaults. Strings and arrays
+  // live in the decoder's arena and are only valid until the next
+  // decode().
+
+  struct MGEWelcome
+  {
+    static constexpr std::string_view TYPE = "welcome";
+    std::string_view message;
+  };
+
+  struct MGEPlayersResponse
+  {
+    static constexpr std::string_view TYPE = "response:get_players";
+
+    struct Player
+    {
+      int id = 0;
+      std::string_view name;
+      int arena = 0;
+      bool inArena = false;
+      int elo = 1000;
+      // Empty if the plugin does not identify players by steam id.
+      std::string_view steamId;
+    };
+
+    // False if the response had no "players" field.
+    bool hasPlayers = false;
+    std::pmr::vector<Player> players;
+
+    explicit MGEPlayersResponse(std::pmr::memory_resource *resource) : players(resource) {}
+  };
+
+  struct MGEArenasResponse
+  {
+    static constexpr std::string_view TYPE = "response:get_arenas";
+
+    struct Arena
+    {
+      int id = 0;
+      // Empty if the plugin did not name the arena.
+      std::string_view name;
+      // Only if the plugin sent an integer priority.
+      std::optional<int> priority;
+    };
+
+    // False unless "arenas" was an array.
+    bool hasArenas = false;
+    std::pmr::vector<Arena> arenas;
+
+    explicit MGEArenasResponse(std::pmr::memory_resource *resource) : arenas(resource) {}
+  };
+
+  struct MGEMatchEndEvent
+  {
+    static constexpr std::string_view TYPE = "event:match_end_1v1";
+    int winnerId = 0;
+    int loserId = 0;
+    int arenaId = 0;
+    std::string_view winnerName;
+    std::string_view loserName;
+    // Empty unless the plugin sent them.
+    std::string_view winnerSteamId;
+    std::string_view loserSteamId;
+  };
+
+  struct MGEPlayerArenaRemovedEvent
+  {
+    static constexpr std::string_view TYPE = "event:player_arena_removed";
+    int playerId = 0;
+    int arenaId = 0;
+    // Empty unless the plugin sent it.
+    std::string_view steamId;
+  };
+
+  // "success" and "error" replies to commands.
+  struct MGEStatus
+  {
+    std::string_view message;
+  };
+
+  class MGEMessageDecoder
+  {
+  public:
+    static constexpr size_t INITIAL_ARENA_BYTES = 64 * 1024;
+
+    MGEMessageDecoder() : arena(INITIAL_ARENA_BYTES) {}
+
+    // Decodes one message, first releasing everything the previous one
+    // used. False with error set if text is not a JSON object or a known
+    // field holds the wrong type.
+    bool decode(std::string_view text, std::string &error);
+
+    // Dispatch key of the last message: "<type>:<command>" for responses,
+    // "<type>:<event>" for events, else just the type. Empty if the
+    // message had no type.
+    std::string_view key() const { return envelope.key; }
+    std::string_view type() const { return envelope.type; }
+    std::string_view command() const { return envelope.command; }
+
+    // The last message's view for its key, e.g. MGEPlayersResponse for
+    // "response:get_players". Views of other types only hold whichever of
+    // their fields the message happened to share.
+    template <typename View>
+    const View &view() const { return std::get<View>(*views); }
+
+  private:
+    class Handler;
+
+    struct Envelope
+    {
+      std::string_view key;
+      std::string_view type;
+      std::string_view command;
+      std::string_view event;
+    };
+
+    // Declared before views, which allocate from it.
+    MessageArena arena;
+    Envelope envelope;
+    std::optional<std::tuple<MGEWelcome, MGEPlayersResponse, MGEArenasResponse, MGEMatchEndEvent,
+                             MGEPlayerArenaRemovedEvent, MGEStatus>>
+        views;
+  };
+
+}
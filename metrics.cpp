@@ -0,0 +1,266 @@
+#include "metrics.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <type_traits>
+
+namespace mge
+{
+  namespace metrics
+  {
+
+    const std::vector<double> LATENCY_BUCKETS = {
+        0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025,
+        0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10};
+
+    namespace
+    {
+
+      std::string formatValue(double value)
+      {
+        char buf[32];
+        // Counts print as integers; bucket bounds and sums as short decimals.
+        if (value == std::floor(value) && std::fabs(value) < 9007199254740992.0)
+        {
+          std::snprintf(buf, sizeof(buf), "%.0f", value);
+        }
+        else
+        {
+          std::snprintf(buf, sizeof(buf), "%.9g", value);
+        }
+        return buf;
+      }
+
+      std::string escapeLabelValue(const std::string &value)
+      {
+        std::string escaped;
+        escaped.reserve(value.size());
+        for (char c : value)
+        {
+          if (c == '\\' || c == '"')
+          {
+            escaped += '\\';
+            escaped += c;
+          }
+          else if (c == '\n')
+          {
+            escaped += "\\n";
+          }
+          else
+          {
+            escaped += c;
+          }
+        }
+        return escaped;
+      }
+
+      // Adds one more label to an already formatted label set.
+      std::string withLabel(const std::string &labels, const std::string &name, const std::string &value)
+      {
+        std::string pair = name + "=\"" + escapeLabelValue(value) + "\"";
+        if (labels.empty())
+        {
+          return "{" + pair + "}";
+        }
+        return labels.substr(0, labels.size() - 1) + "," + pair + "}";
+      }
+
+      bool isDigits(const std::string &s)
+      {
+        return !s.empty() && std::all_of(s.begin(), s.end(), [](unsigned char c)
+                                         { return std::isdigit(c); });
+      }
+
+    }
+
+    void Counter::render(std::string &out, const std::string &name, const std::string &labels) const
+    {
+      appendSample(out, name, labels, static_cast<double>(get()));
+    }
+
+    Histogram::Histogram(const std::vector<double> &bounds)
+        : bounds(bounds), buckets(new std::atomic<uint64_t>[bounds.size() + 1])
+    {
+      for (size_t i = 0; i <= bounds.size(); ++i)
+      {
+        buckets[i].store(0, std::memory_order_relaxed);
+      }
+    }
+
+    void Histogram::observe(double value)
+    {
+      size_t bucket = std::lower_bound(bounds.begin(), bounds.end(), value) - bounds.begin();
+      buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+      count.fetch_add(1, std::memory_order_relaxed);
+      sumNanos.fetch_add(static_cast<uint64_t>(std::max(0.0, value) * 1e9), std::memory_order_relaxed);
+    }
+
+    void Histogram::render(std::string &out, const std::string &name, const std::string &labels) const
+    {
+      uint64_t cumulative = 0;
+      for (size_t i = 0; i < bounds.size(); ++i)
+      {
+        cumulative += buckets[i].load(std::memory_order_relaxed);
+        appendSample(out, name + "_bucket", withLabel(labels, "le", formatValue(bounds[i])),
+                     static_cast<double>(cumulative));
+      }
+      cumulative += buckets[bounds.size()].load(std::memory_order_relaxed);
+      appendSample(out, name + "_bucket", withLabel(labels, "le", "+Inf"), static_cast<double>(cumulative));
+      appendSample(out, name + "_sum", labels, sumNanos.load(std::memory_order_relaxed) / 1e9);
+      // Read separately from the buckets, so under concurrent observe()
+      // calls it may be a little ahead; Prometheus tolerates that.
+      appendSample(out, name + "_count", labels, static_cast<double>(count.load(std::memory_order_relaxed)));
+    }
+
+    template <typename Metric>
+    Metric &Family<Metric>::with(const std::vector<std::string> &labelValues)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+
+      auto it = series.find(labelValues);
+      if (it != series.end())
+      {
+        return *it->second;
+      }
+
+      std::vector<std::string> key = labelValues;
+      if (series.size() >= MAX_SERIES)
+      {
+        key.assign(labelNames.size(), "other");
+        it = series.find(key);
+        if (it != series.end())
+        {
+          return *it->second;
+        }
+      }
+
+      return *series.emplace(std::move(key), make()).first->second;
+    }
+
+    template <typename Metric>
+    std::unique_ptr<Metric> Family<Metric>::make() const
+    {
+      if constexpr (std::is_same_v<Metric, Histogram>)
+      {
+        return std::make_unique<Histogram>(bounds);
+      }
+      else
+      {
+        return std::make_unique<Metric>();
+      }
+    }
+
+    template <typename Metric>
+    void Family<Metric>::render(std::string &out) const
+    {
+      appendHeader(out, name, help, Metric::TYPE);
+
+      std::lock_guard<std::mutex> lock(mutex);
+      for (const auto &[labelValues, metric] : series)
+      {
+        metric->render(out, name, formatLabels(labelNames, labelValues));
+      }
+    }
+
+    template class Family<Counter>;
+    template class Family<Histogram>;
+
+    std::string Registry::render() const
+    {
+      std::string out;
+      challongeRequestSeconds.render(out);
+      challongeRateLimitWaitSeconds.render(out);
+      messages.render(out);
+      messageHandlingSeconds.render(out);
+      matchDispatchSeconds.render(out);
+      playerRedirects.render(out);
+      mgeReconnects.render(out);
+      mgeOfflineCommands.render(out);
+      challongeWrites.render(out);
+      eventLoopIterationSeconds.render(out);
+      return out;
+    }
+
+    Registry &registry()
+    {
+      static Registry instance;
+      return instance;
+    }
+
+    std::string endpointLabel(const std::string &endpoint)
+    {
+      std::string label;
+      std::string previous;
+      size_t start = 0;
+      while (start < endpoint.size())
+      {
+        size_t slash = endpoint.find('/', start + 1);
+        if (slash == std::string::npos)
+        {
+          slash = endpoint.size();
+        }
+
+        // Segment without its leading slash, split from any extension.
+        std::string segment = endpoint.substr(start + 1, slash - start - 1);
+        size_t dot = segment.find('.');
+        std::string stem = segment.substr(0, dot);
+        std::string extension = dot == std::string::npos ? "" : segment.substr(dot);
+
+        label += '/';
+        if (previous == "tournaments")
+        {
+          label += ":tournament" + extension;
+        }
+        else if (isDigits(stem))
+        {
+          label += ":id" + extension;
+        }
+        else
+        {
+          label += segment;
+        }
+
+        previous = stem;
+        start = slash;
+      }
+      return label;
+    }
+
+    void appendHeader(std::string &out, const std::string &name, const std::string &help, const char *type)
+    {
+      out += "# HELP " + name + " " + help + "\n";
+      out += "# TYPE " + name + " " + type + "\n";
+    }
+
+    void appendSample(std::string &out, const std::string &name, const std::string &labels, double value)
+    {
+      out += name;
+      out += labels;
+      out += ' ';
+      out += formatValue(value);
+      out += '\n';
+    }
+
+    std::string formatLabels(const std::vector<std::string> &names, const std::vector<std::string> &values)
+    {
+      if (names.empty())
+      {
+        return "";
+      }
+
+      std::string labels = "{";
+      for (size_t i = 0; i < names.size(); ++i)
+      {
+        if (i > 0)
+        {
+          labels += ',';
+        }
+        labels += names[i] + "=\"" + escapeLabelValue(i < values.size() ? values[i] : "") + "\"";
+      }
+      labels += '}';
+      return labels;
+    }
+
+  }
+}
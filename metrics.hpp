@@ -0,0 +1,186 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <initializer_list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace mge
+{
+  namespace metrics
+  {
+
+    // Monotonic count. inc() is a single relaxed atomic add, so it is safe
+    // and cheap from any thread.
+    class Counter
+    {
+    public:
+      void inc(uint64_t n = 1) { value.fetch_add(n, std::memory_order_relaxed); }
+      uint64_t get() const { return value.load(std::memory_order_relaxed); }
+
+      void render(std::string &out, const std::string &name, const std::string &labels) const;
+      static constexpr const char *TYPE = "counter";
+
+    private:
+      std::atomic<uint64_t> value{0};
+    };
+
+    // Fixed-bucket histogram. observe() is a bucket search over a handful of
+    // bounds plus two relaxed atomic adds; buckets are made cumulative only
+    // when rendered.
+    class Histogram
+    {
+    public:
+      explicit Histogram(const std::vector<double> &bounds);
+
+      void observe(double value);
+
+      void render(std::string &out, const std::string &name, const std::string &labels) const;
+      static constexpr const char *TYPE = "histogram";
+
+    private:
+      std::vector<double> bounds;
+      // One per bound plus +Inf.
+      std::unique_ptr<std::atomic<uint64_t>[]> buckets;
+      std::atomic<uint64_t> count{0};
+      // Sum in nanounits so it can be a plain integer add.
+      std::atomic<uint64_t> sumNanos{0};
+    };
+
+    // Observes the time from construction to destruction, in seconds.
+    class ScopedTimer
+    {
+    public:
+      explicit ScopedTimer(Histogram &histogram)
+          : histogram(histogram), start(std::chrono::steady_clock::now())
+      {
+      }
+      ~ScopedTimer()
+      {
+        histogram.observe(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+      }
+
+      ScopedTimer(const ScopedTimer &) = delete;
+      ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+    private:
+      Histogram &histogram;
+      std::chrono::steady_clock::time_point start;
+    };
+
+    // Buckets for durations, in seconds: 100 us to 10 s.
+    extern const std::vector<double> LATENCY_BUCKETS;
+
+    // A metric name with one series per combination of label values. with()
+    // takes a lock to find or create the series; callers on hot paths with
+    // fixed labels should keep the returned reference. Past MAX_SERIES
+    // distinct combinations, new ones share one series labelled "other", so
+    // label values taken from the network can't grow it without bound.
+    template <typename Metric>
+    class Family
+    {
+    public:
+      static constexpr size_t MAX_SERIES = 256;
+
+      Family(std::string name, std::string help, std::vector<std::string> labelNames,
+             std::vector<double> bounds = {})
+          : name(std::move(name)), help(std::move(help)), labelNames(std::move(labelNames)),
+            bounds(std::move(bounds))
+      {
+      }
+
+      Metric &with(std::initializer_list<std::string> labelValues)
+      {
+        return with(std::vector<std::string>(labelValues));
+      }
+
+      Metric &with(const std::vector<std::string> &labelValues);
+
+      void render(std::string &out) const;
+
+    private:
+      std::unique_ptr<Metric> make() const;
+
+      const std::string name;
+      const std::string help;
+      const std::vector<std::string> labelNames;
+      const std::vector<double> bounds;
+
+      mutable std::mutex mutex;
+      std::map<std::vector<std::string>, std::unique_ptr<Metric>> series;
+    };
+
+    // Every metric the manager exports. Values that are cheaper to read at
+    // scrape time than to keep up to date (queue depths, arena occupancy)
+    // are not here; TournamentManager::renderMetrics() adds them.
+    struct Registry
+    {
+      Family<Histogram> challongeRequestSeconds{
+          "mge_challonge_request_duration_seconds",
+          "Challonge API request latency.",
+          {"method", "endpoint", "status"},
+          LATENCY_BUCKETS};
+      Family<Histogram> challongeRateLimitWaitSeconds{
+          "mge_challonge_rate_limit_wait_seconds",
+          "Time a Challonge request waited for the client-side rate limit or a Retry-After pause before being sent.",
+          {},
+          LATENCY_BUCKETS};
+      Family<Counter> messages{
+          "mge_messages_total",
+          "WebSocket messages handled, by direction, peer and message type.",
+          {"direction", "peer", "type"}};
+      Family<Histogram> messageHandlingSeconds{
+          "mge_message_handling_seconds",
+          "Time spent handling one inbound WebSocket message.",
+          {"peer"},
+          LATENCY_BUCKETS};
+      Family<Histogram> matchDispatchSeconds{
+          "mge_match_dispatch_seconds",
+          "Time from both players of an open match being free to the match being placed in an arena.",
+          {},
+          LATENCY_BUCKETS};
+      Family<Counter> playerRedirects{
+          "mge_player_redirects_total",
+          "Players sent to another MGE server to play a match placed there, by the server they were sent to.",
+          {"server"}};
+      Family<Counter> mgeReconnects{
+          "mge_mge_reconnect_attempts_total",
+          "Attempts to reconnect to an MGE plugin after a failed connection or a drop, per server.",
+          {"server"}};
+      Family<Counter> mgeOfflineCommands{
+          "mge_mge_offline_commands_total",
+          "Commands for an MGE plugin that was offline, by server, command and what became of them (sent, superseded, expired, dropped).",
+          {"server", "command", "outcome"}};
+      Family<Counter> challongeWrites{
+          "mge_challonge_writes_total",
+          "Challonge write attempts from the outbox, by kind and result.",
+          {"kind", "result"}};
+      Family<Histogram> eventLoopIterationSeconds{
+          "mge_event_loop_iteration_seconds",
+          "Duration of one event loop iteration, including up to 50 ms waiting for I/O when idle.",
+          {},
+          LATENCY_BUCKETS};
+
+      // Prometheus text exposition format (version 0.0.4).
+      std::string render() const;
+    };
+
+    Registry &registry();
+
+    // "/tournaments/123/matches/456.json" -> "/tournaments/:tournament/matches/:id.json",
+    // so endpoints can be used as label values.
+    std::string endpointLabel(const std::string &endpoint);
+
+    // Appends a single sample line, for metrics computed at scrape time.
+    void appendSample(std::string &out, const std::string &name, const std::string &labels, double value);
+    void appendHeader(std::string &out, const std::string &name, const std::string &help, const char *type);
+    // Renders {a="x",b="y"}, escaping the values; empty if there are no labels.
+    std::string formatLabels(const std::vector<std::string> &names, const std::vector<std::string> &values);
+
+  }
+}
@@ -0,0 +1,506 @@
+#!/usr/bin/env python3
+"""
+Offline stand-in for the parts of the Challonge v1 API the tournament
+manager uses. Keeps real bracket state (single elimination with byes, or
+double elimination for power-of-two fields) so a whole tournament can run
+against it without touching the live service or its rate limits.
+
+Point the manager at it with "challonge_base_url" in config.json, e.g.
+"http://localhost:9100/v1". Any basic-auth credentials are accepted and any
+tournament URL is created on first use.
+"""
+
+import argparse
+import json
+import random
+import re
+import threading
+import time
+from collections import Counter
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+from urllib.parse import parse_qsl, urlsplit
+
+
+def parse_form(body):
+    """Decodes Rails-style form fields into nested dicts and lists.
+
+    participant[name]=a          -> {"participant": {"name": "a"}}
+    participants[][name]=a&...   -> {"participants": [{"name": "a"}, ...]}
+    A repeated key inside [] starts the next list element.
+    """
+    result = {}
+    for key, value in parse_qsl(body, keep_blank_values=True):
+        parts = re.findall(r"[^\[\]]+|\[\]", key)
+        if not parts:
+            continue
+        node = result
+        for i, part in enumerate(parts):
+            last = i == len(parts) - 1
+            if part == "[]":
+                continue
+            is_list = i + 1 < len(parts) and parts[i + 1] == "[]"
+            if last:
+                node[part] = value
+            elif is_list:
+                items = node.setdefault(part, [])
+                field = parts[i + 2] if i + 2 < len(parts) else None
+                if field is None:
+                    items.append(value)
+                    break
+                if not items or field in items[-1]:
+                    items.append({})
+                node = items[-1]
+            else:
+                node = node.setdefault(part, {})
+    return result
+
+
+class Tournament:
+    def __init__(self, tid, url, kind):
+        self.id = tid
+        self.url = url
+        self.kind = kind
+        self.state = "pending"
+        self.participants = {}
+        self.matches = {}
+        self.next_participant_id = tid * 10000 + 1
+        self.next_match_id = tid * 100000 + 1
+
+    # --- participants -----------------------------------------------------
+
+    def add_participant(self, fields):
+        pid = self.next_participant_id
+        self.next_participant_id += 1
+        seed = int(fields.get("seed") or len(self.participants) + 1)
+        self.participants[pid] = {
+            "id": pid,
+            "tournament_id": self.id,
+            "name": fields.get("name", f"Player {pid}"),
+            "seed": seed,
+            "misc": fields.get("misc"),
+            "active": True,
+        }
+        return self.participants[pid]
+
+    def seeded(self):
+        return sorted(self.participants.values(), key=lambda p: (p["seed"], p["id"]))
+
+    # --- bracket ----------------------------------------------------------
+
+    def new_match(self, rnd, **slots):
+        mid = self.next_match_id
+        self.next_match_id += 1
+        match = {
+            "id": mid,
+            "tournament_id": self.id,
+            "state": "pending",
+            "round": rnd,
+            "player1_id": None,
+            "player2_id": None,
+            "winner_id": None,
+            "loser_id": None,
+            "player1_prereq_match_id": None,
+            "player2_prereq_match_id": None,
+            "player1_is_prereq_match_loser": False,
+            "player2_is_prereq_match_loser": False,
+            "scores_csv": "",
+            "suggested_play_order": len(self.matches) + 1,
+        }
+        match.update(slots)
+        self.matches[mid] = match
+        return match
+
+    @staticmethod
+    def seed_order(size):
+        order = [1]
+        while len(order) < size:
+            n = len(order) * 2 + 1
+            order = [x for s in order for x in (s, n - s)]
+        return order
+
+    def build_bracket(self):
+        players = self.seeded()
+        size = 1
+        while size < len(players):
+            size *= 2
+
+        # Each slot is either a participant id or the id of the match whose
+        # winner fills it.
+        slots = []
+        for seed in self.seed_order(size):
+            slots.append(("player", players[seed - 1]["id"]) if seed <= len(players) else None)
+
+        winners_rounds = []
+        rnd = 1
+        while len(slots) > 1:
+            next_slots = []
+            matches = []
+            for a, b in zip(slots[::2], slots[1::2]):
+                if a is None or b is None:
+                    # A bye: the present entrant goes straight through.
+                    next_slots.append(a or b)
+                    continue
+                match = self.new_match(rnd)
+                for n, slot in ((1, a), (2, b)):
+                    if slot[0] == "player":
+                        match[f"player{n}_id"] = slot[1]
+                    else:
+                        match[f"player{n}_prereq_match_id"] = slot[1]
+                matches.append(match)
+                next_slots.append(("match", match["id"]))
+            winners_rounds.append(matches)
+            slots = next_slots
+            rnd += 1
+
+        if self.kind == "double elimination" and len(players) > 2:
+            self.build_losers_bracket(winners_rounds)
+
+        for match in self.matches.values():
+            self.update_state(match)
+
+    def build_losers_bracket(self, winners_rounds):
+        # Standard layout for a full power-of-two field: losers of winners'
+        # round 1 play each other, then each later round alternates between
+        # taking in winners'-side losers and halving the field.
+        drop = [m["id"] for m in winners_rounds[0]]
+        entrants = []
+        rnd = -1
+        for a, b in zip(drop[::2], drop[1::2]):
+            entrants.append(self.new_match(rnd, player1_prereq_match_id=a, player1_is_prereq_match_loser=True,
+                                           player2_prereq_match_id=b, player2_is_prereq_match_loser=True)["id"])
+        for wr in winners_rounds[1:]:
+            rnd -= 1
+            losers = [m["id"] for m in wr][::-1]
+            entrants = [self.new_match(rnd, player1_prereq_match_id=e,
+                                       player2_prereq_match_id=l, player2_is_prereq_match_loser=True)["id"]
+                        for e, l in zip(entrants, losers)]
+            if len(entrants) > 1:
+                rnd -= 1
+                entrants = [self.new_match(rnd, player1_prereq_match_id=a, player2_prereq_match_id=b)["id"]
+                            for a, b in zip(entrants[::2], entrants[1::2])]
+
+        final_round = len(winners_rounds) + 1
+        winners_final = winners_rounds[-1][0]["id"]
+        grand_final = self.new_match(final_round, player1_prereq_match_id=winners_final,
+                                     player2_prereq_match_id=entrants[0])
+        self.new_match(final_round, player1_prereq_match_id=grand_final["id"],
+                       player2_prereq_match_id=grand_final["id"], player2_is_prereq_match_loser=True)
+
+    def update_state(self, match):
+        if match["winner_id"] is not None:
+            match["state"] = "complete"
+        elif match["player1_id"] is not None and match["player2_id"] is not None:
+            match["state"] = "open"
+        else:
+            match["state"] = "pending"
+
+    def report(self, match, winner_id, scores_csv):
+        if winner_id not in (match["player1_id"], match["player2_id"]):
+            return "Winner is not a participant in this match"
+        loser_id = match["player2_id"] if winner_id == match["player1_id"] else match["player1_id"]
+        match["winner_id"] = winner_id
+        match["loser_id"] = loser_id
+        match["scores_csv"] = scores_csv or ""
+        self.update_state(match)
+
+        for nxt in self.matches.values():
+            both = nxt["player1_prereq_match_id"] == match["id"] == nxt["player2_prereq_match_id"]
+            if both:
+                # Grand final reset: only played if the losers' side won.
+                if winner_id == match["player2_id"]:
+                    nxt["player1_id"] = winner_id
+                    nxt["player2_id"] = loser_id
+                    self.update_state(nxt)
+                continue
+            for n in (1, 2):
+                if nxt[f"player{n}_prereq_match_id"] == match["id"]:
+                    nxt[f"player{n}_id"] = loser_id if nxt[f"player{n}_is_prereq_match_loser"] else winner_id
+            self.update_state(nxt)
+
+        if all(m["state"] == "complete" or (m["state"] == "pending" and self.is_unplayed_reset(m))
+               for m in self.matches.values()):
+            self.state = "awaiting_review"
+        return None
+
+    def is_unplayed_reset(self, match):
+        pre = match["player1_prereq_match_id"]
+        return (pre is not None and pre == match["player2_prereq_match_id"]
+                and self.matches[pre]["state"] == "complete")
+
+    # --- JSON -------------------------------------------------------------
+
+    def to_json(self, include_participants=False, include_matches=False):
+        t = {
+            "id": self.id,
+            "url": self.url,
+            "name": self.url,
+            "tournament_type": self.kind,
+            "state": self.state,
+            "participants_count": len(self.participants),
+        }
+        if include_participants:
+            t["participants"] = [{"participant": p} for p in self.seeded()]
+        if include_matches:
+            t["matches"] = [{"match": m} for m in self.matches.values()]
+        return {"tournament": t}
+
+
+class State:
+    def __init__(self, kind):
+        self.kind = kind
+        self.lock = threading.Lock()
+        self.tournaments = {}
+        self.by_url = {}
+        self.next_id = 1
+        self.requests = Counter()
+        self.started_at = time.time()
+        # API requests answered in the current one-second window, for
+        # --rate-limit.
+        self.window_start = 0
+        self.window_requests = 0
+
+    def over_rate_limit(self, limit):
+        """Counts a request. Returns whether it is over the limit for this
+        second and how many seconds are left until the window resets."""
+        now = time.time()
+        if now - self.window_start >= 1:
+            self.window_start = now
+            self.window_requests = 0
+        self.window_requests += 1
+        return limit > 0 and self.window_requests > limit, max(0.0, self.window_start + 1 - now)
+
+    def lookup(self, key, create=False):
+        if key.isdigit() and int(key) in self.tournaments:
+            return self.tournaments[int(key)]
+        if key in self.by_url:
+            return self.by_url[key]
+        if not create:
+            return None
+        t = Tournament(self.next_id, key, self.kind)
+        self.next_id += 1
+        self.tournaments[t.id] = t
+        self.by_url[key] = t
+        return t
+
+
+ROUTES = [
+    ("GET", r"/tournaments/([^/]+)\.json", "show_tournament"),
+    ("POST", r"/tournaments/([^/]+)/participants/bulk_add\.json", "bulk_add"),
+    ("DELETE", r"/tournaments/([^/]+)/participants/clear\.json", "clear_participants"),
+    ("GET", r"/tournaments/([^/]+)/participants\.json", "list_participants"),
+    ("POST", r"/tournaments/([^/]+)/participants\.json", "create_participant"),
+    ("DELETE", r"/tournaments/([^/]+)/participants/(\d+)\.json", "delete_participant"),
+    ("POST", r"/tournaments/([^/]+)/reset\.json", "reset"),
+    ("POST", r"/tournaments/([^/]+)/start\.json", "start"),
+    ("GET", r"/tournaments/([^/]+)/matches\.json", "list_matches"),
+    ("GET", r"/tournaments/([^/]+)/matches/(\d+)\.json", "show_match"),
+    ("PUT", r"/tournaments/([^/]+)/matches/(\d+)\.json", "update_match"),
+]
+
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+    # Replies are written in several small sends; with Nagle's algorithm on
+    # the client's delayed ACK adds ~40 ms to every keep-alive request.
+    disable_nagle_algorithm = True
+    state = None
+    prefix = "/v1"
+    quiet = False
+    fail_rate = 0.0
+    rate_limit = 0
+
+    def log_message(self, fmt, *args):
+        if not self.quiet:
+            super().log_message(fmt, *args)
+
+    def do_GET(self):
+        self.dispatch("GET")
+
+    def do_POST(self):
+        self.dispatch("POST")
+
+    def do_PUT(self):
+        self.dispatch("PUT")
+
+    def do_DELETE(self):
+        self.dispatch("DELETE")
+
+    def reply(self, status, body, headers=None):
+        data = json.dumps(body).encode()
+        self.send_response(status)
+        for name, value in (headers or {}).items():
+            self.send_header(name, value)
+        self.send_header("Content-Type", "application/json; charset=utf-8")
+        self.send_header("Content-Length", str(len(data)))
+        self.end_headers()
+        self.wfile.write(data)
+
+    def dispatch(self, method):
+        url = urlsplit(self.path)
+        length = int(self.headers.get("Content-Length") or 0)
+        body = self.rfile.read(length).decode() if length else ""
+        params = parse_form(url.query)
+        params.update(parse_form(body))
+
+        if url.path == "/stats.json":
+            with self.state.lock:
+                stats = self.stats()
+            self.reply(200, stats)
+            return
+
+        path = url.path[len(self.prefix):] if url.path.startswith(self.prefix) else url.path
+        for route_method, pattern, name in ROUTES:
+            m = re.fullmatch(pattern, path)
+            if m and route_method == method:
+                with self.state.lock:
+                    limited, reset = self.state.over_rate_limit(self.rate_limit)
+                    if limited:
+                        self.state.requests["rate limited"] += 1
+                if limited:
+                    self.reply(429, {"errors": ["Rate limit exceeded"]},
+                               {"Retry-After": str(max(1, round(reset)))})
+                    return
+                with self.state.lock:
+                    self.state.requests[f"{method} {name}"] += 1
+                    create = name == "show_tournament"
+                    tournament = self.state.lookup(m.group(1), create=create)
+                    if tournament is None:
+                        self.reply(404, {"errors": ["Tournament not found"]})
+                        return
+                    # Injected failure: half of them are applied first, as
+                    # when the response is lost on the way back.
+                    fail = method != "GET" and random.random() < self.fail_rate
+                    if fail:
+                        self.state.requests[f"{method} {name} (failed)"] += 1
+                    if not fail or random.random() < 0.5:
+                        status, result = getattr(self, name)(tournament, params, *m.groups()[1:])
+                if fail:
+                    status, result = 503, {"errors": ["Service Unavailable (injected)"]}
+                self.reply(status, result)
+                return
+
+        self.reply(404, {"errors": [f"No route for {method} {path}"]})
+
+    def stats(self):
+        return {
+            "requests": dict(self.state.requests),
+            "total_requests": sum(self.state.requests.values()),
+            "tournaments": {
+                t.url: {
+                    "state": t.state,
+                    "participants": len(t.participants),
+                    "matches": len(t.matches),
+                    "complete": sum(1 for m in t.matches.values() if m["state"] == "complete"),
+                }
+                for t in self.state.tournaments.values()
+            },
+        }
+
+    # --- endpoints ----------------------------------------------------------
+
+    def show_tournament(self, t, params):
+        return 200, t.to_json(params.get("include_participants") == "1",
+                              params.get("include_matches") == "1")
+
+    def list_participants(self, t, params):
+        return 200, [{"participant": p} for p in t.seeded()]
+
+    def create_participant(self, t, params):
+        if t.state != "pending":
+            return 422, {"errors": ["Participants can't be added after the tournament has started"]}
+        return 200, {"participant": t.add_participant(params.get("participant", {}))}
+
+    def bulk_add(self, t, params):
+        if t.state != "pending":
+            return 422, {"errors": ["Participants can't be added after the tournament has started"]}
+        added = [t.add_participant(fields) for fields in params.get("participants", [])]
+        return 200, [{"participant": p} for p in added]
+
+    def delete_participant(self, t, params, pid):
+        if t.participants.pop(int(pid), None) is None:
+            return 404, {"errors": ["Participant not found"]}
+        return 200, {}
+
+    def clear_participants(self, t, params):
+        if t.state != "pending":
+            return 422, {"errors": ["Participants can only be cleared before the tournament starts"]}
+        t.participants.clear()
+        return 200, {"message": "Participants cleared"}
+
+    def reset(self, t, params):
+        t.matches.clear()
+        t.state = "pending"
+        return 200, t.to_json()
+
+    def start(self, t, params):
+        if t.state != "pending":
+            return 422, {"errors": ["Tournament has already started"]}
+        if len(t.participants) < 2:
+            return 422, {"errors": ["At least 2 participants are required"]}
+        if t.kind == "double elimination" and len(t.participants) & (len(t.participants) - 1):
+            return 422, {"errors": ["This stand-in only builds double elimination for power-of-two fields"]}
+        t.build_bracket()
+        t.state = "underway"
+        return 200, t.to_json(params.get("include_participants") == "1",
+                              params.get("include_matches") == "1")
+
+    def list_matches(self, t, params):
+        wanted = params.get("state")
+        return 200, [{"match": m} for m in t.matches.values() if not wanted or wanted == "all" or m["state"] == wanted]
+
+    def show_match(self, t, params, mid):
+        match = t.matches.get(int(mid))
+        if match is None:
+            return 404, {"errors": ["Match not found"]}
+        return 200, {"match": match}
+
+    def update_match(self, t, params, mid):
+        match = t.matches.get(int(mid))
+        if match is None:
+            return 404, {"errors": ["Match not found"]}
+        fields = params.get("match", {})
+        if match["state"] != "open":
+            return 422, {"errors": ["Match is not open"]}
+        try:
+            winner_id = int(fields.get("winner_id"))
+        except (TypeError, ValueError):
+            return 422, {"errors": ["winner_id is required"]}
+        error = t.report(match, winner_id, fields.get("scores_csv"))
+        if error:
+            return 422, {"errors": [error]}
+        return 200, {"match": match}
+
+
+def make_server(port, kind="single elimination", quiet=False, fail_rate=0.0, rate_limit=0):
+    handler = type("BoundHandler", (Handler,), {"state": State(kind), "quiet": quiet, "fail_rate": fail_rate,
+                                                "rate_limit": rate_limit})
+    return ThreadingHTTPServer(("0.0.0.0", port), handler)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Mock Challonge v1 API")
+    parser.add_argument("--port", type=int, default=9100)
+    parser.add_argument("--type", choices=["single", "double"], default="single",
+                        help="bracket type for new tournaments")
+    parser.add_argument("--quiet", action="store_true", help="don't log each request")
+    parser.add_argument("--fail-rate", type=float, default=0.0,
+                        help="fraction of writes answered with 503, half of them after being applied")
+    parser.add_argument("--rate-limit", type=int, default=0,
+                        help="API requests allowed per second; more get a 429 with Retry-After (0 for no limit)")
+    args = parser.parse_args()
+
+    server = make_server(args.port, f"{args.type} elimination", args.quiet, args.fail_rate, args.rate_limit)
+    print("=" * 60)
+    print("🏆 Mock Challonge Server")
+    print("=" * 60)
+    print(f"Base URL: http://localhost:{args.port}/v1")
+    print(f"Bracket:  {args.type} elimination")
+    print("Stats:    GET /stats.json\n")
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+    main()
@@ -1,32 +1,258 @@
 #!/usr/bin/env python3
+"""
+Mock MGE server plugin. With no options it serves the original four test
+players in 16 arenas with five-second matches. For load testing, raise
+--players (up to 1000) and --arenas, pick a match length distribution,
+and optionally add disconnects and result bursts:
+
+    python3 mock_mge_server.py --players 1000 --arenas 64 \\
+        --duration uniform:0.5:3 --disconnect-rate 0.05 --burst-interval 2 --quiet
+
+With --servers N it plays N plugins on consecutive ports, each with
+--arenas arenas, and deals the players out among them. Players then carry
+steam ids, and redirect_player moves one to the server listening on the
+port in its address after --redirect-seconds.
+
+With --drop-interval S each plugin closes the manager's connection S seconds
+after it connects, as a network blip would. Matches carry on; events that
+come up while the manager is away are lost, and a reconnecting manager
+finds the plugin as it left it.
+"""
+import argparse
 import asyncio
+import contextlib
 import websockets
 import json
 import time
 import random
 
+MAX_PLAYERS = 1000
+
 connected_clients = set()
 
-arena_players = {i: set() for i in range(1, 17)}
+# Overridden from the command line (or by bench/e2e_benchmark.py).
+config = {
+    "port": 9001,
+    "players": 4,
+    "arenas": 16,
+    # fixed:S, uniform:MIN:MAX, normal:MEAN:STDDEV or exp:MEAN (seconds)
+    "duration": "fixed:5",
+    # Chance that a match is cut short by one of its players disconnecting.
+    "disconnect_rate": 0.0,
+    "reconnect_seconds": 2.0,
+    # When > 0, match results are held back and released together every
+    # burst_interval seconds instead of as each match ends.
+    "burst_interval": 0.0,
+    "servers": 1,
+    "redirect_seconds": 0.5,
+    "drop_interval": 0.0,
+    "quiet": False,
+}
+
+# One per simulated plugin: its index, port, current connection, arenas
+# and held-back events. Arena ids are per server.
+servers = []
+offline_players = set()
+# Placements requested while a player was offline; applied on reconnect.
+deferred_placements = {}
+# Server each player is on, and players on their way to another one.
+player_server = {}
+in_transit = set()
+# Arenas a server was told to put a player in once they arrive there.
+expected_arrivals = {}
+
+# Timing collected for benchmarks: when each player last became free and,
+# per dispatched match, how long the pair waited for an arena.
+stats = {
+    "free_since": {},
+    "dispatch_latencies": [],
+    "matches_played": 0,
+    "disconnects": 0,
+    "redirects": 0,
+    "drops": 0,
+    "lost_events": 0,
+    "events_sent": 0,
+    "largest_burst": 0,
+}
+
+# Mock player names based on ID
+players_map = {
+    1: "Shaaden", 2: "BobAmmomod", 3: "CharlieSpire", 4: "DaveShotgunStall"
+}
+elo_map = {1: 1800, 2: 1600, 3: 1700, 4: 1500}
+
+
+def log(message):
+    if not config["quiet"]:
+        print(message)
+
+
+def parse_duration(spec):
+    """Turns a duration spec into a function returning match lengths."""
+    kind, _, rest = spec.partition(":")
+    values = [float(v) for v in rest.split(":")] if rest else []
+    if kind == "fixed" and len(values) == 1:
+        return lambda: values[0]
+    if kind == "uniform" and len(values) == 2:
+        return lambda: random.uniform(values[0], values[1])
+    if kind == "normal" and len(values) == 2:
+        return lambda: max(0.0, random.gauss(values[0], values[1]))
+    if kind == "exp" and len(values) == 1:
+        return lambda: random.expovariate(1.0 / values[0]) if values[0] > 0 else 0.0
+    raise ValueError(f"bad duration spec '{spec}'")
+
+
+match_length = parse_duration(config["duration"])
+
+
+def multi_server():
+    return config["servers"] > 1
+
+
+def steam_id(player_id):
+    return f"STEAM_0:0:{player_id}"
+
+
+def reset_server(server):
+    server["arena_players"] = {arena_id: set() for arena_id in range(1, config["arenas"] + 1)}
+    server["held_events"] = []
+
+
+def reset_state():
+    servers.clear()
+    for index in range(config["servers"]):
+        server = {"index": index, "port": config["port"] + index, "websocket": None, "dropped": False}
+        reset_server(server)
+        servers.append(server)
+    offline_players.clear()
+    deferred_placements.clear()
+    in_transit.clear()
+    expected_arrivals.clear()
+    player_server.clear()
+    for player_id in range(1, config["players"] + 1):
+        player_server[player_id] = (player_id - 1) % config["servers"]
+
+
+def make_players(server):
+    arena_of = {}
+    for arena_id, occupants in server["arena_players"].items():
+        for player_id in occupants:
+            arena_of[player_id] = arena_id
+
+    players = []
+    for player_id in range(1, config["players"] + 1):
+        if player_id in offline_players or player_id in in_transit or player_server[player_id] != server["index"]:
+            continue
+        player = {
+            "id": player_id,
+            "name": players_map.get(player_id, f"Player{player_id}"),
+            "elo": elo_map.get(player_id, random.randint(1000, 2000)),
+            "arena": arena_of.get(player_id, 0),
+            "inArena": player_id in arena_of,
+        }
+        if multi_server():
+            player["steam_id"] = steam_id(player_id)
+        players.append(player)
+    return players
+
+
+async def send_event(server, event):
+    if server["websocket"] is None:
+        stats["lost_events"] += 1
+        return
+    if config["burst_interval"] > 0:
+        server["held_events"].append(event)
+        return
+    stats["events_sent"] += 1
+    await server["websocket"].send(json.dumps(event))
+
+
+async def release_bursts(server):
+    """Flushes held results every burst_interval seconds."""
+    while True:
+        await asyncio.sleep(config["burst_interval"])
+        if not server["held_events"]:
+            continue
+        burst = list(server["held_events"])
+        server["held_events"].clear()
+        stats["largest_burst"] = max(stats["largest_burst"], len(burst))
+        log(f"   💥 Releasing burst of {len(burst)} events")
+        for event in burst:
+            stats["events_sent"] += 1
+            await server["websocket"].send(json.dumps(event))
+
+
+async def drop_later(server, websocket):
+    """Closes the manager's connection after drop_interval seconds."""
+    await asyncio.sleep(config["drop_interval"])
+    log(f"   📴 Dropping the connection to server {server['index']}")
+    stats["drops"] += 1
+    server["dropped"] = True
+    await websocket.close()
+
+
+def free_players(player_list):
+    now = time.monotonic()
+    for player_id in player_list:
+        stats["free_since"][player_id] = now
+
+
+async def reconnect_later(player_id):
+    await asyncio.sleep(config["reconnect_seconds"])
+    offline_players.discard(player_id)
+    log(f"   🔌 Player {player_id} reconnected")
+    placement = deferred_placements.pop(player_id, None)
+    if placement is not None:
+        await place_player(servers[placement[0]], player_id, placement[1])
+
 
-async def simulate_match(websocket, arena_id, players_in_arena):
+async def arrive_later(player_id, target):
+    await asyncio.sleep(config["redirect_seconds"])
+    in_transit.discard(player_id)
+    player_server[player_id] = target
+    log(f"   🛬 Player {player_id} joined server {target}")
+    placement = expected_arrivals.pop(player_id, None)
+    if placement is not None and placement[0] == target:
+        await place_player(servers[target], player_id, placement[1])
+
+
+async def simulate_match(server, arena_id, players_in_arena):
     """
     Simulates a match and sends the result.
-    This is now a separate function to be called only when an arena is full.
+    Runs as its own task once an arena is full, so other arenas keep going.
     """
-    print(f"   🔥 Arena {arena_id} is full. Simulating match between players {players_in_arena}...")
-    await asyncio.sleep(5)  # Shorter simulation time for faster testing
-
+    log(f"   🔥 Arena {arena_id} is full. Simulating match between players {players_in_arena}...")
+    duration = match_length()
     player_list = list(players_in_arena)
+
+    if random.random() < config["disconnect_rate"]:
+        await asyncio.sleep(random.uniform(0, duration))
+        leaver = random.choice(player_list)
+        log(f"   📴 Player {leaver} disconnected from arena {arena_id}")
+        stats["disconnects"] += 1
+        offline_players.add(leaver)
+        server["arena_players"][arena_id].clear()
+        free_players(player_list)
+        # The arena is abandoned; MGE reports the player who left.
+        event = {
+            "type": "event",
+            "event": "player_arena_removed",
+            "player_id": leaver,
+            "arena_id": arena_id,
+            "timestamp": int(time.time())
+        }
+        if multi_server():
+            event["steam_id"] = steam_id(leaver)
+        await send_event(server, event)
+        asyncio.create_task(reconnect_later(leaver))
+        return
+
+    await asyncio.sleep(duration)
+
     winner_id = random.choice(player_list)
     loser_id = player_list[0] if player_list[1] == winner_id else player_list[1]
 
-    # Mock player names based on ID
-    players_map = {
-        1: "Shaaden", 2: "BobAmmomod", 3: "CharlieSpire", 4: "DaveShotgunStall"
-    }
-
-    print(f"   🏆 Match in Arena {arena_id} ended! Winner: Player {winner_id}")
+    log(f"   🏆 Match in Arena {arena_id} ended! Winner: Player {winner_id}")
     event = {
         "type": "event",
         "event": "match_end_1v1",
@@ -39,36 +265,93 @@ async def simulate_match(websocket, arena_id, players_in_arena):
         "loser_score": random.randint(0, 19),
         "timestamp": int(time.time())
     }
-    await websocket.send(json.dumps(event))
+    if multi_server():
+        event["winner_steam_id"] = steam_id(winner_id)
+        event["loser_steam_id"] = steam_id(loser_id)
 
     # Clear the arena for the next match
-    print(f"   🧹 Clearing arena {arena_id}")
-    arena_players[arena_id].clear()
+    log(f"   🧹 Clearing arena {arena_id}")
+    server["arena_players"][arena_id].clear()
+    free_players(player_list)
+    stats["matches_played"] += 1
+
+    await send_event(server, event)
 
 
-async def handler(websocket):
+def leave_arenas(server, player_id, except_arena=None):
+    for other_id, occupants in server["arena_players"].items():
+        if other_id != except_arena:
+            occupants.discard(player_id)
+
+
+async def place_player(server, player_id, arena_id):
+    if player_id in offline_players:
+        log(f"   ⏳ Player {player_id} is offline, placing in arena {arena_id} once back")
+        deferred_placements[player_id] = (server["index"], arena_id)
+        return
+
+    # Add player to our state; like MGE, this moves them out of any other arena.
+    leave_arenas(server, player_id, arena_id)
+    occupants = server["arena_players"].setdefault(arena_id, set())
+    if player_id in occupants:
+        return
+    occupants.add(player_id)
+
+    # Check if the arena is now full
+    if len(occupants) == 2:
+        pair = set(occupants)
+        ready_at = max(stats["free_since"].get(p, time.monotonic()) for p in pair)
+        stats["dispatch_latencies"].append(time.monotonic() - ready_at)
+
+        # If full, start the simulation for the correct players
+        asyncio.create_task(simulate_match(server, arena_id, pair))
+
+
+async def handler(websocket, index=0):
+    server = servers[index]
     connected_clients.add(websocket)
-    print(f"✅ Client connected from {websocket.remote_address}")
-    
-    # Reset state on new connection for clean tests
-    for arena_id in arena_players:
-        arena_players[arena_id].clear()
+    print(f"✅ Client connected to server {index} from {websocket.remote_address}")
+
+    # Reset state on new connection for clean tests; with several servers
+    # only the first connection of a run resets the shared player state.
+    # A manager coming back after a drop finds everything as it was.
+    if server["dropped"]:
+        server["dropped"] = False
+    else:
+        if not any(other["websocket"] for other in servers):
+            reset_state()
+            server = servers[index]
+        reset_server(server)
+    server["websocket"] = websocket
+    bursts = asyncio.create_task(release_bursts(server)) if config["burst_interval"] > 0 else None
+    drop = asyncio.create_task(drop_later(server, websocket)) if config["drop_interval"] > 0 else None
 
     try:
         async for message in websocket:
-            print(f"📩 Received: {message}")
+            log(f"📩 Received: {message}")
             data = json.loads(message)
 
             if data.get("command") == "get_players":
-                print("   → Sending 4 test players")
+                players = make_players(server)
+                log(f"   → Sending {len(players)} test players")
+                now = time.monotonic()
+                for player in players:
+                    stats["free_since"].setdefault(player["id"], now)
                 response = {
                     "type": "response",
                     "command": "get_players",
-                    "players": [
-                        {"id": 1, "name": "Shaaden", "elo": 1800, "arena": 0, "inArena": False},
-                        {"id": 2, "name": "BobAmmomod", "elo": 1600, "arena": 0, "inArena": False},
-                        {"id": 3, "name": "CharlieSpire", "elo": 1700, "arena": 0, "inArena": False},
-                        {"id": 4, "name": "DaveShotgunStall", "elo": 1500, "arena": 0, "inArena": False},
+                    "players": players
+                }
+                await websocket.send(json.dumps(response))
+
+            elif data.get("command") == "get_arenas":
+                log(f"   → Sending {len(server['arena_players'])} arenas")
+                response = {
+                    "type": "response",
+                    "command": "get_arenas",
+                    "arenas": [
+                        {"id": arena_id, "name": f"Arena {arena_id}"}
+                        for arena_id in server["arena_players"]
                     ]
                 }
                 await websocket.send(json.dumps(response))
@@ -76,34 +359,108 @@ async def handler(websocket):
             elif data.get("command") == "add_player_to_arena":
                 player_id = data.get("player_id")
                 arena_id = data.get("arena_id")
-                
-                print(f"   → Adding player {player_id} to arena {arena_id}")
-                
-                # Add player to our state
-                arena_players[arena_id].add(player_id)
-                
+                if player_id is None:
+                    # By steam id: a player who is here already or on the way.
+                    player_id = int(data.get("steam_id", "").rpartition(":")[2] or 0)
+
+                log(f"   → Adding player {player_id} to arena {arena_id}")
+
                 response = { "type": "success", "message": "Player added to arena" }
                 await websocket.send(json.dumps(response))
-                
-                # Check if the arena is now full
-                if len(arena_players[arena_id]) == 2:
-                    # If full, start the simulation for the correct players
-                    await simulate_match(websocket, arena_id, arena_players[arena_id])
+
+                if player_server.get(player_id) == index and player_id not in in_transit:
+                    await place_player(server, player_id, arena_id)
+                else:
+                    expected_arrivals[player_id] = (index, arena_id)
+
+            elif data.get("command") == "redirect_player":
+                player_id = data.get("player_id")
+                address = data.get("address", "")
+                target = int(address.rpartition(":")[2]) - config["port"]
+                log(f"   ✈️  Redirecting player {player_id} to server {target}")
+                stats["redirects"] += 1
+                leave_arenas(server, player_id)
+                in_transit.add(player_id)
+                asyncio.create_task(arrive_later(player_id, target))
 
     except websockets.exceptions.ConnectionClosed:
-        print(f"❌ Client disconnected")
+        print(f"❌ Client disconnected from server {index}")
     finally:
+        if bursts:
+            bursts.cancel()
+        # Unless it is the one closing the connection.
+        if drop and not server["dropped"]:
+            drop.cancel()
+        stats["lost_events"] += len(server["held_events"])
+        server["held_events"].clear()
+        server["websocket"] = None
         connected_clients.remove(websocket)
 
-async def main():
+
+def server_handler(index):
+    """websockets.serve() handler for the server at index."""
+    return lambda websocket: handler(websocket, index)
+
+def configure(**overrides):
+    """Applies settings; used by main() and by benchmark drivers."""
+    global match_length
+    config.update({k: v for k, v in overrides.items() if v is not None})
+    if not 1 <= config["players"] <= MAX_PLAYERS:
+        raise ValueError(f"players must be between 1 and {MAX_PLAYERS}")
+    if config["arenas"] < 1:
+        raise ValueError("arenas must be at least 1")
+    if config["servers"] < 1:
+        raise ValueError("servers must be at least 1")
+    match_length = parse_duration(config["duration"])
+
+async def serve():
     print("=" * 60)
     print("🎮 Mock MGE Server (Stateful Version)")
     print("=" * 60)
-    print("Listening on: ws://localhost:9001")
+    last_port = config["port"] + config["servers"] - 1
+    ports = f"{config['port']}" if config["servers"] == 1 else f"{config['port']}-{last_port}"
+    print(f"Listening on: ws://localhost:{ports}")
+    print(f"Players: {config['players']}, arenas: {config['arenas']}, match length: {config['duration']}")
+    if config["disconnect_rate"] > 0 or config["burst_interval"] > 0:
+        print(f"Disconnect rate: {config['disconnect_rate']}, burst interval: {config['burst_interval']}s")
     print("Waiting for tournament manager to connect...\n")
-    
-    async with websockets.serve(handler, "0.0.0.0", 9001):
+
+    reset_state()
+    async with contextlib.AsyncExitStack() as stack:
+        for server in servers:
+            await stack.enter_async_context(websockets.serve(server_handler(server["index"]), "0.0.0.0", server["port"]))
         await asyncio.Future()
 
+def main():
+    parser = argparse.ArgumentParser(description="Mock MGE server plugin")
+    parser.add_argument("--port", type=int)
+    parser.add_argument("--players", type=int, help=f"number of players, up to {MAX_PLAYERS}")
+    parser.add_argument("--arenas", type=int)
+    parser.add_argument("--duration", help="match length: fixed:S, uniform:MIN:MAX, normal:MEAN:SD or exp:MEAN")
+    parser.add_argument("--match-seconds", type=float, help="shorthand for --duration fixed:S")
+    parser.add_argument("--disconnect-rate", type=float, help="chance a match is aborted by a disconnect")
+    parser.add_argument("--reconnect-seconds", type=float, help="how long a disconnected player stays away")
+    parser.add_argument("--burst-interval", type=float, help="release match results in bursts this often")
+    parser.add_argument("--servers", type=int, help="number of plugins, on consecutive ports")
+    parser.add_argument("--redirect-seconds", type=float, help="how long a redirected player takes to join")
+    parser.add_argument("--drop-interval", type=float, help="close the manager's connection this long after it connects")
+    parser.add_argument("--seed", type=int, help="random seed for reproducible runs")
+    parser.add_argument("--quiet", action="store_true", default=None, help="don't log every message")
+    args = parser.parse_args()
+
+    if args.seed is not None:
+        random.seed(args.seed)
+    duration = args.duration
+    if args.match_seconds is not None:
+        duration = f"fixed:{args.match_seconds}"
+    try:
+        configure(port=args.port, players=args.players, arenas=args.arenas, duration=duration,
+                  disconnect_rate=args.disconnect_rate, reconnect_seconds=args.reconnect_seconds,
+                  burst_interval=args.burst_interval, servers=args.servers,
+                  redirect_seconds=args.redirect_seconds, drop_interval=args.drop_interval, quiet=args.quiet)
+    except ValueError as e:
+        parser.error(str(e))
+    asyncio.run(serve())
+
 if __name__ == "__main__":
-    asyncio.run(main())
\ No newline at end of file
+    main()
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+namespace mge
+{
+
+  // Bounded lock-free queue for many producer threads and one consumer
+  // (Vyukov's array queue). Each slot carries a sequence number that says
+  // whose turn it is: producers claim a slot with one CAS on the tail and
+  // publish it by bumping its sequence, so neither side ever blocks. push()
+  // fails instead of waiting when the queue is full.
+  template <typename T>
+  class MPSCQueue
+  {
+  public:
+    explicit MPSCQueue(size_t minCapacity)
+    {
+      size_t capacity = 1;
+      while (capacity < minCapacity)
+      {
+        capacity <<= 1;
+      }
+      slots.reset(new Slot[capacity]);
+      for (size_t i = 0; i < capacity; ++i)
+      {
+        slots[i].sequence.store(i, std::memory_order_relaxed);
+      }
+      mask = capacity - 1;
+    }
+
+    MPSCQueue(const MPSCQueue &) = delete;
+    MPSCQueue &operator=(const MPSCQueue &) = delete;
+
+    // Safe to call from any thread.
+    bool push(T &&value)
+    {
+      size_t pos = tail.load(std::memory_order_relaxed);
+      while (true)
+      {
+        Slot &slot = slots[pos & mask];
+        size_t sequence = slot.sequence.load(std::memory_order_acquire);
+        intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+        if (diff == 0)
+        {
+          if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+          {
+            slot.value = std::move(value);
+            slot.sequence.store(pos + 1, std::memory_order_release);
+            return true;
+          }
+        }
+        else if (diff < 0)
+        {
+          return false;
+        }
+        else
+        {
+          pos = tail.load(std::memory_order_relaxed);
+        }
+      }
+    }
+
+    // Consumer thread only.
+    bool pop(T &out)
+    {
+      Slot &slot = slots[head & mask];
+      size_t sequence = slot.sequence.load(std::memory_order_acquire);
+      if (static_cast<intptr_t>(sequence) - static_cast<intptr_t>(head + 1) < 0)
+      {
+        return false;
+      }
+      out = std::move(slot.value);
+      slot.value = T();
+      slot.sequence.store(head + mask + 1, std::memory_order_release);
+      ++head;
+      return true;
+    }
+
+    size_t capacity() const { return mask + 1; }
+
+  private:
+    struct Slot
+    {
+      std::atomic<size_t> sequence{0};
+      T value;
+    };
+
+    std::unique_ptr<Slot[]> slots;
+    size_t mask = 0;
+    // Producers and the consumer write these; keep them on separate lines.
+    alignas(64) std::atomic<size_t> tail{0};
+    alignas(64) size_t head = 0;
+  };
+
+}
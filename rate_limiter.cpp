@@ -0,0 +1,57 @@
+#include "rate_limiter.hpp"
+#include <algorithm>
+#include <thread>
+
+namespace mge
+{
+
+  void RateLimiter::configure(Options value)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    options = value;
+    options.burst = std::max(1.0, options.burst);
+    tokens = options.burst;
+    refilled = Clock::now();
+  }
+
+  RateLimiter::Clock::duration RateLimiter::tryAcquire(Clock::time_point now)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (now < pausedUntil)
+    {
+      return pausedUntil - now;
+    }
+    if (options.perSecond <= 0)
+    {
+      return Clock::duration::zero();
+    }
+
+    double elapsed = std::chrono::duration<double>(now - refilled).count();
+    tokens = std::min(options.burst, tokens + elapsed * options.perSecond);
+    refilled = now;
+    if (tokens >= 1)
+    {
+      tokens -= 1;
+      return Clock::duration::zero();
+    }
+    auto wait = std::chrono::duration<double>((1 - tokens) / options.perSecond);
+    return std::max<Clock::duration>(std::chrono::duration_cast<Clock::duration>(wait), std::chrono::microseconds(1));
+  }
+
+  RateLimiter::Clock::duration RateLimiter::acquire()
+  {
+    auto start = Clock::now();
+    for (auto wait = tryAcquire(start); wait > Clock::duration::zero(); wait = tryAcquire())
+    {
+      std::this_thread::sleep_for(wait);
+    }
+    return Clock::now() - start;
+  }
+
+  void RateLimiter::pauseUntil(Clock::time_point until)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    pausedUntil = std::max(pausedUntil, until);
+  }
+
+}
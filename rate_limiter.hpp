@@ -0,0 +1,42 @@
+#pragma once
+
+#include <chrono>
+#include <mutex>
+
+namespace mge
+{
+
+  // Token bucket for outgoing API requests. Tokens refill at perSecond up
+  // to burst and each request takes one; with perSecond at 0 there is no
+  // limit. pauseUntil() holds every request back regardless of tokens, for
+  // a server that answered 429 with a Retry-After. Thread-safe.
+  class RateLimiter
+  {
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Options
+    {
+      double perSecond = 0;
+      double burst = 1;
+    };
+
+    void configure(Options value);
+
+    // Takes a token if one is available and returns zero; otherwise takes
+    // nothing and returns how long until one will be.
+    Clock::duration tryAcquire(Clock::time_point now = Clock::now());
+    // Blocks until it has a token; returns how long that took.
+    Clock::duration acquire();
+    // Extends the pause; an earlier time than the current one is ignored.
+    void pauseUntil(Clock::time_point until);
+
+  private:
+    std::mutex mutex;
+    Options options;
+    double tokens = 1;
+    Clock::time_point refilled;
+    Clock::time_point pausedUntil;
+  };
+
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace mge
+{
+
+  // Fixed-capacity FIFO over a power-of-two ring of slots. Elements are moved
+  // in and out, never copied, and push/pop are O(1). Slots are allocated once
+  // up front, so references to queued elements stay valid until popped.
+  template <typename T>
+  class RingQueue
+  {
+  public:
+    explicit RingQueue(size_t minCapacity)
+    {
+      size_t capacity = 1;
+      while (capacity < minCapacity)
+      {
+        capacity <<= 1;
+      }
+      slots.resize(capacity);
+      mask = capacity - 1;
+    }
+
+    bool push(T &&value)
+    {
+      if (full())
+      {
+        return false;
+      }
+      slots[(head + count) & mask] = std::move(value);
+      ++count;
+      return true;
+    }
+
+    T &front() { return slots[head]; }
+    const T &front() const { return slots[head]; }
+
+    // i-th element counting from the front.
+    T &at(size_t i) { return slots[(head + i) & mask]; }
+
+    void pop()
+    {
+      if (count == 0)
+      {
+        return;
+      }
+      // Release the element's resources now rather than when the slot is
+      // next overwritten.
+      slots[head] = T();
+      head = (head + 1) & mask;
+      --count;
+    }
+
+    bool empty() const { return count == 0; }
+    bool full() const { return count == slots.size(); }
+    size_t size() const { return count; }
+    size_t capacity() const { return slots.size(); }
+
+  private:
+    std::vector<T> slots;
+    size_t mask = 0;
+    size_t head = 0;
+    size_t count = 0;
+  };
+
+}
@@ -1,27 +1,371 @@
 #include "tournament_manager.hpp"
+#include "logger.hpp"
+#include "metrics.hpp"
 #include <curl/curl.h>
 #include <libwebsockets.h>
-#include <iostream>
 #include <sstream>
 #include <algorithm>
+#include <array>
 #include <thread>
 #include <chrono>
-#include <sstream>
+#include <cctype>
+#include <cstdlib>
+#include <ctime>
+#include <deque>
+#include <iterator>
+#include <unordered_set>
 
 namespace mge
 {
 
+  const size_t FrameBuffer::HEADROOM = LWS_PRE;
+
+  std::shared_ptr<FrameBuffer> FrameBuffer::fromString(const std::string &payload, const std::string &coalesceKey)
+  {
+    auto frame = std::make_shared<FrameBuffer>();
+    frame->bytes.resize(HEADROOM + payload.size());
+    std::copy(payload.begin(), payload.end(), frame->bytes.begin() + HEADROOM);
+    frame->coalesceKey = coalesceKey;
+    return frame;
+  }
+
+  OutboundQueue::OutboundQueue(size_t capacity, size_t high, size_t low)
+      : frames(capacity), highWatermark(high), lowWatermark(low)
+  {
+  }
+
+  OutboundQueue::PushResult OutboundQueue::push(OutboundFrame frame)
+  {
+    if (frames.size() >= highWatermark)
+    {
+      isCongested = true;
+    }
+
+    if (isCongested && !frame.coalesceKey().empty())
+    {
+      // Index 0 may already be partly on the wire, so never replace it.
+      for (size_t i = 1; i < frames.size(); ++i)
+      {
+        OutboundFrame &queued = frames.at(i);
+        if (queued.coalesceKey() == frame.coalesceKey())
+        {
+          queued = std::move(frame);
+          return PushResult::Coalesced;
+        }
+      }
+    }
+
+    if (frames.full())
+    {
+      return PushResult::Overflow;
+    }
+
+    frames.push(std::move(frame));
+    return PushResult::Queued;
+  }
+
+  void OutboundQueue::pop()
+  {
+    frames.pop();
+    if (isCongested && frames.size() <= lowWatermark)
+    {
+      isCongested = false;
+    }
+  }
+
+  PlayerHandle PlayerIndex::intern(const std::string &steamId)
+  {
+    auto it = bySteamId.find(steamId);
+    if (it != bySteamId.end())
+    {
+      return it->second;
+    }
+
+    PlayerHandle player = static_cast<PlayerHandle>(entries.size());
+    entries.push_back({steamId});
+    bySteamId.emplace(steamId, player);
+    return player;
+  }
+
+  PlayerHandle PlayerIndex::find(const std::string &steamId) const
+  {
+    auto it = bySteamId.find(steamId);
+    return it == bySteamId.end() ? NO_PLAYER : it->second;
+  }
+
+  PlayerHandle PlayerIndex::findByClientId(int server, int clientId) const
+  {
+    if (server < 0 || static_cast<size_t>(server) >= byClientId.size())
+    {
+      return NO_PLAYER;
+    }
+    const std::vector<PlayerHandle> &slots = byClientId[server];
+    if (clientId < 0 || static_cast<size_t>(clientId) >= slots.size())
+    {
+      return NO_PLAYER;
+    }
+    return slots[clientId];
+  }
+
+  void PlayerIndex::setClientId(PlayerHandle player, int server, int clientId)
+  {
+    Entry &entry = entries[player];
+    if (entry.server >= 0 && entry.clientId >= 0 && byClientId[entry.server][entry.clientId] == player)
+    {
+      byClientId[entry.server][entry.clientId] = NO_PLAYER;
+    }
+
+    entry.server = server;
+    entry.clientId = server >= 0 ? clientId : -1;
+    if (entry.clientId >= 0)
+    {
+      if (static_cast<size_t>(server) >= byClientId.size())
+      {
+        byClientId.resize(server + 1);
+      }
+      std::vector<PlayerHandle> &slots = byClientId[server];
+      if (static_cast<size_t>(clientId) >= slots.size())
+      {
+        slots.resize(clientId + 1, NO_PLAYER);
+      }
+      slots[clientId] = player;
+    }
+  }
+
+  void PlayerIndex::clearServer(int server)
+  {
+    for (auto &entry : entries)
+    {
+      if (entry.server == server)
+      {
+        entry.server = -1;
+        entry.clientId = -1;
+      }
+    }
+    if (server >= 0 && static_cast<size_t>(server) < byClientId.size())
+    {
+      std::fill(byClientId[server].begin(), byClientId[server].end(), NO_PLAYER);
+    }
+  }
+
+  void PlayerIndex::clearClientIds(int server)
+  {
+    for (auto &entry : entries)
+    {
+      if (entry.server == server)
+      {
+        entry.clientId = -1;
+      }
+    }
+    if (server >= 0 && static_cast<size_t>(server) < byClientId.size())
+    {
+      std::fill(byClientId[server].begin(), byClientId[server].end(), NO_PLAYER);
+    }
+  }
+
+  MessageAssembler::Status MessageAssembler::append(const char *data, size_t len, bool finalFragment,
+                                                    size_t remaining, size_t maxSize)
+  {
+    if (!overflowed)
+    {
+      if (buffer.size() + len + remaining > maxSize)
+      {
+        overflowed = true;
+        buffer.clear();
+      }
+      else
+      {
+        if (remaining > 0)
+        {
+          buffer.reserve(buffer.size() + len + remaining);
+        }
+        buffer.append(data, len);
+      }
+    }
+
+    if (!finalFragment || remaining > 0)
+    {
+      return Status::Partial;
+    }
+    return overflowed ? Status::Overflow : Status::Complete;
+  }
+
+  void MessageAssembler::reset()
+  {
+    buffer.clear();
+    overflowed = false;
+
+    // Keep the allocation for the next message unless one unusually large
+    // message left it holding far more than typical traffic needs.
+    if (buffer.capacity() > 256 * 1024)
+    {
+      buffer.shrink_to_fit();
+    }
+  }
+
   static size_t WriteCallback(void *contents, size_t size, size_t nmemb, void *userp)
   {
     ((std::string *)userp)->append((char *)contents, size * nmemb);
     return size * nmemb;
   }
 
+  // Keeps the value of a Retry-After header; other headers are ignored.
+  static size_t HeaderCallback(char *buffer, size_t size, size_t nitems, void *userp)
+  {
+    static const std::string NAME = "retry-after:";
+    size_t length = size * nitems;
+    if (length > NAME.size() &&
+        std::equal(NAME.begin(), NAME.end(), buffer, [](char a, char b)
+                   { return a == std::tolower(static_cast<unsigned char>(b)); }))
+    {
+      std::string value(buffer + NAME.size(), length - NAME.size());
+      size_t first = value.find_first_not_of(" \t");
+      size_t last = value.find_last_not_of(" \t\r\n");
+      *static_cast<std::string *>(userp) = first == std::string::npos ? "" : value.substr(first, last - first + 1);
+    }
+    return length;
+  }
+
+  // Retry-After is either a number of seconds or an HTTP date.
+  static std::optional<std::chrono::milliseconds> parseRetryAfter(const std::string &value)
+  {
+    if (value.empty())
+    {
+      return std::nullopt;
+    }
+    char *end = nullptr;
+    double seconds = std::strtod(value.c_str(), &end);
+    if (end != value.c_str() && *end == '\0')
+    {
+      // Capped at a day so the conversion cannot overflow.
+      return std::chrono::milliseconds(static_cast<long long>(std::clamp(seconds, 0.0, 86400.0) * 1000));
+    }
+    time_t when = curl_getdate(value.c_str(), nullptr);
+    if (when < 0)
+    {
+      return std::nullopt;
+    }
+    return std::chrono::seconds(std::clamp<long long>(when - std::time(nullptr), 0, 86400));
+  }
+
+  static void observeRateLimitWait(std::chrono::steady_clock::duration waited)
+  {
+    static metrics::Histogram &waitSeconds = metrics::registry().challongeRateLimitWaitSeconds.with({});
+    waitSeconds.observe(std::chrono::duration<double>(waited).count());
+  }
+
+  // status is the HTTP code, or 0 if the transfer itself failed.
+  static void observeChallongeRequest(const std::string &method, const std::string &endpoint, long status,
+                                      std::chrono::steady_clock::time_point start)
+  {
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    metrics::registry()
+        .challongeRequestSeconds.with({method, metrics::endpointLabel(endpoint),
+                                       status > 0 ? std::to_string(status) : "error"})
+        .observe(seconds);
+  }
+
   ChallongeAPI::ChallongeAPI(const std::string &user, const std::string &key,
-                             const std::string &subdom, const std::string &tournamentUrl)
-      : username(user), apiKey(key), subdomain(subdom), tournamentUrl(tournamentUrl)
+                             const std::string &subdom, const std::string &tournamentUrl,
+                             const std::string &base)
+      : baseUrl(base), username(user), apiKey(key), subdomain(subdom), tournamentUrl(tournamentUrl)
   {
-    loadTournament();
+    share = curl_share_init();
+    if (share)
+    {
+      curl_share_setopt(share, CURLSHOPT_LOCKFUNC, &ChallongeAPI::lockShare);
+      curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, &ChallongeAPI::unlockShare);
+      curl_share_setopt(share, CURLSHOPT_USERDATA, this);
+      curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+      curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+      curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+    }
+    else
+    {
+      MGE_LOG_WARN("Failed to initialize CURL share; connections will not be reused");
+    }
+  }
+
+  ChallongeAPI::~ChallongeAPI()
+  {
+    for (CURL *curl : idleHandles)
+    {
+      curl_easy_cleanup(curl);
+    }
+    idleHandles.clear();
+
+    if (share)
+    {
+      curl_share_cleanup(share);
+    }
+  }
+
+  void ChallongeAPI::lockShare(CURL *, curl_lock_data data, curl_lock_access, void *userptr)
+  {
+    static_cast<ChallongeAPI *>(userptr)->shareLocks[data].lock();
+  }
+
+  void ChallongeAPI::unlockShare(CURL *, curl_lock_data data, void *userptr)
+  {
+    static_cast<ChallongeAPI *>(userptr)->shareLocks[data].unlock();
+  }
+
+  CURL *ChallongeAPI::acquireHandle()
+  {
+    CURL *curl = nullptr;
+    {
+      std::lock_guard<std::mutex> lock(handlePoolMutex);
+      if (!idleHandles.empty())
+      {
+        curl = idleHandles.back();
+        idleHandles.pop_back();
+      }
+    }
+
+    if (curl)
+    {
+      // Drops per-request options but keeps the handle's live connection.
+      curl_easy_reset(curl);
+    }
+    else
+    {
+      curl = curl_easy_init();
+    }
+
+    if (curl)
+    {
+      configureHandle(curl);
+    }
+    return curl;
+  }
+
+  void ChallongeAPI::releaseHandle(CURL *curl)
+  {
+    std::lock_guard<std::mutex> lock(handlePoolMutex);
+    idleHandles.push_back(curl);
+  }
+
+  void ChallongeAPI::configureHandle(CURL *curl)
+  {
+    if (share)
+    {
+      curl_easy_setopt(curl, CURLOPT_SHARE, share);
+    }
+
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, HeaderCallback);
+    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 1L);
+    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 2L);
+
+    // HTTP/2 when the server negotiates it over TLS, HTTP/1.1 keep-alive
+    // otherwise. PIPEWAIT lets concurrent transfers multiplex onto one
+    // connection instead of opening new ones.
+    curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2TLS);
+    curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPIDLE, 60L);
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPINTVL, 30L);
+    curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
   }
 
   std::string ChallongeAPI::flattenToForm(const json &j, CURL *curl, const std::string &prefix) const
@@ -32,7 +376,21 @@ namespace mge
     {
       std::string key = prefix.empty() ? it.key() : prefix + "[" + it.key() + "]";
 
-      if (it.value().is_object())
+      if (it.value().is_array())
+      {
+        // Rails-style arrays: participants[][name]=a&participants[][name]=b
+        for (const auto &element : it.value())
+        {
+          std::string sub = element.is_object()
+                                ? flattenToForm(element, curl, key + "[]")
+                                : flattenToForm(json{{"", element}}, curl, key);
+          if (!sub.empty())
+          {
+            parts.push_back(sub);
+          }
+        }
+      }
+      else if (it.value().is_object())
       {
         std::string sub = flattenToForm(it.value(), curl, key);
         if (!sub.empty())
@@ -93,34 +451,21 @@ namespace mge
     return res;
   }
 
-  std::string ChallongeAPI::makeRequest(const std::string &method,
-                                        const std::string &endpoint,
-                                        const json &data)
+  curl_slist *ChallongeAPI::prepareRequest(CURL *curl, const Request &request, Response *response)
   {
-    CURL *curl = curl_easy_init();
-    std::string response;
-
-    if (!curl)
-    {
-      std::cerr << "Failed to initialize CURL" << std::endl;
-      return "";
-    }
+    std::string url = baseUrl + request.endpoint;
 
-    std::string url = "https://api.challonge.com/v1" + endpoint;
-
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
-    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 1L);
-    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 2L);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response->body);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, &response->retryAfter);
 
     std::string auth = username + ":" + apiKey;
     curl_easy_setopt(curl, CURLOPT_USERPWD, auth.c_str());
 
     struct curl_slist *headers = nullptr;
 
-    if (method == "POST" || method == "PUT")
+    if (request.method == "POST" || request.method == "PUT")
     {
-      std::string formData = flattenToForm(data, curl, "");
+      std::string formData = flattenToForm(request.data, curl, "");
 
       headers = curl_slist_append(headers, "Content-Type: application/x-www-form-urlencoded");
       curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
@@ -128,881 +473,3673 @@ namespace mge
       curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
       curl_easy_setopt(curl, CURLOPT_COPYPOSTFIELDS, formData.c_str());
 
-      if (method == "POST")
+      if (request.method == "POST")
       {
         curl_easy_setopt(curl, CURLOPT_POST, 1L);
       }
       else
       {
-        curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, method.c_str());
+        curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, request.method.c_str());
       }
 
-      std::cout << "[DEBUG] " << method << " to " << url << std::endl;
-      std::cout << "[DEBUG] Form data: " << formData << std::endl;
+      MGE_LOG_DEBUG("Challonge request", {{"method", request.method}, {"url", url}, {"form_bytes", formData.size()}});
     }
-    else if (method == "GET" || method == "DELETE")
+    else if (request.method == "GET" || request.method == "DELETE")
     {
-      std::string params = flattenToForm(data, curl, "");
+      std::string params = flattenToForm(request.data, curl, "");
       if (!params.empty())
       {
         url += "?" + params;
       }
       curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-      if (method == "DELETE")
+      if (request.method == "DELETE")
       {
         curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "DELETE");
       }
 
-      std::cout << "[DEBUG] " << method << " to " << url << std::endl;
-    }
-
-    CURLcode res = curl_easy_perform(curl);
-
-    if (res != CURLE_OK)
-    {
-      std::cerr << "CURL error: " << curl_easy_strerror(res) << std::endl;
-    }
-    else
-    {
-      long response_code;
-      curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
-      std::cout << "[DEBUG] HTTP response code: " << response_code << std::endl;
-
-      if (response_code >= 400)
-      {
-        std::cerr << "[DEBUG] Error response body: " << response << std::endl;
-      }
+      MGE_LOG_DEBUG("Challonge request", {{"method", request.method}, {"url", url}});
     }
 
-    curl_slist_free_all(headers);
-    curl_easy_cleanup(curl);
+    return headers;
+  }
 
-    return response;
+  std::chrono::milliseconds ChallongeAPI::onRateLimited(const Request &request, const Response &response)
+  {
+    std::chrono::milliseconds pause = parseRetryAfter(response.retryAfter).value_or(DEFAULT_RATE_LIMIT_PAUSE);
+    limiter.pauseUntil(std::chrono::steady_clock::now() + std::min(pause, MAX_RATE_LIMIT_PAUSE));
+    MGE_LOG_WARN("Challonge rate limit hit", {{"endpoint", request.endpoint}, {"pause_ms", pause.count()}});
+    return pause;
   }
 
-  void ChallongeAPI::loadTournament()
+  ChallongeAPI::Response ChallongeAPI::performRequest(const Request &request)
   {
-    std::string endpoint;
-    if (!subdomain.empty())
-    {
-      endpoint = "/tournaments/" + subdomain + "-" + tournamentUrl + ".json";
-    }
-    else
+    Response response;
+    for (int retries = 0;; ++retries)
     {
-      endpoint = "/tournaments/" + tournamentUrl + ".json";
-    }
+      observeRateLimitWait(limiter.acquire());
 
-    json params = {{"include_participants", "1"}, {"include_matches", "1"}};
+      CURL *curl = acquireHandle();
+      if (!curl)
+      {
+        MGE_LOG_ERROR("Failed to initialize CURL");
+        return {};
+      }
 
-    std::cout << "[DEBUG] Loading tournament from: " << endpoint << std::endl;
-    std::string response = makeRequest("GET", endpoint, params);
-    std::cout << "[DEBUG] Tournament response length: " << response.length() << " bytes" << std::endl;
+      response = {};
+      curl_slist *headers = prepareRequest(curl, request, &response);
 
-    try
-    {
-      json j = json::parse(response);
-      if (j.contains("tournament") && j["tournament"].contains("id"))
+      auto start = std::chrono::steady_clock::now();
+      CURLcode res = curl_easy_perform(curl);
+
+      if (res != CURLE_OK)
       {
-        tournamentId = std::to_string(j["tournament"]["id"].get<int>());
-        std::cout << "✅ Loaded tournament ID: " << tournamentId << std::endl;
+        MGE_LOG_ERROR("CURL error", {{"endpoint", request.endpoint}, {"error", curl_easy_strerror(res)}});
+      }
+      else
+      {
+        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response.status);
+        MGE_LOG_DEBUG("Challonge response", {{"endpoint", request.endpoint}, {"status", response.status}});
 
-        if (j["tournament"].contains("url"))
+        if (response.status >= 400 && response.status != 429)
         {
-          std::string url = j["tournament"]["url"].get<std::string>();
-          std::cout << "   Tournament URL: " << url << std::endl;
+          MGE_LOG_WARN("Challonge error response", {{"endpoint", request.endpoint}, {"status", response.status}, {"body", response.body}});
         }
       }
-      else
+      observeChallongeRequest(request.method, request.endpoint, response.status, start);
+
+      curl_slist_free_all(headers);
+      releaseHandle(curl);
+
+      if (response.status != 429 || onRateLimited(request, response) > MAX_RATE_LIMIT_PAUSE ||
+          retries == MAX_RATE_LIMIT_RETRIES)
       {
-        std::cerr << "❌ ERROR: Could not find tournament ID in response!" << std::endl;
-        std::cerr << "   Full response: " << response << std::endl;
+        return response;
       }
     }
-    catch (const std::exception &e)
+  }
+
+  std::string ChallongeAPI::makeRequest(const std::string &method,
+                                        const std::string &endpoint,
+                                        const json &data,
+                                        long *status)
+  {
+    Response response = performRequest({method, endpoint, data});
+
+    if (status)
     {
-      std::cerr << "❌ Error parsing tournament: " << e.what() << std::endl;
-      std::cerr << "   Response was: " << response << std::endl;
+      *status = response.status;
     }
+    return std::move(response.body);
   }
 
-  void ChallongeAPI::addParticipant(const std::string &name,
-                                    const std::string &steamId, int seed)
+  std::vector<ChallongeAPI::Response> ChallongeAPI::makeRequests(const std::vector<Request> &requests,
+                                                                 const std::function<void(size_t)> &onProgress)
   {
-    if (tournamentId.empty())
+    struct Transfer
     {
-      std::cerr << "Cannot add participant: tournament ID is empty!" << std::endl;
-      return;
+      CURL *curl = nullptr;
+      curl_slist *headers = nullptr;
+      size_t index = 0;
+      std::chrono::steady_clock::time_point start;
+    };
+
+    std::vector<Response> responses(requests.size());
+    CURLM *multi = curl_multi_init();
+    if (!multi)
+    {
+      MGE_LOG_WARN("Failed to initialize CURL multi; running requests serially");
+      for (size_t i = 0; i < requests.size(); ++i)
+      {
+        responses[i].body = makeRequest(requests[i].method, requests[i].endpoint,
+                                        requests[i].data, &responses[i].status);
+        if (onProgress)
+          onProgress(i + 1);
+      }
+      return responses;
     }
 
-    std::string endpoint = "/tournaments/" + tournamentId + "/participants.json";
-    json data = {
-        {"participant", {{"name", name}, {"seed", seed}, {"misc", steamId}}}};
-
-    std::cout << "[DEBUG] Adding participant to tournament " << tournamentId << std::endl;
-    std::string response = makeRequest("POST", endpoint, data);
+    curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
 
-    if (response.empty() || response == "[]" || response.length() < 10)
+    std::map<CURL *, Transfer> inFlight;
+    // Requests not started yet; a rate limited one goes back to the front.
+    std::deque<size_t> queue;
+    for (size_t i = 0; i < requests.size(); ++i)
     {
-      std::cerr << "Failed to add participant " << name << " - empty response" << std::endl;
-      std::cerr << "   Response: " << response << std::endl;
-      return;
+      queue.push_back(i);
     }
+    std::vector<int> rateLimitRetries(requests.size(), 0);
+    size_t completed = 0;
+    // Set while the front of the queue is held back by the limiter.
+    std::optional<std::chrono::steady_clock::time_point> waitingSince;
+    std::chrono::steady_clock::duration tokenWait{};
 
-    try
+    auto startTransfers = [&]()
     {
-      json j = json::parse(response);
-      if (j.contains("errors"))
+      tokenWait = std::chrono::steady_clock::duration::zero();
+      while (!queue.empty() && inFlight.size() < MAX_PARALLEL_REQUESTS)
       {
-        std::cerr << "Error adding participant " << name << ": " << j["errors"].dump() << std::endl;
-        return;
-      }
-      if (j.contains("participant") && j["participant"].contains("id"))
-      {
-        std::cout << "Added participant: " << name << " (ID: " << j["participant"]["id"] << ")" << std::endl;
-      }
-      else
-      {
-        std::cerr << "Unexpected response when adding " << name << ": " << response << std::endl;
+        auto now = std::chrono::steady_clock::now();
+        tokenWait = limiter.tryAcquire(now);
+        if (tokenWait > std::chrono::steady_clock::duration::zero())
+        {
+          if (!waitingSince)
+            waitingSince = now;
+          return;
+        }
+        observeRateLimitWait(now - waitingSince.value_or(now));
+        waitingSince.reset();
+
+        Transfer transfer;
+        transfer.index = queue.front();
+        queue.pop_front();
+        transfer.curl = acquireHandle();
+        if (!transfer.curl)
+        {
+          MGE_LOG_ERROR("Failed to initialize CURL");
+          ++completed;
+          continue;
+        }
+        responses[transfer.index] = {};
+        transfer.headers = prepareRequest(transfer.curl, requests[transfer.index], &responses[transfer.index]);
+        transfer.start = std::chrono::steady_clock::now();
+        curl_multi_add_handle(multi, transfer.curl);
+        inFlight[transfer.curl] = transfer;
       }
-    }
-    catch (const std::exception &e)
+    };
+
+    startTransfers();
+
+    int running = 0;
+    do
     {
-      std::cerr << "Error parsing add participant response: " << e.what() << std::endl;
-      std::cerr << "   Response was: " << response << std::endl;
+      curl_multi_perform(multi, &running);
+
+      int queued = 0;
+      while (CURLMsg *msg = curl_multi_info_read(multi, &queued))
+      {
+        if (msg->msg != CURLMSG_DONE)
+          continue;
+
+        CURL *curl = msg->easy_handle;
+        Transfer transfer = inFlight[curl];
+        inFlight.erase(curl);
+        const Request &request = requests[transfer.index];
+        Response &response = responses[transfer.index];
+
+        if (msg->data.result != CURLE_OK)
+        {
+          MGE_LOG_ERROR("CURL error", {{"error", curl_easy_strerror(msg->data.result)}});
+        }
+        else
+        {
+          curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response.status);
+          if (response.status >= 400 && response.status != 429)
+          {
+            MGE_LOG_WARN("Challonge error response", {{"status", response.status}, {"body", response.body}});
+          }
+        }
+        observeChallongeRequest(request.method, request.endpoint, response.status, transfer.start);
+
+        curl_multi_remove_handle(multi, curl);
+        curl_slist_free_all(transfer.headers);
+        releaseHandle(curl);
+
+        if (response.status == 429 && onRateLimited(request, response) <= MAX_RATE_LIMIT_PAUSE &&
+            rateLimitRetries[transfer.index]++ < MAX_RATE_LIMIT_RETRIES)
+        {
+          queue.push_front(transfer.index);
+          continue;
+        }
+
+        ++completed;
+        if (onProgress)
+          onProgress(completed);
+      }
+
+      startTransfers();
+
+      if (!inFlight.empty() || !queue.empty())
+      {
+        // With nothing in flight this just sleeps until the limiter has a
+        // token again.
+        auto timeout = std::chrono::milliseconds(1000);
+        if (tokenWait > std::chrono::steady_clock::duration::zero())
+        {
+          timeout = std::min(timeout, std::chrono::ceil<std::chrono::milliseconds>(tokenWait));
+        }
+        curl_multi_poll(multi, nullptr, 0, static_cast<int>(timeout.count()), nullptr);
+      }
+    } while (!inFlight.empty() || !queue.empty());
+
+    curl_multi_cleanup(multi);
+    return responses;
+  }
+
+  static std::optional<int> optionalInt(const json &j, const char *key)
+  {
+    auto it = j.find(key);
+    if (it == j.end() || !it->is_number_integer())
+    {
+      return std::nullopt;
+    }
+    return it->get<int>();
+  }
+
+  void Bracket::clear()
+  {
+    clearParticipants();
+    clearMatches();
+  }
+
+  void Bracket::clearParticipants()
+  {
+    participants.clear();
+    participantIdBySteamId.clear();
+  }
+
+  void Bracket::clearMatches()
+  {
+    matches.clear();
+  }
+
+  void Bracket::setParticipant(ChallongeParticipant participant)
+  {
+    if (!participant.steamId.empty())
+    {
+      participantIdBySteamId[participant.steamId] = participant.id;
+    }
+    int id = participant.id;
+    participants[id] = std::move(participant);
+  }
+
+  void Bracket::setMatch(ChallongeMatch match)
+  {
+    int id = match.id;
+    matches[id] = std::move(match);
+  }
+
+  const ChallongeParticipant *Bracket::participant(int id) const
+  {
+    auto it = participants.find(id);
+    return it == participants.end() ? nullptr : &it->second;
+  }
+
+  int Bracket::participantId(const std::string &steamId) const
+  {
+    auto it = participantIdBySteamId.find(steamId);
+    return it == participantIdBySteamId.end() ? 0 : it->second;
+  }
+
+  const ChallongeMatch *Bracket::match(int id) const
+  {
+    auto it = matches.find(id);
+    return it == matches.end() ? nullptr : &it->second;
+  }
+
+  const ChallongeMatch *Bracket::findOpenMatch(int participantA, int participantB) const
+  {
+    for (const auto &[id, match] : matches)
+    {
+      if (!match.isOpen())
+        continue;
+
+      if ((*match.player1Id == participantA && *match.player2Id == participantB) ||
+          (*match.player1Id == participantB && *match.player2Id == participantA))
+      {
+        return &match;
+      }
+    }
+    return nullptr;
+  }
+
+  std::optional<PendingMatch> Bracket::pendingMatch(int matchId) const
+  {
+    const ChallongeMatch *m = match(matchId);
+    if (!m || !m->isOpen())
+    {
+      return std::nullopt;
+    }
+
+    const ChallongeParticipant *p1 = participant(*m->player1Id);
+    const ChallongeParticipant *p2 = participant(*m->player2Id);
+    if (!p1 || !p2)
+    {
+      return std::nullopt;
+    }
+
+    PendingMatch pm;
+    pm.matchId = matchId;
+    pm.player1Name = p1->name;
+    pm.player1Id = p1->steamId;
+    pm.player2Name = p2->name;
+    pm.player2Id = p2->steamId;
+    return pm;
+  }
+
+  std::vector<int> Bracket::advance(int matchId, int winnerId, int loserId)
+  {
+    std::vector<int> opened;
+
+    auto completed = matches.find(matchId);
+    if (completed == matches.end())
+    {
+      return opened;
+    }
+
+    completed->second.state = "complete";
+    completed->second.winnerId = winnerId;
+    completed->second.loserId = loserId;
+
+    for (auto &[id, next] : matches)
+    {
+      // The grand final reset takes both players from the first grand
+      // final and is only played if the losers' side wins it; leave that
+      // decision to Challonge.
+      if (next.player1PrereqMatchId == matchId && next.player2PrereqMatchId == matchId)
+      {
+        continue;
+      }
+
+      bool changed = false;
+      if (next.player1PrereqMatchId == matchId)
+      {
+        next.player1Id = next.player1IsPrereqMatchLoser ? loserId : winnerId;
+        changed = true;
+      }
+      if (next.player2PrereqMatchId == matchId)
+      {
+        next.player2Id = next.player2IsPrereqMatchLoser ? loserId : winnerId;
+        changed = true;
+      }
+
+      if (changed && next.player1Id && next.player2Id && !next.winnerId)
+      {
+        next.state = "open";
+        opened.push_back(id);
+      }
+    }
+
+    return opened;
+  }
+
+  void ChallongeAPI::clearCache()
+  {
+    bracket.clear();
+    matchesStale = true;
+  }
+
+  void ChallongeAPI::cacheTournament(const json &tournament)
+  {
+    if (tournament.contains("state") && tournament["state"].is_string())
+    {
+      tournamentState = tournament["state"].get<std::string>();
+    }
+
+    if (tournament.contains("participants"))
+    {
+      for (const auto &p : tournament["participants"])
+      {
+        if (p.contains("participant"))
+        {
+          cacheParticipant(p["participant"]);
+        }
+      }
+    }
+
+    if (tournament.contains("matches"))
+    {
+      bracket.clearMatches();
+      for (const auto &m : tournament["matches"])
+      {
+        if (m.contains("match"))
+        {
+          cacheMatch(m["match"]);
+        }
+      }
+      matchesStale = false;
+    }
+
+    MGE_LOG_DEBUG("Cached bracket", {{"participants", bracket.participantCount()}, {"matches", bracket.matchCount()}});
+  }
+
+  void ChallongeAPI::cacheParticipant(const json &participant)
+  {
+    ChallongeParticipant p;
+    p.id = participant.value("id", 0);
+    p.name = participant.value("name", "");
+    if (participant.contains("misc") && participant["misc"].is_string())
+    {
+      p.steamId = participant["misc"].get<std::string>();
+    }
+    p.seed = optionalInt(participant, "seed").value_or(0);
+
+    if (p.id == 0)
+    {
+      return;
+    }
+
+    bracket.setParticipant(std::move(p));
+  }
+
+  void ChallongeAPI::cacheMatch(const json &match)
+  {
+    ChallongeMatch m;
+    m.id = match.value("id", 0);
+    m.state = match.value("state", "");
+    m.round = optionalInt(match, "round").value_or(0);
+    m.player1Id = optionalInt(match, "player1_id");
+    m.player2Id = optionalInt(match, "player2_id");
+    m.winnerId = optionalInt(match, "winner_id");
+    m.loserId = optionalInt(match, "loser_id");
+    m.player1PrereqMatchId = optionalInt(match, "player1_prereq_match_id");
+    m.player2PrereqMatchId = optionalInt(match, "player2_prereq_match_id");
+    m.player1IsPrereqMatchLoser = match.value("player1_is_prereq_match_loser", false);
+    m.player2IsPrereqMatchLoser = match.value("player2_is_prereq_match_loser", false);
+
+    if (m.id != 0)
+    {
+      bracket.setMatch(std::move(m));
+    }
+  }
+
+  static bool isSuccess(long status)
+  {
+    return status >= 200 && status < 300;
+  }
+
+  static std::string failureText(long status)
+  {
+    return status > 0 ? "HTTP " + std::to_string(status) : "no response";
+  }
+
+  // A 4xx that another try of the same request will not get past. 404 is
+  // not one: the match may exist once our copy of the bracket catches up.
+  static bool isPermanentRejection(long status)
+  {
+    return status >= 400 && status < 500 && status != 404 && status != 429;
+  }
+
+  long ChallongeAPI::refreshParticipants()
+  {
+    long status = 0;
+    std::string endpoint = "/tournaments/" + tournamentId + "/participants.json";
+    std::string response = makeRequest("GET", endpoint, json::object(), &status);
+    if (isSuccess(status))
+    {
+      cacheParticipants(response);
+    }
+    return status;
+  }
+
+  void ChallongeAPI::cacheParticipants(const std::string &response)
+  {
+    try
+    {
+      json participantsJson = json::parse(response);
+
+      bracket.clearParticipants();
+      for (const auto &p : participantsJson)
+      {
+        if (p.contains("participant"))
+        {
+          cacheParticipant(p["participant"]);
+        }
+      }
+    }
+    catch (const std::exception &e)
+    {
+      MGE_LOG_ERROR("Error refreshing participants", {{"error", e.what()}});
+    }
+  }
+
+  long ChallongeAPI::refreshMatches()
+  {
+    long status = 0;
+    std::string endpoint = "/tournaments/" + tournamentId + "/matches.json";
+    MGE_LOG_DEBUG("Refreshing matches from Challonge", {{"endpoint", endpoint}});
+    std::string response = makeRequest("GET", endpoint, json::object(), &status);
+    if (isSuccess(status))
+    {
+      cacheMatches(response);
+    }
+    return status;
+  }
+
+  long ChallongeAPI::refreshMatch(int matchId)
+  {
+    long status = 0;
+    std::string endpoint = "/tournaments/" + tournamentId + "/matches/" + std::to_string(matchId) + ".json";
+    std::string response = makeRequest("GET", endpoint, json::object(), &status);
+    if (!isSuccess(status))
+    {
+      return status;
+    }
+
+    try
+    {
+      json j = json::parse(response);
+      if (j.contains("match"))
+      {
+        cacheMatch(j["match"]);
+      }
+    }
+    catch (const std::exception &e)
+    {
+      MGE_LOG_ERROR("Error refreshing match", {{"match", matchId}, {"error", e.what()}});
+    }
+    return status;
+  }
+
+  void ChallongeAPI::cacheMatches(const std::string &response)
+  {
+    try
+    {
+      json matchesJson = json::parse(response);
+
+      bracket.clearMatches();
+      for (const auto &m : matchesJson)
+      {
+        if (m.contains("match"))
+        {
+          cacheMatch(m["match"]);
+        }
+      }
+      matchesStale = false;
+    }
+    catch (const std::exception &e)
+    {
+      MGE_LOG_ERROR("Error refreshing matches", {{"error", e.what()}});
+    }
+  }
+
+  bool ChallongeAPI::loadTournament()
+  {
+    std::string endpoint;
+    if (!subdomain.empty())
+    {
+      endpoint = "/tournaments/" + subdomain + "-" + tournamentUrl + ".json";
+    }
+    else
+    {
+      endpoint = "/tournaments/" + tournamentUrl + ".json";
+    }
+
+    json params = {{"include_participants", "1"}, {"include_matches", "1"}};
+
+    MGE_LOG_DEBUG("Loading tournament", {{"endpoint", endpoint}});
+    std::string response = makeRequest("GET", endpoint, params);
+    MGE_LOG_DEBUG("Tournament response", {{"bytes", response.length()}});
+
+    try
+    {
+      json j = json::parse(response);
+      if (j.contains("tournament") && j["tournament"].contains("id"))
+      {
+        tournamentId = std::to_string(j["tournament"]["id"].get<int>());
+        MGE_LOG_INFO("Loaded tournament", {{"id", tournamentId}, {"url", j["tournament"].value("url", "")}});
+
+        clearCache();
+        cacheTournament(j["tournament"]);
+        return true;
+      }
+      MGE_LOG_ERROR("Could not find tournament ID in response", {{"response", response}});
+    }
+    catch (const std::exception &e)
+    {
+      MGE_LOG_ERROR("Error parsing tournament", {{"error", e.what()}, {"response", response}});
+    }
+    return false;
+  }
+
+  void ChallongeAPI::resync()
+  {
+    MGE_LOG_DEBUG("Re-syncing tournament state from Challonge");
+    loadTournament();
+  }
+
+  void ChallongeAPI::addParticipant(const std::string &name,
+                                    const std::string &steamId, int seed)
+  {
+    if (tournamentId.empty())
+    {
+      MGE_LOG_ERROR("Cannot add participant: tournament ID is empty");
+      return;
+    }
+
+    std::string endpoint = "/tournaments/" + tournamentId + "/participants.json";
+    json data = {
+        {"participant", {{"name", name}, {"seed", seed}, {"misc", steamId}}}};
+
+    MGE_LOG_DEBUG("Adding participant", {{"tournament", tournamentId}, {"name", name}});
+    std::string response = makeRequest("POST", endpoint, data);
+
+    if (response.empty() || response == "[]" || response.length() < 10)
+    {
+      MGE_LOG_ERROR("Failed to add participant: empty response", {{"name", name}, {"response", response}});
+      return;
+    }
+
+    try
+    {
+      json j = json::parse(response);
+      if (j.contains("errors"))
+      {
+        MGE_LOG_ERROR("Error adding participant", {{"name", name}, {"errors", j["errors"]}});
+        return;
+      }
+      if (j.contains("participant") && j["participant"].contains("id"))
+      {
+        cacheParticipant(j["participant"]);
+        MGE_LOG_INFO("Added participant", {{"name", name}, {"id", j["participant"]["id"]}});
+      }
+      else
+      {
+        MGE_LOG_ERROR("Unexpected response when adding participant", {{"name", name}, {"response", response}});
+      }
+    }
+    catch (const std::exception &e)
+    {
+      MGE_LOG_ERROR("Error parsing add participant response", {{"error", e.what()}, {"response", response}});
+    }
+  }
+
+  void ChallongeAPI::addParticipants(const std::vector<Player> &roster)
+  {
+    if (tournamentId.empty())
+    {
+      MGE_LOG_ERROR("Cannot add participants: tournament ID is empty");
+      return;
+    }
+
+    std::string endpoint = "/tournaments/" + tournamentId + "/participants/bulk_add.json";
+
+    // Roster indices still to add; the seed is always index + 1.
+    std::vector<size_t> missing;
+    for (size_t i = 0; i < roster.size(); ++i)
+    {
+      if (!bracket.participantId(roster[i].steamId))
+      {
+        missing.push_back(i);
+      }
+    }
+
+    for (size_t start = 0; start < missing.size(); start += BULK_ADD_CHUNK_SIZE)
+    {
+      size_t end = std::min(missing.size(), start + BULK_ADD_CHUNK_SIZE);
+
+      json entries = json::array();
+      for (size_t k = start; k < end; ++k)
+      {
+        const Player &player = roster[missing[k]];
+        entries.push_back({{"name", player.name},
+                           {"seed", static_cast<int>(missing[k] + 1)},
+                           {"misc", player.steamId}});
+      }
+
+      MGE_LOG_DEBUG("Bulk adding participants", {{"first", start + 1}, {"last", end}, {"total", missing.size()}});
+      long status = 0;
+      std::string response = makeRequest("POST", endpoint, {{"participants", entries}}, &status);
+
+      bool added = false;
+      try
+      {
+        json j = json::parse(response);
+        if (j.is_array())
+        {
+          for (const auto &p : j)
+          {
+            if (p.contains("participant"))
+            {
+              cacheParticipant(p["participant"]);
+            }
+          }
+          added = true;
+        }
+        else if (j.contains("errors"))
+        {
+          MGE_LOG_ERROR("Error bulk adding participants", {{"errors", j["errors"]}});
+        }
+      }
+      catch (const std::exception &e)
+      {
+        MGE_LOG_ERROR("Error parsing bulk add response", {{"error", e.what()}});
+      }
+
+      if (!added && (status == 0 || status == 429 || status >= 500))
+      {
+        // The chunk may have gone in anyway; the caller retries once
+        // Challonge is back, checking which players it has first.
+        MGE_LOG_WARN("Bulk add failed, leaving participants for a retry", {{"first", start + 1}, {"last", end}, {"status", status}});
+      }
+      else if (!added)
+      {
+        // Keep the event going even if bulk_add is rejected for this chunk.
+        MGE_LOG_WARN("Falling back to adding participants one at a time", {{"first", start + 1}, {"last", end}});
+        for (size_t k = start; k < end; ++k)
+        {
+          const Player &player = roster[missing[k]];
+          addParticipant(player.name, player.steamId, static_cast<int>(missing[k] + 1));
+        }
+      }
+    }
+
+    MGE_LOG_INFO("Added participants", {{"count", missing.size()}, {"already_registered", roster.size() - missing.size()}});
+  }
+
+  long ChallongeAPI::startTournament()
+  {
+    if (tournamentId.empty())
+    {
+      MGE_LOG_ERROR("Cannot start tournament: tournament ID is empty");
+      return 0;
+    }
+
+    // Ask for the generated bracket in the same response so the match cache
+    // is filled without a separate GET.
+    std::string endpoint = "/tournaments/" + tournamentId + "/start.json";
+    json data = {{"include_participants", "1"}, {"include_matches", "1"}};
+
+    MGE_LOG_DEBUG("Starting tournament", {{"tournament", tournamentId}});
+    long status = 0;
+    std::string response = makeRequest("POST", endpoint, data, &status);
+
+    matchesStale = true;
+
+    if (response.empty() || response.length() < 10)
+    {
+      MGE_LOG_ERROR("Failed to start tournament: empty response", {{"response", response}});
+      return status;
+    }
+
+    try
+    {
+      json j = json::parse(response);
+      if (j.contains("errors"))
+      {
+        MGE_LOG_ERROR("Error starting tournament", {{"errors", j["errors"]}});
+        return status;
+      }
+      if (j.contains("tournament"))
+      {
+        std::string state = j["tournament"].value("state", "unknown");
+        MGE_LOG_INFO("Tournament started", {{"state", state}});
+        cacheTournament(j["tournament"]);
+      }
+      else
+      {
+        MGE_LOG_ERROR("Unexpected start tournament response", {{"response", response}});
+      }
+    }
+    catch (const std::exception &e)
+    {
+      MGE_LOG_ERROR("Error parsing start tournament response", {{"error", e.what()}, {"response", response}});
+    }
+    return status;
+  }
+
+  void ChallongeAPI::resetTournament(const std::function<void(size_t, size_t)> &onProgress)
+  {
+    if (tournamentId.empty())
+    {
+      MGE_LOG_ERROR("Cannot reset tournament: tournament ID is empty");
+      return;
+    }
+
+    MGE_LOG_DEBUG("Resetting tournament", {{"tournament", tournamentId}});
+
+    // Reset first: Challonge only lets participants be removed outright
+    // while the tournament is pending.
+    std::string resetEndpoint = "/tournaments/" + tournamentId + "/reset.json";
+    MGE_LOG_DEBUG("Resetting tournament state");
+    long status = 0;
+    std::string resetResponse = makeRequest("POST", resetEndpoint, json::object(), &status);
+    if (status < 200 || status >= 300)
+    {
+      // Removing participants cannot work either, so nothing else is sent.
+      MGE_LOG_ERROR("Failed to reset tournament", {{"tournament", tournamentId}, {"status", status}, {"body", resetResponse}});
+      return;
+    }
+
+    clearCache();
+
+    std::string clearEndpoint = "/tournaments/" + tournamentId + "/participants/clear.json";
+    makeRequest("DELETE", clearEndpoint, json::object(), &status);
+
+    if (status >= 200 && status < 300)
+    {
+      MGE_LOG_INFO("Tournament reset complete (participants cleared)");
+      if (onProgress)
+        onProgress(1, 1);
+      return;
+    }
+
+    MGE_LOG_DEBUG("participants/clear unavailable, deleting participants individually", {{"status", status}});
+
+    std::string participantsEndpoint = "/tournaments/" + tournamentId + "/participants.json";
+    std::string participantsResponse = makeRequest("GET", participantsEndpoint, json::object());
+
+    try
+    {
+      json participantsJson = json::parse(participantsResponse);
+
+      std::vector<Request> deletes;
+      for (auto &p : participantsJson)
+      {
+        if (p.contains("participant"))
+        {
+          int participantId = p["participant"]["id"].get<int>();
+          deletes.push_back({"DELETE",
+                             "/tournaments/" + tournamentId + "/participants/" + std::to_string(participantId) + ".json",
+                             json::object()});
+        }
+      }
+
+      MGE_LOG_DEBUG("Deleting participants", {{"count", deletes.size()}, {"parallel", MAX_PARALLEL_REQUESTS}});
+
+      size_t total = deletes.size();
+      if (onProgress)
+        onProgress(0, total);
+
+      auto responses = makeRequests(deletes, [&](size_t done)
+                                    {
+                                      if (onProgress)
+                                        onProgress(done, total); });
+
+      size_t failed = std::count_if(responses.begin(), responses.end(), [](const Response &r)
+                                    { return r.status < 200 || r.status >= 300; });
+      if (failed > 0)
+      {
+        MGE_LOG_ERROR("Failed to delete participants", {{"failed", failed}, {"total", total}});
+      }
+
+      MGE_LOG_INFO("Tournament reset complete");
+    }
+    catch (const std::exception &e)
+    {
+      MGE_LOG_ERROR("Error resetting tournament", {{"error", e.what()}});
+    }
+  }
+
+  std::vector<PendingMatch> ChallongeAPI::getPendingMatches()
+  {
+    if (tournamentId.empty())
+    {
+      MGE_LOG_ERROR("Cannot get matches: tournament ID is empty");
+      return {};
+    }
+
+    if (matchesStale)
+    {
+      refreshMatches();
+    }
+
+    std::vector<PendingMatch> pending;
+    bool refreshedParticipants = false;
+
+    for (const auto &[id, match] : bracket.allMatches())
+    {
+      if (!match.isOpen())
+        continue;
+
+      // A participant we have never seen was added outside this process;
+      // pick up the roster once rather than skipping the match.
+      if ((!bracket.participant(*match.player1Id) || !bracket.participant(*match.player2Id)) &&
+          !refreshedParticipants)
+      {
+        refreshParticipants();
+        refreshedParticipants = true;
+      }
+
+      std::optional<PendingMatch> pm = bracket.pendingMatch(id);
+      if (!pm)
+      {
+        MGE_LOG_DEBUG("Could not find player info for match", {{"match", id}});
+        continue;
+      }
+
+      MGE_LOG_DEBUG("Added pending match", {{"match", id}, {"player1", pm->player1Name}, {"player2", pm->player2Name}});
+      pending.push_back(std::move(*pm));
+    }
+
+    MGE_LOG_DEBUG("Returning pending matches", {{"count", pending.size()}});
+    return pending;
+  }
+
+  WriteResult ChallongeAPI::registerRoster(const std::vector<Player> &roster, bool verify, std::string &error)
+  {
+    if ((tournamentId.empty() || verify) && !loadTournament())
+    {
+      error = "tournament could not be loaded";
+      return WriteResult::Retry;
+    }
+
+    if (verify && tournamentState != "pending" && bracket.matchCount() > 0)
+    {
+      // Started already: by an earlier attempt if the whole roster is in,
+      // otherwise by someone else, and it is not ours to reset.
+      for (const Player &player : roster)
+      {
+        if (!bracket.participantId(player.steamId))
+        {
+          error = "tournament was started without " + player.steamId;
+          return WriteResult::Failed;
+        }
+      }
+      return WriteResult::AlreadyApplied;
+    }
+
+    MGE_LOG_INFO("Adding players to Challonge", {{"count", roster.size()}});
+    addParticipants(roster);
+
+    size_t missing = std::count_if(roster.begin(), roster.end(), [this](const Player &player)
+                                   { return !bracket.participantId(player.steamId); });
+    if (missing > 0)
+    {
+      error = std::to_string(missing) + " participants could not be added";
+      return WriteResult::Retry;
+    }
+
+    MGE_LOG_DEBUG("All players added, starting Challonge tournament");
+    long status = startTournament();
+    if (!isSuccess(status) || bracket.matchCount() == 0)
+    {
+      error = "start: " + failureText(status);
+      return WriteResult::Retry;
+    }
+    return WriteResult::Applied;
+  }
+
+  WriteResult ChallongeAPI::reportMatch(int matchId, const std::string &winnerId, const std::string &loserId,
+                                        bool verify, std::string &rejection, std::string &error)
+  {
+    if (tournamentId.empty() && !loadTournament())
+    {
+      error = "tournament could not be loaded";
+      return WriteResult::Retry;
+    }
+
+    if (!bracket.participantId(winnerId) || !bracket.participantId(loserId))
+    {
+      long status = refreshParticipants();
+      if (!isSuccess(status))
+      {
+        error = "participants: " + failureText(status);
+        return WriteResult::Retry;
+      }
+    }
+
+    int winnerParticipantId = bracket.participantId(winnerId);
+    int loserParticipantId = bracket.participantId(loserId);
+
+    if (!winnerParticipantId || !loserParticipantId)
+    {
+      MGE_LOG_ERROR("Could not find participant IDs for match", {{"winner", winnerId}, {"loser", loserId}});
+      error = "unknown participant";
+      return WriteResult::Failed;
+    }
+
+    // Without a match id the result belongs to the open match between the
+    // two, or, if that is already reported, to the one they played.
+    auto lookup = [&]() -> const ChallongeMatch *
+    {
+      if (matchId)
+      {
+        return bracket.match(matchId);
+      }
+      if (const ChallongeMatch *open = bracket.findOpenMatch(winnerParticipantId, loserParticipantId))
+      {
+        return open;
+      }
+      for (const auto &[id, match] : bracket.allMatches())
+      {
+        if (match.winnerId == winnerParticipantId && match.loserId == loserParticipantId)
+        {
+          return &match;
+        }
+      }
+      return nullptr;
+    };
+    auto refresh = [&]()
+    {
+      return matchId ? refreshMatch(matchId) : refreshMatches();
+    };
+
+    const ChallongeMatch *match = nullptr;
+    if (!verify)
+    {
+      match = lookup();
+    }
+    if (!match || !match->isOpen())
+    {
+      // Verifying, or our copy may predate the bracket advancing on
+      // Challonge's side.
+      long status = refresh();
+      if (status == 404)
+      {
+        error = "match not found";
+        return WriteResult::Failed;
+      }
+      if (!isSuccess(status))
+      {
+        error = "match state: " + failureText(status);
+        return WriteResult::Retry;
+      }
+      match = lookup();
+    }
+
+    if (!match)
+    {
+      MGE_LOG_ERROR("Could not find match between participants", {{"winner", winnerParticipantId}, {"loser", loserParticipantId}});
+      error = "no match between the participants";
+      return WriteResult::Failed;
+    }
+    if (match->winnerId)
+    {
+      if (*match->winnerId == winnerParticipantId)
+      {
+        return WriteResult::AlreadyApplied;
+      }
+      error = "match " + std::to_string(match->id) + " was won by participant " + std::to_string(*match->winnerId);
+      return WriteResult::Failed;
+    }
+    if (!match->isOpen())
+    {
+      // Waiting on the result of an earlier match that is not in yet.
+      error = "match " + std::to_string(match->id) + " is not open";
+      return WriteResult::Retry;
+    }
+    if (verify && !rejection.empty())
+    {
+      // The match is open without the result, and Challonge turned it
+      // down last time for a reason another try will not change.
+      error = rejection;
+      return WriteResult::Failed;
+    }
+
+    int reportedId = match->id;
+    std::string updateEndpoint = "/tournaments/" + tournamentId +
+                                 "/matches/" + std::to_string(reportedId) + ".json";
+
+    std::string scoreCsv = (*match->player1Id == winnerParticipantId) ? "1-0" : "0-1";
+    json updateData = {
+        {"match", {{"scores_csv", scoreCsv}, {"winner_id", winnerParticipantId}}}};
+
+    long status = 0;
+    std::string response = makeRequest("PUT", updateEndpoint, updateData, &status);
+    matchesStale = true;
+
+    if (!isSuccess(status))
+    {
+      // Even a rejection is retried: the next attempt verifies against
+      // Challonge and settles whether the result is in or cannot be.
+      error = "report: " + failureText(status);
+      rejection.clear();
+      if (isPermanentRejection(status))
+      {
+        rejection = response.empty() ? error : response;
+      }
+      return WriteResult::Retry;
+    }
+
+    try
+    {
+      json j = json::parse(response);
+      if (j.contains("match"))
+      {
+        cacheMatch(j["match"]);
+      }
+      MGE_LOG_INFO("Reported match result", {{"match", reportedId}});
+    }
+    catch (const std::exception &e)
+    {
+      MGE_LOG_ERROR("Error parsing report match response", {{"error", e.what()}});
+    }
+    return WriteResult::Applied;
+  }
+
+  TournamentManager::TournamentManager(lws_context *ctx, const std::string &challongeUser,
+                                       const std::string &challongeKey, const std::string &tournamentUrl,
+                                       const std::string &challongeBaseUrl)
+      : context(ctx), tournamentActive(false)
+  {
+    registerHandlers();
+    setMGEEndpoints({});
+
+    challonge = std::make_unique<ChallongeAPI>(challongeUser, challongeKey, "", tournamentUrl, challongeBaseUrl);
+    challongeExecutor = std::make_unique<ChallongeExecutor>([ctx]()
+                                                            {
+                                                              if (ctx)
+                                                                lws_cancel_service(ctx); });
+
+    loadBracket();
+  }
+
+  void TournamentManager::loadBracket()
+  {
+    ChallongeAPI *api = challonge.get();
+    ++loadAttempts;
+    challongeExecutor->submit([api]()
+                              {
+                                bool ok = api->loadTournament();
+                                return std::make_pair(ok, api->snapshot()); },
+                              [this](std::pair<bool, Bracket> loaded)
+                              {
+                                if (!loaded.first)
+                                {
+                                  retryBracketLoad("Failed to load tournament");
+                                  return;
+                                }
+                                loadAttempts = 0;
+                                bracket = std::move(loaded.second);
+                                bracketLoaded = true;
+                                if (reconcilePending)
+                                {
+                                  reconcileRestoredState();
+                                }
+                              },
+                              [this](const std::string &error)
+                              { retryBracketLoad(error); });
+  }
+
+  void TournamentManager::retryBracketLoad(const std::string &error)
+  {
+    // Restored state is only reconciled against a bracket that really came
+    // back; an empty one would look like a tournament that never started.
+    std::chrono::milliseconds delay = outbox.delayFor(loadAttempts);
+    loadRetryAt = std::chrono::steady_clock::now() + delay;
+    MGE_LOG_WARN("Retrying tournament load", {{"attempts", loadAttempts}, {"delay_ms", delay.count()}, {"error", error}});
+  }
+
+  TournamentManager::~TournamentManager()
+  {
+    // The timers live in the servers, and lws must not fire them later.
+    for (auto &server : mgeServers)
+    {
+      cancelMGETimers(*server);
+    }
+  }
+
+  void TournamentManager::processChallongeResults()
+  {
+    challongeExecutor->drainCompletions();
+    if (loadRetryAt && std::chrono::steady_clock::now() >= *loadRetryAt)
+    {
+      loadRetryAt.reset();
+      loadBracket();
+    }
+    drainOutbox();
+  }
+
+  // Metric label for a server; the unnamed default one is "default".
+  static std::string serverLabel(const MGEServer &server)
+  {
+    return server.endpoint.name.empty() ? "default" : server.endpoint.name;
+  }
+
+  std::string TournamentManager::renderMetrics() const
+  {
+    std::string out = metrics::registry().render();
+
+    metrics::appendHeader(out, "mge_ws_queue_depth", "Frames waiting to be written, per WebSocket connection.", "gauge");
+    for (const auto &[wsi, conn] : connections)
+    {
+      metrics::appendSample(out, "mge_ws_queue_depth",
+                            metrics::formatLabels({"connection", "peer"},
+                                                  {std::to_string(conn->id), conn->type.empty() ? "unknown" : conn->type}),
+                            static_cast<double>(conn->messageQueue.size()));
+    }
+    for (const auto &server : mgeServers)
+    {
+      std::string connection = server->endpoint.name.empty() ? "mge" : "mge:" + server->endpoint.name;
+      metrics::appendSample(out, "mge_ws_queue_depth", metrics::formatLabels({"connection", "peer"}, {connection, "mge"}),
+                            static_cast<double>(server->outgoing.size()));
+    }
+
+    metrics::appendHeader(out, "mge_arenas", "Arenas known to the manager, by MGE server and state.", "gauge");
+    for (const auto &server : mgeServers)
+    {
+      std::string label = serverLabel(*server);
+      metrics::appendSample(out, "mge_arenas", metrics::formatLabels({"server", "state"}, {label, "occupied"}),
+                            static_cast<double>(server->occupied));
+      metrics::appendSample(out, "mge_arenas", metrics::formatLabels({"server", "state"}, {label, "free"}),
+                            static_cast<double>(server->arenaCount() - server->occupied));
+    }
+
+    metrics::appendHeader(out, "mge_open_matches", "Open matches in the local bracket view.", "gauge");
+    metrics::appendSample(out, "mge_open_matches", "", static_cast<double>(openMatches.size()));
+    metrics::appendHeader(out, "mge_ready_matches", "Open matches queued for an arena.", "gauge");
+    metrics::appendSample(out, "mge_ready_matches", "", static_cast<double>(readyMatches.size()));
+
+    metrics::appendHeader(out, "mge_challonge_pending_requests", "Challonge jobs submitted but not yet completed.", "gauge");
+    metrics::appendSample(out, "mge_challonge_pending_requests", "",
+                          static_cast<double>(challongeExecutor->pendingRequests()));
+
+    metrics::appendHeader(out, "mge_challonge_outbox_depth", "Challonge writes not confirmed yet, by kind.", "gauge");
+    for (OutboxEntry::Kind kind : {OutboxEntry::Kind::Register, OutboxEntry::Kind::ReportMatch})
+    {
+      metrics::appendSample(out, "mge_challonge_outbox_depth", metrics::formatLabels({"kind"}, {outboxKindName(kind)}),
+                            static_cast<double>(outbox.count(kind)));
+    }
+
+    metrics::appendHeader(out, "mge_mge_connected", "Whether the MGE plugin connection is up, per MGE server.", "gauge");
+    for (const auto &server : mgeServers)
+    {
+      metrics::appendSample(out, "mge_mge_connected", metrics::formatLabels({"server"}, {serverLabel(*server)}),
+                            server->connected ? 1 : 0);
+    }
+    metrics::appendHeader(out, "mge_mge_ping_seconds",
+                          "Smoothed time for an MGE plugin to answer get_players or get_arenas, per MGE server.", "gauge");
+    for (const auto &server : mgeServers)
+    {
+      metrics::appendSample(out, "mge_mge_ping_seconds", metrics::formatLabels({"server"}, {serverLabel(*server)}),
+                            server->pingSeconds);
+    }
+    metrics::appendHeader(out, "mge_mge_offline_queue_depth",
+                          "Commands held for an MGE plugin until it reconnects, per MGE server.", "gauge");
+    for (const auto &server : mgeServers)
+    {
+      metrics::appendSample(out, "mge_mge_offline_queue_depth", metrics::formatLabels({"server"}, {serverLabel(*server)}),
+                            static_cast<double>(server->offline.size()));
+    }
+    return out;
+  }
+
+  static std::string steamIdOf(const PlayerIndex &index, PlayerHandle player)
+  {
+    return player == NO_PLAYER ? std::string() : index.steamId(player);
+  }
+
+  static json rosterJson(const std::vector<Player> &roster)
+  {
+    json out = json::array();
+    for (const Player &player : roster)
+    {
+      out.push_back(player.toJson());
+    }
+    return out;
+  }
+
+  // Inverse of Player::toJson(); the MGE fields are unknown until the
+  // plugin sends get_players.
+  static Player playerFromJson(const json &j)
+  {
+    Player player;
+    player.steamId = j.value("steamId", "");
+    player.name = j.value("name", "");
+    player.elo = j.value("elo", 1000);
+    player.clientId = -1;
+    player.arena = 0;
+    player.inArena = false;
+    return player;
+  }
+
+  // The arena layout without occupancy, as journaled.
+  static json arenaTableJson(const std::vector<Arena> &table,
+                             const std::vector<std::unique_ptr<MGEServer>> &servers)
+  {
+    json out = json::array();
+    for (const Arena &arena : table)
+    {
+      json entry = {{"id", arena.id}, {"name", arena.name}, {"priority", arena.priority}};
+      const std::string &server = servers[arena.server]->endpoint.name;
+      if (!server.empty())
+      {
+        entry["server"] = server;
+      }
+      out.push_back(std::move(entry));
+    }
+    return out;
+  }
+
+  static std::vector<Arena> arenaTableFromJson(const json &j)
+  {
+    std::vector<Arena> table;
+    for (const auto &a : j)
+    {
+      Arena arena;
+      arena.id = a.at("id").get<int>();
+      arena.name = a.value("name", "");
+      arena.priority = a.value("priority", 0);
+      table.push_back(arena);
+    }
+    return table;
+  }
+
+  void TournamentManager::registerPlayers(std::vector<Player> roster)
+  {
+    OutboxEntry entry;
+    entry.kind = OutboxEntry::Kind::Register;
+    entry.roster = rosterJson(roster);
+    enqueueWrite(std::move(entry));
+  }
+
+  void TournamentManager::reportResult(const std::string &winnerSteamId, const std::string &loserSteamId)
+  {
+    ++matchStateVersion;
+
+    // Looked up before completeMatch() advances the local bracket. If the
+    // bracket is not loaded yet, as right after a restart, the match is
+    // left for the API to find by its players.
+    const ChallongeMatch *match = bracket.findOpenMatch(bracket.participantId(winnerSteamId),
+                                                        bracket.participantId(loserSteamId));
+    OutboxEntry entry;
+    entry.kind = OutboxEntry::Kind::ReportMatch;
+    entry.matchId = match ? match->id : 0;
+    entry.winnerSteamId = winnerSteamId;
+    entry.loserSteamId = loserSteamId;
+    enqueueWrite(std::move(entry));
+  }
+
+  void TournamentManager::enqueueWrite(OutboxEntry entry)
+  {
+    const OutboxEntry &added = outbox.add(std::move(entry));
+    record({{"event", "outbox"}, {"entry", added.toJson()}});
+    drainOutbox();
+  }
+
+  void TournamentManager::drainOutbox()
+  {
+    if (outbox.empty())
+    {
+      return;
+    }
+    for (uint64_t id : outbox.takeDue(std::chrono::steady_clock::now()))
+    {
+      sendWrite(*outbox.find(id));
+    }
+  }
+
+  void TournamentManager::sendWrite(const OutboxEntry &entry)
+  {
+    ChallongeAPI *api = challonge.get();
+    uint64_t id = entry.id;
+    bool verify = entry.attempts > 1;
+
+    if (entry.kind == OutboxEntry::Kind::Register)
+    {
+      std::vector<Player> roster;
+      for (const auto &p : entry.roster)
+      {
+        roster.push_back(playerFromJson(p));
+      }
+      challongeExecutor->submit(
+          [api, roster = std::move(roster), verify]()
+          {
+            std::string error;
+            WriteResult result = api->registerRoster(roster, verify, error);
+            return std::make_tuple(result, std::move(error), api->snapshot());
+          },
+          [this, id](std::tuple<WriteResult, std::string, Bracket> done)
+          {
+            auto &[result, error, started] = done;
+            if (result != WriteResult::Retry && result != WriteResult::Failed && outbox.find(id))
+            {
+              bracket = std::move(started);
+            }
+            finishWrite(id, result, error);
+          },
+          [this, id](const std::string &error)
+          { finishWrite(id, WriteResult::Retry, error); });
+      return;
+    }
+
+    challongeExecutor->submit(
+        [api, matchId = entry.matchId, winner = entry.winnerSteamId, loser = entry.loserSteamId, verify,
+         rejection = entry.rejection]() mutable
+        {
+          std::string error;
+          WriteResult result = api->reportMatch(matchId, winner, loser, verify, rejection, error);
+          return std::make_tuple(result, std::move(error), std::move(rejection));
+        },
+        [this, id](std::tuple<WriteResult, std::string, std::string> done)
+        {
+          auto &[result, error, rejection] = done;
+          if (OutboxEntry *entry = outbox.find(id))
+          {
+            entry->rejection = std::move(rejection);
+          }
+          finishWrite(id, result, error);
+        },
+        [this, id](const std::string &error)
+        { finishWrite(id, WriteResult::Retry, error); });
+  }
+
+  void TournamentManager::finishWrite(uint64_t id, WriteResult result, const std::string &error)
+  {
+    OutboxEntry *entry = outbox.find(id);
+    if (!entry)
+    {
+      // Cleared by a tournament start or stop while in flight.
+      return;
+    }
+    const char *kind = outboxKindName(entry->kind);
+    metrics::registry().challongeWrites.with({kind, writeResultName(result)}).inc();
+    auto now = std::chrono::steady_clock::now();
+
+    if (result == WriteResult::Retry)
+    {
+      auto delay = outbox.retryLater(id, now, error);
+      MGE_LOG_WARN("Challonge write failed, retrying", {{"kind", kind},
+                                                         {"match", entry->matchId},
+                                                         {"attempts", entry->attempts},
+                                                         {"retry_ms", static_cast<long long>(delay.count())},
+                                                         {"error", error}});
+      return;
+    }
+
+    OutboxEntry done = std::move(*entry);
+    outbox.remove(id);
+
+    if (result == WriteResult::Failed)
+    {
+      MGE_LOG_ERROR("Challonge write cannot be applied, dropping it", {{"kind", kind},
+                                                                       {"match", done.matchId},
+                                                                       {"winner", done.winnerSteamId},
+                                                                       {"loser", done.loserSteamId},
+                                                                       {"error", error}});
+      sendToConnection(admin, {{"type", "Error"},
+                               {"payload", {{"message", std::string("Challonge ") + kind + " failed: " + error}}}});
+    }
+    else if (done.attempts > 1)
+    {
+      MGE_LOG_INFO("Challonge write went through after retrying", {{"kind", kind},
+                                                                   {"match", done.matchId},
+                                                                   {"attempts", done.attempts},
+                                                                   {"already_applied", result == WriteResult::AlreadyApplied}});
+      // Challonge is reachable again, so writes still backing off need not
+      // wait out their delay.
+      outbox.retryAllNow(now);
+    }
+
+    if (done.kind == OutboxEntry::Kind::Register && result != WriteResult::Failed)
+    {
+      playersRegistered = true;
+      record({{"event", "registered"}, {"players", done.roster}});
+    }
+    record({{"event", "sent"}, {"id", id}});
+
+    // Open-match syncs are not applied while results are outstanding, so
+    // catch up once a late one settles, or once registration created the
+    // bracket. Reports that settle after a stop schedule nothing.
+    if (tournamentActive &&
+        (done.kind == OutboxEntry::Kind::Register ? result != WriteResult::Failed
+                                                  : done.attempts > 1 || result == WriteResult::Failed))
+    {
+      MGE_LOG_DEBUG("Fetching open matches", {{"after", kind}});
+      syncOpenMatches();
+    }
+    drainOutbox();
+  }
+
+  bool TournamentManager::openJournal(const StateJournal::Options &options)
+  {
+    auto start = std::chrono::steady_clock::now();
+
+    // State journaled for another tournament must not be replayed against
+    // this one: a pending registration would enter last event's roster.
+    StateJournal::Options owned = options;
+    owned.owner = challonge->identity();
+    auto opened = std::make_unique<StateJournal>(owned);
+    json snapshot;
+    std::vector<json> events;
+    if (!opened->open(snapshot, events))
+    {
+      return false;
+    }
+
+    replaying = true;
+    if (!snapshot.is_null())
+    {
+      restoreState(snapshot);
+    }
+    for (const json &event : events)
+    {
+      replay(event);
+    }
+    replaying = false;
+    journal = std::move(opened);
+
+    if (!snapshot.is_null() || !events.empty())
+    {
+      auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+      MGE_LOG_INFO("Restored tournament state", {{"dir", options.dir},
+                                                 {"events", events.size()},
+                                                 {"active", tournamentActive},
+                                                 {"registered", playersRegistered},
+                                                 {"outbox", outbox.size()},
+                                                 {"ms", elapsed.count()}});
+      // Start the new run from a compact snapshot instead of the replayed
+      // tail.
+      journal->snapshot(captureState());
+
+      reconcilePending = tournamentActive;
+      if (reconcilePending && bracketLoaded)
+      {
+        reconcileRestoredState();
+      }
+    }
+    return true;
+  }
+
+  void TournamentManager::record(json event)
+  {
+    if (!journal || replaying)
+    {
+      return;
+    }
+    journal->append(std::move(event));
+    if (journal->snapshotDue())
+    {
+      journal->snapshot(captureState());
+    }
+  }
+
+  json TournamentManager::captureState() const
+  {
+    json occupied = json::array();
+    for (const Arena &arena : arenas)
+    {
+      if (!arena.isEmpty())
+      {
+        json entry = {{"arena", arena.id},
+                      {"player1", steamIdOf(playerIndex, arena.player1)},
+                      {"player2", steamIdOf(playerIndex, arena.player2)}};
+        tagServer(entry, arena.server);
+        occupied.push_back(std::move(entry));
+      }
+    }
+
+    json writes = json::array();
+    for (const auto &[id, entry] : outbox.all())
+    {
+      writes.push_back(entry.toJson());
+    }
+
+    return {{"active", tournamentActive},
+            {"registered", playersRegistered},
+            {"players", rosterJson(players)},
+            {"table", arenaTableJson(arenas, mgeServers)},
+            {"arenas", occupied},
+            {"outbox", writes}};
+  }
+
+  void TournamentManager::restoreState(const json &state)
+  {
+    try
+    {
+      tournamentActive = state.value("active", false);
+      playersRegistered = state.value("registered", false);
+
+      players.clear();
+      for (const auto &p : state.value("players", json::array()))
+      {
+        players.push_back(playerFromJson(p));
+      }
+
+      if (state.contains("table"))
+      {
+        setArenasFromJson(state["table"]);
+      }
+      for (const auto &a : state.value("arenas", json::array()))
+      {
+        json assign = {{"event", "assign"}, {"arena", a.at("arena")}, {"player1", a.at("player1")}, {"player2", a.at("player2")}};
+        if (a.contains("server"))
+        {
+          assign["server"] = a["server"];
+        }
+        replay(assign);
+      }
+
+      outbox.clear();
+      for (const auto &entry : state.value("outbox", json::array()))
+      {
+        replay({{"event", "outbox"}, {"entry", entry}});
+      }
+    }
+    catch (const std::exception &e)
+    {
+      MGE_LOG_ERROR("Invalid state snapshot", {{"error", e.what()}});
+    }
+  }
+
+  void TournamentManager::replay(const json &event)
+  {
+    try
+    {
+      std::string type = event.at("event").get<std::string>();
+      if (type == "start")
+      {
+        tournamentActive = true;
+        playersRegistered = false;
+        outbox.clear();
+      }
+      else if (type == "stop")
+      {
+        tournamentActive = false;
+        playersRegistered = false;
+        outbox.removeKind(OutboxEntry::Kind::Register);
+        for (size_t i = 0; i < arenas.size(); ++i)
+        {
+          releaseArena(static_cast<int>(i));
+        }
+      }
+      else if (type == "registered")
+      {
+        playersRegistered = true;
+        players.clear();
+        for (const auto &p : event.at("players"))
+        {
+          players.push_back(playerFromJson(p));
+        }
+      }
+      else if (type == "outbox")
+      {
+        // It may have reached Challonge before the restart, so the next
+        // attempt counts as a retry and checks first.
+        OutboxEntry entry = OutboxEntry::fromJson(event.at("entry"));
+        entry.attempts = 1;
+        outbox.add(std::move(entry));
+      }
+      else if (type == "sent")
+      {
+        outbox.remove(event.at("id").get<uint64_t>());
+      }
+      else if (type == "arenas")
+      {
+        setArenasFromJson(event.at("arenas"));
+      }
+      else if (type == "assign" || type == "release")
+      {
+        // Arenas the current table no longer has, or on servers no longer
+        // configured, are skipped; get_arenas will tell what exists now.
+        int arena = arenaIndex(event.value("server", ""), event.at("arena").get<int>());
+        if (arena < 0)
+        {
+          return;
+        }
+        if (type == "release")
+        {
+          releaseArena(arena);
+          return;
+        }
+
+        auto handle = [this](const std::string &steamId)
+        {
+          return steamId.empty() ? NO_PLAYER : playerIndex.intern(steamId);
+        };
+        occupyArena(arena, handle(event.at("player1").get<std::string>()),
+                    handle(event.at("player2").get<std::string>()));
+      }
+    }
+    catch (const std::exception &e)
+    {
+      MGE_LOG_WARN("Skipping invalid journal event", {{"event", event}, {"error", e.what()}});
+    }
+  }
+
+  void TournamentManager::reconcileRestoredState()
+  {
+    reconcilePending = false;
+    if (!tournamentActive)
+    {
+      return;
+    }
+
+    if (!playersRegistered)
+    {
+      if (outbox.count(OutboxEntry::Kind::Register) > 0)
+      {
+        // Still in the outbox; it finishes on its own and then fetches
+        // the bracket.
+        return;
+      }
+      if (bracket.matchCount() == 0)
+      {
+        // Registration never finished and nothing has been played, so
+        // starting it over loses nothing.
+        MGE_LOG_WARN("Restored tournament was not registered yet, starting over");
+        handleTournamentStart(TournamentStartPayload{});
+        return;
+      }
+      // The crash came after Challonge started the bracket but before the
+      // completion was journaled.
+      playersRegistered = true;
+      record({{"event", "registered"}, {"players", rosterJson(players)}});
+    }
+
+    // Results still in the outbox, journaled before the restart or
+    // reported since. Challonge may have some of them already, which the
+    // outbox finds out when it sends them. The rest are applied to the
+    // local bracket here; one whose match only opens once another is
+    // applied waits for a later pass.
+    std::vector<const OutboxEntry *> unconfirmed;
+    for (const auto &[id, entry] : outbox.all())
+    {
+      if (entry.kind == OutboxEntry::Kind::ReportMatch)
+      {
+        unconfirmed.push_back(&entry);
+      }
+    }
+
+    size_t applied = 0;
+    for (bool progress = true; progress;)
+    {
+      progress = false;
+      for (auto it = unconfirmed.begin(); it != unconfirmed.end();)
+      {
+        const OutboxEntry &entry = **it;
+        const ChallongeMatch *match = entry.matchId
+                                          ? bracket.match(entry.matchId)
+                                          : bracket.findOpenMatch(bracket.participantId(entry.winnerSteamId),
+                                                                  bracket.participantId(entry.loserSteamId));
+        if (match && match->winnerId)
+        {
+          it = unconfirmed.erase(it);
+          continue;
+        }
+        if (!match || !match->isOpen())
+        {
+          ++it;
+          continue;
+        }
+
+        completeMatch(playerIndex.intern(entry.winnerSteamId), playerIndex.intern(entry.loserSteamId));
+        ++applied;
+        progress = true;
+        it = unconfirmed.erase(it);
+      }
+    }
+    for (const OutboxEntry *left : unconfirmed)
+    {
+      MGE_LOG_WARN("Outstanding result does not fit the bracket", {{"match", left->matchId}, {"winner", left->winnerSteamId}, {"loser", left->loserSteamId}});
+    }
+
+    // Schedule straight from the bracket as it will be once the reports
+    // land, rather than waiting for a sync queued behind them.
+    for (const auto &[id, match] : bracket.allMatches())
+    {
+      std::optional<PendingMatch> pending = bracket.pendingMatch(id);
+      if (pending && !openMatches.count(id))
+      {
+        addOpenMatch(*pending);
+      }
+    }
+
+    MGE_LOG_INFO("Reconciled restored tournament with Challonge", {{"matches", bracket.matchCount()},
+                                                                   {"open", openMatches.size()},
+                                                                   {"unconfirmed", applied}});
+    assignPendingMatches();
+    syncOpenMatches();
+  }
+
+  void TournamentManager::addConnection(lws *wsi)
+  {
+    connections[wsi] = std::make_unique<WebSocketConnection>();
+    connections[wsi]->wsi = wsi;
+    connections[wsi]->id = nextConnectionId++;
+  }
+
+  void TournamentManager::removeConnection(lws *wsi)
+  {
+    if (connections.count(wsi))
+    {
+      if (connections[wsi].get() == admin)
+      {
+        admin = nullptr;
+      }
+      connections.erase(wsi);
+    }
+  }
+
+  void TournamentManager::queueMessage(lws *wsi, const std::string &message)
+  {
+    auto it = connections.find(wsi);
+    if (it != connections.end())
+    {
+      pushFrame(*it->second, OutboundFrame::fromString(message));
+    }
+  }
+
+  void TournamentManager::pushFrame(WebSocketConnection &conn, OutboundFrame frame)
+  {
+    if (conn.closing)
+    {
+      return;
+    }
+
+    switch (conn.messageQueue.push(std::move(frame)))
+    {
+    case OutboundQueue::PushResult::Queued:
+    case OutboundQueue::PushResult::Coalesced:
+      break;
+    case OutboundQueue::PushResult::Overflow:
+      MGE_LOG_WARN("Send queue overflow, disconnecting slow connection", {{"connection", conn.type}});
+      conn.closing = true;
+      break;
+    }
+
+    lws_callback_on_writable(conn.wsi);
+  }
+
+  bool TournamentManager::hasQueuedMessages(lws *wsi) const
+  {
+    auto it = connections.find(wsi);
+    if (it != connections.end())
+    {
+      return !it->second->messageQueue.empty();
+    }
+    return false;
+  }
+
+  OutboundFrame *TournamentManager::frontMessage(lws *wsi)
+  {
+    auto it = connections.find(wsi);
+    if (it == connections.end())
+    {
+      return nullptr;
+    }
+    return it->second->messageQueue.front();
+  }
+
+  void TournamentManager::popMessage(lws *wsi)
+  {
+    auto it = connections.find(wsi);
+    if (it != connections.end())
+    {
+      it->second->messageQueue.pop();
+    }
+  }
+
+  bool TournamentManager::shouldClose(lws *wsi) const
+  {
+    auto it = connections.find(wsi);
+    return it != connections.end() && it->second->closing;
+  }
+
+  void TournamentManager::setMGEEndpoints(const std::vector<MGEEndpoint> &endpoints)
+  {
+    for (const Arena &arena : arenas)
+    {
+      for (PlayerHandle player : {arena.player1, arena.player2})
+      {
+        if (player != NO_PLAYER)
+        {
+          playerIndex.setArena(player, -1);
+        }
+      }
+    }
+    arenas.clear();
+    for (auto &server : mgeServers)
+    {
+      cancelMGETimers(*server);
+    }
+    mgeServers.clear();
+
+    std::vector<MGEEndpoint> list = endpoints.empty() ? std::vector<MGEEndpoint>{MGEEndpoint{}} : endpoints;
+    std::set<std::string> names;
+    for (MGEEndpoint &endpoint : list)
+    {
+      if (endpoint.name.empty() && list.size() > 1)
+      {
+        endpoint.name = endpoint.host + ":" + std::to_string(endpoint.port);
+      }
+      if (!names.insert(endpoint.name).second)
+      {
+        // The journal refers to servers by name.
+        std::string renamed = endpoint.name + "#" + std::to_string(mgeServers.size());
+        MGE_LOG_WARN("Duplicate MGE server name, renaming", {{"name", endpoint.name}, {"renamed", renamed}});
+        endpoint.name = renamed;
+        names.insert(renamed);
+      }
+
+      auto server = std::make_unique<MGEServer>();
+      server->endpoint = endpoint;
+      server->index = static_cast<int>(mgeServers.size());
+      server->reconnectTimer.manager = server->expiryTimer.manager = this;
+      server->reconnectTimer.server = server->expiryTimer.server = server.get();
+      mgeServers.push_back(std::move(server));
+    }
+
+    for (auto &server : mgeServers)
+    {
+      setArenas(*server, arenasFromConfig());
+    }
+  }
+
+  MGEServer *TournamentManager::findMGEServer(const std::string &name) const
+  {
+    for (const auto &server : mgeServers)
+    {
+      if (server->endpoint.name == name)
+      {
+        return server.get();
+      }
+    }
+    // Events journaled before there could be several servers, and admin
+    // messages that do not say, mean the first one.
+    return name.empty() && !mgeServers.empty() ? mgeServers.front().get() : nullptr;
+  }
+
+  bool TournamentManager::anyMGEUsable() const
+  {
+    auto now = std::chrono::steady_clock::now();
+    for (const auto &server : mgeServers)
+    {
+      if (server->usable(now))
+      {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void TournamentManager::tagServer(json &j, int server) const
+  {
+    const std::string &name = mgeServers[server]->endpoint.name;
+    if (!name.empty())
+    {
+      j["server"] = name;
+    }
+  }
+
+  int TournamentManager::pickArena(const ScheduledMatch &scheduled) const
+  {
+    auto now = std::chrono::steady_clock::now();
+    const MGEServer *best = nullptr;
+    double bestCost = 0;
+    for (const auto &server : mgeServers)
+    {
+      if (!server->usable(now) || server->occupied >= server->arenaCount())
+      {
+        continue;
+      }
+
+      int moves = movesTo(scheduled, *server);
+      if (moves < 0)
+      {
+        continue;
+      }
+
+      // A server that is offline for now counts as the slowest there is.
+      double ping = server->connected ? std::min(server->pingSeconds / PING_SCALE_SECONDS, 1.0) : 1.0;
+      double cost = moves * MOVE_COST +
+                    static_cast<double>(server->occupied) / static_cast<double>(server->arenaCount()) +
+                    ping;
+      if (!best || cost < bestCost)
+      {
+        best = server.get();
+        bestCost = cost;
+      }
+    }
+
+    if (best)
+    {
+      for (int index : best->arenaPriority)
+      {
+        if (arenas[index].isEmpty())
+        {
+          return index;
+        }
+      }
+    }
+    return -1;
+  }
+
+  int TournamentManager::movesTo(const ScheduledMatch &scheduled, const MGEServer &server) const
+  {
+    int moves = 0;
+    for (PlayerHandle player : {scheduled.player1, scheduled.player2})
+    {
+      if (playerIndex.server(player) != server.index)
+      {
+        // Only a player the target plugin will recognise can be moved.
+        if (!playerIndex.portable(player) || server.endpoint.connect.empty())
+        {
+          return -1;
+        }
+        ++moves;
+      }
+    }
+    return moves;
+  }
+
+  bool TournamentManager::placeable(const ScheduledMatch &scheduled) const
+  {
+    return std::any_of(mgeServers.begin(), mgeServers.end(), [&](const auto &server)
+                       { return movesTo(scheduled, *server) >= 0; });
+  }
+
+  int TournamentManager::arenaIndex(int server, int arenaId) const
+  {
+    if (server < 0 || static_cast<size_t>(server) >= mgeServers.size())
+    {
+      return -1;
+    }
+    const auto &byId = mgeServers[server]->arenaIndexById;
+    auto it = byId.find(arenaId);
+    return it == byId.end() ? -1 : it->second;
+  }
+
+  int TournamentManager::arenaIndex(const std::string &serverName, int arenaId) const
+  {
+    MGEServer *server = findMGEServer(serverName);
+    return server ? arenaIndex(server->index, arenaId) : -1;
+  }
+
+  void TournamentManager::setArenas(MGEServer &server, std::vector<Arena> table)
+  {
+    // Carry over matches in arenas that survive; players in arenas that
+    // disappeared become free for scheduling again.
+    for (auto &arena : table)
+    {
+      arena.server = server.index;
+      arena.player1 = NO_PLAYER;
+      arena.player2 = NO_PLAYER;
+
+      int previous = arenaIndex(server.index, arena.id);
+      if (previous >= 0)
+      {
+        arena.player1 = arenas[previous].player1;
+        arena.player2 = arenas[previous].player2;
+      }
+    }
+
+    for (const auto &arena : arenas)
+    {
+      for (PlayerHandle player : {arena.player1, arena.player2})
+      {
+        if (player != NO_PLAYER)
+        {
+          playerIndex.setArena(player, -1);
+        }
+      }
+    }
+
+    // The pool stays grouped by server, in server order, so indices into
+    // it are rebuilt for every server.
+    std::vector<Arena> pool;
+    pool.reserve(arenas.size() + table.size());
+    for (const auto &other : mgeServers)
+    {
+      if (other.get() == &server)
+      {
+        std::move(table.begin(), table.end(), std::back_inserter(pool));
+        continue;
+      }
+      for (const Arena &arena : arenas)
+      {
+        if (arena.server == other->index)
+        {
+          pool.push_back(arena);
+        }
+      }
+    }
+    arenas = std::move(pool);
+
+    for (auto &other : mgeServers)
+    {
+      other->arenaIndexById.clear();
+      other->arenaPriority.clear();
+      other->occupied = 0;
+    }
+
+    for (size_t i = 0; i < arenas.size(); ++i)
+    {
+      int index = static_cast<int>(i);
+      MGEServer &owner = *mgeServers[arenas[i].server];
+      owner.arenaIndexById[arenas[i].id] = index;
+      owner.arenaPriority.push_back(index);
+      if (!arenas[i].isEmpty())
+      {
+        ++owner.occupied;
+      }
+
+      for (PlayerHandle player : {arenas[i].player1, arenas[i].player2})
+      {
+        if (player != NO_PLAYER)
+        {
+          playerIndex.setArena(player, index);
+        }
+      }
+    }
+
+    for (auto &other : mgeServers)
+    {
+      std::stable_sort(other->arenaPriority.begin(), other->arenaPriority.end(), [this](int a, int b)
+                       { return arenas[a].priority < arenas[b].priority; });
+    }
+
+    refreshReadyMatches();
+
+    MGE_LOG_INFO("Using arenas", {{"server", server.endpoint.name}, {"count", server.arenaCount()}, {"total", arenas.size()}});
+  }
+
+  void TournamentManager::setArenasFromJson(const json &table)
+  {
+    std::map<std::string, json> byServer;
+    for (const auto &a : table)
+    {
+      byServer[a.value("server", "")].push_back(a);
+    }
+
+    for (const auto &[name, entries] : byServer)
+    {
+      MGEServer *server = findMGEServer(name);
+      if (!server)
+      {
+        MGE_LOG_WARN("Skipping arenas of an MGE server no longer configured", {{"server", name}});
+        continue;
+      }
+      setArenas(*server, arenaTableFromJson(entries));
+    }
+  }
+
+  std::vector<Arena> TournamentManager::arenasFromConfig() const
+  {
+    int count = arenaConfig.value("count", DEFAULT_ARENA_COUNT);
+
+    std::vector<int> priority = {5, 6, 7, 1, 2, 3, 4, 8, 9, 10, 11, 12, 13, 14, 15, 16};
+    if (arenaConfig.contains("priority"))
+    {
+      priority = arenaConfig["priority"].get<std::vector<int>>();
+    }
+
+    std::set<int> excluded = excludedArenaIds();
+
+    std::vector<Arena> table;
+    for (int id = 1; id <= count; ++id)
+    {
+      if (excluded.count(id))
+        continue;
+
+      Arena arena;
+      arena.id = id;
+      arena.name = "Arena " + std::to_string(id);
+
+      // Listed arenas fill in list order, the rest afterwards in id order.
+      auto pos = std::find(priority.begin(), priority.end(), id);
+      arena.priority = pos != priority.end() ? static_cast<int>(pos - priority.begin())
+                                             : static_cast<int>(priority.size()) + id;
+      table.push_back(arena);
+    }
+    return table;
+  }
+
+  std::set<int> TournamentManager::excludedArenaIds() const
+  {
+    // Arenas reserved for something else, e.g. a second bracket running on
+    // the same server.
+    if (arenaConfig.contains("exclude"))
+    {
+      return arenaConfig["exclude"].get<std::set<int>>();
+    }
+    return {};
+  }
+
+  void TournamentManager::setArenaConfig(const json &config)
+  {
+    arenaConfig = config.is_object() ? config : json::object();
+
+    std::vector<Arena> table;
+    try
+    {
+      table = arenasFromConfig();
+    }
+    catch (const std::exception &e)
+    {
+      MGE_LOG_ERROR("Invalid arena config, using defaults", {{"error", e.what()}});
+      arenaConfig = json::object();
+      table = arenasFromConfig();
+    }
+
+    for (auto &server : mgeServers)
+    {
+      setArenas(*server, table);
+    }
+  }
+
+  void TournamentManager::handleArenaList(MGEServer &server, const std::pmr::vector<MGEArenasResponse::Arena> &arenaList)
+  {
+    // Priorities from the plugin win; otherwise the configured order applies
+    // to the ids the plugin reports.
+    std::vector<Arena> configured = arenasFromConfig();
+    std::unordered_map<int, int> configuredPriority;
+    for (const auto &arena : configured)
+    {
+      configuredPriority[arena.id] = arena.priority;
+    }
+
+    std::set<int> excluded = excludedArenaIds();
+
+    std::vector<Arena> table;
+    for (const auto &a : arenaList)
+    {
+      Arena arena;
+      arena.id = a.id;
+      if (arena.id <= 0 || excluded.count(arena.id))
+        continue;
+
+      arena.name = a.name.empty() ? "Arena " + std::to_string(arena.id) : std::string(a.name);
+      if (a.priority)
+      {
+        arena.priority = *a.priority;
+      }
+      else
+      {
+        auto it = configuredPriority.find(arena.id);
+        arena.priority = it != configuredPriority.end() ? it->second
+                                                        : static_cast<int>(configured.size()) + arena.id;
+      }
+      table.push_back(arena);
+    }
+
+    if (table.empty())
+    {
+      MGE_LOG_WARN("MGE plugin reported no usable arenas, keeping current table", {{"server", server.endpoint.name}});
+      return;
+    }
+
+    for (Arena &arena : table)
+    {
+      arena.server = server.index;
+    }
+
+    // A restart has to come back with the plugin's table, or the
+    // occupancy of arenas missing from the configured one would be lost.
+    record({{"event", "arenas"}, {"arenas", arenaTableJson(table, mgeServers)}});
+    setArenas(server, std::move(table));
+    assignPendingMatches();
+  }
+
+  void TournamentManager::occupyArena(int arenaIndex, PlayerHandle player1, PlayerHandle player2)
+  {
+    releaseArena(arenaIndex);
+
+    for (PlayerHandle player : {player1, player2})
+    {
+      // A player can only be in one arena; moving them vacates the old one.
+      if (player != NO_PLAYER && playerIndex.arena(player) >= 0)
+      {
+        releaseArena(playerIndex.arena(player));
+      }
+    }
+
+    Arena &arena = arenas[arenaIndex];
+    arena.player1 = player1;
+    arena.player2 = player2;
+    if (!arena.isEmpty())
+    {
+      ++mgeServers[arena.server]->occupied;
+    }
+
+    json event = {{"event", "assign"},
+                  {"arena", arena.id},
+                  {"player1", steamIdOf(playerIndex, player1)},
+                  {"player2", steamIdOf(playerIndex, player2)}};
+    tagServer(event, arena.server);
+    record(std::move(event));
+
+    for (PlayerHandle player : {player1, player2})
+    {
+      if (player != NO_PLAYER)
+      {
+        playerIndex.setArena(player, arenaIndex);
+      }
+    }
+  }
+
+  void TournamentManager::releaseArena(int arenaIndex)
+  {
+    Arena &arena = arenas[arenaIndex];
+    if (!arena.isEmpty())
+    {
+      --mgeServers[arena.server]->occupied;
+      json event = {{"event", "release"}, {"arena", arena.id}};
+      tagServer(event, arena.server);
+      record(std::move(event));
+    }
+    for (PlayerHandle player : {arena.player1, arena.player2})
+    {
+      if (player != NO_PLAYER && playerIndex.arena(player) == arenaIndex)
+      {
+        playerIndex.setArena(player, -1);
+        markPlayerFree(player);
+      }
+    }
+    arena.player1 = NO_PLAYER;
+    arena.player2 = NO_PLAYER;
+  }
+
+  void TournamentManager::broadcastToServers(const json &message, const std::string &coalesceKey)
+  {
+    // Serialize once; every server queue references the same buffer.
+    auto frame = FrameBuffer::fromString(message.dump(), coalesceKey);
+
+    uint64_t sent = 0;
+    for (auto &[wsi, conn] : connections)
+    {
+      if (conn->type == "server")
+      {
+        pushFrame(*conn, OutboundFrame{frame});
+        ++sent;
+      }
+    }
+    metrics::registry().messages.with({"out", "server", message.value("type", "")}).inc(sent);
+  }
+
+  void TournamentManager::sendToConnection(WebSocketConnection *conn, const json &message)
+  {
+    if (conn)
+    {
+      queueMessage(conn->wsi, message.dump());
+      metrics::registry().messages.with({"out", conn->type.empty() ? "unknown" : conn->type, message.value("type", "")}).inc();
+    }
+  }
+
+  void TournamentManager::sendToMGEPlugin(MGEServer &server, const json &message, const std::string &coalesceKey)
+  {
+    // No wsi check: queueMGEMessage only needs one to request a writeable
+    // callback, and in-process harnesses drain the queue themselves.
+    if (!server.connected)
+    {
+      if (!bufferMGECommand(server, message, std::chrono::steady_clock::now()))
+      {
+        MGE_LOG_WARN("Cannot send to MGE plugin: not connected", {{"server", server.endpoint.name}, {"command", message.value("command", "")}});
+      }
+      return;
     }
+
+    queueMGEMessage(server, message.dump(), coalesceKey);
+    metrics::registry().messages.with({"out", "mge", message.value("command", "")}).inc();
   }
 
-  void ChallongeAPI::startTournament()
+  bool TournamentManager::bufferMGECommand(MGEServer &server, json message, std::chrono::steady_clock::time_point now)
   {
-    if (tournamentId.empty())
+    std::string command = message.value("command", "");
+    auto ttl = mgeCommandTtl.find(command);
+    if (ttl == mgeCommandTtl.end() || ttl->second <= std::chrono::milliseconds::zero())
     {
-      std::cerr << "Cannot start tournament: tournament ID is empty!" << std::endl;
-      return;
+      return false;
     }
 
-    std::string endpoint = "/tournaments/" + tournamentId + "/start.json";
-    json data = json::object();
+    if (server.offline.size() >= MGEServer::OFFLINE_LIMIT)
+    {
+      std::string dropped = server.offline.front().message.value("command", "");
+      MGE_LOG_WARN("MGE offline buffer full, dropping oldest command", {{"server", server.endpoint.name}, {"command", dropped}});
+      metrics::registry().mgeOfflineCommands.with({serverLabel(server), dropped, "dropped"}).inc();
+      server.offline.pop_front();
+    }
 
-    std::cout << "[DEBUG] Starting tournament " << tournamentId << std::endl;
-    std::string response = makeRequest("POST", endpoint, data);
+    MGEServer::BufferedCommand entry;
+    entry.expires = now + ttl->second;
+    if (command == "add_player_to_arena")
+    {
+      // Resolved now: by the time it expires the player's client id may
+      // be gone.
+      entry.arena = arenaIndex(server.index, message.value("arena_id", 0));
+      entry.player = message.contains("steam_id") ? playerIndex.find(message.value("steam_id", ""))
+                                                  : playerIndex.findByClientId(server.index, message.value("player_id", -1));
+    }
+    entry.message = std::move(message);
+    server.offline.push_back(std::move(entry));
 
-    if (response.empty() || response.length() < 10)
+    if (server.expiryAt == std::chrono::steady_clock::time_point{} || server.offline.back().expires < server.expiryAt)
     {
-      std::cerr << "Failed to start tournament - empty response" << std::endl;
-      std::cerr << "   Response: " << response << std::endl;
-      return;
+      scheduleMGEExpiry(server);
     }
+    return true;
+  }
 
-    try
+  size_t TournamentManager::expireMGECommands(MGEServer &server, std::chrono::steady_clock::time_point now)
+  {
+    size_t expired = 0;
+    std::deque<MGEServer::BufferedCommand> kept;
+    for (MGEServer::BufferedCommand &entry : server.offline)
     {
-      json j = json::parse(response);
-      if (j.contains("errors"))
-      {
-        std::cerr << "Error starting tournament: " << j["errors"].dump() << std::endl;
-        return;
-      }
-      if (j.contains("tournament"))
+      if (entry.expires > now)
       {
-        std::string state = j["tournament"].value("state", "unknown");
-        std::cout << "Tournament started, state: " << state << std::endl;
+        kept.push_back(std::move(entry));
+        continue;
       }
-      else
+
+      std::string command = entry.message.value("command", "");
+      metrics::registry().mgeOfflineCommands.with({serverLabel(server), command, "expired"}).inc();
+      ++expired;
+      // Only if the match is still waiting in that arena; it may have been
+      // cancelled and the arena reused since.
+      if (entry.arena >= 0 && entry.player != NO_PLAYER && playerIndex.arena(entry.player) == entry.arena)
       {
-        std::cerr << "Unexpected start tournament response: " << response << std::endl;
+        releaseArena(entry.arena);
       }
     }
-    catch (const std::exception &e)
+    server.offline.swap(kept);
+
+    if (expired > 0)
     {
-      std::cerr << "Error parsing start tournament response: " << e.what() << std::endl;
-      std::cerr << "   Response was: " << response << std::endl;
+      MGE_LOG_WARN("MGE plugin offline, commands for it expired", {{"server", server.endpoint.name}, {"expired", expired}, {"buffered", server.offline.size()}});
     }
+    return expired;
   }
 
-  void ChallongeAPI::resetTournament()
+  void TournamentManager::connectMGE(MGEServer &server)
   {
-    if (tournamentId.empty())
+    server.reconnectScheduled = false;
+    if (server.connected || !mgeConnector)
     {
-      std::cerr << "Cannot reset tournament: tournament ID is empty!" << std::endl;
       return;
     }
+    if (server.reconnectAttempts > 0)
+    {
+      metrics::registry().mgeReconnects.with({serverLabel(server)}).inc();
+    }
+    if (!mgeConnector(server))
+    {
+      scheduleMGEReconnect(server);
+    }
+  }
 
-    std::cout << "[DEBUG] Resetting tournament " << tournamentId << std::endl;
+  void TournamentManager::setMGEReconnectBackoff(MGEReconnectBackoff backoff)
+  {
+    // Same bounds as ChallongeOutbox::setBackoff(), for the same jitter.
+    mgeReconnectBackoff.initialDelay = std::max(backoff.initialDelay, std::chrono::milliseconds(1));
+    mgeReconnectBackoff.maxDelay = std::max(backoff.maxDelay, mgeReconnectBackoff.initialDelay);
+  }
 
-    std::string participantsEndpoint = "/tournaments/" + tournamentId + "/participants.json";
-    std::string participantsResponse = makeRequest("GET", participantsEndpoint, json::object());
+  void TournamentManager::scheduleMGEReconnect(MGEServer &server)
+  {
+    // A connect that fails at once can report the error before returning,
+    // so both paths end up here for the same attempt.
+    if (server.reconnectScheduled || !context || !mgeConnector)
+    {
+      return;
+    }
 
-    try
+    auto delay = mgeReconnectBackoff.initialDelay;
+    for (unsigned i = 0; i < server.reconnectAttempts && delay < mgeReconnectBackoff.maxDelay; ++i)
     {
-      json participantsJson = json::parse(participantsResponse);
+      delay *= 2;
+    }
+    delay = std::min(delay, mgeReconnectBackoff.maxDelay);
+    // Jittered like the outbox's retries, so servers that dropped together
+    // do not all come back at the same moment.
+    delay = std::chrono::milliseconds(std::uniform_int_distribution<long long>(delay.count() / 2, delay.count())(rng));
+    ++server.reconnectAttempts;
+
+    server.reconnectScheduled = true;
+    lws_sul_schedule(context, 0, &server.reconnectTimer.sul, &TournamentManager::onMGEReconnectTimer,
+                     static_cast<lws_usec_t>(delay.count()) * LWS_US_PER_MS);
+    MGE_LOG_INFO("Reconnecting to MGE plugin later", {{"server", server.endpoint.name}, {"attempt", server.reconnectAttempts}, {"delay_ms", delay.count()}});
+  }
 
-      for (auto &p : participantsJson)
+  void TournamentManager::scheduleMGEExpiry(MGEServer &server)
+  {
+    std::chrono::steady_clock::time_point at = server.connected ? std::chrono::steady_clock::time_point{} : server.offlineUntil;
+    for (const MGEServer::BufferedCommand &entry : server.offline)
+    {
+      if (at == std::chrono::steady_clock::time_point{} || entry.expires < at)
       {
-        if (p.contains("participant"))
-        {
-          int participantId = p["participant"]["id"].get<int>();
-          std::string deleteEndpoint = "/tournaments/" + tournamentId +
-                                       "/participants/" + std::to_string(participantId) + ".json";
-          std::cout << "[DEBUG] Deleting participant " << participantId << std::endl;
-          makeRequest("DELETE", deleteEndpoint, json::object());
-        }
+        at = entry.expires;
       }
+    }
 
-      std::string resetEndpoint = "/tournaments/" + tournamentId + "/reset.json";
-      std::cout << "[DEBUG] Resetting tournament state" << std::endl;
-      makeRequest("POST", resetEndpoint, json::object());
-
-      std::cout << "Tournament reset complete" << std::endl;
+    server.expiryAt = at;
+    if (!context)
+    {
+      return;
     }
-    catch (const std::exception &e)
+    if (at == std::chrono::steady_clock::time_point{})
     {
-      std::cerr << "Error resetting tournament: " << e.what() << std::endl;
+      lws_sul_schedule(context, 0, &server.expiryTimer.sul, nullptr, LWS_SET_TIMER_USEC_CANCEL);
+      return;
     }
+    auto delay = std::chrono::duration_cast<std::chrono::microseconds>(at - std::chrono::steady_clock::now());
+    lws_sul_schedule(context, 0, &server.expiryTimer.sul, &TournamentManager::onMGEExpiryTimer,
+                     std::max<lws_usec_t>(1, static_cast<lws_usec_t>(delay.count())));
   }
 
-  std::vector<PendingMatch> ChallongeAPI::getPendingMatches()
+  void TournamentManager::cancelMGETimers(MGEServer &server)
   {
-    if (tournamentId.empty())
+    if (context)
     {
-      std::cerr << "❌ Cannot get matches: tournament ID is empty!" << std::endl;
-      return {};
+      lws_sul_schedule(context, 0, &server.reconnectTimer.sul, nullptr, LWS_SET_TIMER_USEC_CANCEL);
+      lws_sul_schedule(context, 0, &server.expiryTimer.sul, nullptr, LWS_SET_TIMER_USEC_CANCEL);
     }
+    server.reconnectScheduled = false;
+    server.expiryAt = {};
+  }
 
-    std::string endpoint = "/tournaments/" + tournamentId + "/matches.json";
-    json params = {{"state", "open"}};
+  void TournamentManager::onMGEReconnectTimer(lws_sorted_usec_list_t *sul)
+  {
+    MGETimer *timer = lws_container_of(sul, MGETimer, sul);
+    timer->manager->connectMGE(*timer->server);
+  }
 
-    std::cout << "[DEBUG] Calling Challonge API: " << endpoint << std::endl;
-    std::string response = makeRequest("GET", endpoint, params);
-    std::cout << "[DEBUG] Challonge matches response length: " << response.length() << " bytes" << std::endl;
+  void TournamentManager::onMGEExpiryTimer(lws_sorted_usec_list_t *sul)
+  {
+    MGETimer *timer = lws_container_of(sul, MGETimer, sul);
+    timer->manager->handleMGEOfflineExpiry(*timer->server);
+  }
 
-    std::vector<PendingMatch> matches;
+  void TournamentManager::handleMGEOfflineExpiry(MGEServer &server)
+  {
+    auto now = std::chrono::steady_clock::now();
+    server.expiryAt = {};
+    bool released = expireMGECommands(server, now) > 0;
 
-    try
+    if (!server.connected && server.offlineUntil != std::chrono::steady_clock::time_point{} && now >= server.offlineUntil)
     {
-      json matchesJson = json::parse(response);
-      std::cout << "[DEBUG] Parsed matches JSON, size: " << matchesJson.size() << std::endl;
+      // Down for longer than a blip: its players cannot be placed until it
+      // is back and reports them again.
+      server.offlineUntil = {};
+      playerIndex.clearServer(server.index);
+      MGE_LOG_WARN("MGE plugin still offline, its players wait until it is back", {{"server", server.endpoint.name}});
+    }
 
-      std::string participantsEndpoint = "/tournaments/" + tournamentId + "/participants.json";
-      std::cout << "[DEBUG] Calling Challonge API: " << participantsEndpoint << std::endl;
-      std::string participantsResponse = makeRequest("GET", participantsEndpoint, json::object());
-      std::cout << "[DEBUG] Challonge participants response length: " << participantsResponse.length() << " bytes" << std::endl;
+    if (released)
+    {
+      assignPendingMatches();
+    }
+    scheduleMGEExpiry(server);
+  }
 
-      json participantsJson = json::parse(participantsResponse);
-      std::cout << "[DEBUG] Parsed participants JSON, size: " << participantsJson.size() << std::endl;
+  void TournamentManager::requestPlayersFromMGE(MGEServer &server)
+  {
+    json request = {{"command", "get_players"}};
+    server.requestedAt.emplace("get_players", std::chrono::steady_clock::now());
+    sendToMGEPlugin(server, request, "get_players");
+  }
 
-      std::map<int, std::pair<std::string, std::string>> idToPlayer;
+  void TournamentManager::requestArenasFromMGE(MGEServer &server)
+  {
+    json request = {{"command", "get_arenas"}};
+    server.requestedAt.emplace("get_arenas", std::chrono::steady_clock::now());
+    sendToMGEPlugin(server, request, "get_arenas");
+  }
 
-      for (auto &p : participantsJson)
-      {
-        if (p.contains("participant"))
-        {
-          auto &participant = p["participant"];
-          int id = participant["id"].get<int>();
-          std::string name = participant["name"].get<std::string>();
-          std::string steamId = participant.contains("misc") ? participant["misc"].get<std::string>() : "";
-          idToPlayer[id] = {name, steamId};
-          std::cout << "[DEBUG] Participant mapping: ID " << id << " = " << name << " (Steam: " << steamId << ")" << std::endl;
-        }
-      }
+  void TournamentManager::observeMGEReply(MGEServer &server, std::string_view command)
+  {
+    auto it = server.requestedAt.find(std::string(command));
+    if (it == server.requestedAt.end())
+    {
+      return;
+    }
 
-      for (auto &m : matchesJson)
-      {
-        if (m.contains("match"))
-        {
-          auto &match = m["match"];
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - it->second).count();
+    server.requestedAt.erase(it);
+    server.pingSeconds = server.pingSeconds == 0 ? seconds
+                                                 : server.pingSeconds + MGEServer::PING_SMOOTHING * (seconds - server.pingSeconds);
+  }
 
-          if (match.contains("player1_id") && match.contains("player2_id") &&
-              !match["player1_id"].is_null() && !match["player2_id"].is_null())
-          {
+  void TournamentManager::addPlayerToMGEArena(MGEServer &server, int clientId, int arenaId)
+  {
+    json request = {
+        {"command", "add_player_to_arena"},
+        {"player_id", clientId},
+        {"arena_id", arenaId}};
+    sendToMGEPlugin(server, request);
+  }
 
-            if (!match["winner_id"].is_null())
-            {
-              std::cout << "[DEBUG] Skipping completed match" << std::endl;
-              continue;
-            }
+  void TournamentManager::placePlayer(PlayerHandle player, int arenaIndex)
+  {
+    const Arena &arena = arenas[arenaIndex];
+    MGEServer &target = *mgeServers[arena.server];
+    int from = playerIndex.server(player);
+    if (from == arena.server && playerIndex.clientId(player) >= 0)
+    {
+      addPlayerToMGEArena(target, playerIndex.clientId(player), arena.id);
+      return;
+    }
+
+    // By steam id: the target's plugin puts the player in the arena once
+    // they have joined, or at once if they already have.
+    const std::string &steamId = playerIndex.steamId(player);
+    sendToMGEPlugin(target, {{"command", "add_player_to_arena"},
+                             {"steam_id", steamId},
+                             {"arena_id", arena.id}});
+    if (from == arena.server || from < 0)
+    {
+      // Already here, or on the way from somewhere we no longer know.
+      return;
+    }
+    sendToMGEPlugin(*mgeServers[from], {{"command", "redirect_player"},
+                                        {"player_id", playerIndex.clientId(player)},
+                                        {"steam_id", steamId},
+                                        {"address", target.endpoint.connect}});
+    playerIndex.setClientId(player, target.index, -1);
+
+    MGE_LOG_INFO("Moving player", {{"player", steamId}, {"from", mgeServers[from]->endpoint.name}, {"to", target.endpoint.name}});
+    metrics::registry().playerRedirects.with({serverLabel(target)}).inc();
+  }
 
-            int p1Id = match["player1_id"].get<int>();
-            int p2Id = match["player2_id"].get<int>();
+  void TournamentManager::receiveFragment(lws *wsi, const char *data, size_t len,
+                                          bool finalFragment, size_t remaining)
+  {
+    auto it = connections.find(wsi);
+    if (it == connections.end())
+    {
+      return;
+    }
 
-            std::cout << "[DEBUG] Found open match: player " << p1Id << " vs player " << p2Id << std::endl;
+    MessageAssembler &inbound = it->second->inbound;
+    auto status = inbound.append(data, len, finalFragment, remaining, maxMessageSize);
 
-            if (idToPlayer.count(p1Id) && idToPlayer.count(p2Id))
-            {
-              PendingMatch pm;
-              pm.player1Name = idToPlayer[p1Id].first;
-              pm.player1Id = idToPlayer[p1Id].second;
-              pm.player2Name = idToPlayer[p2Id].first;
-              pm.player2Id = idToPlayer[p2Id].second;
-              matches.push_back(pm);
-
-              std::cout << "[DEBUG] Added pending match: " << pm.player1Name << " vs " << pm.player2Name << std::endl;
-            }
-            else
-            {
-              std::cout << "[DEBUG] Could not find player info for match" << std::endl;
-            }
-          }
-        }
-      }
+    if (status == MessageAssembler::Status::Complete)
+    {
+      handleMessage(wsi, inbound.buffer);
     }
-    catch (const std::exception &e)
+    else if (status == MessageAssembler::Status::Overflow)
     {
-      std::cerr << "[DEBUG] Error parsing pending matches: " << e.what() << std::endl;
+      MGE_LOG_WARN("Dropping oversized message", {{"limit", maxMessageSize}});
+
+      json errorMsg = {
+          {"type", "Error"},
+          {"payload", {{"message", "Message exceeds " + std::to_string(maxMessageSize) + " bytes"}}}};
+      queueMessage(wsi, errorMsg.dump());
     }
 
-    std::cout << "[DEBUG] Returning " << matches.size() << " pending matches" << std::endl;
-    return matches;
+    // handleMessage may have closed or replaced the connection entry.
+    it = connections.find(wsi);
+    if (status != MessageAssembler::Status::Partial && it != connections.end())
+    {
+      it->second->inbound.reset();
+    }
   }
 
-  void ChallongeAPI::reportMatch(const std::string &winnerId, const std::string &loserId)
+  void TournamentManager::receiveMGEFragment(MGEServer &server, const char *data, size_t len,
+                                             bool finalFragment, size_t remaining)
   {
-    if (tournamentId.empty())
+    auto status = server.inbound.append(data, len, finalFragment, remaining, maxMessageSize);
+
+    if (status == MessageAssembler::Status::Complete)
     {
-      std::cerr << "Cannot report match: tournament ID is empty!" << std::endl;
-      return;
+      handleMGEPluginMessage(server, server.inbound.buffer);
+    }
+    else if (status == MessageAssembler::Status::Overflow)
+    {
+      MGE_LOG_WARN("Dropping oversized MGE plugin message", {{"server", server.endpoint.name}, {"limit", maxMessageSize}});
     }
 
-    std::string matchesEndpoint = "/tournaments/" + tournamentId + "/matches.json";
-    json params = {{"state", "open"}};
-    std::string response = makeRequest("GET", matchesEndpoint, params);
-
-    try
+    if (status != MessageAssembler::Status::Partial)
     {
-      json matchesJson = json::parse(response);
+      server.inbound.reset();
+    }
+  }
 
-      std::string participantsEndpoint = "/tournaments/" + tournamentId + "/participants.json";
-      std::string participantsResponse = makeRequest("GET", participantsEndpoint, json::object());
-      json participantsJson = json::parse(participantsResponse);
+  void TournamentManager::handleMGEPluginMessage(MGEServer &server, const std::string &message)
+  {
+    static metrics::Histogram &handlingSeconds = metrics::registry().messageHandlingSeconds.with({"mge"});
+    metrics::ScopedTimer timer(handlingSeconds);
 
-      std::map<std::string, int> steamIdToParticipantId;
-      for (auto &p : participantsJson)
+    static metrics::Counter &invalid = metrics::registry().messages.with({"in", "mge", "invalid"});
+    static metrics::Counter &other = metrics::registry().messages.with({"in", "mge", "other"});
+
+    try
+    {
+      std::string error;
+      if (!mgeDecoder.decode(message, error))
       {
-        if (p.contains("participant"))
-        {
-          auto &participant = p["participant"];
-          if (participant.contains("misc"))
-          {
-            std::string steamId = participant["misc"].get<std::string>();
-            int id = participant["id"].get<int>();
-            steamIdToParticipantId[steamId] = id;
-          }
-        }
+        MGE_LOG_ERROR("Error handling MGE plugin message", {{"error", error}});
+        invalid.inc();
+        return;
       }
 
-      if (!steamIdToParticipantId.count(winnerId) || !steamIdToParticipantId.count(loserId))
+      if (mgeDecoder.key().empty())
       {
-        std::cerr << "Could not find participant IDs for match" << std::endl;
+        MGE_LOG_DEBUG("MGE plugin message has no type field");
+        invalid.inc();
         return;
       }
 
-      int winnerParticipantId = steamIdToParticipantId[winnerId];
-      int loserParticipantId = steamIdToParticipantId[loserId];
+      MGE_LOG_DEBUG("MGE plugin message", {{"server", server.endpoint.name}, {"type", mgeDecoder.key()}, {"bytes", message.size()}});
 
-      for (auto &m : matchesJson)
+      if (mgeDecoder.type() == "response")
       {
-        if (m.contains("match"))
-        {
-          auto &match = m["match"];
+        observeMGEReply(server, mgeDecoder.command());
+      }
 
-          if (!match["player1_id"].is_null() && !match["player2_id"].is_null())
-          {
-            int p1Id = match["player1_id"].get<int>();
-            int p2Id = match["player2_id"].get<int>();
+      // Known types are counted by their handler.
+      if (!mgeHandlers.dispatch(mgeDecoder.key(), server))
+      {
+        other.inc();
+      }
+    }
+    catch (const std::exception &e)
+    {
+      MGE_LOG_ERROR("Error handling MGE plugin message", {{"error", e.what()}});
+      invalid.inc();
+    }
+  }
 
-            if ((p1Id == winnerParticipantId && p2Id == loserParticipantId) ||
-                (p2Id == winnerParticipantId && p1Id == loserParticipantId))
-            {
+  void TournamentManager::handleMGEWelcome(MGEServer &server, const MGEWelcome &welcome)
+  {
+    MGE_LOG_INFO("Connected to MGE plugin", {{"server", server.endpoint.name}, {"message", welcome.message}});
+    server.reconnectAttempts = 0;
+    server.resyncing = true;
+    requestArenasFromMGE(server);
+    requestPlayersFromMGE(server);
+  }
 
-              int matchId = match["id"].get<int>();
-              std::string updateEndpoint = "/tournaments/" + tournamentId +
-                                           "/matches/" + std::to_string(matchId) + ".json";
+  void TournamentManager::handleMGEPlayers(MGEServer &server, const MGEPlayersResponse &response)
+  {
+    MGE_LOG_DEBUG("Processing get_players response", {{"server", server.endpoint.name}, {"tournament_active", tournamentActive}});
 
-              std::string scoreCsv = (p1Id == winnerParticipantId) ? "1-0" : "0-1";
-              json updateData = {
-                  {"match", {{"scores_csv", scoreCsv}, {"winner_id", winnerParticipantId}}}};
+    server.awaitingPlayers = false;
 
-              makeRequest("PUT", updateEndpoint, updateData);
-              std::cout << "Reported match result" << std::endl;
-              return;
-            }
+    // For the resync: who was in this server's arenas before the list
+    // replaces what we knew.
+    std::unordered_set<PlayerHandle> wasHere;
+    if (server.resyncing)
+    {
+      for (int index : server.arenaPriority)
+      {
+        for (PlayerHandle player : {arenas[index].player1, arenas[index].player2})
+        {
+          if (player != NO_PLAYER && playerIndex.server(player) == server.index)
+          {
+            wasHere.insert(player);
           }
         }
       }
     }
-    catch (const std::exception &e)
+    playerIndex.clearServer(server.index);
+
+    // This server's part of the roster is replaced, along with entries no
+    // server reported (restored or from UsersInServer). Players it reports
+    // who were listed under another server have moved here.
+    std::vector<Player> reported;
+    std::unordered_set<std::string> reportedIds;
+    std::unordered_map<PlayerHandle, int> pluginArenas;
+    size_t withoutSteamId = 0;
+    if (response.hasPlayers)
+    {
+      reported.reserve(response.players.size());
+      for (const auto &p : response.players)
+      {
+        // With several servers a player can only be matched against one
+        // elsewhere if they can be moved, which takes a steam id. Entering
+        // them anyway would stall the bracket at their first such match.
+        if (p.steamId.empty() && mgeServers.size() > 1)
+        {
+          ++withoutSteamId;
+          continue;
+        }
+
+        Player player;
+        player.clientId = p.id;
+        player.name = p.name;
+        player.arena = p.arena;
+        player.inArena = p.inArena;
+        player.elo = p.elo;
+        player.server = server.index;
+
+        // Without a steam id from the plugin the player gets one made up
+        // from their client id, which no other server would know them by.
+        bool portable = !p.steamId.empty();
+        if (portable)
+        {
+          player.steamId = p.steamId;
+        }
+        else
+        {
+          char steamIdBuf[64];
+          snprintf(steamIdBuf, sizeof(steamIdBuf), "STEAM_ID_%d", player.clientId);
+          player.steamId = server.endpoint.name.empty() ? steamIdBuf : server.endpoint.name + ":" + steamIdBuf;
+        }
+
+        PlayerHandle handle = playerIndex.intern(player.steamId);
+        playerIndex.setClientId(handle, server.index, player.clientId);
+        playerIndex.setPortable(handle, portable);
+        if (server.resyncing && p.inArena)
+        {
+          pluginArenas[handle] = p.arena;
+        }
+
+        reportedIds.insert(player.steamId);
+        reported.push_back(std::move(player));
+        MGE_LOG_DEBUG("Added player", {{"name", reported.back().name}, {"id", reported.back().clientId}, {"elo", reported.back().elo}});
+      }
+    }
+    else
     {
-      std::cerr << "Error reporting match: " << e.what() << std::endl;
+      MGE_LOG_DEBUG("No players array in get_players response");
     }
-  }
 
-  TournamentManager::TournamentManager(lws_context *ctx, const std::string &challongeUser,
-                                       const std::string &challongeKey, const std::string &tournamentUrl)
-      : context(ctx), arenas(NUM_ARENAS), mgeClientWsi(nullptr), mgeConnected(false), tournamentActive(false)
-  {
+    if (withoutSteamId > 0 && !server.missingSteamIds)
+    {
+      MGE_LOG_ERROR("MGE plugin reported players without a steam id; with several servers they are left out",
+                    {{"server", server.endpoint.name}, {"players", withoutSteamId}});
+      sendToConnection(admin, {{"type", "Error"},
+                               {"payload", {{"message", "MGE server " + serverLabel(server) + " reported " + std::to_string(withoutSteamId) +
+                                                            " players without a steam_id. A tournament across several servers needs them, so these players are left out."}}}});
+    }
+    server.missingSteamIds = withoutSteamId > 0;
 
-    arenaPriority = {5, 6, 7, 1, 2, 3, 4, 8, 9, 10, 11, 12, 13, 14, 15, 16};
+    players.erase(std::remove_if(players.begin(), players.end(), [&](const Player &player)
+                                 { return player.server < 0 || player.server == server.index || reportedIds.count(player.steamId); }),
+                  players.end());
+    std::move(reported.begin(), reported.end(), std::back_inserter(players));
+    MGE_LOG_INFO("Received players from MGE plugin", {{"server", server.endpoint.name}, {"count", reportedIds.size()}, {"total", players.size()}});
 
-    challonge = std::make_unique<ChallongeAPI>(challongeUser, challongeKey, "", tournamentUrl);
-  }
+    if (server.resyncing)
+    {
+      resyncMGE(server, pluginArenas, wasHere);
+    }
 
-  void TournamentManager::addConnection(lws *wsi)
-  {
-    connections[wsi] = std::make_unique<WebSocketConnection>();
-    connections[wsi]->wsi = wsi;
-  }
+    // Client ids changed, so matches waiting on a player may be playable
+    // now.
+    refreshReadyMatches();
+    assignPendingMatches();
 
-  void TournamentManager::removeConnection(lws *wsi)
-  {
-    if (connections.count(wsi))
+    // Only once per tournament, and once every connected server has sent
+    // its players: a reconnecting plugin sends get_players again, and the
+    // roster is already on Challonge.
+    bool awaiting = std::any_of(mgeServers.begin(), mgeServers.end(), [](const auto &other)
+                                { return other->connected && other->awaitingPlayers; });
+    if (tournamentActive && !playersRegistered && !awaiting && outbox.count(OutboxEntry::Kind::Register) == 0 && players.size() > 0)
     {
-      if (connections[wsi].get() == admin)
+      // Players from several servers are seeded by ELO, as for
+      // UsersInServer; a single plugin's order is kept.
+      std::vector<Player> roster = players;
+      if (mgeServers.size() > 1)
       {
-        admin = nullptr;
+        std::stable_sort(roster.begin(), roster.end(), [](const Player &a, const Player &b)
+                         { return a.elo > b.elo; });
       }
-      connections.erase(wsi);
+      MGE_LOG_INFO("Starting tournament", {{"players", roster.size()}});
+      registerPlayers(std::move(roster));
     }
   }
 
-  void TournamentManager::queueMessage(lws *wsi, const std::string &message)
+  void TournamentManager::resyncMGE(MGEServer &server, const std::unordered_map<PlayerHandle, int> &pluginArenas,
+                                    const std::unordered_set<PlayerHandle> &wasHere)
   {
-    if (connections.count(wsi))
+    server.resyncing = false;
+    expireMGECommands(server, std::chrono::steady_clock::now());
+
+    // Matches placed here before the drop, or while it lasted. The plugin
+    // may have lost the placement (it restarted, the command never got
+    // there) or finished the match without the result getting through;
+    // either way its players are sent to the arena again, and a match
+    // that was played is played again, with a warning to the admin since
+    // the first result is gone. A player who was here and left frees the
+    // arena, unless they can be sent back by steam id. Players we know
+    // nothing about, e.g. after a restart, are left to the other servers'
+    // lists and events.
+    size_t inPlace = 0;
+    size_t replaced = 0;
+    size_t released = 0;
+    for (int index : server.arenaPriority)
+    {
+      const Arena &arena = arenas[index];
+      if (arena.isEmpty())
+      {
+        continue;
+      }
+
+      std::vector<PlayerHandle> misplaced;
+      bool gone = false;
+      for (PlayerHandle player : {arena.player1, arena.player2})
+      {
+        if (player == NO_PLAYER)
+        {
+          continue;
+        }
+        auto it = pluginArenas.find(player);
+        if (it != pluginArenas.end() && it->second == arena.id)
+        {
+          continue;
+        }
+        if (playerIndex.server(player) == server.index || playerIndex.portable(player))
+        {
+          misplaced.push_back(player);
+        }
+        else if (wasHere.count(player))
+        {
+          gone = true;
+        }
+      }
+
+      if (gone)
+      {
+        releaseArena(index);
+        ++released;
+        continue;
+      }
+      if (!misplaced.empty())
+      {
+        warnReplayedMatch(server, arena);
+      }
+      for (PlayerHandle player : misplaced)
+      {
+        placePlayer(player, index);
+      }
+      ++(misplaced.empty() ? inPlace : replaced);
+    }
+
+    // Placements were redone above from the current state. Redirects go
+    // out with the player's current client id, if they are still here.
+    std::string label = serverLabel(server);
+    size_t sent = 0;
+    for (MGEServer::BufferedCommand &entry : server.offline)
     {
-      connections[wsi]->messageQueue.push_back(message);
-      lws_callback_on_writable(wsi);
+      std::string command = entry.message.value("command", "");
+      bool stale = command == "add_player_to_arena";
+      if (command == "redirect_player")
+      {
+        PlayerHandle player = playerIndex.find(entry.message.value("steam_id", ""));
+        stale = player == NO_PLAYER || playerIndex.server(player) != server.index || playerIndex.clientId(player) < 0;
+        if (!stale)
+        {
+          entry.message["player_id"] = playerIndex.clientId(player);
+        }
+      }
+
+      if (stale)
+      {
+        metrics::registry().mgeOfflineCommands.with({label, command, "superseded"}).inc();
+        continue;
+      }
+      metrics::registry().mgeOfflineCommands.with({label, command, "sent"}).inc();
+      sendToMGEPlugin(server, entry.message);
+      ++sent;
     }
+    size_t superseded = server.offline.size() - sent;
+    server.offline.clear();
+    scheduleMGEExpiry(server);
+
+    MGE_LOG_INFO("Resynchronized with MGE plugin", {{"server", server.endpoint.name},
+                                                   {"in_place", inPlace},
+                                                   {"replaced", replaced},
+                                                   {"released", released},
+                                                   {"sent", sent},
+                                                   {"superseded", superseded}});
   }
 
-  bool TournamentManager::hasQueuedMessages(lws *wsi) const
+  void TournamentManager::warnReplayedMatch(const MGEServer &server, const Arena &arena)
+  {
+    auto match = openMatchByPlayer.find(arena.player1);
+    int matchId = match == openMatchByPlayer.end() ? 0 : match->second;
+    std::string player1 = steamIdOf(playerIndex, arena.player1);
+    std::string player2 = steamIdOf(playerIndex, arena.player2);
+    MGE_LOG_WARN("Sending players back to a match whose result may have been lost", {{"server", server.endpoint.name},
+                                                                                       {"arena", arena.id},
+                                                                                       {"match", matchId},
+                                                                                       {"player1", player1},
+                                                                                       {"player2", player2}});
+    sendToConnection(admin, {{"type", "Error"},
+                             {"payload", {{"message", "MGE server " + serverLabel(server) + " lost track of match " + std::to_string(matchId) +
+                                                          " (" + player1 + " vs " + player2 + ", arena " + std::to_string(arena.id) +
+                                                          ") while it was unreachable; if it was already played, its result was lost and it is being played again"}}}});
+  }
+
+  void TournamentManager::handleMGEArenas(MGEServer &server, const MGEArenasResponse &response)
   {
-    if (connections.count(wsi))
+    MGE_LOG_INFO("Received arena info from MGE plugin", {{"server", server.endpoint.name}});
+    if (response.hasArenas)
     {
-      return !connections.at(wsi)->messageQueue.empty();
+      handleArenaList(server, response.arenas);
     }
-    return false;
   }
 
-  std::string TournamentManager::popMessage(lws *wsi)
+  PlayerHandle TournamentManager::resolveMGEPlayer(MGEServer &server, int clientId, std::string_view steamId)
   {
-    if (connections.count(wsi) && !connections[wsi]->messageQueue.empty())
+    if (steamId.empty())
     {
-      std::string msg = connections[wsi]->messageQueue.front();
-      connections[wsi]->messageQueue.erase(connections[wsi]->messageQueue.begin());
-      return msg;
+      return playerIndex.findByClientId(server.index, clientId);
     }
-    return "";
-  }
 
-  std::optional<int> TournamentManager::getOpenArena()
-  {
-    for (int arenaId : arenaPriority)
+    PlayerHandle player = playerIndex.find(std::string(steamId));
+    if (player != NO_PLAYER)
     {
-      if (arenas[arenaId - 1].isEmpty())
-      {
-        return arenaId - 1;
-      }
+      playerIndex.setClientId(player, server.index, clientId);
+      playerIndex.setPortable(player, true);
     }
-    return std::nullopt;
+    return player;
   }
 
-  bool TournamentManager::isPlayerInMatch(const std::string &steamId) const
+  void TournamentManager::handleMGEMatchEnd(MGEServer &server, const MGEMatchEndEvent &event)
   {
-    for (const auto &arena : arenas)
+    PlayerHandle winner = resolveMGEPlayer(server, event.winnerId, event.winnerSteamId);
+    PlayerHandle loser = resolveMGEPlayer(server, event.loserId, event.loserSteamId);
+
+    if (winner == NO_PLAYER || loser == NO_PLAYER)
     {
-      if (arena.hasPlayer(steamId))
-      {
-        return true;
-      }
+      return;
     }
-    return false;
-  }
 
-  void TournamentManager::broadcastToServers(const json &message)
-  {
-    std::string msgStr = message.dump();
+    std::string winnerSteamId = playerIndex.steamId(winner);
+    std::string loserSteamId = playerIndex.steamId(loser);
 
-    for (auto &[wsi, conn] : connections)
+    MGE_LOG_INFO("Match ended", {{"server", server.endpoint.name}, {"winner", event.winnerName}, {"loser", event.loserName}, {"arena", event.arenaId}});
+
+    if (tournamentActive)
     {
-      if (conn->type == "server")
+      reportResult(winnerSteamId, loserSteamId);
+      completeMatch(winner, loser);
+
+      int arena = arenaIndex(server.index, event.arenaId);
+      if (arena >= 0)
       {
-        queueMessage(wsi, msgStr);
+        releaseArena(arena);
       }
-    }
-  }
 
-  void TournamentManager::sendToConnection(WebSocketConnection *conn, const json &message)
-  {
-    if (conn)
-    {
-      queueMessage(conn->wsi, message.dump());
+      // Fill the freed arena from the local ready set right away; the
+      // matches this result unlocks arrive with the background sync.
+      assignPendingMatches();
+      syncOpenMatches();
     }
   }
 
-  void TournamentManager::sendToMGEPlugin(const json &message)
+  void TournamentManager::handleMGEPlayerArenaRemoved(MGEServer &server, const MGEPlayerArenaRemovedEvent &event)
   {
-    if (!mgeConnected || !mgeClientWsi)
+    int arena = arenaIndex(server.index, event.arenaId);
+    if (arena >= 0)
     {
-      std::cerr << "Cannot send to MGE plugin: not connected" << std::endl;
-      return;
+      // Only if the player is still in that arena; a late event must not
+      // clear a match that has been placed there since.
+      PlayerHandle player = resolveMGEPlayer(server, event.playerId, event.steamId);
+      if (player != NO_PLAYER && playerIndex.arena(player) == arena)
+      {
+        releaseArena(arena);
+        assignPendingMatches();
+      }
     }
-
-    std::string msgStr = message.dump();
-    mgeOutgoingMessages.push(msgStr);
-    lws_callback_on_writable(mgeClientWsi);
-  }
-
-  void TournamentManager::requestPlayersFromMGE()
-  {
-    json request = {{"command", "get_players"}};
-    sendToMGEPlugin(request);
   }
 
-  void TournamentManager::requestArenasFromMGE()
+  void TournamentManager::handleMGESuccess(MGEServer &server, const MGEStatus &status)
   {
-    json request = {{"command", "get_arenas"}};
-    sendToMGEPlugin(request);
+    MGE_LOG_DEBUG("MGE plugin success", {{"server", server.endpoint.name}, {"message", status.message}});
   }
 
-  void TournamentManager::addPlayerToMGEArena(int clientId, int arenaId)
+  void TournamentManager::handleMGEError(MGEServer &server, const MGEStatus &status)
   {
-    json request = {
-        {"command", "add_player_to_arena"},
-        {"player_id", clientId},
-        {"arena_id", arenaId}};
-    sendToMGEPlugin(request);
+    MGE_LOG_ERROR("MGE plugin error", {{"server", server.endpoint.name}, {"message", status.message}});
   }
 
-  void TournamentManager::handleMGEPluginMessage(const std::string &message)
+  void TournamentManager::assignPendingMatches()
   {
-    std::cout << "[DEBUG] MGE Plugin Message: " << message << std::endl;
-
-    try
+    if (!anyMGEUsable())
     {
-      json j = json::parse(message);
+      MGE_LOG_WARN("Cannot assign matches: not connected to MGE plugin");
+      return;
+    }
 
-      if (!j.contains("type"))
+    auto now = std::chrono::steady_clock::now();
+    auto it = readyMatches.begin();
+    while (it != readyMatches.end())
+    {
+      auto found = openMatches.find(*it);
+      if (found == openMatches.end() || !isMatchReady(found->second))
       {
-        std::cout << "[DEBUG] No type field" << std::endl;
-        return;
+        it = readyMatches.erase(it);
+        continue;
       }
 
-      std::string type = j["type"];
-      std::cout << "[DEBUG] Message type: " << type << std::endl;
-
-      if (type == "welcome")
+      bool anyFree = std::any_of(mgeServers.begin(), mgeServers.end(), [now](const auto &server)
+                                 { return server->usable(now) && server->occupied < server->arenaCount(); });
+      if (!anyFree)
       {
-        std::cout << "Connected to MGE plugin: " << j.value("message", "") << std::endl;
-        requestArenasFromMGE();
-        requestPlayersFromMGE();
+        MGE_LOG_DEBUG("No open arenas available", {{"waiting", readyMatches.size()}});
+        break;
       }
-      else if (type == "response")
-      {
-        std::string command = j.value("command", "");
-        std::cout << "[DEBUG] Response command: " << command << std::endl;
 
-        if (command == "get_players")
+      const ScheduledMatch &scheduled = found->second;
+      int arena = pickArena(scheduled);
+      if (arena < 0)
+      {
+        // Its players' servers are full and they cannot be moved; it
+        // stays ready until an arena there frees up. If no server could
+        // ever take it, only the admin can get it going.
+        if (placeable(scheduled))
+        {
+          MGE_LOG_DEBUG("No reachable arena for match", {{"match", scheduled.match.matchId}});
+        }
+        else if (unplaceableMatches.insert(scheduled.match.matchId).second)
         {
-          std::cout << "[DEBUG] Processing get_players response" << std::endl;
-          std::cout << "[DEBUG] tournamentActive = " << (tournamentActive ? "true" : "false") << std::endl;
+          warnUnplaceableMatch(scheduled);
+        }
+        ++it;
+        continue;
+      }
+      unplaceableMatches.erase(scheduled.match.matchId);
 
-          players.clear();
-          steamIdToClientId.clear();
-          clientIdToSteamId.clear();
+      occupyArena(arena, scheduled.player1, scheduled.player2);
+      placePlayer(scheduled.player1, arena);
+      placePlayer(scheduled.player2, arena);
 
-          if (j.contains("players"))
-          {
-            std::cout << "[DEBUG] Players array found, size: " << j["players"].size() << std::endl;
+      MGE_LOG_INFO("Assigned match", {{"match", scheduled.match.matchId}, {"player1", scheduled.match.player1Name}, {"player2", scheduled.match.player2Name}, {"server", mgeServers[arenas[arena].server]->endpoint.name}, {"arena", arenas[arena].id}});
+      static metrics::Histogram &dispatchSeconds = metrics::registry().matchDispatchSeconds.with({});
+      dispatchSeconds.observe(std::chrono::duration<double>(std::chrono::steady_clock::now() - scheduled.readySince).count());
 
-            for (const auto &p : j["players"])
-            {
-              Player player;
-              player.clientId = p.value("id", 0);
-              player.name = p.value("name", "");
-              player.arena = p.value("arena", 0);
-              player.inArena = p.value("inArena", false);
-              player.elo = p.value("elo", 1000);
-
-              char steamIdBuf[64];
-              snprintf(steamIdBuf, sizeof(steamIdBuf), "STEAM_ID_%d", player.clientId);
-              player.steamId = steamIdBuf;
-
-              steamIdToClientId[player.steamId] = player.clientId;
-              clientIdToSteamId[player.clientId] = player.steamId;
-
-              players.push_back(player);
-              std::cout << "[DEBUG] Added player: " << player.name << " (ID: " << player.clientId << ", ELO: " << player.elo << ")" << std::endl;
-            }
-            std::cout << "Received " << players.size() << " players from MGE plugin" << std::endl;
+      it = readyMatches.erase(it);
+    }
+  }
 
-            if (tournamentActive && players.size() > 0)
-            {
-              std::cout << "[DEBUG] Tournament is active, proceeding to add players to Challonge" << std::endl;
-              std::cout << "Starting tournament with " << players.size() << " players" << std::endl;
+  void TournamentManager::warnUnplaceableMatch(const ScheduledMatch &scheduled)
+  {
+    const MGEServer &server1 = *mgeServers[playerIndex.server(scheduled.player1)];
+    const MGEServer &server2 = *mgeServers[playerIndex.server(scheduled.player2)];
+    MGE_LOG_WARN("Match cannot be placed: its players are on different servers and cannot be moved",
+                 {{"match", scheduled.match.matchId},
+                  {"player1", scheduled.match.player1Name},
+                  {"server1", server1.endpoint.name},
+                  {"player2", scheduled.match.player2Name},
+                  {"server2", server2.endpoint.name}});
+    sendToConnection(admin, {{"type", "Error"},
+                             {"payload", {{"message", "Match " + std::to_string(scheduled.match.matchId) + " (" +
+                                                          scheduled.match.player1Name + " on " + serverLabel(server1) + " vs " +
+                                                          scheduled.match.player2Name + " on " + serverLabel(server2) +
+                                                          ") cannot be placed: moving a player needs a steam_id from the plugin and a connect address for the server. Move one of them by hand."}}}});
+  }
 
-              int seed = 1;
-              for (const auto &player : players)
-              {
-                std::cout << "Adding player to Challonge: " << player.name << " (ELO: " << player.elo << ", Seed: " << seed << ")" << std::endl;
-                challonge->addParticipant(player.name, player.steamId, seed++);
-              }
+  void TournamentManager::syncOpenMatches()
+  {
+    if (matchFetchInFlight)
+    {
+      matchFetchQueued = true;
+      return;
+    }
 
-              std::cout << "[DEBUG] All players added, starting Challonge tournament" << std::endl;
-              challonge->startTournament();
+    matchFetchInFlight = true;
+    unsigned version = matchStateVersion;
+
+    MGE_LOG_DEBUG("Fetching pending matches from Challonge");
+    ChallongeAPI *api = challonge.get();
+    challongeExecutor->submit([api]()
+                              {
+                                auto pendingMatches = api->getPendingMatches();
+                                return std::make_pair(std::move(pendingMatches), api->snapshot()); },
+                              [this, version](std::pair<std::vector<PendingMatch>, Bracket> fetched)
+                              {
+                                matchFetchInFlight = false;
+
+                                // A result still in the outbox is missing
+                                // from what Challonge sent; the write that
+                                // settles it syncs again.
+                                bool stale = version != matchStateVersion;
+                                bool behind = outbox.count(OutboxEntry::Kind::ReportMatch) > 0;
+                                if (!stale && !behind)
+                                {
+                                  bracket = std::move(fetched.second);
+                                  mergeOpenMatches(fetched.first);
+                                  assignPendingMatches();
+                                }
+
+                                if ((stale && !behind && tournamentActive) || matchFetchQueued)
+                                {
+                                  matchFetchQueued = false;
+                                  syncOpenMatches();
+                                }
+                              },
+                              [this](const std::string &)
+                              {
+                                // The next result or player event syncs
+                                // again; one already asked for goes now.
+                                matchFetchInFlight = false;
+                                if (matchFetchQueued)
+                                {
+                                  matchFetchQueued = false;
+                                  syncOpenMatches();
+                                }
+                              });
+  }
 
-              std::cout << "[DEBUG] Tournament started, assigning pending matches" << std::endl;
-              assignPendingMatches();
-            }
-            else
-            {
-              std::cout << "[DEBUG] Not starting - tournamentActive=" << tournamentActive << ", players=" << players.size() << std::endl;
-            }
-          }
-          else
-          {
-            std::cout << "[DEBUG] No players array in response" << std::endl;
-          }
-        }
-        else if (command == "get_arenas")
-        {
-          std::cout << "Received arena info from MGE plugin" << std::endl;
-        }
+  void TournamentManager::mergeOpenMatches(const std::vector<PendingMatch> &pendingMatches)
+  {
+    MGE_LOG_DEBUG("Merging pending matches", {{"count", pendingMatches.size()}});
+
+    std::set<int> stillOpen;
+    for (const auto &match : pendingMatches)
+    {
+      stillOpen.insert(match.matchId);
+      if (!openMatches.count(match.matchId))
+      {
+        addOpenMatch(match);
       }
-      else if (type == "event")
+    }
+
+    std::set<int> mispredicted;
+    for (int id : predictedMatches)
+    {
+      if (!stillOpen.count(id) && openMatches.count(id))
       {
-        handleMGEEvent(j);
+        MGE_LOG_WARN("Challonge did not open predicted match, dropping it", {{"match", id}});
+        mispredicted.insert(id);
       }
-      else if (type == "success")
+    }
+    predictedMatches.clear();
+
+    // Matches Challonge no longer lists were completed elsewhere (e.g. by
+    // hand on the website) or were predicted wrongly. Players already placed
+    // for a completed match stay in their arena until MGE reports the end of
+    // the fight; a mispredicted match is never going to count, so its
+    // players are taken back out.
+    for (auto it = openMatches.begin(); it != openMatches.end();)
+    {
+      if (stillOpen.count(it->first))
       {
-        std::cout << "MGE Plugin Success: " << j.value("message", "") << std::endl;
+        ++it;
+        continue;
       }
-      else if (type == "error")
+
+      for (PlayerHandle player : {it->second.player1, it->second.player2})
       {
-        std::cerr << "MGE Plugin Error: " << j.value("message", "") << std::endl;
+        auto byPlayer = openMatchByPlayer.find(player);
+        if (byPlayer != openMatchByPlayer.end() && byPlayer->second == it->first)
+        {
+          openMatchByPlayer.erase(byPlayer);
+        }
       }
-    }
-    catch (const std::exception &e)
-    {
-      std::cerr << "Error handling MGE plugin message: " << e.what() << std::endl;
+      readyMatches.erase(it->first);
+      if (mispredicted.count(it->first))
+      {
+        // After the match is unlisted, so the freed players are offered
+        // their real next match rather than this one.
+        cancelMispredictedMatch(it->first, it->second.player1, it->second.player2);
+      }
+      it = openMatches.erase(it);
     }
   }
 
-  void TournamentManager::handleMGEEvent(const json &event)
+  void TournamentManager::cancelMispredictedMatch(int matchId, PlayerHandle player1, PlayerHandle player2)
   {
-    std::string eventType = event.value("event", "");
-
-    if (eventType == "match_end_1v1")
+    int index = player1 == NO_PLAYER ? -1 : playerIndex.arena(player1);
+    if (index < 0 || !arenas[index].hasPlayer(player1) || !arenas[index].hasPlayer(player2))
     {
-      int winnerId = event.value("winner_id", 0);
-      int loserId = event.value("loser_id", 0);
-      int arenaId = event.value("arena_id", 0);
-
-      if (clientIdToSteamId.count(winnerId) && clientIdToSteamId.count(loserId))
-      {
-        std::string winnerSteamId = clientIdToSteamId[winnerId];
-        std::string loserSteamId = clientIdToSteamId[loserId];
+      return;
+    }
 
-        std::cout << "Match ended: " << event.value("winner_name", "")
-                  << " beat " << event.value("loser_name", "") << std::endl;
+    const Arena &arena = arenas[index];
+    MGE_LOG_WARN("Cancelling placed match Challonge did not open", {{"match", matchId}, {"server", mgeServers[arena.server]->endpoint.name}, {"arena", arena.id}});
+    json payload = {{"arena", arena.id}, {"match", matchId}};
+    tagServer(payload, arena.server);
+    broadcastToServers({{"type", "MatchCancel"}, {"payload", payload}});
+    releaseArena(index);
+  }
 
-        if (tournamentActive)
-        {
-          challonge->reportMatch(winnerSteamId, loserSteamId);
+  void TournamentManager::addOpenMatch(const PendingMatch &match)
+  {
+    ScheduledMatch scheduled;
+    scheduled.match = match;
+    scheduled.player1 = playerIndex.intern(match.player1Id);
+    scheduled.player2 = playerIndex.intern(match.player2Id);
+
+    openMatchByPlayer[scheduled.player1] = match.matchId;
+    openMatchByPlayer[scheduled.player2] = match.matchId;
+    openMatches[match.matchId] = std::move(scheduled);
+    addReadyMatch(match.matchId);
+  }
 
-          if (arenaId > 0 && arenaId <= NUM_ARENAS)
-          {
-            arenas[arenaId - 1].clear();
-          }
+  void TournamentManager::clearSchedule()
+  {
+    // Invalidates any fetch still in flight for the previous bracket.
+    ++matchStateVersion;
+    openMatches.clear();
+    openMatchByPlayer.clear();
+    readyMatches.clear();
+    predictedMatches.clear();
+    unplaceableMatches.clear();
+    bracket.clear();
+  }
 
-          assignPendingMatches();
-        }
-      }
+  void TournamentManager::markPlayerFree(PlayerHandle player)
+  {
+    auto it = openMatchByPlayer.find(player);
+    if (it != openMatchByPlayer.end())
+    {
+      addReadyMatch(it->second);
     }
-    else if (eventType == "player_arena_removed")
+  }
+
+  void TournamentManager::refreshReadyMatches()
+  {
+    for (const auto &[id, scheduled] : openMatches)
     {
-      int arenaId = event.value("arena_id", 0);
-      if (arenaId > 0 && arenaId <= NUM_ARENAS)
+      if (isMatchReady(scheduled))
       {
-        int playerId = event.value("player_id", 0);
-        if (clientIdToSteamId.count(playerId))
-        {
-          std::string steamId = clientIdToSteamId[playerId];
-          arenas[arenaId - 1].currentMatch.reset();
-        }
+        addReadyMatch(id);
       }
     }
   }
 
-  void TournamentManager::assignPendingMatches()
+  void TournamentManager::addReadyMatch(int matchId)
   {
-    if (!mgeConnected)
+    auto match = openMatches.find(matchId);
+    if (match != openMatches.end() && readyMatches.insert(matchId).second)
     {
-      std::cout << "Cannot assign matches: not connected to MGE plugin" << std::endl;
-      return;
+      match->second.readySince = std::chrono::steady_clock::now();
     }
+  }
 
-    std::cout << "[DEBUG] Fetching pending matches from Challonge..." << std::endl;
-    auto pendingMatches = challonge->getPendingMatches();
-    std::cout << "[DEBUG] Got " << pendingMatches.size() << " pending matches" << std::endl;
+  bool TournamentManager::isMatchReady(const ScheduledMatch &scheduled) const
+  {
+    for (PlayerHandle player : {scheduled.player1, scheduled.player2})
+    {
+      // A portable player can be placed by steam id, so one who was moved
+      // is ready before their new server has told their client id.
+      bool present = playerIndex.server(player) >= 0 &&
+                     (playerIndex.clientId(player) >= 0 || playerIndex.portable(player));
+      if (!present || playerIndex.arena(player) >= 0)
+      {
+        return false;
+      }
+    }
+    return true;
+  }
 
-    if (pendingMatches.empty())
+  void TournamentManager::completeMatch(PlayerHandle winner, PlayerHandle loser)
+  {
+    if (winner == NO_PLAYER || loser == NO_PLAYER)
     {
-      std::cout << "[DEBUG] No pending matches available" << std::endl;
       return;
     }
 
-    for (const auto &match : pendingMatches)
+    auto it = openMatchByPlayer.find(winner);
+    if (it != openMatchByPlayer.end())
     {
-      std::cout << "[DEBUG] Processing match: " << match.player1Name << " vs " << match.player2Name << std::endl;
-      std::cout << "[DEBUG] Player 1 ID: " << match.player1Id << ", Player 2 ID: " << match.player2Id << std::endl;
-
-      if (isPlayerInMatch(match.player1Id) || isPlayerInMatch(match.player2Id))
+      auto match = openMatches.find(it->second);
+      if (match == openMatches.end())
       {
-        std::cout << "[DEBUG] One or both players already in a match, skipping" << std::endl;
-        continue;
+        openMatchByPlayer.erase(it);
       }
-
-      auto arenaOpt = getOpenArena();
-      if (!arenaOpt)
+      else if (match->second.player1 == loser || match->second.player2 == loser)
       {
-        std::cout << "No open arenas available" << std::endl;
-        break;
+        openMatchByPlayer.erase(match->second.player1);
+        openMatchByPlayer.erase(match->second.player2);
+        readyMatches.erase(match->first);
+        openMatches.erase(match);
       }
+    }
 
-      int arenaId = arenaOpt.value();
-      std::set<std::string> matchPlayers = {match.player1Id, match.player2Id};
-      arenas[arenaId].currentMatch = matchPlayers;
+    // Only after the finished match is gone, since the matches opened next
+    // take over the players' entries in openMatchByPlayer.
+    predictNextMatches(bracket.participantId(playerIndex.steamId(winner)),
+                       bracket.participantId(playerIndex.steamId(loser)));
+  }
 
-      std::cout << "[DEBUG] Checking if players exist in mapping..." << std::endl;
-      std::cout << "[DEBUG] steamIdToClientId has " << steamIdToClientId.size() << " entries" << std::endl;
-      std::cout << "[DEBUG] Looking for player1Id: " << match.player1Id << std::endl;
-      std::cout << "[DEBUG] Looking for player2Id: " << match.player2Id << std::endl;
+  void TournamentManager::predictNextMatches(int winnerId, int loserId)
+  {
+    const ChallongeMatch *played = bracket.findOpenMatch(winnerId, loserId);
+    if (!played)
+    {
+      return;
+    }
 
-      if (steamIdToClientId.count(match.player1Id) && steamIdToClientId.count(match.player2Id))
+    for (int id : bracket.advance(played->id, winnerId, loserId))
+    {
+      std::optional<PendingMatch> next = bracket.pendingMatch(id);
+      if (next && !openMatches.count(id))
       {
-        int client1 = steamIdToClientId[match.player1Id];
-        int client2 = steamIdToClientId[match.player2Id];
+        MGE_LOG_DEBUG("Predicted match", {{"match", id}, {"player1", next->player1Name}, {"player2", next->player2Name}});
+        predictedMatches.insert(id);
+        addOpenMatch(*next);
+      }
+    }
+  }
 
-        std::cout << "[DEBUG] Found client IDs: " << client1 << " and " << client2 << std::endl;
+  static constexpr size_t PEER_ROLES = 3;
 
-        addPlayerToMGEArena(client1, arenaId + 1);
-        addPlayerToMGEArena(client2, arenaId + 1);
+  static const char *peerRoleLabel(PeerRole role)
+  {
+    switch (role)
+    {
+    case PeerRole::Admin:
+      return "admin";
+    case PeerRole::Server:
+      return "server";
+    default:
+      return "unknown";
+    }
+  }
 
-        std::cout << "Assigned match: " << match.player1Name << " vs "
-                  << match.player2Name << " to arena " << (arenaId + 1) << std::endl;
-      }
-      else
-      {
-        std::cout << "[DEBUG] ERROR: Could not find client IDs for players!" << std::endl;
-        std::cout << "[DEBUG] Player 1 (" << match.player1Id << ") exists: " << (steamIdToClientId.count(match.player1Id) ? "YES" : "NO") << std::endl;
-        std::cout << "[DEBUG] Player 2 (" << match.player2Id << ") exists: " << (steamIdToClientId.count(match.player2Id) ? "YES" : "NO") << std::endl;
-      }
+  static PeerRole peerRole(const std::string &type)
+  {
+    if (type == "admin")
+    {
+      return PeerRole::Admin;
+    }
+    return type == "server" ? PeerRole::Server : PeerRole::Unknown;
+  }
+
+  // The inbound counter of a message type for each role, looked up once
+  // rather than per message.
+  static std::array<metrics::Counter *, PEER_ROLES> inboundCounters(std::string_view type)
+  {
+    std::array<metrics::Counter *, PEER_ROLES> counters;
+    for (size_t i = 0; i < PEER_ROLES; ++i)
+    {
+      counters[i] = &metrics::registry().messages.with({"in", peerRoleLabel(static_cast<PeerRole>(i)), std::string(type)});
     }
+    return counters;
   }
 
   void TournamentManager::handleMessage(lws *wsi, const std::string &message)
   {
+    struct PeerMetrics
+    {
+      metrics::Histogram *handlingSeconds;
+      metrics::Counter *invalid;
+      metrics::Counter *other;
+    };
+    static const std::array<PeerMetrics, PEER_ROLES> byRole = []()
+    {
+      std::array<PeerMetrics, PEER_ROLES> all;
+      auto invalid = inboundCounters("invalid");
+      auto other = inboundCounters("other");
+      for (size_t i = 0; i < PEER_ROLES; ++i)
+      {
+        all[i] = {&metrics::registry().messageHandlingSeconds.with({peerRoleLabel(static_cast<PeerRole>(i))}),
+                  invalid[i], other[i]};
+      }
+      return all;
+    }();
+
+    // Labelled by the role the connection had when the message arrived, so
+    // a ServerHello counts under "unknown".
+    auto conn = connections.find(wsi);
+    PeerRole role = conn != connections.end() ? peerRole(conn->second->type) : PeerRole::Unknown;
+    const PeerMetrics &peer = byRole[static_cast<size_t>(role)];
+    metrics::ScopedTimer timer(*peer.handlingSeconds);
+
     try
     {
       json j = json::parse(message);
 
       if (!j.contains("type"))
       {
-        std::cerr << "Message missing 'type' field" << std::endl;
+        MGE_LOG_WARN("Message missing type field");
+        peer.invalid->inc();
         return;
       }
 
       std::string type = j["type"];
-      json payload = j.contains("payload") ? j["payload"] : json::object();
+      static const json NO_PAYLOAD = json::object();
+      auto payload = j.find("payload");
 
-      std::cout << "Received: " << type << std::endl;
+      MGE_LOG_DEBUG("Received", {{"type", type}});
 
-      if (type == "ServerHello")
-      {
-        handleServerHello(wsi, payload);
-      }
-      else if (type == "TournamentStart")
-      {
-        handleTournamentStart(payload);
-      }
-      else if (type == "TournamentStop")
-      {
-        handleTournamentStop(payload);
-      }
-      else if (type == "UsersInServer")
-      {
-        handleUsersInServer(payload);
-      }
-      else if (type == "MatchResults")
+      // Known types count themselves; unknown ones share one series, as
+      // they come straight off the wire.
+      if (!serverHandlers.dispatch(type, wsi, payload != j.end() ? *payload : NO_PAYLOAD, role))
       {
-        handleMatchResults(payload);
-      }
-      else if (type == "MatchBegan")
-      {
-        handleMatchBegan(payload);
-      }
-      else if (type == "MatchDetails")
-      {
-        handleMatchDetails(payload);
-      }
-      else if (type == "SetMatchScore")
-      {
-        handleSetMatchScore(wsi, payload);
-      }
-      else if (type == "MatchCancel")
-      {
-        handleMatchCancel(payload);
+        peer.other->inc();
       }
     }
     catch (const std::exception &e)
     {
-      std::cerr << "Error handling message: " << e.what() << std::endl;
+      MGE_LOG_ERROR("Error handling message", {{"error", e.what()}});
+      peer.invalid->inc();
+      rejectMessage(wsi, e.what());
+    }
+  }
 
-      json errorMsg = {
-          {"type", "Error"},
-          {"payload", {{"message", e.what()}}}};
-      queueMessage(wsi, errorMsg.dump());
+  void TournamentManager::rejectMessage(lws *wsi, const std::string &reason)
+  {
+    json errorMsg = {
+        {"type", "Error"},
+        {"payload", {{"message", reason}}}};
+    queueMessage(wsi, errorMsg.dump());
+  }
+
+  template <typename Payload>
+  bool TournamentManager::decodePayload(lws *wsi, const json &payload, Payload &decoded)
+  {
+    std::string error;
+    if (decoded.parse(payload, error))
+    {
+      return true;
     }
+
+    std::string type(Payload::TYPE);
+    MGE_LOG_WARN("Rejected malformed message", {{"type", type}, {"error", error}});
+    rejectMessage(wsi, type + ": " + error);
+    return false;
+  }
+
+  template <typename Payload>
+  void TournamentManager::route(void (TournamentManager::*handler)(lws *, const Payload &))
+  {
+    auto received = inboundCounters(Payload::TYPE);
+    serverHandlers.on(Payload::TYPE, [this, handler, received](lws *wsi, const json &payload, PeerRole role)
+                      {
+                        Payload decoded;
+                        if (decodePayload(wsi, payload, decoded))
+                          (this->*handler)(wsi, decoded);
+                        received[static_cast<size_t>(role)]->inc(); });
+  }
+
+  template <typename Payload>
+  void TournamentManager::route(void (TournamentManager::*handler)(const Payload &))
+  {
+    auto received = inboundCounters(Payload::TYPE);
+    serverHandlers.on(Payload::TYPE, [this, handler, received](lws *wsi, const json &payload, PeerRole role)
+                      {
+                        Payload decoded;
+                        if (decodePayload(wsi, payload, decoded))
+                          (this->*handler)(decoded);
+                        received[static_cast<size_t>(role)]->inc(); });
+  }
+
+  template <typename View>
+  void TournamentManager::routeMGE(void (TournamentManager::*handler)(MGEServer &, const View &))
+  {
+    routeMGE(View::TYPE, handler);
+  }
+
+  template <typename View>
+  void TournamentManager::routeMGE(std::string_view key, void (TournamentManager::*handler)(MGEServer &, const View &))
+  {
+    // Looked up once here rather than per message.
+    metrics::Counter &received = metrics::registry().messages.with({"in", "mge", std::string(key)});
+    mgeHandlers.on(key, [this, handler, &received](MGEServer &server)
+                   {
+                     received.inc();
+                     (this->*handler)(server, mgeDecoder.view<View>()); });
   }
 
-  void TournamentManager::handleServerHello(lws *wsi, const json &payload)
+  void TournamentManager::registerHandlers()
+  {
+    route(&TournamentManager::handleServerHello);
+    route(&TournamentManager::handleTournamentStart);
+    route(&TournamentManager::handleTournamentStop);
+    route(&TournamentManager::handleUsersInServer);
+    route(&TournamentManager::handleMatchResults);
+    route(&TournamentManager::handleMatchBegan);
+    route(&TournamentManager::handleMatchDetails);
+    route(&TournamentManager::handleSetMatchScore);
+    route(&TournamentManager::handleMatchCancel);
+    route(&TournamentManager::handleGetOutbox);
+
+    routeMGE(&TournamentManager::handleMGEWelcome);
+    routeMGE(&TournamentManager::handleMGEPlayers);
+    routeMGE(&TournamentManager::handleMGEArenas);
+    routeMGE(&TournamentManager::handleMGEMatchEnd);
+    routeMGE(&TournamentManager::handleMGEPlayerArenaRemoved);
+    routeMGE("success", &TournamentManager::handleMGESuccess);
+    routeMGE("error", &TournamentManager::handleMGEError);
+  }
+
+  void TournamentManager::handleServerHello(lws *wsi, const ServerHelloPayload &payload)
   {
     if (!connections.count(wsi))
       return;
 
-    std::string apiKey = payload.value("apiKey", "");
-
-    if (apiKey == "admin")
+    if (payload.apiKey == "admin")
     {
       connections[wsi]->type = "admin";
       admin = connections[wsi].get();
-      std::cout << "Admin connected" << std::endl;
+      MGE_LOG_INFO("Admin connected");
     }
     else
     {
       connections[wsi]->type = "server";
-      std::cout << "Server connected" << std::endl;
+      MGE_LOG_INFO("Server connected");
     }
   }
 
-  void TournamentManager::handleTournamentStart(const json &payload)
+  void TournamentManager::handleTournamentStart(const TournamentStartPayload &payload)
   {
-    std::cout << "Tournament starting" << std::endl;
+    MGE_LOG_INFO("Tournament starting");
     tournamentActive = true;
+    playersRegistered = false;
+    outbox.clear();
+    clearSchedule();
+    record({{"event", "start"}});
+
+    // The executor runs requests in order, so the reset always reaches
+    // Challonge before the registrations triggered by the player list.
+    MGE_LOG_DEBUG("Resetting tournament");
+    ChallongeAPI *api = challonge.get();
+    ChallongeExecutor *executor = challongeExecutor.get();
+    challongeExecutor->submit([this, api, executor]()
+                              { api->resetTournament([this, executor](size_t done, size_t total)
+                                                     { executor->post([this, done, total]()
+                                                                      { sendResetProgress(done, total); }); }); });
+
+    // Registration waits until every connected server has answered.
+    for (auto &server : mgeServers)
+    {
+      server->awaitingPlayers = server->connected;
+      requestPlayersFromMGE(*server);
+    }
 
-    std::cout << "[DEBUG] Resetting tournament..." << std::endl;
-    challonge->resetTournament();
-
-    requestPlayersFromMGE();
+    MGE_LOG_INFO("Waiting for player list from MGE plugin", {{"servers", mgeServers.size()}});
+  }
 
-    std::cout << "Waiting for player list from MGE plugin..." << std::endl;
+  void TournamentManager::sendResetProgress(size_t done, size_t total)
+  {
+    json msg = {
+        {"type", "ResetProgress"},
+        {"payload", {{"done", done}, {"total", total}}}};
+    sendToConnection(admin, msg);
   }
 
-  void TournamentManager::handleTournamentStop(const json &payload)
+  void TournamentManager::handleTournamentStop(const TournamentStopPayload &payload)
   {
-    std::cout << "Tournament stopping" << std::endl;
+    MGE_LOG_INFO("Tournament stopping");
     tournamentActive = false;
+    playersRegistered = false;
+    // Results already played still belong on Challonge, so unconfirmed
+    // reports keep draining; only a pending registration is moot now.
+    for (const OutboxEntry &entry : outbox.removeKind(OutboxEntry::Kind::Register))
+    {
+      MGE_LOG_WARN("Dropping unconfirmed Challonge write", {{"kind", outboxKindName(entry.kind)},
+                                                            {"attempts", entry.attempts},
+                                                            {"error", entry.lastError}});
+      sendToConnection(admin, {{"type", "Error"},
+                               {"payload", {{"message", std::string("Challonge ") + outboxKindName(entry.kind) +
+                                                            " dropped unconfirmed: tournament stopped"}}}});
+    }
+    if (!outbox.empty())
+    {
+      MGE_LOG_INFO("Unconfirmed results still going to Challonge", {{"count", outbox.size()}});
+    }
+    clearSchedule();
+    record({{"event", "stop"}});
 
-    for (auto &arena : arenas)
+    for (size_t i = 0; i < arenas.size(); ++i)
     {
-      arena.clear();
+      releaseArena(static_cast<int>(i));
     }
 
     json msg = {
@@ -1011,19 +4148,19 @@ namespace mge
     broadcastToServers(msg);
   }
 
-  void TournamentManager::handleUsersInServer(const json &payload)
+  void TournamentManager::handleUsersInServer(const UsersInServerPayload &payload)
   {
-    if (!payload.contains("players"))
+    if (!payload.players)
       return;
 
     players.clear();
 
-    for (const auto &p : payload["players"])
+    for (const auto &user : *payload.players)
     {
       Player player;
-      player.steamId = p.value("steamId", "");
-      player.name = p.value("name", "");
-      player.elo = p.value("elo", 1000);
+      player.steamId = user.steamId;
+      player.name = user.name;
+      player.elo = user.elo;
       players.push_back(player);
     }
 
@@ -1031,127 +4168,178 @@ namespace mge
               [](const Player &a, const Player &b)
               { return a.elo > b.elo; });
 
-    std::cout << "Received " << players.size() << " players" << std::endl;
-
-    int seed = 1;
-    for (const auto &player : players)
-    {
-      std::cout << "Adding player: " << player.name << std::endl;
-      challonge->addParticipant(player.name, player.steamId, seed++);
-    }
-
-    challonge->startTournament();
+    MGE_LOG_INFO("Received players", {{"count", players.size()}});
 
-    assignPendingMatches();
+    registerPlayers(players);
   }
 
-  void TournamentManager::handleMatchResults(const json &payload)
+  void TournamentManager::handleMatchResults(const MatchResultsPayload &payload)
   {
-    std::string winner = payload.value("winner", "");
-    std::string loser = payload.value("loser", "");
-    int arena = payload.value("arena", 0) - 1;
+    const std::string &winner = payload.winner;
+    const std::string &loser = payload.loser;
+    int arenaId = payload.arena;
 
-    std::cout << "Match result: " << winner << " beat " << loser
-              << " in arena " << (arena + 1) << std::endl;
+    MGE_LOG_INFO("Match result", {{"winner", winner}, {"loser", loser}, {"server", payload.server}, {"arena", arenaId}});
 
-    challonge->reportMatch(winner, loser);
+    reportResult(winner, loser);
+    completeMatch(playerIndex.find(winner), playerIndex.find(loser));
 
-    if (arena >= 0 && arena < NUM_ARENAS)
+    int arena = arenaIndex(payload.server, arenaId);
+    if (arena >= 0)
     {
-      arenas[arena].clear();
+      releaseArena(arena);
     }
 
     assignPendingMatches();
+    syncOpenMatches();
   }
 
-  void TournamentManager::handleMatchBegan(const json &payload)
+  void TournamentManager::handleMatchBegan(const MatchBeganPayload &payload)
   {
-    std::string p1 = payload.contains("p1Id") ? payload["p1Id"].get<std::string>()
-                                              : payload.value("p1", "");
-    std::string p2 = payload.contains("p2Id") ? payload["p2Id"].get<std::string>()
-                                              : payload.value("p2", "");
-
-    std::cout << "Match began: " << p1 << " vs " << p2 << std::endl;
+    MGE_LOG_INFO("Match began", {{"player1", payload.player1}, {"player2", payload.player2}});
   }
 
-  void TournamentManager::handleMatchDetails(const json &payload)
+  void TournamentManager::handleMatchDetails(const MatchDetailsPayload &payload)
   {
-    int arenaId = payload.value("arenaId", 0) - 1;
-    std::string p1Id = payload.value("p1Id", "");
-    std::string p2Id = payload.value("p2Id", "");
-
-    if (arenaId >= 0 && arenaId < NUM_ARENAS)
+    int arena = arenaIndex(payload.server, payload.arenaId);
+    if (arena >= 0)
     {
-      std::set<std::string> matchPlayers = {p1Id, p2Id};
-      arenas[arenaId].currentMatch = matchPlayers;
+      occupyArena(arena, playerIndex.intern(payload.p1Id), playerIndex.intern(payload.p2Id));
 
       json msg = {
           {"type", "MatchDetails"},
-          {"payload", payload}};
-      broadcastToServers(msg);
+          {"payload", payload.body}};
+      std::string scope = payload.server.empty() ? "" : payload.server + ":";
+      broadcastToServers(msg, "MatchDetails:" + scope + std::to_string(payload.arenaId));
     }
   }
 
-  void TournamentManager::handleSetMatchScore(lws *wsi, const json &payload)
+  void TournamentManager::handleSetMatchScore(lws *wsi, const SetMatchScorePayload &payload)
   {
+    // Score updates for the same arena supersede each other.
+    std::string coalesceKey;
+    if (!payload.arenaId.is_null())
+    {
+      coalesceKey = "SetMatchScore:" + payload.arenaId.dump();
+    }
+
     json msg = {
         {"type", "SetMatchScore"},
-        {"payload", payload}};
-    broadcastToServers(msg);
+        {"payload", payload.body}};
+    broadcastToServers(msg, coalesceKey);
   }
 
-  void TournamentManager::handleMatchCancel(const json &payload)
+  void TournamentManager::handleGetOutbox(lws *wsi, const GetOutboxPayload &payload)
   {
-    int arena = payload.value("arena", 0) - 1;
+    auto conn = connections.find(wsi);
+    if (conn == connections.end())
+      return;
 
-    if (arena >= 0 && arena < NUM_ARENAS)
+    auto now = std::chrono::steady_clock::now();
+    json entries = json::array();
+    for (const auto &[id, entry] : outbox.all())
     {
-      arenas[arena].clear();
-      std::cout << "Match cancelled in arena " << (arena + 1) << std::endl;
+      if (entries.size() >= OUTBOX_REPORT_LIMIT)
+      {
+        break;
+      }
+      json e = entry.toJson();
+      e["attempts"] = entry.attempts;
+      e["inFlight"] = entry.inFlight;
+      e["lastError"] = entry.lastError;
+      e["retryInMs"] = entry.inFlight ? 0 : std::max<long long>(0, std::chrono::duration_cast<std::chrono::milliseconds>(entry.nextAttempt - now).count());
+      entries.push_back(std::move(e));
     }
-  }
 
-  void TournamentManager::setMGEClientWsi(lws *wsi)
-  {
-    mgeClientWsi = wsi;
+    json msg = {
+        {"type", "Outbox"},
+        {"payload", {{"depth", outbox.size()}, {"entries", entries}}}};
+    sendToConnection(conn->second.get(), msg);
   }
 
-  void TournamentManager::onMGEConnected()
+  void TournamentManager::handleMatchCancel(const MatchCancelPayload &payload)
   {
-    mgeConnected = true;
-    std::cout << "Connected to MGE plugin WebSocket server" << std::endl;
+    int arenaId = payload.arena;
+    int arena = arenaIndex(payload.server, arenaId);
+
+    if (arena >= 0)
+    {
+      releaseArena(arena);
+      MGE_LOG_INFO("Match cancelled", {{"server", payload.server}, {"arena", arenaId}});
+      assignPendingMatches();
+    }
   }
 
-  void TournamentManager::onMGEDisconnected()
+  void TournamentManager::onMGEConnected(MGEServer &server, lws *wsi)
   {
-    mgeConnected = false;
-    mgeClientWsi = nullptr;
-    std::cout << "Disconnected from MGE plugin WebSocket server" << std::endl;
+    server.wsi = wsi;
+    server.connected = true;
+    server.offlineUntil = {};
+    // A restarted plugin hands out new client ids, so none are trusted
+    // until it reports its players; what was buffered waits for that too.
+    playerIndex.clearClientIds(server.index);
+    scheduleMGEExpiry(server);
+    MGE_LOG_INFO("Connected to MGE plugin WebSocket server", {{"server", server.endpoint.name}});
   }
 
-  void TournamentManager::queueMGEMessage(const std::string &message)
+  void TournamentManager::onMGEDisconnected(MGEServer &server)
   {
-    mgeOutgoingMessages.push(message);
-    if (mgeClientWsi)
+    auto now = std::chrono::steady_clock::now();
+    bool wasConnected = server.connected;
+    server.connected = false;
+    server.wsi = nullptr;
+    server.closing = false;
+    server.awaitingPlayers = false;
+    server.resyncing = false;
+    server.requestedAt.clear();
+    server.inbound.reset();
+
+    // Whatever had not gone out yet waits with the commands sent from now
+    // on.
+    for (OutboundFrame *frame = server.outgoing.front(); frame; frame = server.outgoing.front())
     {
-      lws_callback_on_writable(mgeClientWsi);
+      json message = json::parse(frame->payload(), frame->payload() + frame->size(), nullptr, false);
+      server.outgoing.pop();
+      if (!message.is_discarded())
+      {
+        bufferMGECommand(server, std::move(message), now);
+      }
     }
-  }
 
-  bool TournamentManager::hasMGEQueuedMessages() const
-  {
-    return !mgeOutgoingMessages.empty();
+    if (wasConnected)
+    {
+      // A blip should not stall the matches on this server: it is still
+      // placed on for as long as a placement sent now would be kept.
+      auto ttl = mgeCommandTtl.find("add_player_to_arena");
+      server.offlineUntil = now + (ttl != mgeCommandTtl.end() ? ttl->second : std::chrono::milliseconds::zero());
+      scheduleMGEExpiry(server);
+      MGE_LOG_WARN("Disconnected from MGE plugin WebSocket server", {{"server", server.endpoint.name}, {"buffered", server.offline.size()}});
+    }
+    scheduleMGEReconnect(server);
   }
 
-  std::string TournamentManager::popMGEMessage()
+  void TournamentManager::queueMGEMessage(MGEServer &server, const std::string &message, const std::string &coalesceKey)
   {
-    if (mgeOutgoingMessages.empty())
+    if (server.closing)
+    {
+      return;
+    }
+
+    switch (server.outgoing.push(OutboundFrame::fromString(message, coalesceKey)))
+    {
+    case OutboundQueue::PushResult::Queued:
+    case OutboundQueue::PushResult::Coalesced:
+      break;
+    case OutboundQueue::PushResult::Overflow:
+      MGE_LOG_ERROR("MGE send queue overflow, closing plugin connection", {{"server", server.endpoint.name}});
+      server.closing = true;
+      break;
+    }
+
+    if (server.wsi)
     {
-      return "";
+      lws_callback_on_writable(server.wsi);
     }
-    std::string msg = mgeOutgoingMessages.front();
-    mgeOutgoingMessages.pop();
-    return msg;
   }
 
 }
\ No newline at end of file
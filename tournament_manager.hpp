@@ -1,20 +1,33 @@
 #pragma once
 
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <random>
 #include <string>
 #include <vector>
 #include <map>
+#include <unordered_map>
+#include <unordered_set>
 #include <optional>
 #include <set>
 #include <memory>
-#include <queue>
+#include <functional>
+#include <mutex>
 #include <nlohmann/json.hpp>
 #include <curl/curl.h>
+#include <libwebsockets.h>
+#include "challonge_executor.hpp"
+#include "challonge_outbox.hpp"
+#include "journal.hpp"
+#include "message_dispatch.hpp"
+#include "messages.hpp"
+#include "rate_limiter.hpp"
+#include "ring_queue.hpp"
 
 using json = nlohmann::json;
 
-struct lws;
-struct lws_context;
-
 namespace mge
 {
 
@@ -26,6 +39,8 @@ namespace mge
     int clientId;
     int arena;
     bool inArena;
+    // Index of the MGE server that reported the player, -1 if none did.
+    int server = -1;
 
     json toJson() const
     {
@@ -33,125 +48,877 @@ namespace mge
     }
   };
 
+  // Dense id for a player, interned from their steam id by PlayerIndex.
+  using PlayerHandle = uint32_t;
+  static constexpr PlayerHandle NO_PLAYER = UINT32_MAX;
+
+  // Interns steam ids into PlayerHandles and keeps, per handle, the MGE
+  // server the player is on, their client id there and the arena they are
+  // assigned to, so every lookup the scheduler makes is O(1) no matter how
+  // many players or arenas there are.
+  class PlayerIndex
+  {
+  public:
+    PlayerHandle intern(const std::string &steamId);
+    PlayerHandle find(const std::string &steamId) const;
+    PlayerHandle findByClientId(int server, int clientId) const;
+
+    const std::string &steamId(PlayerHandle player) const { return entries[player].steamId; }
+    // Index of the MGE server the player is on or was sent to, -1 if
+    // unknown.
+    int server(PlayerHandle player) const { return entries[player].server; }
+    // -1 when not known, e.g. for a player who was moved to that server
+    // and has not been named in one of its events since.
+    int clientId(PlayerHandle player) const { return entries[player].clientId; }
+    // Index into TournamentManager::arenas, or -1 when not in a match.
+    int arena(PlayerHandle player) const { return entries[player].arena; }
+    // True if the plugin identified the player by their real steam id, so
+    // another server will recognise them after a move.
+    bool portable(PlayerHandle player) const { return entries[player].portable; }
+
+    void setClientId(PlayerHandle player, int server, int clientId);
+    void setArena(PlayerHandle player, int arena) { entries[player].arena = arena; }
+    void setPortable(PlayerHandle player, bool portable) { entries[player].portable = portable; }
+    // Forgets who is on one server, e.g. before applying its fresh
+    // get_players list.
+    void clearServer(int server);
+    // Forgets the client ids on one server but not who was there, e.g.
+    // when a plugin that may have restarted reconnects.
+    void clearClientIds(int server);
+
+    size_t size() const { return entries.size(); }
+
+  private:
+    struct Entry
+    {
+      std::string steamId;
+      int server = -1;
+      int clientId = -1;
+      int arena = -1;
+      bool portable = false;
+    };
+
+    std::vector<Entry> entries;
+    std::unordered_map<std::string, PlayerHandle> bySteamId;
+    // Per server. MGE client ids are small slot numbers, so a flat table
+    // beats a map.
+    std::vector<std::vector<PlayerHandle>> byClientId;
+  };
+
   struct Arena
   {
-    std::optional<std::set<std::string>> currentMatch;
+    int id = 0; // MGE plugin arena id, unique per server
+    int server = 0; // index of the MGE server the arena is on
+    std::string name;
+    int priority = 0; // lower fills first
+    PlayerHandle player1 = NO_PLAYER;
+    PlayerHandle player2 = NO_PLAYER;
 
-    void clear() { currentMatch.reset(); }
-    bool isEmpty() const { return !currentMatch.has_value(); }
-    bool hasPlayer(const std::string &steamId) const
+    bool isEmpty() const { return player1 == NO_PLAYER && player2 == NO_PLAYER; }
+    bool hasPlayer(PlayerHandle player) const
     {
-      if (!currentMatch)
-        return false;
-      return currentMatch->count(steamId) > 0;
+      return player != NO_PLAYER && (player1 == player || player2 == player);
     }
   };
 
   struct PendingMatch
   {
+    int matchId = 0;
     std::string player1Name;
     std::string player1Id;
     std::string player2Name;
     std::string player2Id;
   };
 
+  // An open Challonge match the scheduler knows about, with its players
+  // resolved to handles so readiness checks don't need string lookups.
+  struct ScheduledMatch
+  {
+    PendingMatch match;
+    PlayerHandle player1 = NO_PLAYER;
+    PlayerHandle player2 = NO_PLAYER;
+    // When the match last entered readyMatches, for the dispatch latency
+    // metric.
+    std::chrono::steady_clock::time_point readySince;
+  };
+
+  struct ChallongeParticipant
+  {
+    int id = 0;
+    std::string name;
+    std::string steamId;
+    int seed = 0;
+  };
+
+  struct ChallongeMatch
+  {
+    int id = 0;
+    std::string state;
+    int round = 0;
+    std::optional<int> player1Id;
+    std::optional<int> player2Id;
+    std::optional<int> winnerId;
+    std::optional<int> loserId;
+    // Where each slot's player comes from: the winner (or loser, in double
+    // elimination) of an earlier match.
+    std::optional<int> player1PrereqMatchId;
+    std::optional<int> player2PrereqMatchId;
+    bool player1IsPrereqMatchLoser = false;
+    bool player2IsPrereqMatchLoser = false;
+
+    bool isOpen() const
+    {
+      return state == "open" && player1Id && player2Id && !winnerId;
+    }
+  };
+
+  // Participants and matches of one single- or double-elimination
+  // tournament. ChallongeAPI uses it as its cache; TournamentManager keeps a
+  // copy so it can advance the bracket itself the moment a result is known.
+  class Bracket
+  {
+  public:
+    void clear();
+    void clearParticipants();
+    void clearMatches();
+    void setParticipant(ChallongeParticipant participant);
+    void setMatch(ChallongeMatch match);
+
+    const ChallongeParticipant *participant(int id) const;
+    // Participant registered with this steam id, or 0 if there is none.
+    int participantId(const std::string &steamId) const;
+    const ChallongeMatch *match(int id) const;
+    const ChallongeMatch *findOpenMatch(int participantA, int participantB) const;
+    const std::map<int, ChallongeMatch> &allMatches() const { return matches; }
+    size_t participantCount() const { return participants.size(); }
+    size_t matchCount() const { return matches.size(); }
+
+    // The open match as the scheduler sees it; nullopt if it is not open or
+    // a participant is unknown.
+    std::optional<PendingMatch> pendingMatch(int matchId) const;
+
+    // Completes matchId and moves the winner and loser into the matches
+    // that take them, the way Challonge does. Returns the ids of matches
+    // that became open as a result.
+    std::vector<int> advance(int matchId, int winnerId, int loserId);
+
+  private:
+    std::map<int, ChallongeParticipant> participants;
+    std::unordered_map<std::string, int> participantIdBySteamId;
+    std::map<int, ChallongeMatch> matches;
+  };
+
+  // A serialized message laid out the way lws_write() wants it: HEADROOM
+  // (LWS_PRE) bytes reserved in front of the payload so it can be written in
+  // place. The payload never changes after construction, so one buffer is
+  // shared by every queue a broadcast is delivered to.
+  struct FrameBuffer
+  {
+    static const size_t HEADROOM;
+
+    std::vector<unsigned char> bytes;
+    // Non-empty for state updates that a newer frame with the same key
+    // supersedes, e.g. "MatchDetails:3"; such frames may be coalesced or
+    // dropped when the connection falls behind.
+    std::string coalesceKey;
+
+    static std::shared_ptr<FrameBuffer> fromString(const std::string &payload,
+                                                   const std::string &coalesceKey = "");
+
+    unsigned char *payload() { return bytes.data() + HEADROOM; }
+    size_t size() const { return bytes.size() - HEADROOM; }
+  };
+
+  // One connection's reference to a queued FrameBuffer. Large payloads go
+  // out as several fragments; sent tracks how much this connection has
+  // written so far.
+  struct OutboundFrame
+  {
+    std::shared_ptr<FrameBuffer> buffer;
+    size_t sent = 0;
+
+    static OutboundFrame fromString(const std::string &payload,
+                                    const std::string &coalesceKey = "")
+    {
+      return {FrameBuffer::fromString(payload, coalesceKey)};
+    }
+
+    unsigned char *payload() { return buffer->payload(); }
+    size_t size() const { return buffer->size(); }
+    const std::string &coalesceKey() const { return buffer->coalesceKey; }
+    bool started() const { return sent > 0; }
+  };
+
+  // Bounded per-connection send queue with backpressure. Once the queue
+  // reaches its high watermark it is congested until it drains back to the
+  // low watermark; while congested, a keyed state update replaces the queued
+  // update with the same key instead of growing the queue. A full queue still
+  // accepts such a replacement; anything else reports Overflow, at which point
+  // the owner should disconnect the consumer.
+  class OutboundQueue
+  {
+  public:
+    enum class PushResult
+    {
+      Queued,
+      Coalesced,
+      Overflow
+    };
+
+    OutboundQueue(size_t capacity, size_t highWatermark, size_t lowWatermark);
+
+    PushResult push(OutboundFrame frame);
+    OutboundFrame *front() { return frames.empty() ? nullptr : &frames.front(); }
+    void pop();
+
+    bool empty() const { return frames.empty(); }
+    size_t size() const { return frames.size(); }
+    bool congested() const { return isCongested; }
+
+  private:
+    RingQueue<OutboundFrame> frames;
+    size_t highWatermark;
+    size_t lowWatermark;
+    bool isCongested = false;
+  };
+
+  // Collects the fragments of one inbound WebSocket message. The buffer is
+  // cleared rather than freed between messages so its allocation is reused.
+  struct MessageAssembler
+  {
+    enum class Status
+    {
+      Partial,
+      Complete,
+      Overflow
+    };
+
+    std::string buffer;
+    bool overflowed = false;
+
+    // Adds one received chunk. Complete means buffer now holds a whole
+    // message; Overflow means the message exceeded maxSize and was discarded.
+    // Either way the caller must reset() before the next message starts.
+    Status append(const char *data, size_t len, bool finalFragment,
+                  size_t remaining, size_t maxSize);
+    void reset();
+  };
+
+  // A connection's role as far as inbound message metrics go: "admin",
+  // "server", or neither yet.
+  enum class PeerRole
+  {
+    Admin,
+    Server,
+    Unknown
+  };
+
   struct WebSocketConnection
   {
-    lws *wsi;
+    static constexpr size_t QUEUE_CAPACITY = 1024;
+    static constexpr size_t QUEUE_HIGH_WATERMARK = 768;
+    static constexpr size_t QUEUE_LOW_WATERMARK = 256;
+
+    lws *wsi = nullptr;
+    // Stable label for per-connection metrics; wsi pointers get reused.
+    unsigned id = 0;
     std::string type;
-    std::vector<std::string> messageQueue;
+    OutboundQueue messageQueue{QUEUE_CAPACITY, QUEUE_HIGH_WATERMARK, QUEUE_LOW_WATERMARK};
+    MessageAssembler inbound;
+    // Set when the consumer fell too far behind; the next writeable
+    // callback closes the connection.
+    bool closing = false;
+  };
+
+  // One MGE plugin to connect to ("mge_servers" in config.json).
+  struct MGEEndpoint
+  {
+    // Identifies the server in logs, metrics and the journal. Only the
+    // single default endpoint goes without one.
+    std::string name;
+    std::string host = "localhost";
+    int port = 9001;
+    std::string path = "/";
+    // Game server address players on other servers are redirected to when
+    // a match is placed here. Empty means nobody is moved to this server.
+    std::string connect;
+  };
+
+  // Delay before reconnecting to an MGE plugin ("mge_reconnect_initial_ms"
+  // and "mge_reconnect_max_ms" in config.json). Attempt n waits between
+  // half and all of min(maxDelay, initialDelay * 2^(n-1)).
+  struct MGEReconnectBackoff
+  {
+    std::chrono::milliseconds initialDelay{1000};
+    std::chrono::milliseconds maxDelay{30000};
+  };
+
+  class TournamentManager;
+  struct MGEServer;
+
+  // An lws_sul timer that calls back into the manager for one server.
+  // sul comes first so lws_container_of() can get back to the rest.
+  struct MGETimer
+  {
+    lws_sorted_usec_list_t sul{};
+    TournamentManager *manager = nullptr;
+    MGEServer *server = nullptr;
+  };
+
+  // Connection to one MGE plugin, with its share of the arena pool.
+  struct MGEServer
+  {
+    static constexpr size_t QUEUE_CAPACITY = 4096;
+    static constexpr size_t QUEUE_HIGH_WATERMARK = 3072;
+    static constexpr size_t QUEUE_LOW_WATERMARK = 1024;
+    // Weight of the newest sample in pingSeconds.
+    static constexpr double PING_SMOOTHING = 0.2;
+    // Most commands held for the plugin while it is offline; beyond that
+    // the oldest are dropped.
+    static constexpr size_t OFFLINE_LIMIT = 1024;
+
+    // A command that could not be sent, kept until the plugin is back or
+    // expires passes. For add_player_to_arena, arena and player say which
+    // placement it was, resolved when it was buffered.
+    struct BufferedCommand
+    {
+      json message;
+      std::chrono::steady_clock::time_point expires;
+      int arena = -1;
+      PlayerHandle player = NO_PLAYER;
+    };
+
+    MGEEndpoint endpoint;
+    // Position in the manager's server list; Arena::server and PlayerIndex
+    // refer to the server by it.
+    int index = 0;
+    lws *wsi = nullptr;
+    bool connected = false;
+    // Set when the send queue overflowed; the next writeable callback
+    // closes the connection.
+    bool closing = false;
+    OutboundQueue outgoing{QUEUE_CAPACITY, QUEUE_HIGH_WATERMARK, QUEUE_LOW_WATERMARK};
+    MessageAssembler inbound;
+
+    // This server's arenas: indices into the manager's arenas in the order
+    // they fill, and by MGE arena id.
+    std::vector<int> arenaPriority;
+    std::unordered_map<int, int> arenaIndexById;
+    size_t occupied = 0;
+
+    // Smoothed time from sending get_players or get_arenas to the reply,
+    // queueing included; 0 until measured. requestedAt holds when the
+    // unanswered ones were sent, by command.
+    double pingSeconds = 0;
+    std::unordered_map<std::string, std::chrono::steady_clock::time_point> requestedAt;
+    // Set while a starting tournament waits for this server's players.
+    bool awaitingPlayers = false;
+    // Its last get_players listed players without a steam id, which were
+    // left out; reported once until a list comes without any.
+    bool missingSteamIds = false;
+
+    // Reconnecting. reconnectAttempts counts attempts since the last
+    // welcome and sets the backoff. A server that dropped keeps being
+    // placed on until offlineUntil, with the commands for it buffered in
+    // offline; expiryTimer fires at the earliest of that and the buffered
+    // commands' expiry (expiryAt, zero if not scheduled).
+    MGETimer reconnectTimer;
+    MGETimer expiryTimer;
+    unsigned reconnectAttempts = 0;
+    bool reconnectScheduled = false;
+    std::chrono::steady_clock::time_point offlineUntil;
+    std::chrono::steady_clock::time_point expiryAt;
+    std::deque<BufferedCommand> offline;
+    // Set from welcome until the get_players reply has been checked
+    // against the local arena state.
+    bool resyncing = false;
+
+    size_t arenaCount() const { return arenaPriority.size(); }
+    // Whether matches may be placed here: connected, or only just dropped.
+    bool usable(std::chrono::steady_clock::time_point now) const { return connected || now < offlineUntil; }
   };
 
   class ChallongeAPI
   {
+    // bench/mge_bench.cpp times private hot paths directly.
+    friend struct BenchAccess;
+
+  public:
+    static constexpr const char *DEFAULT_BASE_URL = "https://api.challonge.com/v1";
+
   private:
+    static constexpr size_t BULK_ADD_CHUNK_SIZE = 64;
+    static constexpr size_t MAX_PARALLEL_REQUESTS = 8;
+    // A 429 was not applied, so the request is sent again once the
+    // Retry-After pause is over, as long as that pause is at most
+    // MAX_RATE_LIMIT_PAUSE; otherwise the 429 goes back to the caller.
+    static constexpr int MAX_RATE_LIMIT_RETRIES = 3;
+    static constexpr std::chrono::milliseconds DEFAULT_RATE_LIMIT_PAUSE{1000};
+    static constexpr std::chrono::milliseconds MAX_RATE_LIMIT_PAUSE{30000};
+
+    struct Request
+    {
+      std::string method;
+      std::string endpoint;
+      json data;
+    };
+
+    struct Response
+    {
+      long status = 0;
+      std::string body;
+      std::string retryAfter;
+    };
+
+    std::string baseUrl;
     std::string username;
     std::string apiKey;
     std::string subdomain;
     std::string tournamentUrl;
     std::string tournamentId;
+    // "pending", "underway", ... as of the last response that said.
+    std::string tournamentState;
+
+    // Local model of the bracket. Filled by loadTournament() and kept current
+    // from the responses to our own writes; only touched from the executor's
+    // worker thread, so it needs no locking.
+    Bracket bracket;
+    // Set after we report a result: Challonge advances the bracket on its
+    // side, so the next read of open matches has to refetch them once.
+    bool matchesStale = true;
+
+    // Connections, TLS sessions and DNS results are shared across requests
+    // through one CURLSH; easy handles are pooled so keep-alive connections
+    // to api.challonge.com survive between calls.
+    CURLSH *share = nullptr;
+    std::mutex shareLocks[CURL_LOCK_DATA_LAST];
+    std::mutex handlePoolMutex;
+    std::vector<CURL *> idleHandles;
+
+    RateLimiter limiter;
+
+    static void lockShare(CURL *handle, curl_lock_data data, curl_lock_access access, void *userptr);
+    static void unlockShare(CURL *handle, curl_lock_data data, void *userptr);
+    CURL *acquireHandle();
+    void releaseHandle(CURL *curl);
+    void configureHandle(CURL *curl);
+
+    void clearCache();
+    void cacheTournament(const json &tournament);
+    void cacheParticipant(const json &participant);
+    void cacheMatch(const json &match);
+    // Replace the cached participants / matches with a participants.json or
+    // matches.json response body.
+    void cacheParticipants(const std::string &response);
+    void cacheMatches(const std::string &response);
+    // These return the HTTP status, 0 if there was no response. The cache
+    // is only touched on success.
+    long refreshParticipants();
+    long refreshMatches();
+    long refreshMatch(int matchId);
 
+    // Points the handle's body and Retry-After output at response.
+    curl_slist *prepareRequest(CURL *curl, const Request &request, Response *response);
+    // Pauses the limiter for a 429's Retry-After; returns the pause asked for.
+    std::chrono::milliseconds onRateLimited(const Request &request, const Response &response);
+    // Sends one request through the limiter, retrying 429s.
+    Response performRequest(const Request &request);
+    // performRequest() for one request; returns the body and, if status is
+    // given, the HTTP status.
     std::string makeRequest(const std::string &method,
                             const std::string &endpoint,
-                            const json &data = json::object());
+                            const json &data = json::object(),
+                            long *status = nullptr);
+    // Runs independent requests concurrently on one curl multi handle, at most
+    // MAX_PARALLEL_REQUESTS in flight and started as the limiter allows;
+    // onProgress gets the completed count.
+    std::vector<Response> makeRequests(const std::vector<Request> &requests,
+                                       const std::function<void(size_t)> &onProgress = nullptr);
 
     std::string flattenToForm(const json &j, CURL *curl, const std::string &prefix = "") const;
 
   public:
     ChallongeAPI(const std::string &user, const std::string &key,
-                 const std::string &subdomain, const std::string &tournamentUrl);
+                 const std::string &subdomain, const std::string &tournamentUrl,
+                 const std::string &baseUrl = DEFAULT_BASE_URL);
+    ~ChallongeAPI();
 
-    void loadTournament();
+    ChallongeAPI(const ChallongeAPI &) = delete;
+    ChallongeAPI &operator=(const ChallongeAPI &) = delete;
+
+    // Client-side limit on requests per second; off by default. A 429's
+    // Retry-After is honored either way.
+    void setRateLimit(RateLimiter::Options options) { limiter.configure(options); }
+
+    // The tournament this client works on, as {"subdomain", "tournament"}.
+    json identity() const { return {{"subdomain", subdomain}, {"tournament", tournamentUrl}}; }
+    // False if the tournament could not be loaded.
+    bool loadTournament();
     void addParticipant(const std::string &name, const std::string &steamId, int seed);
-    void startTournament();
+    // Registers the roster through participants/bulk_add, seeded in roster
+    // order, in chunks of BULK_ADD_CHUNK_SIZE participants per request.
+    // Players already registered under their steam id are skipped, so a
+    // partly failed registration can simply be run again.
+    void addParticipants(const std::vector<Player> &roster);
+    // The HTTP status, 0 if there was no response.
+    long startTournament();
     std::vector<PendingMatch> getPendingMatches();
-    void reportMatch(const std::string &winnerId, const std::string &loserId);
-    void resetTournament();
+
+    // Writes for ChallongeOutbox. Each is safe to repeat: the cached
+    // bracket is checked first, and with verify set it is refreshed from
+    // Challonge beforehand, for when an earlier attempt may have been
+    // applied without us seeing the response. error says why on Retry and
+    // Failed.
+    //
+    // Adds the roster and starts the tournament.
+    WriteResult registerRoster(const std::vector<Player> &roster, bool verify, std::string &error);
+    // Reports the winner of matchId, or of the open match between the two
+    // players if matchId is 0. rejection carries the body of the last
+    // permanent rejection of the report between attempts: a verifying
+    // attempt that finds the result still not in fails with it.
+    WriteResult reportMatch(int matchId, const std::string &winnerId, const std::string &loserId,
+                            bool verify, std::string &rejection, std::string &error);
+    // Clears participants and resets the bracket; onProgress(done, total) is
+    // called from the calling thread as participant deletions complete.
+    void resetTournament(const std::function<void(size_t, size_t)> &onProgress = nullptr);
+    // Discards the cached bracket and reloads it from Challonge.
+    void resync();
 
     const std::string &getTournamentId() const { return tournamentId; }
+    // Copy of the cached bracket, for handing to the event loop thread.
+    Bracket snapshot() const { return bracket; }
   };
 
   class TournamentManager
   {
+    friend struct BenchAccess;
+
   private:
-    static constexpr int NUM_ARENAS = 16;
+    // Used until config.json or the plugin's get_arenas reply says otherwise.
+    static constexpr int DEFAULT_ARENA_COUNT = 16;
+    // Placement cost of a server for a match: MOVE_COST per player who has
+    // to be moved there, plus its share of occupied arenas, plus its ping
+    // as a fraction of PING_SCALE_SECONDS (at most 1). So a match stays on
+    // its players' server while that has room, and otherwise goes to the
+    // least loaded, closest one.
+    static constexpr double MOVE_COST = 2;
+    static constexpr double PING_SCALE_SECONDS = 0.2;
+    // Most outbox entries listed in a reply to GetOutbox, oldest first.
+    static constexpr size_t OUTBOX_REPORT_LIMIT = 50;
 
+    // The live arena pool of every MGE server, grouped by server. Each
+    // MGEServer indexes its own part.
     std::vector<Arena> arenas;
-    std::vector<int> arenaPriority;
+    json arenaConfig = json::object();
     std::vector<Player> players;
     std::map<lws *, std::unique_ptr<WebSocketConnection>> connections;
     WebSocketConnection *admin = nullptr;
+    unsigned nextConnectionId = 1;
 
     std::unique_ptr<ChallongeAPI> challonge;
+    // Declared after challonge so the worker thread is joined before the
+    // API object it calls into is destroyed.
+    std::unique_ptr<ChallongeExecutor> challongeExecutor;
     lws_context *context;
 
-    lws *mgeClientWsi;
-    bool mgeConnected;
-    std::queue<std::string> mgeOutgoingMessages;
+    // Never empty; setMGEEndpoints() replaces the default one.
+    std::vector<std::unique_ptr<MGEServer>> mgeServers;
+    // Opens a connection to a plugin; false if it failed at once. Set by
+    // main(); without it (in-process harnesses) nothing reconnects.
+    std::function<bool(MGEServer &)> mgeConnector;
+    MGEReconnectBackoff mgeReconnectBackoff;
+    // How long each command is kept for a plugin that is offline; commands
+    // not listed are dropped. The add_player_to_arena TTL is also how long
+    // a server that dropped is still placed on.
+    std::unordered_map<std::string, std::chrono::milliseconds> mgeCommandTtl{
+        {"add_player_to_arena", std::chrono::seconds(30)},
+        {"redirect_player", std::chrono::seconds(10)}};
+    std::mt19937 rng{std::random_device{}()};
+    size_t maxMessageSize = DEFAULT_MAX_MESSAGE_SIZE;
     bool tournamentActive;
-    std::map<std::string, int> steamIdToClientId;
-    std::map<int, std::string> clientIdToSteamId;
+    PlayerIndex playerIndex;
+
+    // Local view of the open bracket, kept current from MGE events and
+    // reconciled with Challonge in the background. readyMatches holds ids
+    // of matches whose players may both be free; entries are re-checked
+    // when popped, so it is safe for it to contain stale ids.
+    std::map<int, ScheduledMatch> openMatches;
+    std::unordered_map<PlayerHandle, int> openMatchByPlayer;
+    std::set<int> readyMatches;
+    // Latest bracket from Challonge, advanced locally as results come in.
+    // Matches opened that way are dispatched at once and tracked in
+    // predictedMatches until a sync from Challonge confirms them.
+    Bracket bracket;
+    std::set<int> predictedMatches;
+    // Ready matches no server can take, already reported to the admin.
+    std::unordered_set<int> unplaceableMatches;
+
+    bool matchFetchInFlight = false;
+    bool matchFetchQueued = false;
+    // Bumped whenever a result is reported, so an open-match list fetched
+    // before the report reached Challonge is discarded rather than applied.
+    unsigned matchStateVersion = 0;
+
+    // Challonge writes (registration and results) not confirmed yet. They
+    // are retried with backoff until Challonge has them and are journaled,
+    // so they survive a restart as well.
+    ChallongeOutbox outbox;
 
-    std::optional<int> getOpenArena();
+    // Crash recovery. Everything the manager cannot get back from
+    // Challonge or the MGE plugin after a restart is recorded in journal;
+    // openJournal() replays it and the startup bracket fetch reconciles
+    // it. playersRegistered is set once the roster reached Challonge.
+    std::unique_ptr<StateJournal> journal;
+    bool playersRegistered = false;
+    bool bracketLoaded = false;
+    // A failed startup fetch is tried again, with the outbox backoff, once
+    // loadRetryAt has passed.
+    unsigned loadAttempts = 0;
+    std::optional<std::chrono::steady_clock::time_point> loadRetryAt;
+    // Set by openJournal() when there is restored state for the startup
+    // fetch to reconcile. Results that come in before then cannot be
+    // matched to the bracket yet; reconciliation applies them.
+    bool reconcilePending = false;
+    // True while openJournal() replays, so replayed changes are not
+    // journaled again.
+    bool replaying = false;
+
+    // Handlers by message type, filled in once by registerHandlers().
+    // serverHandlers get the sender, the message's "payload" and the
+    // sender's role;
+    // mgeHandlers run on the message mgeDecoder just decoded, keyed by its
+    // key(), and read the view for that key.
+    MessageDispatcher<lws *, const json &, PeerRole> serverHandlers;
+    MessageDispatcher<MGEServer &> mgeHandlers;
+    MGEMessageDecoder mgeDecoder;
+
+    void registerHandlers();
+    // Register a handler under Payload::TYPE, wrapped so that it runs
+    // only if the message parses into a Payload.
+    template <typename Payload>
+    void route(void (TournamentManager::*handler)(lws *, const Payload &));
+    template <typename Payload>
+    void route(void (TournamentManager::*handler)(const Payload &));
+    // Register a plugin message handler under key, View::TYPE by default;
+    // it gets the decoder's View of the message.
+    template <typename View>
+    void routeMGE(void (TournamentManager::*handler)(MGEServer &, const View &));
+    template <typename View>
+    void routeMGE(std::string_view key, void (TournamentManager::*handler)(MGEServer &, const View &));
+    template <typename Payload>
+    bool decodePayload(lws *wsi, const json &payload, Payload &decoded);
+    // Replies to the sender with an Error message.
+    void rejectMessage(lws *wsi, const std::string &reason);
+
+    // The server with this name; an empty name that matches none means the
+    // first server. nullptr if there is none.
+    MGEServer *findMGEServer(const std::string &name) const;
+    // Whether any server can take matches (see MGEServer::usable()).
+    bool anyMGEUsable() const;
+    // Adds "server" to a journal event or reply unless the server is the
+    // unnamed default one.
+    void tagServer(json &j, int server) const;
+    // Free arena for a scheduled match on the cheapest usable server
+    // (see MOVE_COST), or -1 if none can take it.
+    int pickArena(const ScheduledMatch &scheduled) const;
+    // Players of the match who would have to move to play on server, or -1
+    // if one of them cannot be moved there.
+    int movesTo(const ScheduledMatch &scheduled, const MGEServer &server) const;
+    // Whether any server could ever take the match, full or not.
+    bool placeable(const ScheduledMatch &scheduled) const;
+    // Index into arenas for an MGE arena id on a server, or -1 if the id is
+    // unknown.
+    int arenaIndex(int server, int arenaId) const;
+    int arenaIndex(const std::string &serverName, int arenaId) const;
+    // Swaps in a new arena table for one server, keeping matches in arenas
+    // that still exist.
+    void setArenas(MGEServer &server, std::vector<Arena> table);
+    // Applies a journaled table, whose entries name their server.
+    void setArenasFromJson(const json &table);
+    std::vector<Arena> arenasFromConfig() const;
+    std::set<int> excludedArenaIds() const;
+    void handleArenaList(MGEServer &server, const std::pmr::vector<MGEArenasResponse::Arena> &arenaList);
+    // Places ready matches into free arenas. Purely local, no Challonge I/O.
     void assignPendingMatches();
-    bool isPlayerInMatch(const std::string &steamId) const;
-    void broadcastToServers(const json &message);
+    // Tells the admin that a ready match has players on different servers
+    // and neither can be moved to the other's server.
+    void warnUnplaceableMatch(const ScheduledMatch &scheduled);
+    // Fetches the open-match list in the background and merges it.
+    void syncOpenMatches();
+    void mergeOpenMatches(const std::vector<PendingMatch> &pendingMatches);
+    // Takes a predicted match Challonge did not open back out of its arena,
+    // if it was placed: the game servers get a MatchCancel and both players
+    // are free again.
+    void cancelMispredictedMatch(int matchId, PlayerHandle player1, PlayerHandle player2);
+    void addOpenMatch(const PendingMatch &match);
+    void clearSchedule();
+    void markPlayerFree(PlayerHandle player);
+    void refreshReadyMatches();
+    // Queues a match for dispatch, starting its dispatch clock unless it
+    // was already queued.
+    void addReadyMatch(int matchId);
+    bool isMatchReady(const ScheduledMatch &scheduled) const;
+    // Drops the open match between the two players, if any, after a result
+    // and schedules the matches the result opens in the local bracket.
+    void completeMatch(PlayerHandle winner, PlayerHandle loser);
+    void predictNextMatches(int winnerId, int loserId);
+    void registerPlayers(std::vector<Player> roster);
+    void reportResult(const std::string &winnerSteamId, const std::string &loserSteamId);
+    // Journals an outbox entry and sends it.
+    void enqueueWrite(OutboxEntry entry);
+    // Hands the outbox entries that are due to the executor.
+    void drainOutbox();
+    void sendWrite(const OutboxEntry &entry);
+    void finishWrite(uint64_t id, WriteResult result, const std::string &error);
+    // All arena occupancy changes go through these two so the player->arena
+    // reverse map in playerIndex stays in step with arenas.
+    void occupyArena(int arenaIndex, PlayerHandle player1, PlayerHandle player2);
+    void releaseArena(int arenaIndex);
+    // Appends an event to the journal, if there is one, and snapshots the
+    // state when enough events have piled up.
+    void record(json event);
+    json captureState() const;
+    void restoreState(const json &state);
+    void replay(const json &event);
+    // Fetches the bracket in the background; on success reconciles any
+    // restored state, otherwise schedules another try.
+    void loadBracket();
+    void retryBracketLoad(const std::string &error);
+    // Brings restored state in line with the bracket fetched at startup.
+    void reconcileRestoredState();
+    void broadcastToServers(const json &message, const std::string &coalesceKey = "");
+    void pushFrame(WebSocketConnection &conn, OutboundFrame frame);
     void sendToConnection(WebSocketConnection *conn, const json &message);
+    void sendResetProgress(size_t done, size_t total);
 
-    void sendToMGEPlugin(const json &message);
-    void handleMGEEvent(const json &event);
-    void requestPlayersFromMGE();
-    void requestArenasFromMGE();
-    void addPlayerToMGEArena(int clientId, int arenaId);
+    // Queues a command, or buffers it while the plugin is offline.
+    void sendToMGEPlugin(MGEServer &server, const json &message, const std::string &coalesceKey = "");
+    // False if the command has no TTL and was dropped instead.
+    bool bufferMGECommand(MGEServer &server, json message, std::chrono::steady_clock::time_point now);
+    // Drops the buffered commands that expired; an expired placement frees
+    // its arena so the match can go elsewhere. Returns how many expired.
+    size_t expireMGECommands(MGEServer &server, std::chrono::steady_clock::time_point now);
+    void scheduleMGEReconnect(MGEServer &server);
+    void scheduleMGEExpiry(MGEServer &server);
+    void cancelMGETimers(MGEServer &server);
+    static void onMGEReconnectTimer(lws_sorted_usec_list_t *sul);
+    static void onMGEExpiryTimer(lws_sorted_usec_list_t *sul);
+    void handleMGEOfflineExpiry(MGEServer &server);
+    // After a reconnect: re-sends placements the plugin lost, releases
+    // arenas whose players left, then sends what was buffered. pluginArenas
+    // is the arena id the plugin has each reported player in; wasHere the
+    // players in this server's arenas who were on it before.
+    void resyncMGE(MGEServer &server, const std::unordered_map<PlayerHandle, int> &pluginArenas,
+                   const std::unordered_set<PlayerHandle> &wasHere);
+    // Tells the admin that a match is being placed again after a drop,
+    // in case it had been played and its match_end_1v1 was lost.
+    void warnReplayedMatch(const MGEServer &server, const Arena &arena);
+    void handleMGEWelcome(MGEServer &server, const MGEWelcome &welcome);
+    void handleMGEPlayers(MGEServer &server, const MGEPlayersResponse &response);
+    void handleMGEArenas(MGEServer &server, const MGEArenasResponse &response);
+    void handleMGEMatchEnd(MGEServer &server, const MGEMatchEndEvent &event);
+    void handleMGEPlayerArenaRemoved(MGEServer &server, const MGEPlayerArenaRemovedEvent &event);
+    void handleMGESuccess(MGEServer &server, const MGEStatus &status);
+    void handleMGEError(MGEServer &server, const MGEStatus &status);
+    // A player named in a plugin event, by steam id if the plugin sent one
+    // (which also tells their client id there), else by client id.
+    PlayerHandle resolveMGEPlayer(MGEServer &server, int clientId, std::string_view steamId);
+    // Feeds the reply to a timed request into the server's ping.
+    void observeMGEReply(MGEServer &server, std::string_view command);
+    void requestPlayersFromMGE(MGEServer &server);
+    void requestArenasFromMGE(MGEServer &server);
+    void addPlayerToMGEArena(MGEServer &server, int clientId, int arenaId);
+    // Sends a player to an arena, redirecting them first if the arena is
+    // on another server than theirs.
+    void placePlayer(PlayerHandle player, int arenaIndex);
 
   public:
+    // challongeBaseUrl can point at a local stand-in such as
+    // mock_challonge_server.py instead of the live API.
     TournamentManager(lws_context *ctx, const std::string &challongeUser,
-                      const std::string &challongeKey, const std::string &tournamentUrl);
+                      const std::string &challongeKey, const std::string &tournamentUrl,
+                      const std::string &challongeBaseUrl = ChallongeAPI::DEFAULT_BASE_URL);
+    ~TournamentManager();
 
     void handleMessage(lws *wsi, const std::string &message);
-    void handleMGEPluginMessage(const std::string &message);
+    void handleMGEPluginMessage(MGEServer &server, const std::string &message);
+    // Feed raw receive callbacks in; complete messages are dispatched to
+    // handleMessage / handleMGEPluginMessage once all fragments arrived.
+    void receiveFragment(lws *wsi, const char *data, size_t len,
+                         bool finalFragment, size_t remaining);
+    void receiveMGEFragment(MGEServer &server, const char *data, size_t len,
+                            bool finalFragment, size_t remaining);
+    static constexpr size_t DEFAULT_MAX_MESSAGE_SIZE = 1024 * 1024;
+    void setMaxMessageSize(size_t bytes) { maxMessageSize = bytes; }
+    // The MGE plugins to manage ("mge_servers" in config.json); by default
+    // a single unnamed one at localhost:9001. Each gets the configured
+    // arena table until it answers get_arenas. Call first, before
+    // setArenaConfig() and openJournal(). With several endpoints, unnamed
+    // ones are named "host:port".
+    void setMGEEndpoints(const std::vector<MGEEndpoint> &endpoints);
+    size_t mgeServerCount() const { return mgeServers.size(); }
+    MGEServer &mgeServer(size_t index) { return *mgeServers[index]; }
+    void setMGEConnector(std::function<bool(MGEServer &)> connector) { mgeConnector = std::move(connector); }
+    void setMGEReconnectBackoff(MGEReconnectBackoff backoff);
+    // "mge_offline_ttl_ms" in config.json; 0 stops the command from being
+    // buffered.
+    void setMGECommandTtl(const std::string &command, std::chrono::milliseconds ttl) { mgeCommandTtl[command] = std::max(ttl, std::chrono::milliseconds(0)); }
+    // Connects to a plugin through the connector, retrying with backoff
+    // until it answers; later drops reconnect the same way.
+    void connectMGE(MGEServer &server);
+    // Fallback arena table ("arenas" in config.json): {"count": N,
+    // "priority": [ids...], "exclude": [ids...]}. Applied until the MGE
+    // plugin answers get_arenas.
+    void setArenaConfig(const json &config);
+    // Restores the state journaled in options.dir and keeps journaling
+    // there. Call after setArenaConfig(), before the event loop starts.
+    // State journaled for another tournament is moved aside, not restored.
+    // False if the journal cannot be written; the manager then runs
+    // without one.
+    bool openJournal(const StateJournal::Options &options);
     void addConnection(lws *wsi);
     void removeConnection(lws *wsi);
     void queueMessage(lws *wsi, const std::string &message);
     bool hasQueuedMessages(lws *wsi) const;
-    std::string popMessage(lws *wsi);
-
-    void handleServerHello(lws *wsi, const json &payload);
-    void handleTournamentStart(const json &payload);
-    void handleTournamentStop(const json &payload);
-    void handleUsersInServer(const json &payload);
-    void handleMatchResults(const json &payload);
-    void handleMatchBegan(const json &payload);
-    void handleMatchDetails(const json &payload);
-    void handleSetMatchScore(lws *wsi, const json &payload);
-    void handleMatchCancel(const json &payload);
-
-    void setMGEClientWsi(lws *wsi);
-    void onMGEConnected();
-    void onMGEDisconnected();
-    void queueMGEMessage(const std::string &message);
-    bool hasMGEQueuedMessages() const;
-    std::string popMGEMessage();
+    // The frame currently being written to wsi; it stays at the front until
+    // popMessage() is called after its final fragment.
+    OutboundFrame *frontMessage(lws *wsi);
+    void popMessage(lws *wsi);
+    bool shouldClose(lws *wsi) const;
+
+    void handleServerHello(lws *wsi, const ServerHelloPayload &payload);
+    void handleTournamentStart(const TournamentStartPayload &payload);
+    void handleTournamentStop(const TournamentStopPayload &payload);
+    void handleUsersInServer(const UsersInServerPayload &payload);
+    void handleMatchResults(const MatchResultsPayload &payload);
+    void handleMatchBegan(const MatchBeganPayload &payload);
+    void handleMatchDetails(const MatchDetailsPayload &payload);
+    void handleSetMatchScore(lws *wsi, const SetMatchScorePayload &payload);
+    void handleMatchCancel(const MatchCancelPayload &payload);
+    void handleGetOutbox(lws *wsi, const GetOutboxPayload &payload);
+
+    // Runs finished Challonge request callbacks and sends the outbox
+    // entries whose retry is due; call from the event loop.
+    void processChallongeResults();
+    // Retry delays for Challonge writes ("challonge_retry_initial_ms" and
+    // "challonge_retry_max_ms" in config.json).
+    void setRetryBackoff(ChallongeOutbox::Backoff backoff) { outbox.setBackoff(backoff); }
+    // "challonge_rate_limit" in config.json.
+    void setChallongeRateLimit(RateLimiter::Options options) { challonge->setRateLimit(options); }
+    // Challonge writes not confirmed yet.
+    size_t outboxDepth() const { return outbox.size(); }
+
+    // Everything in metrics::registry() plus gauges read from the live
+    // state (queue depths, arena occupancy). Call from the event loop.
+    std::string renderMetrics() const;
+
+    void onMGEConnected(MGEServer &server, lws *wsi);
+    void onMGEDisconnected(MGEServer &server);
+    void queueMGEMessage(MGEServer &server, const std::string &message, const std::string &coalesceKey = "");
+    bool hasMGEQueuedMessages(const MGEServer &server) const { return !server.outgoing.empty(); }
+    OutboundFrame *frontMGEMessage(MGEServer &server) { return server.outgoing.front(); }
+    void popMGEMessage(MGEServer &server) { server.outgoing.pop(); }
+    bool shouldCloseMGE(const MGEServer &server) const { return server.closing; }
   };
 
 }
\ No newline at end of file